@@ -0,0 +1,469 @@
+#include <string.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+
+#include <libavutil/opt.h>
+
+#include "audio_transcode.h"
+#include "log.h"
+
+#define TAG "AUDIO_TC"
+
+// 输入没有采样率时的 AAC 编码采样率
+#define TRANSCODE_DEFAULT_RATE  16000
+// 转码器预分配的重采样缓冲 (样本数)，一个 G.711 RTP 包通常只有 160~320 个样本
+#define TRANSCODE_CONV_SAMPLES  4096
+#define TRANSCODE_FIFO_SAMPLES  (1024 * 50)
+// 输入丢包造成的时间戳空洞不超过该时长时补静音，更长的断流直接跳到新时间戳
+#define TRANSCODE_MAX_PAD_MS    1000
+// 每路输入/输出队列深度 (仅音频)
+#define TRANSCODE_QUEUE_DEPTH   256
+// 工作线程每次处理一路任务的最大包数，处理完把该路放回就绪链表尾部，避免一路占住线程
+#define TRANSCODE_BATCH_MAX     16
+
+/* ========================================================================== */
+/* Audio Transcoder                                                           */
+/* ========================================================================== */
+
+static void FreeTranscoder(AudioTranscoder *tc) {
+    if (!tc) return;
+    if (tc->dec_ctx) avcodec_free_context(&tc->dec_ctx);
+    if (tc->enc_ctx) avcodec_free_context(&tc->enc_ctx);
+    if (tc->swr_ctx) swr_free(&tc->swr_ctx);
+    if (tc->fifo)    av_audio_fifo_free(tc->fifo);
+    if (tc->dec_frame) av_frame_free(&tc->dec_frame);
+    if (tc->enc_frame) av_frame_free(&tc->enc_frame);
+    if (tc->conv_data) {
+        av_freep(&tc->conv_data[0]);
+        av_freep(&tc->conv_data);
+    }
+    av_packet_unref(&tc->enc_pkt);
+    memset(tc, 0, sizeof(AudioTranscoder));
+}
+
+static int AllocConvBuffer(AudioTranscoder *tc, int nb_samples) {
+    if (tc->conv_data && nb_samples <= tc->conv_cap) return 0;
+    if (tc->conv_data) {
+        av_freep(&tc->conv_data[0]);
+        av_freep(&tc->conv_data);
+    }
+    tc->conv_cap = 0;
+    if (av_samples_alloc_array_and_samples(&tc->conv_data, NULL, tc->enc_ctx->channels,
+                                           nb_samples, tc->enc_ctx->sample_fmt, 0) < 0) {
+        return -1;
+    }
+    tc->conv_cap = nb_samples;
+    return 0;
+}
+
+static int InitTranscoder(AudioTranscoder *tc, AVStream *ast) {
+    int ret;
+    AVCodecParameters *in_par = ast->codecpar;
+    AVCodec *dec = avcodec_find_decoder(in_par->codec_id);
+    AVCodec *enc = avcodec_find_encoder(AV_CODEC_ID_AAC); 
+    if (!enc) enc = avcodec_find_encoder_by_name("aac");
+
+    if (!enc || !dec) return -1;
+
+    tc->dec_ctx = avcodec_alloc_context3(dec);
+    if (!tc->dec_ctx) return -1;
+    avcodec_parameters_to_context(tc->dec_ctx, in_par);
+    if (tc->dec_ctx->channels <= 0) tc->dec_ctx->channels = 1;
+    if ((ret = avcodec_open2(tc->dec_ctx, dec, NULL)) < 0) return ret;
+
+    tc->enc_ctx = avcodec_alloc_context3(enc);
+    if (!tc->enc_ctx) return -1;
+    tc->enc_ctx->sample_rate = in_par->sample_rate > 0 ? in_par->sample_rate : TRANSCODE_DEFAULT_RATE;
+    tc->enc_ctx->channel_layout = AV_CH_LAYOUT_MONO;
+    tc->enc_ctx->channels = 1;
+    tc->enc_ctx->sample_fmt = enc->sample_fmts ? enc->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+    tc->enc_ctx->bit_rate = 32000; 
+    tc->enc_ctx->time_base = (AVRational){1, tc->enc_ctx->sample_rate};
+    tc->enc_ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL; 
+    tc->enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    if ((ret = avcodec_open2(tc->enc_ctx, enc, NULL)) < 0) return ret;
+    if (tc->enc_ctx->frame_size <= 0) return -1;
+
+    tc->swr_ctx = swr_alloc();
+    if (!tc->swr_ctx) return -1;
+    av_opt_set_int(tc->swr_ctx, "in_channel_layout",  tc->dec_ctx->channel_layout ? tc->dec_ctx->channel_layout : av_get_default_channel_layout(tc->dec_ctx->channels), 0);
+    av_opt_set_int(tc->swr_ctx, "in_sample_rate",     tc->dec_ctx->sample_rate, 0);
+    av_opt_set_sample_fmt(tc->swr_ctx, "in_sample_fmt", tc->dec_ctx->sample_fmt, 0);
+
+    av_opt_set_int(tc->swr_ctx, "out_channel_layout", tc->enc_ctx->channel_layout, 0);
+    av_opt_set_int(tc->swr_ctx, "out_sample_rate",    tc->enc_ctx->sample_rate, 0);
+    av_opt_set_sample_fmt(tc->swr_ctx, "out_sample_fmt", tc->enc_ctx->sample_fmt, 0);
+
+    if ((ret = swr_init(tc->swr_ctx)) < 0) return ret;
+
+    // 帧、FIFO、重采样缓冲全部在这里一次分配好，稳态下每包不再申请内存
+    tc->fifo = av_audio_fifo_alloc(tc->enc_ctx->sample_fmt, tc->enc_ctx->channels, TRANSCODE_FIFO_SAMPLES);
+    tc->dec_frame = av_frame_alloc();
+    tc->enc_frame = av_frame_alloc();
+    if (!tc->fifo || !tc->dec_frame || !tc->enc_frame) return -1;
+    if (AllocConvBuffer(tc, TRANSCODE_CONV_SAMPLES) < 0) return -1;
+    tc->enc_frame->nb_samples = tc->enc_ctx->frame_size;
+    tc->enc_frame->format = tc->enc_ctx->sample_fmt;
+    tc->enc_frame->channel_layout = tc->enc_ctx->channel_layout;
+    tc->enc_frame->sample_rate = tc->enc_ctx->sample_rate;
+    
+    if ((ret = av_frame_get_buffer(tc->enc_frame, 0)) < 0) return ret;
+
+    av_init_packet(&tc->enc_pkt);
+    tc->enc_pkt.data = NULL;
+    tc->enc_pkt.size = 0;
+    tc->in_tb = ast->time_base;
+    tc->initialized = 1;
+    tc->pts_counter = AV_NOPTS_VALUE;
+    return 0;
+}
+
+// 取走编码器输出的 AAC 包，负载换到该路缓冲池后放入输出队列
+static void DrainEncoder(AudioTranscodeJob *job) {
+    AudioTranscoder *tc = &job->tc;
+
+    while (avcodec_receive_packet(tc->enc_ctx, &tc->enc_pkt) >= 0) {
+        tc->enc_pkt.stream_index = job->stream_index;
+        if (job->buf_pool) packet_pool_rebuf(job->buf_pool, &tc->enc_pkt);
+        packet_queue_put(&job->out, &tc->enc_pkt, PKT_TYPE_AUDIO);
+        av_packet_unref(&tc->enc_pkt);
+    }
+}
+
+// FIFO 中每攒够 frame_size 个样本编码一帧，pts 按样本数单调递增
+static void EncodeFifo(AudioTranscodeJob *job) {
+    AudioTranscoder *tc = &job->tc;
+    int frame_size = tc->enc_ctx->frame_size;
+
+    while (av_audio_fifo_size(tc->fifo) >= frame_size) {
+        // 编码器一般不持有输入帧，这里不会重新分配；万一被引用则复制一份
+        if (av_frame_make_writable(tc->enc_frame) < 0) break;
+        if (av_audio_fifo_read(tc->fifo, (void **)tc->enc_frame->data, frame_size) < frame_size) break;
+        tc->enc_frame->nb_samples = frame_size;
+        tc->enc_frame->pts = tc->pts_counter;
+        tc->pts_counter += frame_size;
+
+        if (avcodec_send_frame(tc->enc_ctx, tc->enc_frame) < 0) break;
+        DrainEncoder(job);
+    }
+}
+
+// 向 FIFO 写入 nb_samples 个静音样本
+static void PadSilence(AudioTranscoder *tc, int64_t nb_samples) {
+    while (nb_samples > 0) {
+        int n = (nb_samples > tc->conv_cap) ? tc->conv_cap : (int)nb_samples;
+        av_samples_set_silence(tc->conv_data, 0, n, tc->enc_ctx->channels, tc->enc_ctx->sample_fmt);
+        if (av_audio_fifo_write(tc->fifo, (void **)tc->conv_data, n) < n) break;
+        nb_samples -= n;
+    }
+}
+
+// 按样本数推算的下一个输入样本位置 (pts_counter + FIFO 与重采样器中尚未编码的样本) 与输入时间戳
+// 相差超过一帧时重新对齐：G.711 RTP 丢包留下的空洞补静音，长时间断流补齐当前帧后跳到新位置；
+// 输入时间戳回退时丢弃 FIFO 中多出的样本，已送入编码器的 pts 不回拨，保证单调
+static void ResyncPts(AudioTranscodeJob *job, int64_t in_pts) {
+    AudioTranscoder *tc = &job->tc;
+    int frame_size = tc->enc_ctx->frame_size;
+    int out_rate = tc->enc_ctx->sample_rate;
+    int64_t delay = swr_get_delay(tc->swr_ctx, out_rate);
+    int64_t drift = in_pts - (tc->pts_counter + av_audio_fifo_size(tc->fifo) + delay);
+
+    if (drift > frame_size) {
+        if (drift <= (int64_t)out_rate * TRANSCODE_MAX_PAD_MS / 1000) {
+            PadSilence(tc, drift);
+        } else {
+            PadSilence(tc, (frame_size - av_audio_fifo_size(tc->fifo) % frame_size) % frame_size);
+            EncodeFifo(job);
+            tc->pts_counter = in_pts - delay;
+            LOG_WARN(TAG, "Audio gap %lld samples, re-anchor pts\n", (long long)drift);
+        }
+    } else if (drift < -frame_size) {
+        int drop = av_audio_fifo_size(tc->fifo);
+        if ((int64_t)drop > -drift) drop = (int)-drift;
+        av_audio_fifo_drain(tc->fifo, drop);
+    }
+}
+
+// 解码一个输入包并把得到的 PCM 重采样后放入 FIFO，再按定长帧编码为 AAC
+static void TranscodeAudioPacket(AudioTranscodeJob *job, const AVPacket *pkt) {
+    AudioTranscoder *tc = &job->tc;
+    int out_rate = tc->enc_ctx->sample_rate;
+
+    // 第一个包对齐到输入时间戳，之后按样本数递增，保证 AAC 的 pts 连续且单调；
+    // 丢包/断流使两者偏差超过一帧时由 ResyncPts 重新对齐
+    if (pkt->pts != AV_NOPTS_VALUE) {
+        int64_t in_pts = av_rescale_q(pkt->pts, tc->in_tb, tc->enc_ctx->time_base);
+        if (tc->pts_counter == AV_NOPTS_VALUE) tc->pts_counter = in_pts;
+        else ResyncPts(job, in_pts);
+    } else if (tc->pts_counter == AV_NOPTS_VALUE) {
+        tc->pts_counter = 0;
+    }
+
+    if (avcodec_send_packet(tc->dec_ctx, pkt) < 0) return;
+
+    while (avcodec_receive_frame(tc->dec_ctx, tc->dec_frame) >= 0) {
+        int in_rate = tc->dec_frame->sample_rate > 0 ? tc->dec_frame->sample_rate : tc->dec_ctx->sample_rate;
+        int max_out = (int)av_rescale_rnd(swr_get_delay(tc->swr_ctx, in_rate) + tc->dec_frame->nb_samples,
+                                          out_rate, in_rate, AV_ROUND_UP);
+        int n;
+
+        if (AllocConvBuffer(tc, max_out) < 0) {
+            av_frame_unref(tc->dec_frame);
+            break;
+        }
+        n = swr_convert(tc->swr_ctx, tc->conv_data, tc->conv_cap,
+                        (const uint8_t **)tc->dec_frame->extended_data, tc->dec_frame->nb_samples);
+        av_frame_unref(tc->dec_frame);
+        if (n <= 0) continue;
+
+        if (av_audio_fifo_write(tc->fifo, (void **)tc->conv_data, n) < n) {
+            LOG_WARN(TAG, "Audio fifo write failed\n");
+            break;
+        }
+    }
+
+    EncodeFifo(job);
+}
+
+/* ========================================================================== */
+/* 工作线程池                                                                 */
+/* ========================================================================== */
+
+// 调用者持有 pool->mutex，且已把 scheduled 从 0 置为 1 (取得该路的调度权)
+static void ScheduleJobLocked(AudioTranscodePool *pool, AudioTranscodeJob *job) {
+    job->next = NULL;
+    if (pool->ready_tail) pool->ready_tail->next = job;
+    else pool->ready_head = job;
+    pool->ready_tail = job;
+    pthread_cond_broadcast(&pool->cond);
+}
+
+static int QueueDepth(PacketQueue *q) {
+    int nb = 0;
+    packet_queue_get_stats(q, NULL, &nb, NULL);
+    return nb;
+}
+
+static void *AudioWorkerThread(void *Arg) {
+    AudioTranscodePool *pool = (AudioTranscodePool *)Arg;
+    AVPacket pkt;
+    int n;
+
+    prctl(PR_SET_NAME, "Audio_Worker");
+    av_init_packet(&pkt);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->abort_request) {
+        AudioTranscodeJob *job = pool->ready_head;
+        if (!job) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+            continue;
+        }
+        pool->ready_head = job->next;
+        if (!pool->ready_head) pool->ready_tail = NULL;
+        job->next = NULL;
+        pthread_mutex_unlock(&pool->mutex);
+
+        // scheduled 保持为 1：同一路不会同时被两个线程处理
+        for (n = 0; n < TRANSCODE_BATCH_MAX; n++) {
+            if (packet_queue_get(&job->in, &pkt, 0) <= 0) break;
+            if (job->opened) TranscodeAudioPacket(job, &pkt);
+            av_packet_unref(&pkt);
+        }
+
+        // 提交方先入队再抢 scheduled；这里先清 scheduled 再复查队列，
+        // 两边至少有一方看到对方的写入，不会漏掉刚到的包，也只有抢到 0->1 的一方入就绪链表
+        __atomic_store_n(&job->scheduled, 0, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&job->opened, __ATOMIC_ACQUIRE) && QueueDepth(&job->in) > 0 &&
+            __atomic_exchange_n(&job->scheduled, 1, __ATOMIC_ACQ_REL) == 0) {
+            pthread_mutex_lock(&pool->mutex);
+            if (job->opened) {
+                ScheduleJobLocked(pool, job);
+            } else {
+                __atomic_store_n(&job->scheduled, 0, __ATOMIC_RELEASE);
+                pthread_cond_broadcast(&pool->cond);
+            }
+        } else {
+            pthread_mutex_lock(&pool->mutex);
+            pthread_cond_broadcast(&pool->cond); // 唤醒等待该路空闲的 close
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+int audio_transcode_pool_init(AudioTranscodePool *pool, int nb_threads) {
+    int i;
+
+    if (!pool) return -1;
+    if (nb_threads <= 0) nb_threads = AUDIO_WORKER_DEFAULT;
+    if (nb_threads > AUDIO_WORKER_MAX) nb_threads = AUDIO_WORKER_MAX;
+
+    memset(pool, 0, sizeof(AudioTranscodePool));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    for (i = 0; i < nb_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, AudioWorkerThread, pool) != 0) {
+            LOG_ERROR(TAG, "Failed to create audio worker %d\n", i);
+            break;
+        }
+        pool->nb_threads++;
+    }
+    // 一个线程都没有时锁仍保留，job_open 会失败，该路按无音频处理
+    if (pool->nb_threads == 0) return -1;
+    LOG_INFO(TAG, "Audio transcode pool started, %d workers\n", pool->nb_threads);
+    return 0;
+}
+
+int audio_transcode_pool_grow(AudioTranscodePool *pool, int nb_threads) {
+    if (!pool) return -1;
+    if (nb_threads > AUDIO_WORKER_MAX) nb_threads = AUDIO_WORKER_MAX;
+
+    // nb_threads 只在控制线程 (Stream_Init / Stream_Start) 中修改，加锁是为了与 uninit 互斥
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->abort_request && pool->nb_threads < nb_threads) {
+        if (pthread_create(&pool->threads[pool->nb_threads], NULL, AudioWorkerThread, pool) != 0) {
+            LOG_ERROR(TAG, "Failed to create audio worker %d\n", pool->nb_threads);
+            break;
+        }
+        pool->nb_threads++;
+        LOG_INFO(TAG, "Audio transcode pool grown to %d workers\n", pool->nb_threads);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return pool->nb_threads > 0 ? 0 : -1;
+}
+
+// 需在所有任务 close 之后调用
+void audio_transcode_pool_uninit(AudioTranscodePool *pool) {
+    int i;
+
+    if (!pool) return;
+    pthread_mutex_lock(&pool->mutex);
+    pool->abort_request = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->nb_threads; i++) pthread_join(pool->threads[i], NULL);
+    pool->nb_threads = 0;
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+int audio_transcode_job_init(AudioTranscodeJob *job, AudioTranscodePool *pool, PacketPool *buf_pool, const char *name) {
+    char qname[QUEUE_STATS_NAME_LEN];
+
+    if (!job || !pool) return -1;
+    memset(job, 0, sizeof(AudioTranscodeJob));
+    job->pool = pool;
+    job->buf_pool = buf_pool;
+    job->stream_index = -1;
+    packet_queue_init(&job->in, 1, TRANSCODE_QUEUE_DEPTH);
+    packet_queue_init(&job->out, 1, TRANSCODE_QUEUE_DEPTH);
+    if (name) {
+        snprintf(qname, sizeof(qname), "%s.in", name);
+        packet_queue_set_name(&job->in, qname);
+        snprintf(qname, sizeof(qname), "%s.out", name);
+        packet_queue_set_name(&job->out, qname);
+    }
+    return 0;
+}
+
+void audio_transcode_job_destroy(AudioTranscodeJob *job) {
+    if (!job || !job->pool) return;
+    audio_transcode_job_close(job);
+    packet_queue_destroy(&job->in);
+    packet_queue_destroy(&job->out);
+    job->pool = NULL;
+}
+
+int audio_transcode_job_open(AudioTranscodeJob *job, AVStream *ast, int stream_index) {
+    int ret;
+
+    if (!job || !job->pool || !ast) return -1;
+    audio_transcode_job_close(job);
+    if (job->pool->nb_threads == 0) return -1;
+
+    // 此时没有工作线程持有该任务，可直接初始化转码器
+    ret = InitTranscoder(&job->tc, ast);
+    if (ret < 0) {
+        FreeTranscoder(&job->tc);
+        return ret;
+    }
+    // 下游 (录像/P2P) 看到的是转码后的 AAC 流
+    avcodec_parameters_from_context(ast->codecpar, job->tc.enc_ctx);
+    ast->time_base = job->tc.enc_ctx->time_base;
+
+    pthread_mutex_lock(&job->pool->mutex);
+    job->stream_index = stream_index;
+    __atomic_store_n(&job->opened, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&job->pool->mutex);
+    return 0;
+}
+
+void audio_transcode_job_close(AudioTranscodeJob *job) {
+    AudioTranscodePool *pool;
+
+    if (!job || !job->pool) return;
+    pool = job->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    __atomic_store_n(&job->opened, 0, __ATOMIC_RELEASE);
+    // 还在就绪链表中的直接摘掉；正在处理的等它处理完当前批次
+    if (__atomic_load_n(&job->scheduled, __ATOMIC_ACQUIRE)) {
+        AudioTranscodeJob **pp = &pool->ready_head;
+        AudioTranscodeJob *prev = NULL;
+        while (*pp && *pp != job) {
+            prev = *pp;
+            pp = &(*pp)->next;
+        }
+        if (*pp == job) {
+            *pp = job->next;
+            if (pool->ready_tail == job) pool->ready_tail = prev;
+            job->next = NULL;
+            __atomic_store_n(&job->scheduled, 0, __ATOMIC_RELEASE);
+        }
+    }
+    // 正被工作线程处理，或提交方刚抢到 scheduled 还没拿到锁：两者都会在锁内清零并广播
+    while (__atomic_load_n(&job->scheduled, __ATOMIC_ACQUIRE)) pthread_cond_wait(&pool->cond, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+
+    packet_queue_flush(&job->in);
+    packet_queue_flush(&job->out);
+    FreeTranscoder(&job->tc);
+}
+
+int audio_transcode_job_submit(AudioTranscodeJob *job, AVPacket *pkt) {
+    AudioTranscodePool *pool;
+
+    if (!job || !job->pool || !pkt) return -1;
+    pool = job->pool;
+
+    if (packet_queue_put(&job->in, pkt, PKT_TYPE_AUDIO) < 0) return -1;
+
+    // 该路已在就绪链表中或正被处理时不碰全局锁；只有抢到 0->1 的一次才加锁入链表
+    if (!__atomic_load_n(&job->opened, __ATOMIC_ACQUIRE)) return 0;
+    if (__atomic_exchange_n(&job->scheduled, 1, __ATOMIC_ACQ_REL) != 0) return 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (job->opened) {
+        ScheduleJobLocked(pool, job);
+    } else {
+        // 抢到后发现已被 close：交还调度权，唤醒等待的 close
+        __atomic_store_n(&job->scheduled, 0, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+int audio_transcode_job_receive(AudioTranscodeJob *job, AVPacket *pkt) {
+    if (!job || !job->pool) return 0;
+    return (packet_queue_get(&job->out, pkt, 0) > 0) ? 1 : 0;
+}
+
+int audio_transcode_job_pending(AudioTranscodeJob *job) {
+    if (!job || !job->pool) return 0;
+    return QueueDepth(&job->out);
+}
@@ -12,6 +12,7 @@
 #include <unistd.h>
 
 #include "log.h"
+#include "profile.h"
 #include "system.h"
 #include "network.h"
 #include "camera_manage.h"
@@ -40,7 +41,7 @@
 
 /* ========================================================================== */
 /* External Interface: Set Current Focus Channel                              */
-/* Index: -1 for Overview (All On), 0~3 for Single View (Focus On, Others Off)*/
+/* Index: -1 for Overview (All On), 0~N-1 for Single View (Focus On, Others Off)*/
 /* ========================================================================== */
 void CamManage_SetFocusChannel(StationHandle *Station, int32_t Index)
 {
@@ -64,6 +65,7 @@ void CamManage_SetFocusChannel(StationHandle *Station, int32_t Index)
 static void *CamManage_FlowControlThread(void *Args)
 {
     StationHandle *Station = (StationHandle *)Args;
+    int32_t ChannelCnt = Station->CameraMag->ChannelCnt;
 
 #if ENABLE_AUTO_SWITCH_DEMO
     int32_t AutoEnableIdx = 0; 
@@ -98,8 +100,8 @@ static void *CamManage_FlowControlThread(void *Args)
         int found = 0;
         int startIdx = AutoEnableIdx;
         
-        for (int k = 0; k < CAM_MAX_CNT; k++) {
-            int idx = (startIdx + k) % CAM_MAX_CNT;
+        for (int k = 0; k < ChannelCnt; k++) {
+            int idx = (startIdx + k) % ChannelCnt;
             // 检查该通道是否正在运行
             if (Station->Stream->Rtsp[idx].running && Station->Stream->Rtsp[idx].thread_created) {
                 AutoEnableIdx = idx;
@@ -110,7 +112,7 @@ static void *CamManage_FlowControlThread(void *Args)
 
         // 2. 如果找到了在线通道，执行切换逻辑
         if (found) {
-            for (int i = 0; i < CAM_MAX_CNT; i++) {
+            for (int i = 0; i < ChannelCnt; i++) {
                 if (!Station->Stream->Rtsp[i].running) continue;
 
                 if (i == AutoEnableIdx) {
@@ -126,7 +128,7 @@ static void *CamManage_FlowControlThread(void *Args)
                 }
             }
             // 准备下一次轮询的索引 (下一次循环会再次检查它是否在线)
-            AutoEnableIdx = (AutoEnableIdx + 1) % CAM_MAX_CNT;
+            AutoEnableIdx = (AutoEnableIdx + 1) % ChannelCnt;
         } else {
             // 没有通道在线，不做任何操作，防止空转过快
             LOG_DEBUG(TAG, "[FlowCtrl] No active streams found\n");
@@ -142,7 +144,7 @@ static void *CamManage_FlowControlThread(void *Args)
         CurrentFocus = CamManage->FocusIndex;
         pthread_mutex_unlock(&CamManage->FocusMutex);
 
-        for (i = 0; i < CAM_MAX_CNT; i++) {
+        for (i = 0; i < ChannelCnt; i++) {
             RtspCtx *ctx = &Station->Stream->Rtsp[i];
             
             if (!ctx->running || !ctx->thread_created) continue;
@@ -179,49 +181,180 @@ static void *CamManage_FlowControlThread(void *Args)
     pthread_exit(NULL);
 }
 
-int32_t CamManage_ReadCamInfo(CamManageHandle *CamManage)
+// cam_info 写入 (调用者持有 CamInfoMutex)
+// 先写临时文件再 rename，写到一半掉电不会留下残缺的绑定信息
+static int32_t CamManage_WriteCamInfo(CamManageHandle *CamManage)
 {
-	int32_t i;
+	CamInfoHeader Header;
 	FILE *File;
+	int32_t Ret = 0;
 
-	pthread_mutex_lock(&CamManage->CamInfoMutex);
-	if (access(CAM_INFO, F_OK) == 0) {
-		File = fopen(CAM_INFO, "r");
-		if (File) {
-			fread(CamManage->Camera, 1, sizeof(CamManage->Camera), File);
-			fclose(File);
-			for (i = 0; i < CAM_MAX_CNT; i++) {
-				CamManage->Camera[i].Sock = -1;
-				CamManage->Camera[i].IsAlive = 0;
-				CamManage->Camera[i].DisconCnt = 0;
-				memset(CamManage->Camera[i].Addr, 0, sizeof(CamManage->Camera[i].Addr));
-			}
+	memset(&Header, 0, sizeof(Header));
+	Header.Magic = CAM_INFO_MAGIC;
+	Header.Version = CAM_INFO_VERSION;
+	Header.Count = CamManage->ChannelCnt;
+	Header.EntrySize = sizeof(CameraInfo);
+
+	File = fopen(CAM_INFO_TMP, "w");
+	if (File == NULL) {
+		LOG_ERROR(TAG, "Open %s failed: %d\n", CAM_INFO_TMP, errno);
+		return -1;
+	}
+	if (fwrite(&Header, 1, sizeof(Header), File) != sizeof(Header) ||
+		fwrite(CamManage->Camera, sizeof(CameraInfo), CamManage->ChannelCnt, File) != (size_t)CamManage->ChannelCnt) {
+		Ret = -1;
+	}
+	if (fflush(File) != 0 || fsync(fileno(File)) != 0) Ret = -1;
+	if (fclose(File) != 0) Ret = -1;
+	if (Ret == 0 && rename(CAM_INFO_TMP, CAM_INFO) != 0) Ret = -1;
+	if (Ret < 0) {
+		LOG_ERROR(TAG, "Write %s failed: %d\n", CAM_INFO, errno);
+		unlink(CAM_INFO_TMP);
+	}
+	return Ret;
+}
+
+// 读取 cam_info 中已绑定的摄像头，按 DevIndex 放入 Bound[]，返回最大 DevIndex + 1
+// 兼容两种格式：
+//   v1 (旧版本)：无文件头，CAM_MAX_CNT 个 CameraInfo 原样写入
+//   v2：CamInfoHeader + Count 个条目，条目大小记在文件头里，CameraInfo 以后增加字段时旧文件仍可读
+// 文件不存在、为旧格式或条目有问题时 *Rewrite 置 1，由调用者按当前格式重写
+static int32_t CamManage_LoadCamInfo(CameraInfo *Bound, int32_t *Rewrite)
+{
+	CamInfoHeader Header;
+	CameraInfo Entry;
+	uint8_t *Buf;
+	FILE *File;
+	long Size;
+	uint32_t i, Count, EntrySize;
+	int32_t Used = 0;
+
+	memset(Bound, 0, sizeof(CameraInfo) * CAM_CHANNEL_LIMIT);
+	for (i = 0; i < CAM_CHANNEL_LIMIT; i++) {
+		Bound[i].DevIndex = -1;
+	}
+	*Rewrite = 1;
+
+	File = fopen(CAM_INFO, "r");
+	if (File == NULL) return 0;
+
+	fseek(File, 0, SEEK_END);
+	Size = ftell(File);
+	rewind(File);
+	if (Size >= (long)sizeof(Header) && fread(&Header, 1, sizeof(Header), File) == sizeof(Header) &&
+		Header.Magic == CAM_INFO_MAGIC) {
+		if (Header.Version != CAM_INFO_VERSION) {
+			LOG_WARN(TAG, "cam_info version %u, expect %u\n", Header.Version, CAM_INFO_VERSION);
 		}
+		else {
+			*Rewrite = 0;
+		}
+		Count = Header.Count;
+		EntrySize = Header.EntrySize;
 	}
 	else {
-		memset(CamManage->Camera, 0, sizeof(CamManage->Camera));
-		for (i = 0; i < CAM_MAX_CNT; i++) {
-			CamManage->Camera[i].DevIndex = -1;
-			CamManage->Camera[i].Sock = -1;
+		LOG_INFO(TAG, "cam_info is legacy format (%ld bytes), upgrade to v%d\n", Size, CAM_INFO_VERSION);
+		rewind(File);
+		Count = Size > 0 ? Size / sizeof(CameraInfo) : 0;
+		EntrySize = sizeof(CameraInfo);
+	}
+
+	// 条目至少要包含 DevIndex ~ FwVersion
+	if (EntrySize < offsetof(CameraInfo, IsAlive) || EntrySize > 4096) {
+		LOG_ERROR(TAG, "cam_info entry size %u invalid, ignored\n", EntrySize);
+		fclose(File);
+		*Rewrite = 1;
+		return 0;
+	}
+
+	Buf = malloc(EntrySize);
+	for (i = 0; Buf && i < Count; i++) {
+		if (fread(Buf, 1, EntrySize, File) != EntrySize) {
+			LOG_WARN(TAG, "cam_info truncated at entry %u\n", i);
+			*Rewrite = 1;
+			break;
 		}
-		File = fopen(CAM_INFO, "w");
-		if (File) {
-			fwrite(CamManage->Camera, 1, sizeof(CamManage->Camera), File);
-			fclose(File);
+		memset(&Entry, 0, sizeof(Entry));
+		memcpy(&Entry, Buf, EntrySize < sizeof(Entry) ? EntrySize : sizeof(Entry));
+		Entry.DevId[sizeof(Entry.DevId) - 1] = '\0';
+		Entry.FwVersion[sizeof(Entry.FwVersion) - 1] = '\0';
+		if (Entry.DevIndex < 0 || Entry.DevId[0] == '\0') continue;
+		if (Entry.DevIndex >= CAM_CHANNEL_LIMIT || Bound[Entry.DevIndex].DevIndex >= 0) {
+			LOG_WARN(TAG, "cam_info entry %u [%s] has invalid index %d, dropped\n", i, Entry.DevId, Entry.DevIndex);
+			*Rewrite = 1;
+			continue;
 		}
+		Bound[Entry.DevIndex] = Entry;
+		if (Entry.DevIndex + 1 > Used) Used = Entry.DevIndex + 1;
+	}
+	free(Buf);
+	fclose(File);
+
+	return Used;
+}
+
+// 通道数来自配置 Camera/channels，未配置时为 CAM_MAX_CNT
+static int32_t CamManage_ReadChannelCnt(StationHandle *Station)
+{
+	char Value[32] = {0};
+	int32_t Cnt;
+
+	if (Profile_Read(Station, "Camera", "channels", Value) < 0 || Value[0] == '\0') {
+		return CAM_MAX_CNT;
+	}
+	Cnt = atoi(Value);
+	if (Cnt < 1 || Cnt > CAM_CHANNEL_LIMIT) {
+		LOG_WARN(TAG, "Invalid Camera/channels %s (1~%d), use %d\n", Value, CAM_CHANNEL_LIMIT, CAM_MAX_CNT);
+		return CAM_MAX_CNT;
+	}
+	return Cnt;
+}
+
+int32_t CamManage_ReadCamInfo(CamManageHandle *CamManage)
+{
+	CameraInfo Bound[CAM_CHANNEL_LIMIT];
+	int32_t i, Used, Rewrite, ChannelCnt;
+
+	pthread_mutex_lock(&CamManage->CamInfoMutex);
+	Used = CamManage_LoadCamInfo(Bound, &Rewrite);
+	ChannelCnt = CamManage_ReadChannelCnt(CamManage->Station);
+	// 配置的通道数比已绑定的通道少时保留原有绑定，摄像头不会因此换通道
+	if (ChannelCnt < Used) {
+		LOG_WARN(TAG, "Camera/channels %d < bound channel %d, keep %d channels\n", ChannelCnt, Used - 1, Used);
+		ChannelCnt = Used;
+	}
+
+	CamManage->Camera = calloc(ChannelCnt, sizeof(CameraInfo));
+	if (CamManage->Camera == NULL) {
+		pthread_mutex_unlock(&CamManage->CamInfoMutex);
+		return -1;
+	}
+	if (CamManage->ChannelCnt != 0 && CamManage->ChannelCnt != ChannelCnt) Rewrite = 1;
+	CamManage->ChannelCnt = ChannelCnt;
+	CamManage->CameraBindCnt = 0;
+	for (i = 0; i < ChannelCnt; i++) {
+		CamManage->Camera[i] = Bound[i];
+		CamManage->Camera[i].Sock = -1;
+		CamManage->Camera[i].IsAlive = 0;
+		CamManage->Camera[i].DisconCnt = 0;
+		memset(CamManage->Camera[i].Addr, 0, sizeof(CamManage->Camera[i].Addr));
+		if (CamManage->Camera[i].DevIndex >= 0) CamManage->CameraBindCnt++;
+	}
+	if (Rewrite) {
+		CamManage_WriteCamInfo(CamManage);
 	}
 	pthread_mutex_unlock(&CamManage->CamInfoMutex);
 
+	LOG_INFO(TAG, "Camera channels: %d, bound: %d\n", ChannelCnt, CamManage->CameraBindCnt);
 	return 0;
 }
 
 int32_t CamManage_AddCamInfo(CamManageHandle *CamManage, int32_t Sock, char *Addr, CameraInfo *CamIno)
 {
 	int32_t i, Flag = 0;
-	FILE *File;
 	
     // 1. Search for existing device ID (Reconnect logic)
-	for (i = 0; i < CAM_MAX_CNT; i++) {
+	for (i = 0; i < CamManage->ChannelCnt; i++) {
 		if (CamManage->Camera[i].DevIndex >= 0 && strcmp(CamManage->Camera[i].DevId, CamIno->DevId) == 0) {
 			Flag = 1;
             
@@ -242,11 +375,11 @@ int32_t CamManage_AddCamInfo(CamManageHandle *CamManage, int32_t Sock, char *Add
 
     // 2. If not found, find a free slot (New Connection)
 	if (Flag == 0) {
-		if (CamManage->CameraBindCnt >= CAM_MAX_CNT) {
+		if (CamManage->CameraBindCnt >= CamManage->ChannelCnt) {
             LOG_ERROR(TAG, "Max Cameras Reached (%d)\n", CamManage->CameraBindCnt);
 			return -1;
 		}
-		for (i = 0; i < CAM_MAX_CNT; i++) {
+		for (i = 0; i < CamManage->ChannelCnt; i++) {
 			if (CamManage->Camera[i].DevIndex < 0) {
 				Flag = 2;
 				CamManage->CameraBindCnt++;
@@ -258,7 +391,6 @@ int32_t CamManage_AddCamInfo(CamManageHandle *CamManage, int32_t Sock, char *Add
 
 	if (Flag) {
 		pthread_mutex_lock(&CamManage->CamInfoMutex);
-		File = fopen(CAM_INFO, "w");
 
         // Update State
 		CamManage->CameraConnectedCnt++;
@@ -270,8 +402,7 @@ int32_t CamManage_AddCamInfo(CamManageHandle *CamManage, int32_t Sock, char *Add
 		strcpy(CamManage->Camera[i].DevId, CamIno->DevId);
 		strcpy(CamManage->Camera[i].FwVersion, CamIno->FwVersion);
 		
-		fwrite(CamManage->Camera, 1, sizeof(CamManage->Camera), File);
-		fclose(File);
+		CamManage_WriteCamInfo(CamManage);
 		pthread_mutex_unlock(&CamManage->CamInfoMutex);
         
         // Log Bitrate for diagnosis
@@ -290,9 +421,8 @@ int32_t CamManage_AddCamInfo(CamManageHandle *CamManage, int32_t Sock, char *Add
 int32_t CamManage_DisconnectCamInfo(CamManageHandle *CamManage, int32_t Sock)
 {
 	int32_t i;
-	FILE *File;
 	
-	for (i = 0; i < CAM_MAX_CNT; i++) {
+	for (i = 0; i < CamManage->ChannelCnt; i++) {
 		if (CamManage->Camera[i].Sock == Sock) {
 			LOG_INFO(TAG, "Camera[%s] Disconnected\n", CamManage->Camera[i].Addr);
 			if (CamManage->CameraConnectedCnt > 0) {
@@ -303,9 +433,7 @@ int32_t CamManage_DisconnectCamInfo(CamManageHandle *CamManage, int32_t Sock)
 			CamManage->Camera[i].DisconCnt = 0;
 			
 			pthread_mutex_lock(&CamManage->CamInfoMutex);
-			File = fopen(CAM_INFO, "w");
-			fwrite(CamManage->Camera, 1, sizeof(CamManage->Camera), File);
-			fclose(File);
+			CamManage_WriteCamInfo(CamManage);
 			pthread_mutex_unlock(&CamManage->CamInfoMutex);
 			
 			return CamManage->Camera[i].DevIndex;
@@ -318,7 +446,7 @@ int32_t CamManage_DisconnectCamInfo(CamManageHandle *CamManage, int32_t Sock)
 int32_t CamManage_GetCamIndex(CamManageHandle *CamManage, int32_t Sock)
 {
 	int32_t i;
-	for (i = 0; i < CAM_MAX_CNT; i++) {
+	for (i = 0; i < CamManage->ChannelCnt; i++) {
 		if (Sock == CamManage->Camera[i].Sock) {
 			return CamManage->Camera[i].DevIndex;
 		}
@@ -329,7 +457,7 @@ int32_t CamManage_GetCamIndex(CamManageHandle *CamManage, int32_t Sock)
 char* CamManage_GetCamAddr(CamManageHandle *CamManage, int32_t Sock)
 {
 	int i;
-	for (i = 0; i < CAM_MAX_CNT; i++) {
+	for (i = 0; i < CamManage->ChannelCnt; i++) {
 		if (Sock == CamManage->Camera[i].Sock) {
 			return CamManage->Camera[i].Addr;
 		}
@@ -340,7 +468,7 @@ char* CamManage_GetCamAddr(CamManageHandle *CamManage, int32_t Sock)
 int64_t CamManage_GetCamDevId(CamManageHandle *CamManage, int32_t Sock)
 {
 	int i;
-	for (i = 0; i < CAM_MAX_CNT; i++) {
+	for (i = 0; i < CamManage->ChannelCnt; i++) {
 		if (Sock == CamManage->Camera[i].Sock) {
 			return *((int64_t *)CamManage->Camera[i].DevId);
 		}
@@ -351,7 +479,7 @@ int64_t CamManage_GetCamDevId(CamManageHandle *CamManage, int32_t Sock)
 int32_t CamManage_SetCamKeepAlive(CamManageHandle *CamManage, int32_t Sock)
 {
 	int32_t i;
-	for (i = 0; i < CAM_MAX_CNT; i++) {
+	for (i = 0; i < CamManage->ChannelCnt; i++) {
 		if (Sock == CamManage->Camera[i].Sock) {
 			CamManage->Camera[i].DisconCnt = 0;
 		}
@@ -435,7 +563,7 @@ OPEN_SOCKET:
         goto OPEN_SOCKET;
     }
     
-    if (listen(CamManage->ListenSock, CAM_MAX_CNT) < 0) {
+    if (listen(CamManage->ListenSock, CamManage->ChannelCnt) < 0) {
         LOG_ERROR(TAG, "Socket listen failed\n");
 		close(CamManage->ListenSock);
 		sleep(2);
@@ -461,7 +589,7 @@ OPEN_SOCKET:
 		if (SelectRet == 0) {
             // Heartbeat/Timeout check logic
 			for (i = CamManage->ListenSock + 1;  i <= MaxFd; i ++) {
-				for (int32_t j = 0; j < CAM_MAX_CNT; j++) {
+				for (int32_t j = 0; j < CamManage->ChannelCnt; j++) {
 					if (i == CamManage->Camera[j].Sock) {
 						CamManage->Camera[j].DisconCnt++;
 						if (CamManage->Camera[j].IsAlive == 1 && CamManage->Camera[j].DisconCnt > 3) {
@@ -527,6 +655,17 @@ OPEN_SOCKET:
 							}
 							break;
 						}
+						case MSG_STREAM_INFO:
+						{
+							int32_t Index = CamManage_GetCamIndex(CamManage, i);
+							if (Index >= 0 && Packet->Len >= (int32_t)sizeof(StreamInfo)) {
+								StreamInfo *Info = (StreamInfo *)Packet->Data;
+								LOG_INFO(TAG, "Recv MSG_STREAM_INFO from Ch%d: %dx%d@%d audio %dHz\n", Index,
+										 Info->VideoWidth, Info->VideoHeight, Info->VideoFrameRate, Info->AudioSampleRate);
+								Stream_SetStreamInfo(CamManage->Station, Index, Info);
+							}
+							break;
+						}
 						case MSG_STREAM_READY:
 						{
 							int32_t Index = CamManage_GetCamIndex(CamManage, i);
@@ -591,7 +730,8 @@ int32_t CamManage_Init(StationHandle *Station)
 
 	if (Ret != 0) goto CamManage_Init_Error;
 
-	CamManage_ReadCamInfo(CamManage);
+	Ret = CamManage_ReadCamInfo(CamManage);
+	if (Ret < 0) goto CamManage_Init_Error;
 	Ret = pthread_create(&CamManage->ConnThread, NULL, CamManage_ConnThread, CamManage);
 	if (Ret < 0) goto CamManage_Init_Error;
 
@@ -603,6 +743,7 @@ int32_t CamManage_Init(StationHandle *Station)
 CamManage_Init_Error:
 	if (CamManage->ConnThread > 0) pthread_cancel(CamManage->ConnThread);
     if (CamManage->FlowThread > 0) pthread_cancel(CamManage->FlowThread);
+	free(CamManage->Camera);
 	free(CamManage);
 	Station->CameraMag = NULL;
 	return -1;
@@ -613,7 +754,7 @@ void CamManage_Deinit(StationHandle *Station)
 	CamManageHandle *CamManage = Station->CameraMag;
 	if (CamManage) {
 		if (CamManage->ListenSock) {
-			for (int i = 0; i < CamManage->CameraConnectedCnt; i++) {
+			for (int i = 0; i < CamManage->ChannelCnt; i++) {
 				if (CamManage->Camera[i].Sock > 0) {
 					close(CamManage->Camera[i].Sock);
 					CamManage->Camera[i].Sock = 0;
@@ -633,6 +774,7 @@ void CamManage_Deinit(StationHandle *Station)
 
 		pthread_mutex_destroy(&CamManage->CamInfoMutex);
         pthread_mutex_destroy(&CamManage->FocusMutex);
+		free(CamManage->Camera);
 		free(CamManage);
 		Station->CameraMag = NULL;
 	}
@@ -645,6 +787,7 @@ int32_t CamManage_Send(StationHandle *Station, int32_t Index, int32_t Type, char
 	MsgPacket *Packet = (MsgPacket *)Buf;
 	CamManageHandle *CamManage = Station->CameraMag;
 	
+	if (Index < 0 || Index >= CamManage->ChannelCnt) return -1;
 	Packet->Type = MSG_TYPE_STA2CAM(Type);
 	Packet->Len = Len;
 	Packet->CheckSum = 0;
@@ -661,9 +804,23 @@ int32_t CamManage_Send(StationHandle *Station, int32_t Index, int32_t Type, char
 int64_t CamManage_GetCamDevIdByIndex(StationHandle *Station, int32_t Index)
 {
 	CamManageHandle *CamManage = Station->CameraMag;
+	if (Index < 0 || Index >= CamManage->ChannelCnt) return -1;
 	return *((int64_t *)CamManage->Camera[Index].DevId);
 }
 
+int32_t CamManage_GetChannelCnt(StationHandle *Station)
+{
+	CamManageHandle *CamManage = Station->CameraMag;
+	return CamManage ? CamManage->ChannelCnt : 0;
+}
+
+int32_t CamManage_IsCamBound(StationHandle *Station, int32_t Index)
+{
+	CamManageHandle *CamManage = Station->CameraMag;
+	if (CamManage == NULL || Index < 0 || Index >= CamManage->ChannelCnt) return 0;
+	return CamManage->Camera[Index].DevIndex >= 0;
+}
+
 int32_t CamManage_RemoveCamInfo(StationHandle *Station)
 {
 	CamManageHandle *CamManage = Station->CameraMag;
@@ -0,0 +1,89 @@
+#ifndef __AUDIO_TRANSCODE_H__
+#define __AUDIO_TRANSCODE_H__
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswresample/swresample.h>
+#include <libavutil/audio_fifo.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "packet_queue.h"
+#include "packet_pool.h"
+
+// 音频转码工作线程池 (所有摄像头共用)
+// RTSP 线程只把原始音频包放进该路的输入队列；解码/重采样/AAC 编码在池中的工作线程完成，
+// 编码结果放回该路的输出队列，由 RTSP 线程按时间戳与视频合并后发布到广播环。
+// 这样 AAC 编码的抖动不会拖慢 av_read_frame，视频接收延迟与音频编码开销无关。
+// 同一路任务任一时刻只会被一个工作线程处理，转码器状态无需加锁。
+
+#define AUDIO_WORKER_MAX        4
+#define AUDIO_WORKER_DEFAULT    2
+
+typedef struct {
+    int initialized;
+    AVCodecContext *dec_ctx;
+    AVCodecContext *enc_ctx;
+    SwrContext *swr_ctx;
+    AVAudioFifo *fifo;
+    AVFrame *dec_frame;
+    AVFrame *enc_frame;
+    AVPacket enc_pkt;
+    uint8_t **conv_data;     // 重采样输出缓冲，按 conv_cap 个样本预分配，不够时才扩容
+    int conv_cap;
+    AVRational in_tb;        // 输入包的时间基 (ast->time_base 会被改为编码器的 1/sample_rate)
+    int64_t pts_counter;     // 下一个 AAC 帧的 pts (1/sample_rate)，AV_NOPTS_VALUE 表示尚未对齐到输入时间戳
+} AudioTranscoder;
+
+typedef struct AudioTranscodePool AudioTranscodePool;
+typedef struct AudioTranscodeJob AudioTranscodeJob;
+
+// 每路摄像头一个任务 (嵌在 RtspCtx 中)
+struct AudioTranscodeJob {
+    AudioTranscodePool *pool;
+    AudioTranscoder tc;         // 仅由当前处理该任务的工作线程访问
+    PacketQueue in;             // RTSP 线程 -> 工作线程：待转码的原始音频包
+    PacketQueue out;            // 工作线程 -> RTSP 线程：编码好的 AAC 包
+    PacketPool *buf_pool;       // 输出包负载换到该路的分级缓冲池
+    int stream_index;           // 输出包的 stream_index
+    int scheduled;              // 已在就绪链表中或正被处理 (原子，把它从 0 置为 1 的一方负责入就绪链表)
+    int opened;                 // 转码器已打开 (在 pool->mutex 内原子写入，submit 无锁读取)
+    AudioTranscodeJob *next;    // 就绪链表
+};
+
+struct AudioTranscodePool {
+    pthread_t threads[AUDIO_WORKER_MAX];
+    int nb_threads;
+    AudioTranscodeJob *ready_head;
+    AudioTranscodeJob *ready_tail;
+    int abort_request;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;        // 有任务就绪 / 任务处理完毕
+};
+
+// --- 线程池 ---
+int audio_transcode_pool_init(AudioTranscodePool *pool, int nb_threads);
+void audio_transcode_pool_uninit(AudioTranscodePool *pool);
+// 工作线程补充到 nb_threads 个 (只增不减，上限 AUDIO_WORKER_MAX)，摄像头绑定数增加时调用
+int audio_transcode_pool_grow(AudioTranscodePool *pool, int nb_threads);
+
+// --- 每路任务 ---
+int audio_transcode_job_init(AudioTranscodeJob *job, AudioTranscodePool *pool, PacketPool *buf_pool, const char *name);
+void audio_transcode_job_destroy(AudioTranscodeJob *job);
+
+// 按输入音频流打开转码器 (AAC 编码参数写回 ast->codecpar / time_base)，返回 0 成功
+int audio_transcode_job_open(AudioTranscodeJob *job, AVStream *ast, int stream_index);
+
+// 关闭转码器：等待工作线程处理完当前批次，丢弃两个队列中剩余的包 (重连或停止时调用)
+void audio_transcode_job_close(AudioTranscodeJob *job);
+
+// RTSP 线程提交一个原始音频包 (对 pkt 取引用，调用者仍需 unref)
+int audio_transcode_job_submit(AudioTranscodeJob *job, AVPacket *pkt);
+
+// RTSP 线程取一个编码好的 AAC 包 (不阻塞)，返回 1 成功，0 无数据
+int audio_transcode_job_receive(AudioTranscodeJob *job, AVPacket *pkt);
+
+// 输出队列中待合并的包数
+int audio_transcode_job_pending(AudioTranscodeJob *job);
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef __BIT_READER_H__
+#define __BIT_READER_H__
+
+#include <stdint.h>
+#include <string.h>
+
+// H.264 码流位读取器 (stream.c / record.c 共用)
+// 64 位缓存按块补充，补充时直接跳过防竞争字节 (00 00 03)，无需先拷贝成 RBSP；
+// Exp-Golomb 用前导零计数一次解出。读到数据末尾之后返回 0 并置 overread，与原先逐位读取的行为一致。
+// 每个包都要解析 slice 头，函数全部内联在头文件中。
+
+typedef struct {
+    const uint8_t *p;   // 下一个待装入的字节
+    const uint8_t *end;
+    uint64_t cache;     // 待读的位 (高位对齐，有效位以下全为 0)
+    int bits;           // cache 中的有效位数
+    int zeros;          // 已装入的连续 0x00 个数，用于识别防竞争字节
+    int overread;       // 读取超出了数据末尾
+} BitReader;
+
+// 8 个字节中是否有 0x00
+#define BR_HAS_ZERO_BYTE(w) \
+    (((w) - 0x0101010101010101ULL) & ~(w) & 0x8080808080808080ULL)
+
+static inline uint64_t bit_reader_load_be64(const uint8_t *p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return w;
+#else
+    return __builtin_bswap64(w);
+#endif
+}
+
+// data 为 NAL 头之后的 EBSP 数据 (可含防竞争字节)
+static inline void bit_reader_init(BitReader *br, const uint8_t *data, int size)
+{
+    br->p = data;
+    br->end = data + ((size > 0) ? size : 0);
+    br->cache = 0;
+    br->bits = 0;
+    br->zeros = 0;
+    br->overread = 0;
+}
+
+// 补充缓存到至少 57 位 (数据不足时装到末尾为止)
+static inline void bit_reader_refill(BitReader *br)
+{
+    // 快速路径：接下来 8 字节里没有 0x00 就不可能出现防竞争字节，整块装入
+    if (br->zeros == 0 && br->end - br->p >= 8) {
+        uint64_t w = bit_reader_load_be64(br->p);
+        if (!BR_HAS_ZERO_BYTE(w)) {
+            int n = (64 - br->bits) >> 3;
+            br->cache |= (w >> (64 - n * 8)) << (64 - n * 8 - br->bits);
+            br->bits += n * 8;
+            br->p += n;
+            return;
+        }
+    }
+
+    while (br->bits <= 56 && br->p < br->end) {
+        uint8_t v = *br->p++;
+        if (br->zeros >= 2 && v == 0x03) {
+            br->zeros = 0;
+            continue; // Skip Emulation Prevention Byte
+        }
+        br->zeros = v ? 0 : br->zeros + 1;
+        br->cache |= (uint64_t)v << (56 - br->bits);
+        br->bits += 8;
+    }
+}
+
+static inline void bit_reader_consume(BitReader *br, int n)
+{
+    if (n > br->bits) {
+        br->overread = 1;
+        br->cache = 0;
+        br->bits = 0;
+        return;
+    }
+    br->cache <<= n;
+    br->bits -= n;
+}
+
+// 读取 n 位 (1..32)
+static inline unsigned bit_reader_read(BitReader *br, int n)
+{
+    unsigned v;
+
+    if (n <= 0) return 0;
+    if (br->bits < n) bit_reader_refill(br);
+    v = (unsigned)(br->cache >> (64 - n));
+    bit_reader_consume(br, n);
+    return v;
+}
+
+static inline unsigned bit_reader_read1(BitReader *br)
+{
+    return bit_reader_read(br, 1);
+}
+
+static inline void bit_reader_skip(BitReader *br, int n)
+{
+    while (n > 32) {
+        bit_reader_read(br, 32);
+        n -= 32;
+    }
+    bit_reader_read(br, n);
+}
+
+// 无符号 Exp-Golomb ue(v)，前导零超过 31 个视为码流错误，返回 0 并置 overread
+static inline unsigned bit_reader_read_ue(BitReader *br)
+{
+    int lz;
+
+    if (br->bits < 32) bit_reader_refill(br);
+    if (br->cache == 0) {
+        bit_reader_consume(br, br->bits + 1);
+        return 0;
+    }
+
+    lz = __builtin_clzll(br->cache);
+    if (2 * lz + 1 <= br->bits) {
+        unsigned v = (unsigned)(br->cache >> (63 - 2 * lz)) - 1U;
+        bit_reader_consume(br, 2 * lz + 1);
+        return v;
+    }
+    if (lz > 31) {
+        bit_reader_consume(br, br->bits + 1);
+        return 0;
+    }
+
+    // 码字跨越缓存边界 (仅长码字或接近末尾时出现)
+    bit_reader_consume(br, lz);
+    return bit_reader_read(br, lz + 1) - 1U;
+}
+
+// 有符号 Exp-Golomb se(v)
+static inline int bit_reader_read_se(BitReader *br)
+{
+    unsigned ue = bit_reader_read_ue(br);
+    return (ue & 1) ? (int)((ue + 1) / 2) : -(int)(ue / 2);
+}
+
+#endif
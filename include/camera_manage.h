@@ -8,9 +8,15 @@
 
 #include "common.h"
 
+// 通道数由配置 Camera/channels 决定 (CamManageHandle.ChannelCnt)，未配置时为 CAM_MAX_CNT
+// 各模块的每路上下文按实际通道数分配，CAM_CHANNEL_LIMIT 只是配置的上限
 #define CAM_MAX_CNT 4
+#define CAM_CHANNEL_LIMIT       16
 
 #define CAM_INFO                "/config/cam_info"
+#define CAM_INFO_TMP            "/config/cam_info.tmp"
+#define CAM_INFO_MAGIC          0x494d4143      // "CAMI"
+#define CAM_INFO_VERSION        2
 
 
 #define MSG_FLAG_CAMERA         (0<<31)
@@ -70,13 +76,23 @@ typedef struct camera_info {
         int32_t DisconCnt;
 } CameraInfo;
 
+// cam_info 文件头 (v2)，后跟 Count 个 EntrySize 字节的 CameraInfo
+// v1 没有文件头，是 CAM_MAX_CNT 个 CameraInfo 的原样拷贝，读取时自动升级
+typedef struct cam_info_header {
+        uint32_t Magic;
+        uint16_t Version;
+        uint16_t Count;
+        uint32_t EntrySize;
+        uint32_t Reserved;
+} CamInfoHeader;
+
 struct CamManageHandle {
         StationHandle  *Station;
 
     // --- [新增] 流控相关成员 ---
         // 记录当前用户选择的通道 ID
         // -1: 代表四分屏（全看）
-        // 0~3: 代表只看某一路，其他的暂停
+        // 0~ChannelCnt-1: 代表只看某一路，其他的暂停
         int32_t FocusIndex;
         pthread_mutex_t FocusMutex; // 保护 FocusIndex 的读写
         int64_t LastActionTime;     // 上一次启动通道的时间 (ms)
@@ -86,7 +102,8 @@ struct CamManageHandle {
         pthread_t ConnThread;
         pthread_t FlowThread;       // [新增] 流控线程句柄
         int32_t ListenSock;
-        CameraInfo Camera[CAM_MAX_CNT];
+        CameraInfo *Camera;         // ChannelCnt 个，按 DevIndex 存放
+        int32_t ChannelCnt;
         int32_t CameraConnectedCnt;
         int32_t CameraBindCnt;
         pthread_mutex_t CamInfoMutex;
@@ -97,6 +114,10 @@ void CamManage_Deinit(StationHandle *Station);
 int32_t CamManage_Send(StationHandle *Station, int32_t Index, int32_t Type, char *Data, int32_t Len);
 int64_t CamManage_GetCamDevIdByIndex(StationHandle *Station, int32_t Index);
 int32_t CamManage_RemoveCamInfo(StationHandle *Station);
+// 运行时通道数 (其他模块据此分配每路上下文)
+int32_t CamManage_GetChannelCnt(StationHandle *Station);
+// 该通道是否已绑定摄像头
+int32_t CamManage_IsCamBound(StationHandle *Station, int32_t Index);
 void CamManage_SetFocusChannel(StationHandle *Station, int32_t Index);
 
 #endif
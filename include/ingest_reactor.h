@@ -0,0 +1,49 @@
+#ifndef __INGEST_REACTOR_H__
+#define __INGEST_REACTOR_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+// 单线程 ingest reactor (stream.c 中 ENABLE_INGEST_REACTOR 打开时使用)
+// 所有摄像头的 RTSP 连接由一个 epoll 线程驱动 (rtsp_client.h 非阻塞客户端)，
+// 代替每路一个阻塞在 av_read_frame 上的 Stream_RtspThread，减少线程栈和上下文切换。
+// 收到的帧与线程模式走同一条接收路径 (Stream_IngestPacket)，下游录像/P2P 无需区分。
+
+#define INGEST_REACTOR_MAX_CHANNELS 16
+
+struct rtsp_ctx;
+
+typedef struct {
+    int op;                     // INGEST_CMD_*
+    struct rtsp_ctx *ctx;
+} IngestCmd;
+
+typedef struct {
+    int epfd;
+    int evfd;                   // eventfd：增删通道、退出时唤醒 epoll_wait
+    pthread_t thread;
+    int started;
+    volatile int abort_request;
+
+    // 以下仅由 reactor 线程访问
+    struct rtsp_ctx *chans[INGEST_REACTOR_MAX_CHANNELS];
+    int nb_chans;
+
+    // 命令队列 (受 mutex 保护)，cond 用于等待通道被释放
+    IngestCmd cmds[INGEST_REACTOR_MAX_CHANNELS * 2];
+    int nb_cmds;
+    int nb_reserved;            // 已接受的通道数 (含还没处理的 ADD)，add 时据此判断是否已满
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} IngestReactor;
+
+int ingest_reactor_init(IngestReactor *r);
+void ingest_reactor_uninit(IngestReactor *r);
+
+// 把通道交给 reactor 接收 (ctx->url 等已填好)，reactor 未运行或已满返回 -1
+int ingest_reactor_add(IngestReactor *r, struct rtsp_ctx *ctx);
+
+// 停止通道：阻塞到 reactor 关闭连接、不再访问 ctx 为止
+void ingest_reactor_remove(IngestReactor *r, struct rtsp_ctx *ctx);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __NAL_INDEX_H__
+#define __NAL_INDEX_H__
+
+#include <stdint.h>
+
+// Annex-B NAL 索引
+// 每个视频包在 Stream_RtspThread 中只扫描一次起始码，索引随包元数据 (packet_meta.h) 传递；
+// 录像等下游直接按索引访问各个 NAL，不再逐字节重复扫描整个包 (I 帧可达上百 KB)。
+// 起始码查找按平台选择 SSE2 / NEON / SWAR (8 字节一组) 实现。
+
+#define NAL_INDEX_MAX        16          // 单包最多记录的 NAL 数 (SPS/PPS/SEI/多 slice)
+#define NAL_INDEX_TRUNCATED  0x0001      // NAL 数超过上限，之后的 NAL 未记录
+
+typedef struct {
+    uint32_t offset;    // NAL 头在包内的偏移 (起始码之后)
+    uint32_t size;      // NAL 长度 (不含起始码及其前导 0x00)
+    uint8_t sc_size;    // 起始码长度: 3 或 4
+    uint8_t header;     // NAL 头第一个字节
+    uint16_t reserved;
+} NalUnitInfo;
+
+typedef struct {
+    uint32_t pkt_size;  // 建索引时的包长度，用于校验索引与数据是否匹配
+    uint16_t count;
+    uint16_t flags;
+    NalUnitInfo nal[NAL_INDEX_MAX];
+} NalIndex;
+
+// H.264 NAL 头字段
+#define NAL_H264_TYPE(u)     ((u)->header & 0x1F)
+#define NAL_H264_REF_IDC(u)  (((u)->header >> 5) & 0x03)
+
+// H.265 NAL 头第一个字节中的 nal_unit_type (第二个字节为 layer id / temporal id，未记录)
+#define NAL_HEVC_TYPE(u)     (((u)->header >> 1) & 0x3F)
+
+// 查找 [p, end) 中第一个 00 00 01，返回其位置，找不到返回 end
+const uint8_t *nal_find_start_code(const uint8_t *p, const uint8_t *end);
+
+// 单次扫描建立索引，返回 NAL 个数
+int nal_index_build(NalIndex *idx, const uint8_t *data, int size);
+
+#endif
@@ -145,7 +145,8 @@ struct P2pHandle {
         char            UID[24];
         char            Authkey[12];
         int32_t         SessionId;
-        CameraStream  CamStream[CAM_MAX_CNT];
+        CameraStream   *CamStream;      // ChannelCnt 路，与 Stream 模块相同
+        int32_t         ChannelCnt;
         pthread_t   ListenThd;
         pthread_t       LoginThd;
         void            *Priv[0];
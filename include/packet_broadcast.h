@@ -0,0 +1,125 @@
+#ifndef __PACKET_BROADCAST_H__
+#define __PACKET_BROADCAST_H__
+
+#include <libavcodec/avcodec.h>
+#include <stdint.h>
+#include "packet_queue.h"
+
+// 一路输入、多路输出的广播队列
+// 生产者每个包只 put 一次 (一次 av_packet_ref)，各消费者 (录像、P2P、转发...) 有自己的读游标和丢包策略。
+// 槽位记录还有几个读者没读，最后一个读者直接把包 move 走，其余读者拿引用，全程不拷贝数据。
+// put 不加锁：写位置和读游标都是原子量，只有读者真正休眠时才进内核唤醒 (futex)。
+// 读者的每一份"未读"只能由一方认领：读者读包、生产者追赶/预算淘汰、flush 都通过对读游标 CAS 认领，
+// 认领到的槽位由认领方释放，生产者只在槽位无人持有时才覆盖。
+
+#define PACKET_BROADCAST_MAX_READERS 4
+
+// 广播环槽位
+// 除 pkt/pending 外的字段只由生产者在发布前写入，读者持有份额期间只读
+typedef struct {
+    AVPacket pkt;       // FFmpeg 数据包
+    PacketType type;    // 包类型
+    int key;            // 是否关键帧 (pkt 可能已被读者 move 走，GOP 追赶看这里)
+    int size;           // 负载字节数
+    uint32_t type_seq;  // 同类型的发布序号，读者据此得出该类型的积压
+    int64_t pts;        // pts 副本 (包被取走后仍可用于时长统计)
+    int64_t enq_us;     // 发布时间戳 (单调时钟，微秒)
+    int pending;        // 还未释放的读者份额 (原子)，归零后生产者才能覆盖
+} BroadcastSlot;
+
+typedef struct PacketBroadcastReader PacketBroadcastReader;
+
+// 广播队列控制块
+typedef struct {
+    BroadcastSlot *slots;
+    uint32_t mask;             // 槽位数 - 1 (槽位数为 2 的幂)
+    uint32_t head;             // 下一个写入序号 (生产者 release 发布，读者 acquire 读取)
+    uint32_t tail;             // 最旧有效序号，不早于 head - 槽位数 (仅生产者推进)
+    int count[2];              // 环中各类型的包数 (0: 视频, 1: 音频，仅生产者访问)
+    uint32_t type_puts[2];     // 各类型累计发布数 (原子)
+    PacketBroadcastReader *readers[PACKET_BROADCAST_MAX_READERS];
+    int nb_readers;            // 已挂载的读者数，每个新包的 pending 初值
+    int size_bytes;            // 环中尚未被全部读者释放的字节数 (原子)
+    int max_bytes;             // 字节预算 (0 不限制)
+    int max_duration_ms;       // 时长预算 (0 不限制，按视频 pts 计算)
+    int duration_ms;           // 最近一次 put 后环中视频的时长 (未设置时间基时为 0)
+    AVRational time_base;      // 视频 pts 的时间基
+    int abort_request;         // 退出标志
+    int nb_parked;             // 正在休眠的读者数，为 0 时 put 不进内核
+    uint32_t wake_seq;         // futex 等待字，每次唤醒加一
+    QueueStats stats;          // 发布速率、环占用高水位、预算淘汰统计
+} PacketBroadcast;
+
+// 读者 (由使用者分配，通常嵌在上下文结构中)
+struct PacketBroadcastReader {
+    PacketBroadcast *bc;
+    uint32_t cursor;           // 下一个要读的序号 (原子，读者/生产者/flush 通过 CAS 推进)
+    int max_lag;               // 允许落后生产者的最大包数，超过按策略跳过
+    PacketEvictPolicy policy;  // 落后时的跳过策略 (OLDEST / GOP)
+    int attached;              // 是否已挂到广播队列
+    int paused;                // 暂停时 get 不返回包，生产者每次发布后把游标推到写位置
+    int abort_request;         // 仅中止该读者
+    uint32_t dropped_video;    // 因落后被跳过的视频包累计数
+    uint32_t dropped_audio;    // 因落后被跳过的音频包累计数
+    QueueStats stats;          // 该读者的驻留时间、积压高水位、跳过统计
+};
+
+// --- API 接口 ---
+
+// 初始化：capacity 为环中最多保留的包数 (音视频混合)
+int packet_broadcast_init(PacketBroadcast *bc, int capacity);
+
+// 设置字节/时长预算 (0 表示不限制)，需在生产者线程内或开始发布前调用
+// 超出时生产者推进最旧位置，仍停在更早位置的读者按各自策略 (OLDEST/GOP) 跳过
+int packet_broadcast_set_budget(PacketBroadcast *bc, int max_bytes, int max_duration_ms, AVRational time_base);
+
+// 命名并注册统计信息 (读者需在 attach 之后调用)
+int packet_broadcast_set_name(PacketBroadcast *bc, const char *name);
+int packet_broadcast_reader_set_name(PacketBroadcastReader *r, const char *name);
+
+// 销毁：释放环中剩余的包 (需先 detach 所有读者)
+void packet_broadcast_destroy(PacketBroadcast *bc);
+
+// 中止：唤醒所有读者，之后 get 返回 -1
+void packet_broadcast_abort(PacketBroadcast *bc);
+
+// 发布：单生产者调用，对 pkt 取一次引用，调用者仍需 unref 自己的 pkt
+// 落后超过 max_lag 的读者由生产者在发布后按策略推进，开销与读者个数成正比 (读者最多 PACKET_BROADCAST_MAX_READERS 个)
+int packet_broadcast_put(PacketBroadcast *bc, AVPacket *pkt, PacketType type);
+
+// 挂载读者：从当前写位置开始读，max_lag 不超过环容量 - 1
+// attach/detach 只能在没有 put 进行时调用 (生产者线程启动前 / 退出后)
+int packet_broadcast_attach(PacketBroadcast *bc, PacketBroadcastReader *r, int max_lag, PacketEvictPolicy policy);
+
+// 卸载读者：释放该读者尚未读取的包
+void packet_broadcast_detach(PacketBroadcastReader *r);
+
+// 读取：block=1 为阻塞模式，返回 1 成功，0 无数据，-1 中止
+int packet_broadcast_get(PacketBroadcastReader *r, AVPacket *pkt, int block);
+
+// 限时读取：返回 1 成功，0 超时，-1 中止 (timeout_ms < 0 等同阻塞 get，0 等同非阻塞 get)
+// 超时按 CLOCK_MONOTONIC 计算，消费者可借此在无数据时做周期性检查而无需轮询
+int packet_broadcast_get_timeout(PacketBroadcastReader *r, AVPacket *pkt, int timeout_ms);
+
+// 批量读取：一次取走最多 max 个包，返回个数，-1 中止
+// timeout_ms 含义同 packet_queue_get_batch (<0 至少等到 1 个，0 不等待，>0 等凑满 max 或超时)
+int packet_broadcast_get_batch(PacketBroadcastReader *r, AVPacket *pkts, int max, int timeout_ms);
+
+// 暂停/恢复读者：暂停期间不再持有新包，恢复后从当前写位置开始读 (可与 put 并发)
+void packet_broadcast_pause(PacketBroadcastReader *r, int pause);
+
+// 丢弃读者当前积压，直接跳到写位置 (可在任意线程调用)
+void packet_broadcast_flush(PacketBroadcastReader *r);
+
+// 中止单个读者 (不影响其它读者)
+void packet_broadcast_reader_abort(PacketBroadcastReader *r);
+// 读者或整个环已被中止 (不阻塞，供还没开始读的线程在等待循环中检查)
+int packet_broadcast_reader_aborted(PacketBroadcastReader *r);
+
+// 获取环当前占用：字节数、有效包数、视频时长 (毫秒)
+void packet_broadcast_get_depth(PacketBroadcast *bc, int *size_bytes, int *nb_packets, int *duration_ms);
+
+// 获取读者积压的包数与累计丢包数
+void packet_broadcast_get_stats(PacketBroadcastReader *r, int *nb_packets, uint32_t *dropped_video, uint32_t *dropped_audio);
+
+#endif
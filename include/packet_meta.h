@@ -0,0 +1,77 @@
+#ifndef __PACKET_META_H__
+#define __PACKET_META_H__
+
+#include <libavcodec/avcodec.h>
+#include <stdint.h>
+#include "nal_index.h"
+
+// 视频包元数据：在 Stream_RtspThread 中每包解析一次，作为 side data 随包经队列下发
+// 录像、P2P 等下游只读这里的结果，不再各自扫描起始码、解析 slice 头和 SPS
+// 支持 H.264 和 H.265，按流的 codecpar->codec_id 选择
+
+#define PKT_META_IDR          0x0001  // 含 IDR slice (H.265 为 IDR_W_RADL / IDR_N_LP)
+#define PKT_META_I_SLICE      0x0002  // 含 slice_type 为 I 的非 IDR slice (仅 H.264)
+#define PKT_META_SI_SLICE     0x0004  // 含 slice_type 为 SI 的非 IDR slice (仅 H.264)
+#define PKT_META_DISPOSABLE   0x0008  // 第一个 slice 不被参考 (H.264 nal_ref_idc == 0，H.265 子层非参考图像)
+#define PKT_META_RES_CHANGED  0x0010  // 包内 SPS 的分辨率与该路上一次不同 (由 ingest 标记)
+#define PKT_META_IRAP         0x0020  // 含 IRAP 图像 (仅 H.265：BLA / IDR / CRA)
+
+// 可作为切片/起播点
+#define PKT_META_IS_KEY(m)    (((m)->flags & (PKT_META_IDR | PKT_META_I_SLICE | PKT_META_IRAP)) != 0)
+// 帧内编码 (录像额外接受 SI slice)
+#define PKT_META_IS_INTRA(m)  (((m)->flags & (PKT_META_IDR | PKT_META_I_SLICE | PKT_META_SI_SLICE | PKT_META_IRAP)) != 0)
+
+#define PKT_META_CODEC_H264   0
+#define PKT_META_CODEC_HEVC   1
+
+// 私有 side data 类型：取 FFmpeg 枚举之外的值 ('PMET')，muxer 遇到未知类型会忽略
+#define PACKET_META_SIDE_DATA ((enum AVPacketSideDataType)0x504D4554)
+
+typedef struct {
+    uint32_t flags;         // PKT_META_*
+    uint8_t codec;          // PKT_META_CODEC_*
+    int8_t slice_type;      // 第一个 slice 的 slice_type (H.264: 0..4)，-1 表示没有 slice 或未解析 (H.265)
+    int8_t vps;             // VPS 在 nal.nal[] 中的下标，-1 表示没有 (仅 H.265)
+    int8_t sps;             // SPS 在 nal.nal[] 中的下标，-1 表示没有
+    int8_t pps;             // PPS 在 nal.nal[] 中的下标，-1 表示没有
+    uint8_t reserved[3];
+    uint16_t width;         // 包内 SPS 解析出的分辨率，没有 SPS 时为 0
+    uint16_t height;
+    uint64_t type_mask;     // 出现过的 nal_unit_type 位图 (bit n 对应类型 n，H.265 类型可到 63)
+    NalIndex nal;           // 必须放在最后：附加时只复制有效的 NAL 条目
+} PacketMeta;
+
+// H.265 SPS 中生成 hvcC 所需的字段
+typedef struct {
+    uint8_t ptl[12];                // general_profile_space .. general_level_idc 原样 12 字节
+    uint8_t chroma_format_idc;
+    uint8_t bit_depth_luma_minus8;
+    uint8_t bit_depth_chroma_minus8;
+    uint8_t max_sub_layers;         // sps_max_sub_layers_minus1 + 1
+    uint8_t temporal_id_nesting;
+    int width;                      // 已减去 conformance window
+    int height;
+} HevcSpsInfo;
+
+// 流的视频编码是否支持按包解析元数据
+int packet_meta_codec_supported(enum AVCodecID codec_id);
+
+// 解析 Annex-B 包 (起始码扫描、关键帧类型、参数集位置、SPS 分辨率)，不支持的编码返回 -1
+int packet_meta_parse(PacketMeta *m, enum AVCodecID codec_id, const uint8_t *data, int size);
+int packet_meta_parse_h264(PacketMeta *m, const uint8_t *data, int size);
+int packet_meta_parse_hevc(PacketMeta *m, const uint8_t *data, int size);
+
+// 作为 side data 附加到包上
+int packet_meta_attach(AVPacket *pkt, const PacketMeta *m);
+
+// 取包上的元数据；没有或与数据/编码不匹配时现场解析到 tmp 中并返回 tmp
+const PacketMeta *packet_meta_get(const AVPacket *pkt, enum AVCodecID codec_id, PacketMeta *tmp);
+
+// 解析 SPS 得到宽高，sps_payload 为 NAL 头之后的数据 (可含防竞争字节)
+int packet_meta_h264_sps_wh(const uint8_t *sps_payload, int sps_len, int *w, int *h);
+int packet_meta_hevc_sps_parse(const uint8_t *sps_payload, int sps_len, HevcSpsInfo *info);
+
+// 从 codecpar extradata (Annex-B 或 avcC / hvcC) 中的第一个 SPS 得到宽高
+int packet_meta_extradata_wh(enum AVCodecID codec_id, const uint8_t *extra, int extra_size, int *w, int *h);
+
+#endif
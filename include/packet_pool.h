@@ -0,0 +1,51 @@
+#ifndef __PACKET_POOL_H__
+#define __PACKET_POOL_H__
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// 压缩帧负载的分级缓冲池 (每路 RtspCtx 一个)
+// 解复用出来的包立即拷贝到按大小分级的 AVBufferPool 中，原缓冲马上释放；
+// 在队列里长时间驻留的都是池内定长块，稳定后不再向堆申请，避免 uClibc 下变长块造成碎片。
+
+#define PKT_POOL_CLASSES 5
+
+typedef struct PacketPool PacketPool;
+
+// 单个尺寸级别
+typedef struct {
+    PacketPool *owner;
+    AVBufferPool *pool;
+    int size;           // 块大小 (不含 padding)
+    uint32_t gets;      // 从该级别取块次数
+    uint32_t allocs;    // 池中无空闲块、真正向堆申请的次数
+} PacketPoolClass;
+
+struct PacketPool {
+    PacketPoolClass cls[PKT_POOL_CLASSES];
+    uint32_t oversize;  // 超过最大级别、保留原缓冲的包数
+    uint32_t failed;    // 取块失败、保留原缓冲的包数
+};
+
+// 分配器统计快照
+typedef struct {
+    uint32_t gets;      // 总取块次数
+    uint32_t allocs;    // 总堆申请次数 (稳定后应基本不再增长)
+    uint32_t oversize;
+    uint32_t failed;
+} PacketPoolStats;
+
+int packet_pool_init(PacketPool *pp);
+
+// 释放池：仍被队列引用的块在最后一个引用释放时才真正回收，可安全调用
+void packet_pool_uninit(PacketPool *pp);
+
+// 把 pkt 的负载拷贝到池内缓冲 (pkt->size 及其余字段不变，buf->size 为级别块大小)，失败或超大时保持原样
+int packet_pool_rebuf(PacketPool *pp, AVPacket *pkt);
+
+void packet_pool_get_stats(PacketPool *pp, PacketPoolStats *st);
+void packet_pool_dump(PacketPool *pp, const char *name, FILE *fp);
+
+#endif
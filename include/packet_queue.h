@@ -4,7 +4,9 @@
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <pthread.h>
+#include <stdint.h>
 #include "link_list.h"
+#include "queue_stats.h"
 
 // 默认容量配置
 // 视频帧较大，数量相对少；音频帧极小，但数量多，需要足够深度的队列防止爆音
@@ -18,41 +20,160 @@ typedef enum {
     PKT_TYPE_OTHER = 2
 } PacketType;
 
+// 队列工作模式 (初始化时选择)
+typedef enum {
+    PKT_QUEUE_MODE_LOCKED = 0, // 互斥锁 + 条件变量 + 链表 (默认，支持任意多生产者/消费者)
+    PKT_QUEUE_MODE_SPSC   = 1, // 单生产者/单消费者无锁环形队列，仅在消费者休眠时才 futex 唤醒
+    PKT_QUEUE_MODE_COMPACT = 2 // 同 LOCKED，但节点为紧凑格式 (索引链接，不内嵌 AVPacket)，适合深队列
+} PacketQueueMode;
+
+// 队列满时的丢弃策略
+typedef enum {
+    PKT_EVICT_OLDEST       = 0, // 丢弃同类型最旧的单个包 (默认)
+    PKT_EVICT_GOP          = 1, // 视频满时整 GOP 丢弃: 最旧的关键帧到下一个关键帧之间的音视频一起丢
+    PKT_EVICT_NONREF_FIRST = 2  // 先丢非参考帧 (AV_PKT_FLAG_DISPOSABLE)，没有再按 GOP 丢 (仅 LOCKED 模式)
+} PacketEvictPolicy;
+
+#ifndef AV_PKT_FLAG_DISPOSABLE
+#define AV_PKT_FLAG_DISPOSABLE 0x0010
+#endif
+
 // 队列节点
 typedef struct {
     ListNode node;      // 链表节点接口 (必须是第一个成员)
+    ListNode type_node; // 同类型子链表节点 (与 active_list 同序，用于 O(1) 丢旧)
+    ListNode evict_node;// 可丢弃 (非参考帧) 子链表节点
     AVPacket pkt;       // FFmpeg 数据包
     PacketType type;    // 标记该节点属于哪个内存池
+    int64_t enq_us;     // 入队时间戳 (单调时钟，微秒)
 } PacketNode;
 
+// 水位回调：队列深度 (音视频包数之和) 涨到设定值时，在生产者线程、锁外调用一次；
+// 深度回落到设定值以下后重新布防。回调应尽快返回，不可对同一队列 put
+typedef void (*PacketQueueWatermarkCb)(void *opaque, int depth);
+
+// 紧凑节点 (COMPACT 模式)
+// 只保存负载引用、side data (包元数据) 和必要字段，出队时再还原为 AVPacket；
+// 链接用 32 位下标代替指针。同类型链表与总链表同序，只会从头部摘除，单向即可
+#define PKT_NODE_NIL 0xFFFFFFFFu
+
+typedef struct {
+    AVBufferRef *buf;   // 负载引用
+    AVPacketSideData *side_data; // 从入队包复制来的 side data，出队时移交给 AVPacket
+    int64_t pts;
+    int64_t dts;
+    int64_t enq_us;     // 入队时间戳 (单调时钟，微秒)
+    uint32_t prev;      // 总顺序链表
+    uint32_t next;      // 总顺序链表 / 空闲链表
+    uint32_t type_next; // 同类型链表
+    int32_t data_off;   // data 相对 buf->data 的偏移
+    int32_t size;
+    uint16_t flags;
+    uint8_t stream_index;
+    uint8_t type;
+    uint8_t side_data_elems;
+} CompactNode;
+
+// 无锁环形队列槽位
+typedef struct {
+    uint32_t seq;       // 槽位序号: ==pos 可写, ==pos+1 可读 (原子访问)
+    uint32_t order;     // 全局入队序号，用于音视频两个环之间按到达顺序合并
+    int flags;          // 入队时的包标志副本 (仅生产者读写，用于 GOP 丢弃)
+    int64_t pts;        // 入队时的 pts 副本 (仅生产者读写，用于时长预算)
+    int64_t enq_us;     // 入队时间戳 (随槽位发布，由取走的一方读取)
+    AVPacket pkt;       // FFmpeg 数据包
+} PacketSlot;
+
+// 单类型无锁环 (视频/音频各一个，保持分池 + 同类型丢旧的语义)
+typedef struct {
+    PacketSlot *slots;
+    uint32_t mask;      // 槽位数 - 1 (槽位数为 2 的幂)
+    uint32_t cap;       // 容量上限
+    uint32_t head;      // 写位置 (仅生产者修改)
+    uint32_t tail;      // 读位置 (消费者/生产者丢包时 CAS 推进)
+} PacketRing;
+
 // 队列控制块
 typedef struct {
+    PacketQueueMode mode;      // 工作模式
+    PacketEvictPolicy evict_policy; // 队列满时的丢弃策略
+
     LinkList active_list;      // 活跃队列 (混合了音视频，保持严格的时间入队顺序)
 
     // --- 视频专用池 (LargeBlock) ---
     LinkList free_list_video;  // 视频空闲节点链表
+    LinkList active_video;     // 活跃视频子链表 (挂 type_node)
     PacketNode *pool_video;    // 视频内存池首地址
     int cap_video;             // 视频容量上限
     int count_video;           // 当前视频包数量
+    uint32_t dropped_video;    // 队列满被丢弃的视频包累计数
 
     // --- 音频专用池 (SmallBlock) ---
     LinkList free_list_audio;  // 音频空闲节点链表
+    LinkList active_audio;     // 活跃音频子链表 (挂 type_node)
+    LinkList disposable_list;  // 活跃的可丢弃视频包 (挂 evict_node，仅 NONREF_FIRST 策略)
     PacketNode *pool_audio;    // 音频内存池首地址
     int cap_audio;             // 音频容量上限
     int count_audio;           // 当前音频包数量
+    uint32_t dropped_audio;    // 队列满被丢弃的音频包累计数
 
     int size_bytes;            // 总数据字节数 (统计用)
+    QueueStats stats;          // 驻留时间/高水位/速率/丢弃统计
+
+    // --- 容量预算 (0 表示不限制，与包数上限同时生效) ---
+    int max_bytes;             // 字节预算
+    int max_duration_ms;       // 时长预算 (按视频 pts 计算)
+    AVRational time_base;      // 视频 pts 的时间基
     int abort_request;         // 退出标志
 
+    // --- 水位回调 (仅生产者在 put 中读写) ---
+    int wm_depth;              // 触发深度 (0 为关闭)
+    int wm_armed;              // 已布防，触发后需回落到 wm_depth 以下才再次布防
+    PacketQueueWatermarkCb wm_cb;
+    void *wm_opaque;
+
+    // --- COMPACT 模式 ---
+    CompactNode *cnodes;       // 视频节点 [0, cap_video)，音频节点 [cap_video, cap_video + cap_audio)
+    uint32_t c_head;           // 总顺序链表头 (最旧)
+    uint32_t c_tail;           // 总顺序链表尾 (最新)
+    uint32_t c_type_head[2];   // 同类型链表头，下标为 PacketType
+    uint32_t c_type_tail[2];
+    uint32_t c_free[2];        // 同类型空闲链表
+
+    // --- SPSC 无锁模式 ---
+    PacketRing ring_video;     // 视频环
+    PacketRing ring_audio;     // 音频环
+    uint32_t put_order;        // 入队序号 (仅生产者修改)
+    uint32_t wake_seq;         // futex 等待字
+    int consumer_parked;       // 消费者是否已休眠
+
     pthread_mutex_t mutex;
     pthread_cond_t cond;
 } PacketQueue;
 
 // --- API 接口 ---
 
-// 初始化：支持分别设置视频和音频的队列深度
+// 初始化：支持分别设置视频和音频的队列深度 (默认 LOCKED 模式)
 void packet_queue_init(PacketQueue *q, int max_video, int max_audio);
 
+// 初始化：额外指定工作模式
+// SPSC 模式要求 put 只在一个线程调用、get 只在一个线程调用；flush 可在任意线程调用
+void packet_queue_init_ex(PacketQueue *q, int max_video, int max_audio, PacketQueueMode mode);
+
+// 设置队列满时的丢弃策略 (在生产者开始 put 之前调用)
+// SPSC 模式不支持 NONREF_FIRST，会降级为 GOP
+int packet_queue_set_evict_policy(PacketQueue *q, PacketEvictPolicy policy);
+
+// 设置字节/时长预算 (0 表示不限制)，超出时按丢弃策略淘汰旧包
+// time_base 为视频流的时间基，时长由队列中最旧与最新视频包的 pts 差得出
+int packet_queue_set_budget(PacketQueue *q, int max_bytes, int max_duration_ms, AVRational time_base);
+
+// 设置水位回调 (在生产者开始 put 之前调用)，depth <= 0 或 cb 为 NULL 时关闭
+int packet_queue_set_watermark(PacketQueue *q, int depth, PacketQueueWatermarkCb cb, void *opaque);
+
+// 命名并注册统计信息，之后可由 queue_stats_dump_all() 输出
+int packet_queue_set_name(PacketQueue *q, const char *name);
+
 // 销毁：释放所有内存池资源
 void packet_queue_destroy(PacketQueue *q);
 
@@ -65,16 +186,40 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt, PacketType type);
 // 出队：block=1 为阻塞模式
 int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block);
 
-// 获取统计信息
-void packet_queue_get_stats(PacketQueue *q, int *size, int *nb_packets);
+// 限时出队：返回 1 成功，0 超时，-1 中止
+// timeout_ms < 0 等同阻塞 get，0 等同非阻塞 get
+int packet_queue_get_timeout(PacketQueue *q, AVPacket *pkt, int timeout_ms);
+
+// 截止时间出队：deadline_us 为 CLOCK_MONOTONIC 绝对时间 (微秒，与 queue_stats_now_us() 同一时钟)
+// 适合消费者按固定节拍做周期性工作 (分段、保活、统计)，不会因系统校时而提前或推迟
+int packet_queue_get_until(PacketQueue *q, AVPacket *pkt, int64_t deadline_us);
+
+// 批量出队：一次取走最多 max 个包到 pkts[]，返回取到的个数，-1 表示中止
+// timeout_ms <  0  阻塞到至少有 1 个包
+// timeout_ms == 0  不等待，取走当前已有的
+// timeout_ms >  0  等到凑满 max 个或超时，再取走已有的 (可能为 0)
+int packet_queue_get_batch(PacketQueue *q, AVPacket *pkts, int max, int timeout_ms);
+
+// 获取统计信息：当前字节数、包数、视频时长 (毫秒，未设置时间基时为 0)
+void packet_queue_get_stats(PacketQueue *q, int *size, int *nb_packets, int *duration_ms);
+// 获取队列满时按类型丢弃的累计包数
+void packet_queue_get_drop_stats(PacketQueue *q, uint32_t *dropped_video, uint32_t *dropped_audio);
 void packet_queue_flush(PacketQueue *q);
 
 // 宏映射 (保持部分兼容性)
 #define PacketQueue_Init        packet_queue_init
+#define PacketQueue_InitEx      packet_queue_init_ex
 #define PacketQueue_Destroy     packet_queue_destroy
+#define PacketQueue_SetEvict    packet_queue_set_evict_policy
+#define PacketQueue_SetBudget   packet_queue_set_budget
+#define PacketQueue_SetName     packet_queue_set_name
 #define PacketQueue_Abort       packet_queue_abort
 #define PacketQueue_Put         packet_queue_put
 #define PacketQueue_Get         packet_queue_get
+#define PacketQueue_GetTimeout  packet_queue_get_timeout
+#define PacketQueue_GetUntil    packet_queue_get_until
+#define PacketQueue_SetWatermark packet_queue_set_watermark
+#define PacketQueue_GetBatch    packet_queue_get_batch
 #define PacketQueue_GetStats    packet_queue_get_stats
 
 #endif
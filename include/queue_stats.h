@@ -0,0 +1,71 @@
+#ifndef __QUEUE_STATS_H__
+#define __QUEUE_STATS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+// 队列运行统计：驻留时间直方图、占用高水位、出入队速率、丢弃计数 (视频/音频分开)
+// 计数均为原子累加，生产者/消费者可在各自线程无锁更新；
+// 注册后可通过 queue_stats_dump_all() 统一输出 (main 中由 SIGUSR1 触发写 /tmp 文件)
+
+#define QUEUE_STATS_NAME_LEN   24
+#define QUEUE_STATS_MAX        32
+#define QUEUE_STATS_DUMP_FILE  "/tmp/queue_stats.txt"
+
+// HDR 风格的对数-线性直方图: 每个 2 的幂区间再均分 8 份，相对误差 <12.5%
+// 0..15us 精确计数，最大覆盖 2^31us (约 35 分钟)
+#define QS_HIST_SUB_BITS   3
+#define QS_HIST_LINEAR     16
+#define QS_HIST_BUCKETS    (QS_HIST_LINEAR + (31 - 4 + 1) * (1 << QS_HIST_SUB_BITS))
+
+typedef struct {
+    uint32_t buckets[QS_HIST_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+} QsHistogram;
+
+// 单一类型 (视频或音频) 的统计
+typedef struct {
+    uint32_t puts;              // 累计入队数
+    uint32_t gets;              // 累计出队数
+    uint32_t evicts;            // 累计丢弃数
+    int depth_hw;               // 包数高水位
+    QsHistogram residence_us;   // 入队到出队的驻留时间 (微秒)
+} QsTypeStats;
+
+typedef struct {
+    char name[QUEUE_STATS_NAME_LEN];
+    int registered;
+    int bytes_hw;               // 字节数高水位
+    QsTypeStats type[2];        // 0: 视频, 1: 音频 (与 PacketType 取值一致)
+
+    // 上次 dump 时的快照，用于计算速率
+    int64_t last_dump_us;
+    uint32_t last_puts[2];
+    uint32_t last_gets[2];
+} QueueStats;
+
+// 单调时钟 (微秒)，用作入队时间戳
+int64_t queue_stats_now_us(void);
+
+// 清零 (不影响注册状态)
+void queue_stats_reset(QueueStats *s);
+
+// 入队：depth_pkts 为入队后该类型的包数，depth_bytes 为入队后的总字节数
+void queue_stats_on_put(QueueStats *s, int type, int depth_pkts, int depth_bytes);
+
+// 出队：enq_us 为入队时间戳，depth_pkts 为出队前该消费者该类型的积压包数
+void queue_stats_on_get(QueueStats *s, int type, int64_t enq_us, int depth_pkts);
+
+// 丢弃 n 个包
+void queue_stats_on_evict(QueueStats *s, int type, int n);
+
+// 注册到全局表以便统一 dump，name 会被复制
+int queue_stats_register(QueueStats *s, const char *name);
+void queue_stats_unregister(QueueStats *s);
+
+// 输出单个队列 / 所有已注册队列
+void queue_stats_dump(QueueStats *s, FILE *fp);
+int queue_stats_dump_all(const char *path);
+
+#endif
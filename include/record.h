@@ -5,9 +5,13 @@
 #include <libavformat/avformat.h>
 
 #include "common.h"        // StationHandle definition
-#include "camera_manage.h" // CAM_MAX_CNT
+#include "camera_manage.h" // CamManage_GetChannelCnt
 #include "stream.h"        // RtspCtx
 #include "packet_queue.h"  // PacketQueue
+#include "record_io.h"     // RecordIo
+#include "record_store.h"  // RecordStore
+#include "record_retention.h" // RecordRetention
+#include "record_catalog.h"   // RecordCatalog
 
 #ifndef RECORD_SLICE_MIN
 #define RECORD_SLICE_MIN 1
@@ -29,15 +33,52 @@ typedef struct {
     int64_t bytes;
 } PreBuf;
 
+/* Recording session state (per RTSP session, owned by whichever thread records the channel) */
+typedef struct {
+    int began;                      // RTSP 流参数已缓存
+    AVFormatContext *oc;
+    AVStream *stream_in_audio;
+    int32_t video_idx;
+    int32_t audio_idx;
+    enum AVCodecID v_codec;
+    int file_opened;
+    int wait_audio_cnt;
+    uint8_t vps_cache[256]; int vps_sz;
+    uint8_t sps_cache[512]; int sps_sz;
+    uint8_t pps_cache[256]; int pps_sz;
+    int sps_w, sps_h;               // 包元数据中最近一次 SPS 的分辨率
+    uint8_t asc_cache[2]; int asc_sz;
+    PreBuf pb;
+    int64_t seg_start_ms;
+    int64_t gop_bytes;              // 当前 GOP 已交给 muxer 的字节 (frag_keyframe：下一个 I 帧时才写出)
+    int seg_no;
+    int cam_index;
+} RecordSession;
+
+/* Segment being written: handed to the I/O thread with the file, cataloged when it closes */
+typedef struct {
+    struct RecordHandle *Record;
+    int Ticket;                    // record_store 槽位句柄，-1 表示普通文件
+    RecordCatalogEntry Entry;
+    char Path[128];
+} RecordSegInfo;
+
 /* Recording channel context */
 typedef struct {
     struct RecordHandle *Record;   // Pointer to parent handle
     RtspCtx *Rtsp;                 // Pointer to source stream context
 
     pthread_t Thread;
-    int thread_created;
+    int thread_created;            // 录像已启动 (独立线程或共享录像线程)
+    int shared_attached;           // 由共享录像线程处理 (受 RecordHandle.Mutex 保护)
+    int shared_stop;               // 请求共享录像线程交还该通道
+    RecordSession Session;
+    RecordIoWriter Io;             // 写后缓冲，分段数据经 Record IO 线程落盘
 
     char FileName[128];
+    int StoreTicket;               // 当前分段所在的槽位句柄 (-1 表示普通文件)
+    RecordSegInfo *SegInfo;        // 当前分段的目录信息
+    uint16_t EventFlags;           // Record_MarkEvent 累积的事件，关闭分段时并入目录条目
 
     // Codec Params Cache
     AVCodecParameters *v_codecpar_cache;
@@ -70,7 +111,16 @@ typedef struct {
 typedef struct RecordHandle {
     StationHandle   *Station;
     pthread_mutex_t Mutex;
-    RecordCtx        Ctx[CAM_MAX_CNT];
+    RecordCtx       *Ctx;           // 与 Stream 模块相同的通道数
+    int32_t          ChannelCnt;
+    RecordIo         Io;            // 各路共用的 SD 卡写入线程
+    RecordStore      Store;         // 预分配槽位存储
+    RecordRetention  Retention;     // CAMn 下分段文件的循环删除
+    RecordCatalog    Catalog;       // 卡上的录像目录与按时间的索引
+    pthread_t        SharedThread;  // 共享录像模式下处理所有通道的线程
+    int              SharedStarted;
+    int              SharedAbort;
+    pthread_cond_t   SharedCond;    // 配合 Mutex：通道增删 / 空闲等待
     void            *Priv[0];
 } RecordHandle;
 
@@ -79,5 +129,17 @@ int32_t Record_Init(StationHandle *Station);
 void Record_Deinit(StationHandle *Station);
 int32_t Record_Start(StationHandle *Station, int32_t Index);
 int32_t Record_Stop(StationHandle *Station, int32_t Index);
+void Record_DumpIoStats(StationHandle *Station, FILE *fp);
+
+// 给 Index 路当前 (或下一个) 分段打上事件标志 RECORD_EVENT_*
+void Record_MarkEvent(StationHandle *Station, int32_t Index, uint16_t Flags);
+// 录像目录查询 (时间为墙钟 ms)：覆盖 TimeMs 的分段，找到返回 0
+int32_t Record_FindSegment(StationHandle *Station, int32_t Index, int64_t TimeMs, RecordCatalogEntry *Out);
+// 与 [FromMs, ToMs) 有交集的分段按起始时间升序写入 Out (最多 Max 个)，返回总数
+int32_t Record_ListSegments(StationHandle *Station, int32_t Index, int64_t FromMs, int64_t ToMs,
+                            RecordCatalogEntry *Out, int32_t Max);
+// 同上，时间段为本地时间的某一天
+int32_t Record_ListSegmentsOfDay(StationHandle *Station, int32_t Index, int32_t Year, int32_t Month, int32_t Day,
+                                 RecordCatalogEntry *Out, int32_t Max);
 
 #endif
@@ -0,0 +1,120 @@
+#ifndef __RECORD_CATALOG_H__
+#define __RECORD_CATALOG_H__
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "camera_manage.h"  // CAM_CHANNEL_LIMIT
+#include "record_store.h"   // RECORD_STORE_MAX_SLOTS
+
+// 录像目录 (catalog)
+// 每个分段关闭时向卡上的 catalog.bin 追加一条定长记录 (摄像头、起止墙钟时间、字节数、I 帧数、事件标志)，
+// 删除 (保留管理) 追加一条删除记录；槽位开始被新分段覆盖时追加一条作废记录。插卡后目录线程在锁外顺序回放
+// 一次文件，在内存中为每路建立按起始时间排序的数组和前缀最大结束时间，建好后再交换进来；压缩重写也在该线程，
+// 写入路径 (Record IO 线程) 只追加单条记录。"某路某天的录像" 与 "覆盖时刻 T 的分段" 都是二分查找，不再扫描目录。
+
+#define RECORD_CATALOG_FILE         "catalog.bin"
+#define RECORD_CATALOG_MAGIC        0x47544143          // "CATG"
+#define RECORD_CATALOG_NAME_MAX     48
+#define RECORD_CATALOG_COMPACT_MIN  4096                // 文件记录数超过活跃条目 2 倍且不少于此值时压缩重写
+#define RECORD_CATALOG_PENDING_MAX  64                  // 回放完成前最多暂存的增删记录
+
+enum {
+    RECORD_CATALOG_OP_ADD = 1,
+    RECORD_CATALOG_OP_DEL,
+    RECORD_CATALOG_OP_DROP,     // 槽位开始被覆盖，原条目作废
+};
+
+// 分段标志
+#define RECORD_EVENT_MOTION         0x0001
+#define RECORD_EVENT_HUMAN          0x0002
+#define RECORD_EVENT_VEHICLE        0x0004
+#define RECORD_EVENT_PET            0x0008
+#define RECORD_EVENT_RING           0x0010
+#define RECORD_SEG_PARTIAL          0x8000              // 写入出错，内容可能不完整
+
+typedef struct {
+    int16_t Cam;
+    uint16_t Flags;             // RECORD_EVENT_* / RECORD_SEG_*
+    uint32_t KeyFrames;
+    int64_t StartMs;            // 墙钟时间 (ms)
+    int64_t EndMs;
+    uint32_t Bytes;
+    int32_t Slot;               // 槽位号 (record_store)，-1 表示 CAMn 下的普通文件
+    char Name[RECORD_CATALOG_NAME_MAX]; // 相对卡根目录的路径
+} RecordCatalogEntry;
+
+// 卡上的记录 (96 字节)
+typedef struct {
+    uint32_t Magic;
+    uint8_t Op;                 // RECORD_CATALOG_OP_*
+    uint8_t Reserved;
+    int16_t Cam;
+    int64_t StartMs;
+    int64_t EndMs;
+    uint32_t Bytes;
+    uint32_t KeyFrames;
+    uint16_t Flags;
+    uint16_t Reserved2;
+    int32_t Slot;
+    uint32_t Reserved3;
+    char Name[RECORD_CATALOG_NAME_MAX];
+    uint32_t Check;             // 以上字段的 FNV-1a，断电截断的尾部记录据此丢弃
+} RecordCatalogRecord;
+
+// 单路的区间索引：Items 按 StartMs 升序，有效范围 [Begin, Count)
+// MaxEnd[i] 为 Items[..i] 的最大 EndMs (单调不减)，按时间段列出时二分找起点
+typedef struct {
+    RecordCatalogEntry *Items;
+    int64_t *MaxEnd;
+    int Begin;
+    int Count;
+    int Cap;
+} RecordCatalogCam;
+
+typedef struct {
+    int16_t Cam;                // -1 表示该槽位没有目录条目
+    int64_t StartMs;
+} RecordCatalogSlotRef;
+
+typedef struct {
+    StationHandle *Station;
+    char CardDir[64];
+    int Loaded;
+    int Fd;
+    uint32_t FileRecords;       // 文件中的记录数 (含已作废的)
+    uint32_t Live;              // 内存中的条目数
+    RecordCatalogCam Cam[CAM_CHANNEL_LIMIT];
+    RecordCatalogSlotRef *SlotRef; // RECORD_STORE_MAX_SLOTS 个
+    int CompactRequest;         // 由目录线程压缩
+    RecordCatalogRecord Pending[RECORD_CATALOG_PENDING_MAX]; // 卡已就绪、回放还没完成时到达的增删
+    int NbPending;
+    pthread_t Thread;           // 插拔检测、回放与压缩
+    int ThreadStarted;
+    volatile int AbortRequest;
+    int Inited;
+    pthread_mutex_t Mutex;
+} RecordCatalog;
+
+int record_catalog_init(RecordCatalog *cat, StationHandle *Station, const char *card_dir);
+void record_catalog_uninit(RecordCatalog *cat);
+
+// 登记一个已关闭的分段 (Name 取自 path 相对卡根目录的部分)，追加到 catalog.bin
+void record_catalog_add(RecordCatalog *cat, const RecordCatalogEntry *e, const char *path);
+// 分段文件已删除
+void record_catalog_remove(RecordCatalog *cat, int cam, const char *path);
+// 槽位开始被覆盖，原条目作废：追加一条 DROP 记录并等待落盘，
+// 覆盖途中掉电时回放不会把槽位里的新数据当成旧的时间段 (写入数据前调用)；
+// 目录还在回放时先暂存，交换进来后由目录线程补写并落盘
+void record_catalog_drop_slot(RecordCatalog *cat, int slot);
+
+// 查找 cam 路覆盖时刻 t_ms 的分段，找到返回 0
+int record_catalog_find(RecordCatalog *cat, int cam, int64_t t_ms, RecordCatalogEntry *out);
+// 列出 cam 路与 [from_ms, to_ms) 有交集的分段 (按起始时间升序)，最多写 max 个，返回总数
+int record_catalog_list(RecordCatalog *cat, int cam, int64_t from_ms, int64_t to_ms, RecordCatalogEntry *out, int max);
+
+void record_catalog_dump(RecordCatalog *cat, FILE *fp);
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef __RECORD_IO_H__
+#define __RECORD_IO_H__
+
+#include <libavformat/avio.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// 录像写后缓冲 (write-behind)
+// muxer 的输出经自定义 AVIOContext 追加到按页对齐的大块缓冲中，由所有通道共用的 I/O 线程
+// 按顺序整块写入 SD 卡 (支持时用 O_DIRECT)。文件的打开/关闭也在 I/O 线程中完成，
+// 录像线程只做内存拷贝，SD 卡 GC 造成的几百毫秒写停顿不会再堵住广播环读者。
+// 每路缓冲块数有上限：卡停顿过久导致缓冲用完时，当前分段后续数据丢弃并报错，
+// 录像线程关闭该分段，按 I/O 错误冷却后重开，内存不会无限增长。
+
+#define RECORD_IO_BLOCK_SIZE    (128 * 1024)    // 单次写入大小，需为 RECORD_IO_ALIGN 的整数倍
+#define RECORD_IO_MAX_BLOCKS    32              // 每路最多缓冲 4MB，约 2Mbps 码流 16 秒
+#define RECORD_IO_ALIGN         4096            // O_DIRECT 要求的缓冲/偏移对齐
+#define RECORD_IO_STALL_MS      100             // 单次写入超过该时间计为一次停顿
+#define RECORD_IO_PATH_MAX      128
+#define RECORD_IO_AVIO_BUF_SIZE (32 * 1024)     // muxer 侧 AVIOContext 缓冲
+
+enum {
+    RECORD_IO_OP_OPEN = 0,
+    RECORD_IO_OP_DATA,
+    RECORD_IO_OP_CLOSE,
+};
+
+enum {
+    RECORD_IO_EV_OPENED = 0,    // 文件已打开 (error 非 0 表示打开失败)
+    RECORD_IO_EV_CLOSED,        // 文件已关闭，length 为写入的有效字节数
+};
+
+// 文件事件回调，在 I/O 线程中调用 (I/O 线程未运行时在 writer_destroy 中调用)
+typedef void (*RecordIoEventCb)(void *opaque, int tag, int event, int64_t length, int error);
+
+// 写入目标的附加属性，普通文件传 NULL
+typedef struct {
+    int64_t prealloc;           // >0: 预分配好的定长文件，不截断、原地覆盖，关闭时用 'free' box 填满剩余空间
+    RecordIoEventCb cb;
+    void *opaque;
+    int tag;
+} RecordIoTarget;
+
+typedef struct RecordIoBlock {
+    int op;                     // RECORD_IO_OP_*
+    uint32_t gen;               // 所属文件的序号，I/O 失败只作用于该文件
+    uint8_t *data;              // RECORD_IO_BLOCK_SIZE 字节，RECORD_IO_ALIGN 对齐；OPEN/CLOSE 为 NULL
+    int len;
+    char path[RECORD_IO_PATH_MAX];
+    RecordIoTarget target;      // OPEN 时有效
+    struct RecordIoBlock *next;
+} RecordIoBlock;
+
+// 写入统计 (受 RecordIo.mutex 保护)
+typedef struct {
+    uint64_t bytes;             // 已写入 SD 卡的字节数
+    uint32_t files;
+    uint32_t writes;
+    uint32_t stalls;            // 超过 RECORD_IO_STALL_MS 的写入次数
+    int64_t stall_total_ms;
+    int64_t write_max_ms;
+    uint32_t overflows;         // 缓冲用完、丢弃分段剩余数据的次数
+    uint32_t errors;            // 打开/写入失败次数
+    int direct;                 // 当前文件是否用了 O_DIRECT
+    int peak_blocks;            // 最多同时排队的块数
+} RecordIoStats;
+
+typedef struct RecordIo RecordIo;
+typedef struct RecordIoWriter RecordIoWriter;
+
+// 每路录像一个 (嵌在 RecordCtx 中)
+struct RecordIoWriter {
+    RecordIo *io;
+    char name[16];
+
+    // 以下仅由录像线程访问
+    RecordIoBlock *cur;         // 正在填充的数据块
+    uint32_t gen;
+    int64_t file_bytes;         // 当前文件已交给写后缓冲的字节数
+
+    // 以下受 io->mutex 保护
+    RecordIoBlock *head;        // 待 I/O 线程处理的块
+    RecordIoBlock *tail;
+    RecordIoBlock *free_list;
+    int nb_blocks;              // 已分配的块数 (含空闲)
+    int queued;
+    uint32_t failed_gen;        // 写失败的文件序号 (0 表示无)
+    int scheduled;              // 已在就绪链表中或正被 I/O 线程处理
+    RecordIoStats stats;
+    RecordIoWriter *next;       // 就绪链表
+
+    // 以下仅由 I/O 线程访问
+    int fd;
+    int direct;                 // fd 以 O_DIRECT 打开
+    int io_error;               // 当前文件已写失败，丢弃其余数据直到下一个 OPEN
+    int64_t file_off;
+    RecordIoTarget target;      // 当前文件的目标属性
+    int target_pending;         // 已打开、尚未回调 CLOSED
+};
+
+struct RecordIo {
+    pthread_t thread;
+    int started;
+    int abort_request;
+    RecordIoWriter *ready_head;
+    RecordIoWriter *ready_tail;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;        // 有块待写 / 某路处理完毕
+};
+
+int record_io_init(RecordIo *io);
+// 需在所有 writer 销毁之后调用
+void record_io_uninit(RecordIo *io);
+
+void record_io_writer_init(RecordIoWriter *w, RecordIo *io, const char *name);
+// 等待该路排队的数据全部落盘、文件关闭后释放缓冲 (Record_Stop 中调用)
+void record_io_writer_destroy(RecordIoWriter *w);
+
+// 开始一个新文件，返回写入该文件的 AVIOContext (不可 seek)，失败返回 NULL
+// 文件实际在 I/O 线程中创建，创建失败通过 record_io_failed 报告
+// target 为 NULL 时按普通文件创建/截断
+AVIOContext *record_io_open(RecordIoWriter *w, const char *path, const RecordIoTarget *target);
+
+// 刷出 AVIOContext 中的数据并排队关闭文件，不等待落盘，*pb 置 NULL
+void record_io_close(RecordIoWriter *w, AVIOContext **pb);
+
+// 当前文件是否已写失败或缓冲溢出 (录像线程据此关闭分段)
+int record_io_failed(RecordIoWriter *w);
+
+// 当前文件已写出的字节数 (录像线程侧计数，含尚未落盘的部分)
+int64_t record_io_file_bytes(RecordIoWriter *w);
+
+void record_io_get_stats(RecordIoWriter *w, RecordIoStats *st);
+void record_io_dump(RecordIoWriter *w, FILE *fp);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef __RECORD_RETENTION_H__
+#define __RECORD_RETENTION_H__
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "camera_manage.h"  // CAM_CHANNEL_LIMIT
+#include "link_list.h"
+
+// 循环录像：CAMn 目录下逐个创建的分段文件的保留管理
+// 卡就绪后扫描一次 CAMn 目录建立各路按时间排序的分段链表，之后新分段关闭时追加到链表尾部，
+// 后台线程按可用空间水位从所有通道中最旧的分段开始删除，不再反复扫描目录。
+// 预分配槽位 (record_store.h) 自己环形覆盖，不归这里管；但槽位池还能扩大时 (FreeGoal)
+// 会把水位提到池的需要之上，旧固件录满的卡上 CAMn 下的旧分段逐步删掉，空间让给槽位池。
+
+#define RECORD_RETENTION_FREE_LOW   (128LL * 1024 * 1024)   // 可用空间低于此值开始删除
+#define RECORD_RETENTION_FREE_HIGH  (192LL * 1024 * 1024)   // 删到可用空间高于此值为止
+#define RECORD_RETENTION_POLL_MS    5000
+#define RECORD_RETENTION_NAME_MAX   64
+
+typedef struct {
+    ListNode Node;
+    int64_t Mtime;              // 排序用 (秒)
+    char Name[RECORD_RETENTION_NAME_MAX]; // CAMn 目录下的文件名
+} RecordSegNode;
+
+typedef struct {
+    LinkList List;              // 按时间从旧到新 (用 Mutex 保护，只调无锁接口)
+    int Count;
+} RecordSegList;
+
+typedef struct {
+    StationHandle *Station;
+    char BaseDir[64];
+    RecordSegList Cam[CAM_CHANNEL_LIMIT];
+    int Scanned;                // 本次插卡已扫描过目录
+    int WarnedEmpty;            // 已提示过卡满但无分段可删
+
+    uint32_t Deleted;           // 统计
+    uint64_t DeletedBytes;
+    uint32_t Passes;            // 触发删除的次数
+
+    // 回调 (保留线程中调用，用 record_retention_set_hooks 设置，受 Mutex 保护)
+    void (*OnDelete)(void *Opaque, int Cam, const char *Path);  // 分段文件已删除 (同步录像目录)
+    int64_t (*FreeGoal)(void *Opaque);  // 额外要求的可用空间 (槽位池扩建)，0 表示没有
+    void *Opaque;
+
+    pthread_t Thread;
+    int ThreadStarted;
+    int AbortRequest;
+    int Kick;                   // 立即检查一次 (写卡失败时)
+    pthread_mutex_t Mutex;
+    pthread_cond_t Cond;
+} RecordRetention;
+
+int record_retention_init(RecordRetention *rt, StationHandle *Station, const char *base_dir);
+void record_retention_uninit(RecordRetention *rt);
+
+// 分段文件关闭后登记 (path 为完整路径，只取文件名)，只操作内存
+void record_retention_add(RecordRetention *rt, int cam, const char *path);
+
+// 写卡失败 (可能是卡满) 时调用，后台线程立即检查水位
+void record_retention_kick(RecordRetention *rt);
+
+// 设置回调 (可为 NULL)
+void record_retention_set_hooks(RecordRetention *rt, void (*on_delete)(void *, int, const char *),
+                                int64_t (*free_goal)(void *), void *opaque);
+
+void record_retention_dump(RecordRetention *rt, FILE *fp);
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef __RECORD_STORE_H__
+#define __RECORD_STORE_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "common.h"
+
+// 录像槽位存储 (SD 卡)
+// 卡就绪后在 RECORD_STORE_DIR 下预分配一批固定大小的分段文件 (posix_fallocate)，
+// 录像按环形顺序覆盖最旧的槽位，不再每分钟新建/删除文件，FAT/exFAT 上不会随时间碎片化，
+// 卡满时也不需要扫描目录删除旧文件。槽位 → 摄像头/时间段的对应关系记在固定布局的索引文件中，
+// 每次更新只 pwrite 一个条目。
+// 槽位文件内有效数据之后是一个 'free' box 填满剩余空间，播放器把它当作普通 MP4 读取。
+
+#define RECORD_STORE_DIR            "REC"
+#define RECORD_STORE_INDEX          "index.bin"
+#define RECORD_STORE_SLOT_BYTES     (32 * 1024 * 1024)  // 一分钟分段在 4Mbps 下约 30MB
+#define RECORD_STORE_SLOT_MARGIN    (4 * 1024 * 1024)   // 写到 SLOT_BYTES - MARGIN 后在下一个 I 帧切段
+#define RECORD_STORE_SLOT_GUARD     (1 * 1024 * 1024)   // GOP 过长时剩余不足此值立即切段 (留给 moof/尾部/free box)
+#define RECORD_STORE_MAX_SLOTS      4096
+#define RECORD_STORE_MIN_SLOTS      8                   // 建好这么多槽位后才开始使用
+#define RECORD_STORE_RESERVE_BYTES  (256LL * 1024 * 1024) // 卡上留给升级包等其它文件的空间
+
+#define RECORD_STORE_MAGIC          0x4f545352          // "RSTO"
+#define RECORD_STORE_VERSION        1
+
+// 槽位句柄 = 挂载序号 << 16 | 槽号，换卡后旧句柄的回调不会写到新卡的索引里
+#define RECORD_STORE_TICKET(gen, slot)  ((int)((((uint32_t)(gen)) & 0x7fff) << 16) | (slot))
+#define RECORD_STORE_TICKET_GEN(t)      (((uint32_t)(t) >> 16) & 0x7fff)
+#define RECORD_STORE_TICKET_SLOT(t)     ((t) & 0xffff)
+
+enum {
+    RECORD_SLOT_FREE = 0,       // 建好后未写过
+    RECORD_SLOT_WRITING,        // 正在写 (掉电后挂载时改为 PARTIAL)
+    RECORD_SLOT_DONE,
+    RECORD_SLOT_PARTIAL,        // 写入中断或出错，Length 可能不准
+};
+
+// Busy[] 取值：槽位的运行时状态 (只在内存中)，非 0 的槽位 acquire 不会分配
+enum {
+    RECORD_BUSY_NONE = 0,
+    RECORD_BUSY_WRITING,        // 从 acquire 到文件关闭
+    RECORD_BUSY_OPEN_FAILED,    // 打开失败，关闭时恢复 acquire 之前的条目
+    RECORD_BUSY_MISSING,        // 打开失败且槽位文件已不在卡上，关闭后交给后台重建
+    RECORD_BUSY_REBUILD,        // 等待后台重新预分配槽位文件
+    RECORD_BUSY_RETIRED,        // 重建失败，本次挂载内不再使用
+};
+
+// 索引文件头，之后是 RECORD_STORE_MAX_SLOTS 个 RecordSlotEntry (创建时一次性占位)
+typedef struct {
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t EntrySize;
+    uint32_t SlotBytes;
+    uint32_t NbSlots;           // 已建好的槽位数
+    uint32_t Head;              // 下一个要写的槽位
+    uint32_t Seq;               // 最近分配的写入序号
+    uint32_t Reserved[2];
+} RecordStoreHeader;
+
+typedef struct {
+    uint32_t Seq;               // 写入序号，越大越新 (0 表示从未写过)
+    int16_t Cam;
+    uint8_t State;              // RECORD_SLOT_*
+    uint8_t Reserved;
+    int64_t StartMs;            // 墙钟时间 (ms)
+    int64_t EndMs;
+    uint32_t Length;            // 有效数据长度
+    uint32_t Reserved2;
+} RecordSlotEntry;
+
+typedef struct {
+    StationHandle *Station;
+    char Dir[64];
+    int Mounted;
+    int IndexFd;
+    int TargetSlots;            // 本卡要建的槽位数 (按可用空间计算，Mutex 保护)
+    uint32_t MountGen;          // 每次挂载加一，编进槽位句柄
+    RecordStoreHeader Hdr;
+    RecordSlotEntry *Slots;     // RECORD_STORE_MAX_SLOTS 个
+    uint8_t *Busy;              // RECORD_BUSY_*，不落盘
+
+    pthread_t Thread;           // 挂载/卸载检测与后台建槽位
+    int ThreadStarted;
+    volatile int AbortRequest;
+    pthread_mutex_t Mutex;      // 保护以上内存状态
+    pthread_mutex_t IoMutex;    // 串行化索引文件写入 (不与 Mutex 同时持有 SD 卡 I/O)
+} RecordStore;
+
+int record_store_init(RecordStore *st, StationHandle *Station, const char *card_dir);
+void record_store_uninit(RecordStore *st);
+
+// 取槽位：优先用还没写过的，池建满后环形覆盖最旧的；填写文件路径，返回槽位句柄
+// 未挂载、槽位不足，或池还在扩大而新槽位尚未建好时返回 -1 (调用者改写普通文件)
+// 句柄带挂载序号，换卡后旧句柄的后续调用被忽略
+int record_store_acquire(RecordStore *st, int cam, char *path, int path_size);
+
+// 分段结束时间 (录像线程在关闭分段时调用，只更新内存)
+void record_store_finish(RecordStore *st, int ticket, int64_t end_ms);
+
+// 槽位文件已打开 / 已关闭 (写后缓冲 I/O 线程回调，负责把条目写入索引)
+// 打开失败 (error 非 0) 时槽位条目在关闭时恢复为 acquire 之前的内容，不覆盖索引里旧分段的记录；
+// 槽位文件已被删掉的，关闭后由后台线程重新预分配
+void record_store_opened(RecordStore *st, int ticket, int error);
+void record_store_closed(RecordStore *st, int ticket, int64_t length, int error);
+
+// 读取槽位条目快照，返回 0 成功
+int record_store_get_entry(RecordStore *st, int slot, RecordSlotEntry *e);
+int record_store_slot_count(RecordStore *st);
+
+// 槽位池还能扩大时希望卡上保留的可用空间 (保留空间 + 一个槽位)，否则返回 0
+// 循环删除 (record_retention) 据此把 CAMn 下的旧分段逐步腾给槽位池
+int64_t record_store_free_goal(RecordStore *st);
+
+#endif
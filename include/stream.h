@@ -8,20 +8,93 @@
 #include "common.h"
 #include "camera_manage.h"
 #include "packet_queue.h"
+#include "packet_broadcast.h"
+#include "packet_pool.h"
+#include "audio_transcode.h"
+#include "rtsp_client.h"
+#include "ingest_reactor.h"
+
+#define RTSP_CACHE_STREAMS 4
+
+// 重连状态机
+typedef enum {
+    RTSP_STATE_CONNECTING = 0,  // avformat_open_input
+    RTSP_STATE_PROBING,         // avformat_find_stream_info (参数与上次不同或没有缓存)
+    RTSP_STATE_STREAMING,
+    RTSP_STATE_BACKOFF,         // 断线/失败后按退避时间等待
+} RtspState;
+
+// 断线重连统计 (仅 RTSP 线程写，诊断输出时直接读取)
+typedef struct {
+    RtspState state;
+    int attempts;               // 本次断线以来连续失败的次数，决定下一次退避时长
+    int last_backoff_ms;
+    int64_t down_since_ms;      // 本次断线开始时间 (单调时钟)，0 表示在线
+    int64_t last_gap_ms;        // 最近一次从断线到恢复出流的时长
+    int64_t max_gap_ms;
+    int64_t total_gap_ms;
+    uint32_t reconnects;        // 断线后恢复的次数
+    uint32_t fast_reconnects;   // 其中参数未变、跳过 find_stream_info 的次数
+    uint32_t failures;          // 打开/探测失败次数
+    uint32_t probes;            // 实际执行 find_stream_info 的次数 (缓存和摄像头通告的参数都不可用时)
+    unsigned int seed;          // 退避抖动的随机种子
+} RtspReconnect;
+
+// 上一次成功连接的流参数：重连后 SDP 给出的参数与签名一致时直接套用，跳过 find_stream_info 探测
+typedef struct {
+    int valid;
+    int nb_streams;
+    uint32_t sdp_sig[RTSP_CACHE_STREAMS];           // avformat_open_input 之后、探测之前的参数签名
+    AVCodecParameters *par[RTSP_CACHE_STREAMS];     // 探测完成后的参数 (音频转码改写之前)
+    AVRational frame_rate[RTSP_CACHE_STREAMS];
+} RtspParamCache;
+
+// 一次 RTSP 连接的接收状态 (线程模式和 reactor 模式共用，见 Stream_Ingest*)
+typedef struct {
+    int audio_path;             // 音频入队路径 (stream.c 中的 AudioPath)
+    AVPacket audio_hold;        // 已从转码输出取出、尚未到发布时间的音频包
+    int audio_held;
+    AVRational audio_tb;
+    int64_t audio_limit;        // 最近视频包的时间 (音频时间基)
+    AVRational video_tb;
+    int last_w;                 // 最近一次 SPS 的分辨率，用于标记分辨率变化
+    int last_h;
+    int64_t last_valid_pts;     // 重连后时间戳接续
+    int64_t pts_offset;
+    int is_first_connection;
+    int calc_offset_flag;
+    int fast_path;              // 本次连接套用了缓存参数，未做 find_stream_info
+    int64_t pkts;               // 本次连接收到的包数
+} IngestSession;
 
 typedef struct rtsp_ctx {
         StreamHandle *Stream;
         pthread_t Thread;
         int32_t running;
         int32_t TransProto;  //1: TCP, 0: UDP
-    PacketQueue RecordQueue;
-    PacketQueue P2pQueue;
+    uint32_t SessionGen;     // 每次连接成功 (Stream_IngestBegin) 加一，读者据此发现重连
+    PacketBroadcast Ingest;  // RTSP 线程只发布一次，录像/P2P 各自按游标读取
+    PacketBroadcastReader RecordReader;
+    PacketBroadcastReader P2pReader;
+    PacketPool Pool;         // 入队包负载的分级缓冲池
+    AudioTranscodeJob Audio; // 非 AAC 音频交给共享转码线程池，RTSP 线程只负责入队和按时间戳合并
+    RtspReconnect Reconnect; // 退避与断线时长统计
+    RtspParamCache ParamCache;
+    IngestSession Session;
+    // reactor 模式 (ENABLE_INGEST_REACTOR) 下由 ingest reactor 线程使用
+    int32_t InReactor;       // 已交给 reactor，没有独立的 RTSP 线程
+    int32_t ReactorAttached; // reactor 仍持有该通道 (受 reactor mutex 保护)
+    RtspClient Client;
+    uint32_t ReactorEvents;  // 当前在 epoll 中登记的事件
+    int64_t RetryAtMs;       // 下次重连时间，0 表示已连接或正在连接
+    int32_t RetryLinkDown;   // 退避开始时链路断开，链路恢复即提前重连
         char url[64];
     AVFormatContext *AvFmtCtx;
         int32_t AdIndex;
         int32_t VdIndex;
+    enum AVCodecID VdCodecId; // 视频编码 (H.264 / H.265)，每次连接成功后由 RTSP 线程按 codecpar 更新
     int CamIndex;
-        int32_t   thread_created;
+        int32_t   thread_created;  // 接收已启动 (独立线程或 reactor)
 
         // 【新增】暂停控制标志位
         // 0 = 正常运行, 1 = 暂停推流(但保持RTSP连接)
@@ -30,8 +103,13 @@ typedef struct rtsp_ctx {
 
 struct StreamHandle {
         StationHandle  *Station;
-        RtspCtx         Rtsp[CAM_MAX_CNT];
+        RtspCtx        *Rtsp;           // ChannelCnt 路，Stream_Init 时按 CamManage 的通道数分配
+        int32_t         ChannelCnt;
         pthread_mutex_t Mutex;
+        AudioTranscodePool AudioPool; // 各路共用的音频转码线程
+    IngestReactor Reactor;        // reactor 模式下所有摄像头共用的接收线程
+    StreamInfo *Announced;        // 摄像头经控制通道 (MSG_STREAM_INFO) 通告的流参数，受 Mutex 保护
+    int32_t *AnnouncedValid;
         void            *Priv[0];
 };
 
@@ -41,5 +119,25 @@ int32_t Stream_Start(StationHandle *Station, int32_t Index);
 int32_t Stream_Stop(StationHandle *Station, int32_t Index);
 int32_t Stream_RequestIFrame(StationHandle *Station, int32_t Index);
 int32_t Stream_SetPause(StationHandle *Station, int32_t Index, int32_t Pause);
+// 保存摄像头通告的流参数，下次连接时直接填入 codecpar，不再 find_stream_info
+void Stream_SetStreamInfo(StationHandle *Station, int32_t Index, const StreamInfo *Info);
+void Stream_DumpPoolStats(StationHandle *Station, FILE *fp);
+void Stream_DumpReconnectStats(StationHandle *Station, FILE *fp);
+
+// --- 接收路径 (stream.c 的 RTSP 线程与 ingest_reactor.c 共用，只在该通道的接收线程中调用) ---
+void Stream_IngestReset(RtspCtx *ctx);
+// ctx->AvFmtCtx 的流参数已确定：选择音视频流、打开音频转码，running 置 2。没有视频流返回 -1
+int Stream_IngestBegin(RtspCtx *ctx, int fast_path);
+// 处理一个收到的包 (时间戳接续、元数据、发布到广播环)，pkt 在返回前被 unref
+void Stream_IngestPacket(RtspCtx *ctx, AVPacket *pkt);
+// 连接结束，返回断流原因 (用于退避日志)
+const char *Stream_IngestEnd(RtspCtx *ctx);
+// 通道停止
+void Stream_IngestFinish(RtspCtx *ctx);
+// 用摄像头通告的参数补全 codecpar，成功返回 1
+int Stream_SeedParams(RtspCtx *ctx, AVFormatContext *fmt);
+void Stream_MarkDown(RtspCtx *ctx);
+int Stream_BackoffDelay(RtspCtx *ctx, const char *reason, int *link_down);
+int Stream_LinkDown(RtspCtx *ctx);
 
 #endif
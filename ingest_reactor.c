@@ -0,0 +1,430 @@
+#include "ingest_reactor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+
+#include "stream.h"
+#include "rtsp_client.h"
+#include "log.h"
+
+#define TAG "REACTOR"
+
+#define INGEST_CMD_ADD          1
+#define INGEST_CMD_REMOVE       2
+
+#define REACTOR_MAX_EVENTS      16
+#define REACTOR_TICK_MS         200     // 超时/keepalive/重连检查间隔
+#define REACTOR_TIMEOUT_MS      5000    // 握手或收流超时，与线程模式的 stimeout 一致
+
+static int64_t NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
+}
+
+// ==========================================
+// 客户端回调 (在 reactor 线程中执行)
+// ==========================================
+
+// PLAY 成功：按 SDP 建立流参数，之后与线程模式共用接收路径
+static int OnReady(void *opaque)
+{
+    RtspCtx *ctx = (RtspCtx *)opaque;
+    RtspClient *c = &ctx->Client;
+    AVFormatContext *fmt;
+    int i;
+
+    fmt = avformat_alloc_context();
+    if (!fmt) return -1;
+
+    for (i = 0; i < c->nb_tracks; i++) {
+        RtspTrack *t = &c->tracks[i];
+        AVStream *st = avformat_new_stream(fmt, NULL);
+        AVCodecParameters *par;
+
+        if (!st) {
+            avformat_free_context(fmt);
+            return -1;
+        }
+        par = st->codecpar;
+        st->time_base = (AVRational){ 1, t->clock_rate };
+        par->codec_type = t->type;
+        par->codec_id = t->codec_id;
+        if (t->type == AVMEDIA_TYPE_AUDIO) {
+            par->sample_rate = t->clock_rate;
+            par->channels = t->channels;
+            par->channel_layout = av_get_default_channel_layout(t->channels);
+        }
+        if (t->extradata_size > 0) {
+            par->extradata = av_mallocz(t->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (par->extradata) {
+                memcpy(par->extradata, t->extradata, t->extradata_size);
+                par->extradata_size = t->extradata_size;
+            }
+        }
+    }
+
+    // 分辨率/帧率由 SDP 参数集和摄像头通告补全，不需要探测
+    Stream_SeedParams(ctx, fmt);
+    ctx->AvFmtCtx = fmt;
+    return Stream_IngestBegin(ctx, 0);
+}
+
+static void OnFrame(void *opaque, int track, const uint8_t *data, int size, int64_t pts)
+{
+    RtspCtx *ctx = (RtspCtx *)opaque;
+    AVPacket pkt;
+
+    if (ctx->running != 2 || !ctx->AvFmtCtx) return;
+
+    av_init_packet(&pkt);
+    if (av_new_packet(&pkt, size) < 0) return;
+    memcpy(pkt.data, data, size);
+    pkt.stream_index = track;
+    pkt.pts = pkt.dts = pts;
+    if (ctx->AvFmtCtx->streams[track]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+        pkt.flags |= AV_PKT_FLAG_KEY;
+    Stream_IngestPacket(ctx, &pkt);
+}
+
+// ==========================================
+// 通道状态
+// ==========================================
+
+static void UpdateEvents(IngestReactor *r, RtspCtx *ctx)
+{
+    struct epoll_event ev;
+    uint32_t events = EPOLLIN | (rtsp_client_want_write(&ctx->Client) ? EPOLLOUT : 0);
+
+    if (events == ctx->ReactorEvents) return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = ctx;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_MOD, ctx->Client.fd, &ev) == 0) ctx->ReactorEvents = events;
+}
+
+static void ScheduleRetry(RtspCtx *ctx, const char *reason, int64_t now)
+{
+    int link_down = 0;
+    int delay = Stream_BackoffDelay(ctx, reason, &link_down);
+
+    ctx->RetryAtMs = now + (delay > 0 ? delay : 1);
+    ctx->RetryLinkDown = link_down;
+}
+
+// 连接结束 (断流、超时或握手失败)，释放连接并安排重连
+static void SessionEnd(IngestReactor *r, RtspCtx *ctx, const char *reason, int64_t now)
+{
+    int began = (ctx->VdIndex >= 0);   // Stream_IngestBegin 已成功
+    const char *why;
+
+    if (ctx->Client.fd >= 0) epoll_ctl(r->epfd, EPOLL_CTL_DEL, ctx->Client.fd, NULL);
+    rtsp_client_close(&ctx->Client);
+    ctx->ReactorEvents = 0;
+    // 先退出收流状态，录像等读者不再按 running == 2 访问流参数
+    if (ctx->running == 2) ctx->running = 1;
+
+    if (began) {
+        LOG_WARN(TAG, "[Ch%d] %s\n", ctx->CamIndex, reason);
+        why = Stream_IngestEnd(ctx);
+    } else {
+        audio_transcode_job_close(&ctx->Audio);
+        ctx->Reconnect.failures++;
+        if (!ctx->Session.is_first_connection) Stream_MarkDown(ctx);
+        why = reason;
+    }
+    if (ctx->AvFmtCtx) {
+        avformat_free_context(ctx->AvFmtCtx);
+        ctx->AvFmtCtx = NULL;
+    }
+    if (ctx->running) ScheduleRetry(ctx, why, now);
+}
+
+static void ChannelConnect(IngestReactor *r, RtspCtx *ctx, int64_t now)
+{
+    struct epoll_event ev;
+    int fd;
+
+    ctx->running = 1;
+    ctx->VdIndex = -1;
+    ctx->AdIndex = -1;
+    ctx->RetryAtMs = 0;
+    ctx->Reconnect.state = RTSP_STATE_CONNECTING;
+    audio_transcode_job_close(&ctx->Audio);
+
+    LOG_INFO(TAG, "[Ch%d] Connecting to %s...\n", ctx->CamIndex, ctx->url);
+    fd = rtsp_client_open(&ctx->Client, ctx->url, OnFrame, OnReady, ctx);
+    if (fd < 0) {
+        SessionEnd(r, ctx, "Open failed", now);
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (rtsp_client_want_write(&ctx->Client) ? EPOLLOUT : 0);
+    ev.data.ptr = ctx;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        SessionEnd(r, ctx, "epoll_ctl failed", now);
+        return;
+    }
+    ctx->ReactorEvents = ev.events;
+}
+
+static void ChannelAttach(IngestReactor *r, RtspCtx *ctx, int64_t now)
+{
+    if (r->nb_chans >= INGEST_REACTOR_MAX_CHANNELS) {
+        LOG_ERROR(TAG, "[Ch%d] Too many channels\n", ctx->CamIndex);
+        // 没接上也要清掉标志，否则 ingest_reactor_remove 会一直等下去
+        pthread_mutex_lock(&r->mutex);
+        ctx->ReactorAttached = 0;
+        r->nb_reserved--;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->mutex);
+        return;
+    }
+    r->chans[r->nb_chans++] = ctx;
+    ctx->Client.fd = -1;
+    Stream_IngestReset(ctx);
+    ctx->RetryAtMs = now;
+    ctx->RetryLinkDown = 0;
+}
+
+static void ChannelDetach(IngestReactor *r, RtspCtx *ctx)
+{
+    int i;
+
+    for (i = 0; i < r->nb_chans; i++) {
+        if (r->chans[i] != ctx) continue;
+        if (ctx->Client.fd >= 0) epoll_ctl(r->epfd, EPOLL_CTL_DEL, ctx->Client.fd, NULL);
+        rtsp_client_close(&ctx->Client);
+        if (ctx->VdIndex >= 0) Stream_IngestEnd(ctx);
+        if (ctx->AvFmtCtx) {
+            avformat_free_context(ctx->AvFmtCtx);
+            ctx->AvFmtCtx = NULL;
+        }
+        Stream_IngestFinish(ctx);
+        r->chans[i] = r->chans[--r->nb_chans];
+        break;
+    }
+    LOG_INFO(TAG, "[Ch%d] Detached\n", ctx->CamIndex);
+
+    pthread_mutex_lock(&r->mutex);
+    if (ctx->ReactorAttached) r->nb_reserved--;
+    ctx->ReactorAttached = 0;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+}
+
+static void DrainCommands(IngestReactor *r, int64_t now)
+{
+    IngestCmd cmds[INGEST_REACTOR_MAX_CHANNELS * 2];
+    uint64_t v;
+    int i, n;
+
+    if (read(r->evfd, &v, sizeof(v)) < 0 && errno != EAGAIN) {
+        LOG_WARN(TAG, "eventfd read failed: %d\n", errno);
+    }
+
+    pthread_mutex_lock(&r->mutex);
+    n = r->nb_cmds;
+    memcpy(cmds, r->cmds, n * sizeof(IngestCmd));
+    r->nb_cmds = 0;
+    pthread_mutex_unlock(&r->mutex);
+
+    for (i = 0; i < n; i++) {
+        if (cmds[i].op == INGEST_CMD_ADD) ChannelAttach(r, cmds[i].ctx, now);
+        else ChannelDetach(r, cmds[i].ctx);
+    }
+}
+
+// 重连、超时和 keepalive，返回距下一次需要处理的毫秒数
+static int RunTimers(IngestReactor *r, int64_t now)
+{
+    int i, next = REACTOR_TICK_MS;
+
+    for (i = 0; i < r->nb_chans; i++) {
+        RtspCtx *ctx = r->chans[i];
+
+        if (ctx->RetryAtMs) {
+            if (now >= ctx->RetryAtMs || (ctx->RetryLinkDown && !Stream_LinkDown(ctx))) {
+                ChannelConnect(r, ctx, now);
+            } else if (ctx->RetryAtMs - now < next) {
+                next = (int)(ctx->RetryAtMs - now);
+            }
+            continue;
+        }
+        if (rtsp_client_tick(&ctx->Client, now, REACTOR_TIMEOUT_MS) < 0) {
+            SessionEnd(r, ctx, "Timeout", now);
+            continue;
+        }
+        UpdateEvents(r, ctx);
+    }
+    return next;
+}
+
+static void *ReactorThread(void *arg)
+{
+    IngestReactor *r = (IngestReactor *)arg;
+    struct epoll_event evs[REACTOR_MAX_EVENTS];
+    int64_t now, next_tick;
+    int i, n, timeout;
+
+    prctl(PR_SET_NAME, "Ingest_Reactor");
+    now = NowMs();
+    next_tick = now;
+
+    while (!r->abort_request) {
+        now = NowMs();
+        timeout = REACTOR_TICK_MS;
+        if (now >= next_tick) {
+            timeout = RunTimers(r, now);
+            next_tick = now + timeout;
+        } else {
+            timeout = (int)(next_tick - now);
+        }
+
+        n = epoll_wait(r->epfd, evs, REACTOR_MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR(TAG, "epoll_wait failed: %d\n", errno);
+            break;
+        }
+
+        now = NowMs();
+        for (i = 0; i < n; i++) {
+            RtspCtx *ctx = (RtspCtx *)evs[i].data.ptr;
+            uint32_t e = evs[i].events;
+
+            if (!ctx) {
+                DrainCommands(r, now);
+                // 新加入的通道马上连接
+                next_tick = now;
+                continue;
+            }
+            // 同一批事件中该通道可能已被前面的命令移除或关闭
+            if (ctx->Client.fd < 0) continue;
+            if (rtsp_client_process(&ctx->Client, (e & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0,
+                                    (e & (EPOLLOUT | EPOLLERR)) != 0, now) < 0) {
+                SessionEnd(r, ctx, "EOF/Error", now);
+                next_tick = now;
+                continue;
+            }
+            UpdateEvents(r, ctx);
+        }
+    }
+
+    DrainCommands(r, NowMs());
+    while (r->nb_chans > 0) ChannelDetach(r, r->chans[0]);
+    LOG_INFO(TAG, "Thread Exit\n");
+    return NULL;
+}
+
+// ==========================================
+// 对外接口
+// ==========================================
+
+int ingest_reactor_init(IngestReactor *r)
+{
+    struct epoll_event ev;
+
+    memset(r, 0, sizeof(IngestReactor));
+    r->epfd = -1;
+    r->evfd = -1;
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_cond_init(&r->cond, NULL);
+
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    r->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->epfd < 0 || r->evfd < 0) goto fail;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->evfd, &ev) < 0) goto fail;
+
+    if (pthread_create(&r->thread, NULL, ReactorThread, r) != 0) goto fail;
+    r->started = 1;
+    return 0;
+
+fail:
+    LOG_ERROR(TAG, "Init failed: %d\n", errno);
+    if (r->epfd >= 0) close(r->epfd);
+    if (r->evfd >= 0) close(r->evfd);
+    r->epfd = r->evfd = -1;
+    return -1;
+}
+
+void ingest_reactor_uninit(IngestReactor *r)
+{
+    uint64_t one = 1;
+
+    if (r->started) {
+        r->abort_request = 1;
+        if (write(r->evfd, &one, sizeof(one)) < 0) {
+            LOG_WARN(TAG, "eventfd write failed: %d\n", errno);
+        }
+        pthread_join(r->thread, NULL);
+        r->started = 0;
+        close(r->epfd);
+        close(r->evfd);
+        r->epfd = r->evfd = -1;
+    }
+    pthread_mutex_destroy(&r->mutex);
+    pthread_cond_destroy(&r->cond);
+}
+
+static int PushCommand(IngestReactor *r, int op, RtspCtx *ctx)
+{
+    uint64_t one = 1;
+
+    if (r->nb_cmds >= INGEST_REACTOR_MAX_CHANNELS * 2) return -1;
+    r->cmds[r->nb_cmds].op = op;
+    r->cmds[r->nb_cmds].ctx = ctx;
+    r->nb_cmds++;
+    if (write(r->evfd, &one, sizeof(one)) < 0) {
+        LOG_WARN(TAG, "eventfd write failed: %d\n", errno);
+    }
+    return 0;
+}
+
+int ingest_reactor_add(IngestReactor *r, RtspCtx *ctx)
+{
+    int ret = -1;
+
+    if (!r->started || r->abort_request) return -1;
+
+    pthread_mutex_lock(&r->mutex);
+    // 满了直接返回失败，调用者改用独立线程
+    if (r->nb_reserved < INGEST_REACTOR_MAX_CHANNELS && PushCommand(r, INGEST_CMD_ADD, ctx) == 0) {
+        ctx->ReactorAttached = 1;
+        r->nb_reserved++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&r->mutex);
+    return ret;
+}
+
+void ingest_reactor_remove(IngestReactor *r, RtspCtx *ctx)
+{
+    pthread_mutex_lock(&r->mutex);
+    if (ctx->ReactorAttached && r->started) {
+        while (PushCommand(r, INGEST_CMD_REMOVE, ctx) < 0) {
+            // 命令队列满 (极少见)：等 reactor 取走后重试
+            pthread_mutex_unlock(&r->mutex);
+            usleep(10 * 1000);
+            pthread_mutex_lock(&r->mutex);
+        }
+        while (ctx->ReactorAttached) pthread_cond_wait(&r->cond, &r->mutex);
+    }
+    pthread_mutex_unlock(&r->mutex);
+}
@@ -17,6 +17,7 @@
 #include "record.h"
 #include "p2p.h"
 #include "device_manage.h"
+#include "queue_stats.h"
 
 #define TAG		"STATION"
 #define WTD_TIMEOUT		5
@@ -26,10 +27,12 @@
 #define POWER_STATE_RUNNING		2
 
 static StationHandle *StaHandle = NULL;
+static volatile sig_atomic_t DumpStatsReq = 0;
 
 /*************************************************
  Function:       SigHandler
- Description:    Signal handler for the main application. Handles SIGINT to trigger graceful exit.
+ Description:    Signal handler for the main application. Handles SIGINT to trigger graceful exit,
+                 SIGUSR1 to request a queue stats dump.
  Input:          SigNum - The signal number received.
  Output:         None
  Return:         None
@@ -42,6 +45,10 @@ static void SigHandler(int32_t SigNum)
 			StaHandle->PowerState = POWER_STATE_REBOOT;
 		}
     }
+	else if (SigNum == SIGUSR1) {
+		// Dump queue stats from StationLoop, not in signal context
+		DumpStatsReq = 1;
+	}
 }
 
 /*************************************************
@@ -166,6 +173,19 @@ int32_t StationLoop(StationHandle *Station)
 	struct timespec TimeSpec;
 
 	while(Station->PowerState == POWER_STATE_RUNNING) {
+		if (DumpStatsReq) {
+			FILE *Fp;
+
+			DumpStatsReq = 0;
+			queue_stats_dump_all(QUEUE_STATS_DUMP_FILE);
+			Fp = fopen(QUEUE_STATS_DUMP_FILE, "a");
+			if (Fp) {
+				Stream_DumpPoolStats(Station, Fp);
+				Stream_DumpReconnectStats(Station, Fp);
+				Record_DumpIoStats(Station, Fp);
+				fclose(Fp);
+			}
+		}
 			if (clock_gettime(CLOCK_REALTIME, &TimeSpec) == -1) {
 			LOG_ERROR(TAG, "clock_gettime error\n");
 			sleep(1);
@@ -210,6 +230,7 @@ int main(int argc, const char *argv[])
 
     signal(SIGINT, SigHandler);
     signal(SIGTERM, SigHandler);
+    signal(SIGUSR1, SigHandler);
 	system_call_init();
 	
 	Station = StationInit();
@@ -21,6 +21,14 @@
 
 #define MAX_CHANNELS    4
 #define MAX_URL_LEN     256
+#define WRITER_TICK_MS  500
+
+// 队列字节预算按物理内存推算：所有通道的 disk+net 队列合计不超过内存的 1/QUEUE_RAM_SHARE，
+// 且不超过 QUEUE_BUDGET_CEILING；合计值按通道数均分，每路再按 4:1 分给 disk/net
+// (录像要扛住 SD 卡抖动，转发积压了也只能丢)。例：64MB、4 路 -> 每路 disk 1.6MB / net 512KB
+#define QUEUE_RAM_SHARE       8
+#define QUEUE_BUDGET_CEILING  (32 * 1024 * 1024)
+#define QUEUE_BUDGET_MIN      (512 * 1024)      // 单个队列的下限，至少放得下几个大 I 帧
 
 #define MAIN_LOG_PREFIX "[MAIN] "
 
@@ -36,6 +44,27 @@ static void ffmpeg_log_callback(void *ptr, int level, const char *fmt, va_list v
     // fprintf(stderr, "\n"); // FFmpeg usually includes newline
 }
 
+// 按物理内存和通道数计算每路队列的字节预算
+static void queue_budget_bytes(int channels, int *disk_bytes, int *net_bytes)
+{
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    int64_t total = QUEUE_BUDGET_CEILING;
+    int64_t per_ch;
+
+    if (pages > 0 && page_size > 0) {
+        int64_t share = (int64_t)pages * page_size / QUEUE_RAM_SHARE;
+        if (share < total) total = share;
+    }
+    if (channels <= 0) channels = 1;
+    per_ch = total / channels;
+
+    *disk_bytes = (int)(per_ch * 4 / 5);
+    *net_bytes  = (int)(per_ch / 5);
+    if (*disk_bytes < QUEUE_BUDGET_MIN) *disk_bytes = QUEUE_BUDGET_MIN;
+    if (*net_bytes < QUEUE_BUDGET_MIN) *net_bytes = QUEUE_BUDGET_MIN;
+}
+
 typedef struct {
     int   id;
 
@@ -215,7 +244,8 @@ static void* disk_writer_thread(void* arg)
             continue;
         }
 
-        int r = packet_queue_get(&ch->queue_disk, &pkt, 1);
+        // 限时等待：writer_running 清零后最多 WRITER_TICK_MS 内退出，无需依赖 abort
+        int r = packet_queue_get_timeout(&ch->queue_disk, &pkt, WRITER_TICK_MS);
         if (r < 0) {
             printf("[Ch%d] Disk writer: queue aborted, exit loop.\n", ch->id);
             break;
@@ -283,10 +313,8 @@ static void* net_writer_thread(void* arg)
     pkt.size = 0;
 
     while (ch->writer_running) {
-        // 如果这里没有数据(因为被 paused 拦截了)，这个线程会阻塞在 get 上
-        // 或者如果 get 是非阻塞的，它会空转。
-        // 假设 packet_queue_get 是阻塞的 (block=1)
-        int ret = packet_queue_get(&ch->queue_net, &pkt, 1);
+        // 如果这里没有数据(因为被 paused 拦截了)，限时等待后重新检查 writer_running
+        int ret = packet_queue_get_timeout(&ch->queue_net, &pkt, WRITER_TICK_MS);
         if (ret < 0) break;
         else if (ret == 0) continue;
 
@@ -415,6 +443,11 @@ int main_app(int argc, char *argv[])
 
     printf(MAIN_LOG_PREFIX "argc=%d, channels=%d\n", argc, g_channel_count);
 
+    int disk_budget, net_budget;
+    queue_budget_bytes(g_channel_count, &disk_budget, &net_budget);
+    printf(MAIN_LOG_PREFIX "queue budget per channel: disk=%dKB net=%dKB\n",
+           disk_budget / 1024, net_budget / 1024);
+
     av_register_all();
     avformat_network_init();
 
@@ -451,9 +484,13 @@ int main_app(int argc, char *argv[])
 
         // [FIXED] Init queues with split memory pool sizes
         // queue_disk: Video=2048, Audio=1024 (Robust buffer)
-        packet_queue_init(&ch->queue_disk, 2048, 1024); 
+        // 紧凑节点模式：3000+ 个节点常驻，每节点约 64 字节，避免整包 AVPacket 占用内存
+        packet_queue_init_ex(&ch->queue_disk, 2048, 1024, PKT_QUEUE_MODE_COMPACT);
         // queue_net: Video=1024, Audio=256 (Faster buffer)
-        packet_queue_init(&ch->queue_net, 1024, 256);  
+        packet_queue_init_ex(&ch->queue_net, 1024, 256, PKT_QUEUE_MODE_COMPACT);
+        // 包数上限之外再加字节预算，防止大 I 帧把内存撑爆 (按内存与通道数分配，见 QUEUE_RAM_SHARE)
+        packet_queue_set_budget(&ch->queue_disk, disk_budget, 0, (AVRational){0, 1});
+        packet_queue_set_budget(&ch->queue_net, net_budget, 0, (AVRational){0, 1});
 
         ch->writer_running = 1;
         ch->has_seen_keyframe = 0; // Reset keyframe flag
@@ -0,0 +1,107 @@
+#include "nal_index.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#ifndef TAG
+#define TAG "NALIDX"
+#endif
+
+// 8 个字节中是否有 0x00 (与字节序无关)
+#define SWAR_HAS_ZERO(w) (((w) - 0x0101010101010101ULL) & ~(w) & 0x8080808080808080ULL)
+
+const uint8_t *nal_find_start_code(const uint8_t *p, const uint8_t *end)
+{
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one  = _mm_set1_epi8(1);
+
+    // 同时比较 p[i]==0、p[i+1]==0、p[i+2]==1，16 个位置一组
+    while (end - p >= 18) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + 2));
+        __m128i m = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)),
+                                  _mm_cmpeq_epi8(c, one));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one  = vdupq_n_u8(1);
+
+    while (end - p >= 18) {
+        uint8x16_t m = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(p), zero), vceqq_u8(vld1q_u8(p + 1), zero)),
+                                vceqq_u8(vld1q_u8(p + 2), one));
+        uint64x2_t m64 = vreinterpretq_u64_u8(m);
+        if (vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1)) {
+            // 命中的组很少，组内逐字节定位即可
+            while (!(p[0] == 0 && p[1] == 0 && p[2] == 1)) p++;
+            return p;
+        }
+        p += 16;
+    }
+#else
+    // SWAR：8 字节中没有 0x00 就不可能有起始码从这里开始，整组跳过
+    while (end - p >= 10) {
+        uint64_t w;
+        int k;
+
+        memcpy(&w, p, sizeof(w));
+        if (SWAR_HAS_ZERO(w)) {
+            for (k = 0; k < 8; k++) {
+                if (p[k] == 0 && p[k + 1] == 0 && p[k + 2] == 1) return p + k;
+            }
+        }
+        p += 8;
+    }
+#endif
+
+    for (; end - p >= 3; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) return p;
+    }
+    return end;
+}
+
+int nal_index_build(NalIndex *idx, const uint8_t *data, int size)
+{
+    const uint8_t *end, *sc;
+
+    idx->pkt_size = (size > 0) ? (uint32_t)size : 0;
+    idx->count = 0;
+    idx->flags = 0;
+    if (!data || size < 4) return 0;
+
+    end = data + size;
+    sc = nal_find_start_code(data, end);
+    while (sc < end) {
+        const uint8_t *nal = sc + 3;
+        const uint8_t *next = nal_find_start_code(nal, end);
+        const uint8_t *nal_end = next;
+        NalUnitInfo *u;
+
+        // 下一个起始码前的 0x00 属于 4 字节起始码，不计入本 NAL
+        if (next < end && next > nal && next[-1] == 0) nal_end = next - 1;
+
+        if (nal < nal_end) {
+            if (idx->count >= NAL_INDEX_MAX) {
+                idx->flags |= NAL_INDEX_TRUNCATED;
+                break;
+            }
+            u = &idx->nal[idx->count++];
+            u->offset   = (uint32_t)(nal - data);
+            u->size     = (uint32_t)(nal_end - nal);
+            u->sc_size  = (sc > data && sc[-1] == 0) ? 4 : 3;
+            u->header   = nal[0];
+            u->reserved = 0;
+        }
+        sc = next;
+    }
+    return idx->count;
+}
@@ -35,6 +35,8 @@
 #define MAX_SIZE_IOCTRL_BUF     512
 #define AUDIO_BUF_SIZE          512
 #define MAX_HEART_CHANNEL       2
+#define P2P_SEND_BATCH_MAX      16
+#define P2P_IDLE_TICK_MS        500
 #define RECORD_PATH             "/mnt/sdcard" 
 
 // 定义可能缺失的宏，防止原始注释代码报错
@@ -45,6 +47,11 @@
 #define LED_CAM_4 0
 #endif
 
+// 旧版 SDK 的 AVFRAMEINFO.h 没有 HEVC 编码标识
+#ifndef MEDIA_CODEC_VIDEO_HEVC
+#define MEDIA_CODEC_VIDEO_HEVC 0x50
+#endif
+
 static P2pHandle *gP2p = NULL;
 
 static void P2P_LoginCallback(uint32_t nLoginInfo)
@@ -241,7 +248,7 @@ static void P2P_HandleIOCtrlCmd(P2pHandle *P2p, int32_t SessionId, int32_t avInd
     ClientInfo *Client;
 
     Chn = *((int32_t *)Data);
-    if(Chn < 0 || Chn >= CAM_MAX_CNT) {
+    if(Chn < 0 || Chn >= P2p->ChannelCnt) {
         LOG_ERROR(TAG, "Invalid channel %d\n", Chn);
         return ;
     }
@@ -832,8 +839,9 @@ static int32_t P2P_SendVideoFrame(CameraStream  *CamStream, char *FrameData, in
     FRAMEINFO_t FrameInfo;
     P2pHandle *P2p = CamStream->P2p;
 
-    memset(&FrameInfo, 0, sizeof(FRAMEINFO_t));
-    FrameInfo.codec_id = MEDIA_CODEC_VIDEO_H264;
+    memset(&FrameInfo, 0, sizeof(FRAMEINFO_t));
+    // 编码标识随 RTSP 流的 codecpar 变化 (H.264 / H.265)
+    FrameInfo.codec_id = (CamStream->Ctx->VdCodecId == AV_CODEC_ID_HEVC) ? MEDIA_CODEC_VIDEO_HEVC : MEDIA_CODEC_VIDEO_H264;
     FrameInfo.reserve2 = FrameSeq;
     FrameInfo.onlineNum = P2p->OnlineNum;
     FrameInfo.timestamp = timestamp;
@@ -998,7 +1006,10 @@ static void* P2p_SendThread(void *Arg)
 {
     int32_t ret, Seq;
     int32_t HasKeyFrame;
+    uint32_t SessionGen, Gen;
     AVPacket pkt;
+    AVPacket batch[P2P_SEND_BATCH_MAX];
+    int32_t batch_n = 0, batch_i = 0;
     CameraStream  *CamStream = (CameraStream *)Arg;
     RtspCtx *ctx;
 
@@ -1012,37 +1023,50 @@ static void* P2p_SendThread(void *Arg)
 #endif
 
     prctl(PR_SET_NAME, "P2P_Send");
-    pthread_detach(pthread_self());
     
     // Bind context
     ctx = CamStream->Ctx;
+    if (!ctx) {
+        pthread_exit(NULL);
+    }
 
     Seq = 0;
     HasKeyFrame = 0;
+    SessionGen = __atomic_load_n(&ctx->SessionGen, __ATOMIC_ACQUIRE);
     av_init_packet(&pkt);
     pkt.data = NULL;
     pkt.size = 0;
     while (1) {
-        pthread_testcancel();
-        
-        // Wait for RTSP stream to be active
-        // Use Ctx directly as per new stream.c logic
-        if (!ctx || ctx->running != 2) {
-             HasKeyFrame = 0;
-             usleep(100000); 
-             continue;
-        }
-        
         // Get from P2P Queue (Small Buffer, Low Latency)
-        ret = packet_queue_get(&ctx->P2pQueue, &pkt, 1);
-        if (ret < 0) {
-            LOG_ERROR(TAG, "%s: queue aborted, exit loop.\n", ctx->url);
-            break;
-        }
-        else if (ret == 0) {
-            HasKeyFrame = 0;
-            continue;
+        // 积压时一次取走一批，减少每包的加锁/唤醒开销；
+        // 无数据时限时等待，超时后做周期性检查 (流断开期间不再轮询 running 状态)
+        if (batch_i >= batch_n) {
+            batch_i = 0;
+            batch_n = 0;
+            ret = packet_broadcast_get_batch(&ctx->P2pReader, batch, P2P_SEND_BATCH_MAX, 0);
+            if (ret == 0) {
+                ret = packet_broadcast_get_timeout(&ctx->P2pReader, &batch[0], P2P_IDLE_TICK_MS);
+            }
+            // RTSP 重连 (不论多快) 后新连接的非关键帧不能直接发给观看端，重新等关键帧
+            Gen = __atomic_load_n(&ctx->SessionGen, __ATOMIC_ACQUIRE);
+            if (Gen != SessionGen) {
+                SessionGen = Gen;
+                HasKeyFrame = 0;
+            }
+            if (ret < 0) {
+                LOG_ERROR(TAG, "%s: queue aborted, exit loop.\n", ctx->url);
+                break;
+            }
+            else if (ret == 0) {
+                // RTSP 重连期间重新等关键帧
+                if (ctx->running != 2) {
+                    HasKeyFrame = 0;
+                }
+                continue;
+            }
+            batch_n = ret;
         }
+        pkt = batch[batch_i++];
         
         // --- KEYFRAME WAIT LOGIC ---
         // If we haven't seen a keyframe yet, check this packet
@@ -1113,9 +1137,11 @@ static void *P2P_ListenThread(void *Args)
         }
         P2p->SessionId = SessionId;
 
-        for (int32_t i = 0; i < CAM_MAX_CNT; i++)
+        // 只为已绑定摄像头的通道启动 AV 服务线程
+        for (int32_t i = 0; i < P2p->ChannelCnt; i++)
         {
             pthread_t AVServerThid;
+            if (!CamManage_IsCamBound(P2p->Station, i)) continue;
             int32_t *Param = (int *)malloc(2*sizeof(int32_t));
 
             Param[0] = (int32_t)P2p;
@@ -1211,7 +1237,7 @@ static void *P2P_InitThread(void *Args)
     }
     
     P2p->MaxClientNum = CLIENT_MAX_CNT;
-    for(i = 0; i < CAM_MAX_CNT; i++) {
+    for(i = 0; i < P2p->ChannelCnt; i++) {
         ClientInfo *Client = P2p->CamStream[i].Client;
         
         memset(Client, 0, sizeof(P2p->CamStream[i].Client));
@@ -1320,6 +1346,14 @@ int32_t P2P_Init(StationHandle *Station)
         return -1;
     }
 
+    P2p->ChannelCnt = Station->Stream ? Station->Stream->ChannelCnt : CamManage_GetChannelCnt(Station);
+    P2p->CamStream = calloc(P2p->ChannelCnt > 0 ? P2p->ChannelCnt : 1, sizeof(CameraStream));
+    if (P2p->CamStream == NULL) {
+        LOG_ERROR(TAG, "calloc CameraStream failed\n");
+        free(P2p);
+        return -1;
+    }
+
     Station->P2p = P2p;
     P2p->Station = Station;
     Ret = pthread_create(&InitThd, NULL, P2P_InitThread, P2p);
@@ -1332,6 +1366,7 @@ int32_t P2P_Init(StationHandle *Station)
     return 0;
 
 P2P_Init_Error:
+    free(P2p->CamStream);
     free(P2p);
     Station->P2p = NULL;
     
@@ -1352,13 +1387,13 @@ void P2P_Deinit(StationHandle *Station)
             pthread_cancel(P2p->ListenThd);
         }
         P2p->IsExit =1;
-        for (i = 0; i < CAM_MAX_CNT; i++) {
+        for (i = 0; i < P2p->ChannelCnt; i++) {
             P2P_Stop(Station, i);
         }
         
         P2p->OnlineNum = 0;
 
-        for(i = 0; i < CAM_MAX_CNT; i++) {
+        for(i = 0; i < P2p->ChannelCnt; i++) {
             ClientInfo *Client = P2p->CamStream[i].Client;
             
             memset(Client, 0, sizeof(P2p->CamStream[i].Client));
@@ -1370,6 +1405,7 @@ void P2P_Deinit(StationHandle *Station)
         }
 
         usleep(500000);
+        free(P2p->CamStream);
         free(P2p);
         Station->P2p = NULL;
     }
@@ -1385,7 +1421,8 @@ int32_t P2P_Start(StationHandle *Station, int32_t Index)
     if (P2p == NULL) {
         LOG_ERROR(TAG, "P2p is not ready\n");
         return -1;
-    }
+    }
+    if (Index < 0 || Index >= P2p->ChannelCnt) return -1;
 
     P2p->CamStream[Index].P2p = P2p;
     // Bind the RTSP Context from the Stream module
@@ -1404,8 +1441,11 @@ int32_t P2P_Stop(StationHandle *Station, int32_t Index)
 {
     P2pHandle *P2p = Station->P2p;
     
-    if (P2p && P2p->CamStream[Index].SendThread) {
-        pthread_cancel(P2p->CamStream[Index].SendThread);
+    if (P2p && Index >= 0 && Index < P2p->ChannelCnt && P2p->CamStream[Index].SendThread) {
+        // 中止读者即可让发送线程从等待中返回并退出，无需 pthread_cancel
+        if (P2p->CamStream[Index].Ctx) {
+            packet_broadcast_reader_abort(&P2p->CamStream[Index].Ctx->P2pReader);
+        }
         pthread_join(P2p->CamStream[Index].SendThread, NULL); 
         P2p->CamStream[Index].SendThread = 0;
     }
@@ -0,0 +1,565 @@
+#include "packet_broadcast.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "log.h"
+#ifndef TAG
+#define TAG "BCAST"
+#endif
+
+#ifndef FUTEX_WAIT_PRIVATE
+#define FUTEX_WAIT_PRIVATE FUTEX_WAIT
+#define FUTEX_WAKE_PRIVATE FUTEX_WAKE
+#endif
+
+/* ========================================================================== */
+/* 内部辅助函数 */
+/* ========================================================================== */
+
+static uint32_t bc_round_pow2(uint32_t v)
+{
+    uint32_t n = 1;
+    while (n < v) n <<= 1;
+    return n;
+}
+
+static inline uint32_t bc_size(PacketBroadcast *bc)
+{
+    return bc->mask + 1;
+}
+
+static inline uint32_t bc_head(PacketBroadcast *bc)
+{
+    return __atomic_load_n(&bc->head, __ATOMIC_ACQUIRE);
+}
+
+// 最旧的有效序号：put 覆盖槽位和预算淘汰都会推进 tail
+static inline uint32_t bc_oldest(PacketBroadcast *bc)
+{
+    return __atomic_load_n(&bc->tail, __ATOMIC_RELAXED);
+}
+
+// 最旧的包离开环 (被覆盖或预算淘汰)，仅生产者调用
+static void bc_retire_oldest(PacketBroadcast *bc)
+{
+    BroadcastSlot *slot = &bc->slots[bc->tail & bc->mask];
+
+    bc->count[slot->type]--;
+    __atomic_store_n(&bc->tail, bc->tail + 1, __ATOMIC_RELAXED);
+}
+
+// 环中视频的时长 (毫秒)，未设置时间基时为 0 (仅生产者调用)
+static int bc_duration_ms(PacketBroadcast *bc)
+{
+    uint32_t oldest = bc_oldest(bc);
+    uint32_t p;
+    int64_t first = AV_NOPTS_VALUE, last = AV_NOPTS_VALUE;
+
+    if (bc->time_base.num <= 0 || bc->time_base.den <= 0) return 0;
+
+    for (p = oldest; p != bc->head; p++) {
+        BroadcastSlot *slot = &bc->slots[p & bc->mask];
+        if (slot->type == PKT_TYPE_VIDEO) {
+            first = slot->pts;
+            break;
+        }
+    }
+    for (p = bc->head; p != oldest; p--) {
+        BroadcastSlot *slot = &bc->slots[(p - 1) & bc->mask];
+        if (slot->type == PKT_TYPE_VIDEO) {
+            last = slot->pts;
+            break;
+        }
+    }
+    if (first == AV_NOPTS_VALUE || last == AV_NOPTS_VALUE || last <= first) return 0;
+    return (int)av_rescale_q(last - first, bc->time_base, (AVRational){1, 1000});
+}
+
+// 释放一份读者份额，最后一份负责释放包并把槽位交还生产者
+// pending 为 1 时只剩自己一份，其余持有者都已释放，不会再有人改它
+static void slot_release(PacketBroadcast *bc, BroadcastSlot *slot)
+{
+    int p = __atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        if (p <= 0) return;
+        if (p == 1) {
+            __atomic_sub_fetch(&bc->size_bytes, slot->size, __ATOMIC_RELAXED);
+            av_packet_unref(&slot->pkt);
+            __atomic_store_n(&slot->pending, 0, __ATOMIC_RELEASE);
+            return;
+        }
+        if (__atomic_compare_exchange_n(&slot->pending, &p, p - 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+    }
+}
+
+// 把读者游标推进到 to，认领并释放途经的份额
+// count_drop=1 时按类型计入丢包统计 (追赶/预算淘汰)，0 时不计 (flush/detach/pause)
+// 游标已被别人推过 to 时什么也不做
+static void reader_skip(PacketBroadcastReader *r, uint32_t to, int count_drop)
+{
+    PacketBroadcast *bc = r->bc;
+    uint32_t c = __atomic_load_n(&r->cursor, __ATOMIC_ACQUIRE);
+    uint32_t p;
+
+    while ((int32_t)(to - c) > 0) {
+        if (!__atomic_compare_exchange_n(&r->cursor, &c, to, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        for (p = c; p != to; p++) {
+            BroadcastSlot *slot = &bc->slots[p & bc->mask];
+            if (count_drop) {
+                __atomic_add_fetch((slot->type == PKT_TYPE_VIDEO) ? &r->dropped_video : &r->dropped_audio,
+                                   1, __ATOMIC_RELAXED);
+                queue_stats_on_evict(&r->stats, slot->type, 1);
+            }
+            slot_release(bc, slot);
+        }
+        return;
+    }
+}
+
+// 读者落后超过 max_lag 或读位置已被预算淘汰时，按策略计算跳到哪里 (仅生产者调用)
+static uint32_t reader_catchup_target(PacketBroadcastReader *r)
+{
+    PacketBroadcast *bc = r->bc;
+    uint32_t target = bc->head - (uint32_t)r->max_lag;
+    uint32_t oldest = bc_oldest(bc);
+    uint32_t p;
+
+    if ((int32_t)(oldest - target) > 0) target = oldest;
+
+    if (r->policy == PKT_EVICT_OLDEST) return target;
+
+    // GOP: 跳到 target 之后的第一个关键帧，保证读者拿到的都是完整 GOP
+    for (p = target; p != bc->head; p++) {
+        BroadcastSlot *slot = &bc->slots[p & bc->mask];
+        if (slot->type == PKT_TYPE_VIDEO && slot->key) {
+            return p;
+        }
+    }
+    return target;
+}
+
+// 生产者发布后检查读者：暂停的直接推到写位置，落后的按策略追赶
+// max_lag 不超过环容量 - 1，所以下一次 put 要覆盖的槽位一定已被所有读者认领过
+static void reader_catchup(PacketBroadcastReader *r)
+{
+    PacketBroadcast *bc = r->bc;
+    uint32_t c = __atomic_load_n(&r->cursor, __ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&r->paused, __ATOMIC_ACQUIRE)) {
+        reader_skip(r, bc->head, 0);
+        return;
+    }
+    if (bc->head - c > (uint32_t)r->max_lag || (int32_t)(bc_oldest(bc) - c) > 0) {
+        reader_skip(r, reader_catchup_target(r), 1);
+    }
+}
+
+// 超出字节/时长预算时推进最旧位置，仍停在更早位置的读者按策略跳过，至少保留刚发布的包
+static void bc_evict_budget(PacketBroadcast *bc)
+{
+    int i;
+
+    for (;;) {
+        uint32_t oldest = bc_oldest(bc);
+        BroadcastSlot *slot;
+
+        if ((int32_t)(bc->head - 1 - oldest) <= 0) break;
+        if (!((bc->max_bytes > 0 && __atomic_load_n(&bc->size_bytes, __ATOMIC_RELAXED) > bc->max_bytes) ||
+              (bc->max_duration_ms > 0 && bc_duration_ms(bc) > bc->max_duration_ms))) {
+            break;
+        }
+
+        slot = &bc->slots[oldest & bc->mask];
+        if (__atomic_load_n(&slot->pending, __ATOMIC_RELAXED) > 0) {
+            queue_stats_on_evict(&bc->stats, slot->type, 1);
+        }
+        bc_retire_oldest(bc);
+        for (i = 0; i < bc->nb_readers; i++) {
+            reader_catchup(bc->readers[i]);
+        }
+    }
+}
+
+static inline int reader_stopped(PacketBroadcastReader *r)
+{
+    return __atomic_load_n(&r->bc->abort_request, __ATOMIC_SEQ_CST) ||
+           __atomic_load_n(&r->abort_request, __ATOMIC_SEQ_CST);
+}
+
+// 读者当前可读的包数
+static inline uint32_t reader_avail(PacketBroadcastReader *r)
+{
+    if (__atomic_load_n(&r->paused, __ATOMIC_ACQUIRE)) return 0;
+    return __atomic_load_n(&r->bc->head, __ATOMIC_SEQ_CST) -
+           __atomic_load_n(&r->cursor, __ATOMIC_ACQUIRE);
+}
+
+// 读出一个包，没有可读的包返回 0
+static int reader_pop(PacketBroadcastReader *r, AVPacket *pkt)
+{
+    PacketBroadcast *bc = r->bc;
+
+    if (__atomic_load_n(&r->paused, __ATOMIC_ACQUIRE)) return 0;
+
+    for (;;) {
+        uint32_t c = __atomic_load_n(&r->cursor, __ATOMIC_ACQUIRE);
+        uint32_t head = bc_head(bc);
+        BroadcastSlot *slot;
+
+        if ((int32_t)(head - c) <= 0) return 0;
+
+        // 先认领再读：认领失败说明生产者/flush 已把游标推走，重新取
+        if (!__atomic_compare_exchange_n(&r->cursor, &c, c + 1, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        slot = &bc->slots[c & bc->mask];
+        queue_stats_on_get(&r->stats, slot->type, slot->enq_us,
+                           (int)(__atomic_load_n(&bc->type_puts[slot->type], __ATOMIC_RELAXED) - slot->type_seq));
+        if (__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE) == 1) {
+            // 最后一个读者，直接拿走
+            *pkt = slot->pkt;
+            av_init_packet(&slot->pkt);
+            slot->pkt.data = NULL;
+            slot->pkt.size = 0;
+            __atomic_sub_fetch(&bc->size_bytes, slot->size, __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->pending, 0, __ATOMIC_RELEASE);
+            return 1;
+        }
+        if (av_packet_ref(pkt, &slot->pkt) == 0) {
+            slot_release(bc, slot);
+            return 1;
+        }
+        // 引用失败 (OOM)，跳过该包
+        __atomic_add_fetch((slot->type == PKT_TYPE_VIDEO) ? &r->dropped_video : &r->dropped_audio,
+                           1, __ATOMIC_RELAXED);
+        queue_stats_on_evict(&r->stats, slot->type, 1);
+        slot_release(bc, slot);
+    }
+}
+
+static void bc_wake(PacketBroadcast *bc)
+{
+    __atomic_add_fetch(&bc->wake_seq, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &bc->wake_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// 休眠到有新包、中止或 deadline_us (单调时钟，<0 不限时)
+// seen 为休眠前看到的可读包数：先记录等待字再声明休眠，再复查一次，避免丢失唤醒
+static void reader_park(PacketBroadcastReader *r, uint32_t seen, int64_t deadline_us)
+{
+    PacketBroadcast *bc = r->bc;
+    struct timespec rel, *prel = NULL;
+    uint32_t seq;
+
+    if (deadline_us >= 0) {
+        int64_t left = deadline_us - queue_stats_now_us();
+        if (left <= 0) return;
+        rel.tv_sec  = left / 1000000;
+        rel.tv_nsec = (long)(left % 1000000) * 1000L;
+        prel = &rel;
+    }
+
+    seq = __atomic_load_n(&bc->wake_seq, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&bc->nb_parked, 1, __ATOMIC_SEQ_CST);
+    if (!reader_stopped(r) && reader_avail(r) == seen) {
+        syscall(SYS_futex, &bc->wake_seq, FUTEX_WAIT_PRIVATE, seq, prel, NULL, 0);
+    }
+    __atomic_sub_fetch(&bc->nb_parked, 1, __ATOMIC_RELAXED);
+}
+
+/* ========================================================================== */
+/* API 实现 */
+/* ========================================================================== */
+
+int packet_broadcast_init(PacketBroadcast *bc, int capacity)
+{
+    uint32_t i, n;
+
+    if (!bc || capacity <= 0) return -1;
+    memset(bc, 0, sizeof(PacketBroadcast));
+
+    // 至少 2 个槽位，max_lag 才能取到 1
+    n = bc_round_pow2((uint32_t)(capacity < 2 ? 2 : capacity));
+    bc->slots = (BroadcastSlot *)calloc(n, sizeof(BroadcastSlot));
+    if (!bc->slots) {
+        LOG_ERROR(TAG, "Failed to alloc broadcast ring (%u)\n", n);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        av_init_packet(&bc->slots[i].pkt);
+        bc->slots[i].pkt.data = NULL;
+        bc->slots[i].pkt.size = 0;
+    }
+    bc->mask = n - 1;
+    queue_stats_reset(&bc->stats);
+
+    LOG_INFO(TAG, "Broadcast Init: %u slots\n", n);
+    return 0;
+}
+
+void packet_broadcast_destroy(PacketBroadcast *bc)
+{
+    uint32_t i;
+
+    if (!bc || !bc->slots) return;
+
+    queue_stats_unregister(&bc->stats);
+    for (i = 0; i <= bc->mask; i++) {
+        av_packet_unref(&bc->slots[i].pkt);
+    }
+    free(bc->slots);
+    bc->slots = NULL;
+}
+
+void packet_broadcast_abort(PacketBroadcast *bc)
+{
+    if (!bc) return;
+    __atomic_store_n(&bc->abort_request, 1, __ATOMIC_SEQ_CST);
+    bc_wake(bc);
+}
+
+int packet_broadcast_put(PacketBroadcast *bc, AVPacket *pkt, PacketType type)
+{
+    BroadcastSlot *slot;
+    AVPacket ref;
+    int i;
+
+    if (!bc || !bc->slots || !pkt) return -1;
+    if (__atomic_load_n(&bc->abort_request, __ATOMIC_ACQUIRE)) return -1;
+
+    if (av_packet_ref(&ref, pkt) < 0) return -1;
+
+    // 上一轮追赶后所有读者都已越过这个槽位，剩下的只可能是认领后还在拷贝的读者，很快会释放
+    slot = &bc->slots[bc->head & bc->mask];
+    if (bc->tail == bc->head - bc_size(bc)) bc_retire_oldest(bc);
+    while (__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+
+    slot->type = type;
+    slot->key = (pkt->flags & AV_PKT_FLAG_KEY) ? 1 : 0;
+    slot->size = ref.size;
+    slot->pts = ref.pts;
+    slot->enq_us = queue_stats_now_us();
+    slot->type_seq = bc->type_puts[type];
+    bc->count[type]++;
+    __atomic_store_n(&bc->type_puts[type], bc->type_puts[type] + 1, __ATOMIC_RELAXED);
+    if (bc->nb_readers > 0) {
+        slot->pkt = ref; // Move data
+        __atomic_add_fetch(&bc->size_bytes, ref.size, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->pending, bc->nb_readers, __ATOMIC_RELAXED);
+    } else {
+        av_packet_unref(&ref);
+    }
+    __atomic_store_n(&bc->head, bc->head + 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < bc->nb_readers; i++) {
+        reader_catchup(bc->readers[i]);
+    }
+    if (bc->max_bytes > 0 || bc->max_duration_ms > 0) {
+        bc_evict_budget(bc);
+    }
+    __atomic_store_n(&bc->duration_ms, bc_duration_ms(bc), __ATOMIC_RELAXED);
+    queue_stats_on_put(&bc->stats, type, bc->count[type],
+                       __atomic_load_n(&bc->size_bytes, __ATOMIC_RELAXED));
+
+    // 只有读者真正休眠时才进内核唤醒
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&bc->nb_parked, __ATOMIC_RELAXED) > 0) {
+        bc_wake(bc);
+    }
+    return 0;
+}
+
+int packet_broadcast_set_budget(PacketBroadcast *bc, int max_bytes, int max_duration_ms, AVRational time_base)
+{
+    if (!bc) return -1;
+
+    bc->max_bytes = (max_bytes > 0) ? max_bytes : 0;
+    bc->max_duration_ms = (max_duration_ms > 0) ? max_duration_ms : 0;
+    bc->time_base = time_base;
+    return 0;
+}
+
+int packet_broadcast_set_name(PacketBroadcast *bc, const char *name)
+{
+    if (!bc) return -1;
+    return queue_stats_register(&bc->stats, name);
+}
+
+int packet_broadcast_attach(PacketBroadcast *bc, PacketBroadcastReader *r, int max_lag, PacketEvictPolicy policy)
+{
+    int lag_limit;
+
+    if (!bc || !r || !bc->slots) return -1;
+    if (bc->nb_readers >= PACKET_BROADCAST_MAX_READERS) {
+        LOG_ERROR(TAG, "Too many broadcast readers (%d)\n", bc->nb_readers);
+        return -1;
+    }
+
+    memset(r, 0, sizeof(PacketBroadcastReader));
+    lag_limit = (int)bc_size(bc) - 1;
+    r->bc = bc;
+    r->max_lag = (max_lag <= 0 || max_lag > lag_limit) ? lag_limit : max_lag;
+    r->policy = (policy == PKT_EVICT_OLDEST) ? PKT_EVICT_OLDEST : PKT_EVICT_GOP;
+    r->cursor = bc->head;
+    r->attached = 1;
+    queue_stats_reset(&r->stats);
+
+    bc->readers[bc->nb_readers++] = r;
+    return 0;
+}
+
+int packet_broadcast_reader_set_name(PacketBroadcastReader *r, const char *name)
+{
+    if (!r || !r->attached) return -1;
+    return queue_stats_register(&r->stats, name);
+}
+
+void packet_broadcast_detach(PacketBroadcastReader *r)
+{
+    PacketBroadcast *bc;
+    int i;
+
+    if (!r || !r->attached) return;
+    bc = r->bc;
+
+    queue_stats_unregister(&r->stats);
+
+    reader_skip(r, bc->head, 0);
+    for (i = 0; i < bc->nb_readers; i++) {
+        if (bc->readers[i] == r) {
+            bc->readers[i] = bc->readers[--bc->nb_readers];
+            bc->readers[bc->nb_readers] = NULL;
+            break;
+        }
+    }
+    r->attached = 0;
+}
+
+int packet_broadcast_get(PacketBroadcastReader *r, AVPacket *pkt, int block)
+{
+    if (!r || !r->attached || !pkt) return -1;
+
+    for (;;) {
+        if (reader_stopped(r)) return -1;
+        if (reader_pop(r, pkt)) return 1;
+        if (!block) return 0;
+        reader_park(r, 0, -1);
+    }
+}
+
+int packet_broadcast_get_timeout(PacketBroadcastReader *r, AVPacket *pkt, int timeout_ms)
+{
+    int64_t deadline_us;
+
+    if (timeout_ms <= 0) return packet_broadcast_get(r, pkt, timeout_ms < 0);
+    if (!r || !r->attached || !pkt) return -1;
+
+    deadline_us = queue_stats_now_us() + (int64_t)timeout_ms * 1000;
+
+    for (;;) {
+        if (reader_stopped(r)) return -1;
+        if (reader_pop(r, pkt)) return 1;
+        if (queue_stats_now_us() >= deadline_us) return 0;
+        reader_park(r, 0, deadline_us);
+    }
+}
+
+int packet_broadcast_get_batch(PacketBroadcastReader *r, AVPacket *pkts, int max, int timeout_ms)
+{
+    int64_t deadline_us = -1;
+    int n = 0;
+
+    if (!r || !r->attached || !pkts || max <= 0) return -1;
+
+    if (timeout_ms > 0) deadline_us = queue_stats_now_us() + (int64_t)timeout_ms * 1000;
+
+    for (;;) {
+        uint32_t avail;
+
+        if (reader_stopped(r)) return -1;
+
+        avail = reader_avail(r);
+        if (avail >= (uint32_t)max || timeout_ms == 0 || (avail > 0 && timeout_ms < 0)) break;
+        if (deadline_us >= 0 && queue_stats_now_us() >= deadline_us) break;
+
+        reader_park(r, avail, deadline_us);
+    }
+
+    while (n < max && reader_pop(r, &pkts[n])) n++;
+    return n;
+}
+
+void packet_broadcast_pause(PacketBroadcastReader *r, int pause)
+{
+    if (!r || !r->attached) return;
+
+    if (pause) {
+        // 先置标志：之后发布的包由生产者替读者释放，这里只释放已有的积压
+        __atomic_store_n(&r->paused, 1, __ATOMIC_RELEASE);
+        reader_skip(r, bc_head(r->bc), 0);
+    } else if (__atomic_load_n(&r->paused, __ATOMIC_ACQUIRE)) {
+        reader_skip(r, bc_head(r->bc), 0);
+        __atomic_store_n(&r->paused, 0, __ATOMIC_RELEASE);
+        bc_wake(r->bc);
+    }
+}
+
+void packet_broadcast_flush(PacketBroadcastReader *r)
+{
+    if (!r || !r->attached) return;
+    reader_skip(r, bc_head(r->bc), 0);
+}
+
+void packet_broadcast_reader_abort(PacketBroadcastReader *r)
+{
+    if (!r || !r->bc) return;
+    __atomic_store_n(&r->abort_request, 1, __ATOMIC_SEQ_CST);
+    bc_wake(r->bc);
+}
+
+int packet_broadcast_reader_aborted(PacketBroadcastReader *r)
+{
+    if (!r || !r->bc) return 1;
+    return reader_stopped(r);
+}
+
+void packet_broadcast_get_depth(PacketBroadcast *bc, int *size_bytes, int *nb_packets, int *duration_ms)
+{
+    if (!bc || !bc->slots) return;
+
+    if (size_bytes)  *size_bytes  = __atomic_load_n(&bc->size_bytes, __ATOMIC_RELAXED);
+    if (nb_packets)  *nb_packets  = (int)(bc_head(bc) - bc_oldest(bc));
+    if (duration_ms) *duration_ms = __atomic_load_n(&bc->duration_ms, __ATOMIC_RELAXED);
+}
+
+void packet_broadcast_get_stats(PacketBroadcastReader *r, int *nb_packets, uint32_t *dropped_video, uint32_t *dropped_audio)
+{
+    uint32_t lag = 0;
+
+    if (!r || !r->bc) return;
+
+    if (r->attached) lag = reader_avail(r);
+    if (nb_packets) *nb_packets = (int)lag;
+    if (dropped_video) *dropped_video = __atomic_load_n(&r->dropped_video, __ATOMIC_RELAXED);
+    if (dropped_audio) *dropped_audio = __atomic_load_n(&r->dropped_audio, __ATOMIC_RELAXED);
+}
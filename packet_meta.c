@@ -0,0 +1,443 @@
+#include "packet_meta.h"
+#include <string.h>
+#include <stddef.h>
+
+#include "bit_reader.h"
+#include "log.h"
+#ifndef TAG
+#define TAG "PKTMETA"
+#endif
+
+#define NAL_TYPE_SLICE      1
+#define NAL_TYPE_SLICE_IDR  5
+#define NAL_TYPE_SPS        7
+#define NAL_TYPE_PPS        8
+
+#define SLICE_TYPE_I        2
+#define SLICE_TYPE_SI       4
+
+// H.265 nal_unit_type
+#define HEVC_NAL_RSV_VCL_N14   14   // 0..14 中的偶数为子层非参考图像
+#define HEVC_NAL_BLA_W_LP      16   // 16..23 为 IRAP
+#define HEVC_NAL_IDR_W_RADL    19
+#define HEVC_NAL_IDR_N_LP      20
+#define HEVC_NAL_RSV_IRAP_23   23
+#define HEVC_NAL_VCL_MAX       31
+#define HEVC_NAL_VPS           32
+#define HEVC_NAL_SPS           33
+#define HEVC_NAL_PPS           34
+
+// 与原先 H264SpsGetWh 一致的分辨率合理范围
+#define META_MAX_WIDTH      4096
+#define META_MAX_HEIGHT     2160
+
+// slice 头前两个字段: first_mb_in_slice, slice_type
+static int H264SliceType(const uint8_t *nal, int nal_len)
+{
+    BitReader br;
+
+    if (nal_len < 2) return -1;
+    bit_reader_init(&br, nal + 1, nal_len - 1);
+    bit_reader_read_ue(&br);
+    return (int)(bit_reader_read_ue(&br) % 5);
+}
+
+static void MetaReset(PacketMeta *m, int codec)
+{
+    m->flags = 0;
+    m->codec = (uint8_t)codec;
+    m->slice_type = -1;
+    m->vps = -1;
+    m->sps = -1;
+    m->pps = -1;
+    memset(m->reserved, 0, sizeof(m->reserved));
+    m->width = 0;
+    m->height = 0;
+    m->type_mask = 0;
+}
+
+static void MetaSetWh(PacketMeta *m, int w, int h)
+{
+    if (w > 0 && h > 0 && w <= META_MAX_WIDTH && h <= META_MAX_HEIGHT) {
+        m->width = (uint16_t)w;
+        m->height = (uint16_t)h;
+    }
+}
+
+int packet_meta_codec_supported(enum AVCodecID codec_id)
+{
+    return codec_id == AV_CODEC_ID_H264 || codec_id == AV_CODEC_ID_HEVC;
+}
+
+int packet_meta_parse(PacketMeta *m, enum AVCodecID codec_id, const uint8_t *data, int size)
+{
+    if (codec_id == AV_CODEC_ID_H264) return packet_meta_parse_h264(m, data, size);
+    if (codec_id == AV_CODEC_ID_HEVC) return packet_meta_parse_hevc(m, data, size);
+    return -1;
+}
+
+int packet_meta_parse_h264(PacketMeta *m, const uint8_t *data, int size)
+{
+    int i, seen_slice = 0;
+
+    MetaReset(m, PKT_META_CODEC_H264);
+    nal_index_build(&m->nal, data, size);
+
+    for (i = 0; i < m->nal.count; i++) {
+        const NalUnitInfo *u = &m->nal.nal[i];
+        const uint8_t *nal = data + u->offset;
+        int type = NAL_H264_TYPE(u);
+
+        m->type_mask |= 1ULL << type;
+
+        if (type == NAL_TYPE_SPS && m->sps < 0) {
+            int w = 0, h = 0;
+            m->sps = (int8_t)i;
+            if (packet_meta_h264_sps_wh(nal + 1, (int)u->size - 1, &w, &h) == 0) MetaSetWh(m, w, h);
+        } else if (type == NAL_TYPE_PPS && m->pps < 0) {
+            m->pps = (int8_t)i;
+        } else if (type == NAL_TYPE_SLICE || type == NAL_TYPE_SLICE_IDR) {
+            int st;
+
+            if (type == NAL_TYPE_SLICE_IDR) m->flags |= PKT_META_IDR;
+
+            // 第一个 slice 决定 slice_type 和是否可丢弃；其余 slice 只在还没找到帧内 slice 时才解析
+            if (!seen_slice) {
+                seen_slice = 1;
+                st = H264SliceType(nal, (int)u->size);
+                m->slice_type = (int8_t)st;
+                if (type == NAL_TYPE_SLICE && NAL_H264_REF_IDC(u) == 0) m->flags |= PKT_META_DISPOSABLE;
+            } else if (type == NAL_TYPE_SLICE && !PKT_META_IS_INTRA(m)) {
+                st = H264SliceType(nal, (int)u->size);
+            } else {
+                continue;
+            }
+
+            if (type == NAL_TYPE_SLICE) {
+                if (st == SLICE_TYPE_I) m->flags |= PKT_META_I_SLICE;
+                else if (st == SLICE_TYPE_SI) m->flags |= PKT_META_SI_SLICE;
+            }
+        }
+    }
+
+    return m->nal.count;
+}
+
+// H.265 不解析 slice 头 (需要 PPS 状态)：关键帧按 IRAP 判断，slice_type 保持 -1
+int packet_meta_parse_hevc(PacketMeta *m, const uint8_t *data, int size)
+{
+    int i, seen_vcl = 0;
+
+    MetaReset(m, PKT_META_CODEC_HEVC);
+    nal_index_build(&m->nal, data, size);
+
+    for (i = 0; i < m->nal.count; i++) {
+        const NalUnitInfo *u = &m->nal.nal[i];
+        const uint8_t *nal = data + u->offset;
+        int type = NAL_HEVC_TYPE(u);
+
+        m->type_mask |= 1ULL << type;
+
+        if (type == HEVC_NAL_VPS && m->vps < 0) {
+            m->vps = (int8_t)i;
+        } else if (type == HEVC_NAL_SPS && m->sps < 0) {
+            HevcSpsInfo si;
+            m->sps = (int8_t)i;
+            if (u->size > 2 && packet_meta_hevc_sps_parse(nal + 2, (int)u->size - 2, &si) == 0) {
+                MetaSetWh(m, si.width, si.height);
+            }
+        } else if (type == HEVC_NAL_PPS && m->pps < 0) {
+            m->pps = (int8_t)i;
+        } else if (type <= HEVC_NAL_VCL_MAX) {
+            if (type >= HEVC_NAL_BLA_W_LP && type <= HEVC_NAL_RSV_IRAP_23) {
+                m->flags |= PKT_META_IRAP;
+                if (type == HEVC_NAL_IDR_W_RADL || type == HEVC_NAL_IDR_N_LP) m->flags |= PKT_META_IDR;
+            }
+            // 子层非参考图像 (TRAIL_N / TSA_N / STSA_N / RADL_N / RASL_N ...)：摄像头码流只有一个时域子层，可直接丢弃
+            if (!seen_vcl) {
+                seen_vcl = 1;
+                if (type <= HEVC_NAL_RSV_VCL_N14 && (type & 1) == 0) m->flags |= PKT_META_DISPOSABLE;
+            }
+        }
+    }
+
+    return m->nal.count;
+}
+
+int packet_meta_attach(AVPacket *pkt, const PacketMeta *m)
+{
+    int size;
+    uint8_t *sd;
+
+    if (!pkt || !m) return -1;
+
+    size = (int)(offsetof(PacketMeta, nal.nal) + m->nal.count * sizeof(NalUnitInfo));
+    sd = av_packet_new_side_data(pkt, PACKET_META_SIDE_DATA, size);
+    if (!sd) return -1;
+    memcpy(sd, m, size);
+    return 0;
+}
+
+const PacketMeta *packet_meta_get(const AVPacket *pkt, enum AVCodecID codec_id, PacketMeta *tmp)
+{
+    const PacketMeta *m;
+    int size = 0;
+    int codec = (codec_id == AV_CODEC_ID_HEVC) ? PKT_META_CODEC_HEVC : PKT_META_CODEC_H264;
+
+    m = (const PacketMeta *)av_packet_get_side_data((AVPacket *)pkt, PACKET_META_SIDE_DATA, &size);
+    if (m && size >= (int)offsetof(PacketMeta, nal.nal) && m->nal.count <= NAL_INDEX_MAX &&
+        size >= (int)(offsetof(PacketMeta, nal.nal) + m->nal.count * sizeof(NalUnitInfo)) &&
+        m->nal.pkt_size == (uint32_t)pkt->size && m->codec == codec) {
+        return m;
+    }
+
+    if (packet_meta_parse(tmp, codec_id, pkt->data, pkt->size) < 0) {
+        MetaReset(tmp, codec);
+        nal_index_build(&tmp->nal, NULL, 0);
+    }
+    return tmp;
+}
+
+int packet_meta_h264_sps_wh(const uint8_t *sps_payload, int sps_len, int *w, int *h)
+{
+    BitReader br;
+    unsigned profile_idc;
+    unsigned chroma_format_idc = 1;
+    unsigned separate_colour_plane_flag = 0;
+    unsigned pic_width_in_mbs_minus1;
+    unsigned pic_height_in_map_units_minus1;
+    unsigned frame_mbs_only_flag;
+    unsigned frame_cropping_flag;
+    unsigned crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+    int width, height;
+    int sub_width_c = 1, sub_height_c = 1;
+    int crop_unit_x, crop_unit_y;
+    int i;
+
+    if (!sps_payload || sps_len <= 0) return -1;
+    bit_reader_init(&br, sps_payload, sps_len);
+
+    profile_idc = bit_reader_read(&br, 8);
+    bit_reader_read(&br, 8); // constraint_set_flags
+    bit_reader_read(&br, 8); // level_idc
+    bit_reader_read_ue(&br); // seq_parameter_set_id
+
+    if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 ||
+        profile_idc == 244 || profile_idc == 44 || profile_idc == 83 ||
+        profile_idc == 86 || profile_idc == 118 || profile_idc == 128 ||
+        profile_idc == 138 || profile_idc == 139 || profile_idc == 134) {
+
+        chroma_format_idc = bit_reader_read_ue(&br);
+        if (chroma_format_idc == 3) {
+            separate_colour_plane_flag = bit_reader_read1(&br);
+        }
+        bit_reader_read_ue(&br); // bit_depth_luma_minus8
+        bit_reader_read_ue(&br); // bit_depth_chroma_minus8
+        bit_reader_read1(&br); // qpprime_y_zero_transform_bypass_flag
+
+        if (bit_reader_read1(&br)) { // seq_scaling_matrix_present_flag
+            int scaling_list_count = (chroma_format_idc != 3) ? 8 : 12;
+            for (i = 0; i < scaling_list_count; i++) {
+                if (bit_reader_read1(&br)) {
+                    int size = (i < 6) ? 16 : 64;
+                    int last = 8, next = 8, j;
+                    for (j = 0; j < size; j++) {
+                        if (next != 0) {
+                            int delta = bit_reader_read_se(&br);
+                            next = (last + delta + 256) % 256;
+                        }
+                        last = (next == 0) ? last : next;
+                    }
+                }
+            }
+        }
+    }
+
+    bit_reader_read_ue(&br); // log2_max_frame_num_minus4
+    unsigned pic_order_cnt_type = bit_reader_read_ue(&br);
+
+    if (pic_order_cnt_type == 0) {
+        bit_reader_read_ue(&br); // log2_max_pic_order_cnt_lsb_minus4
+    } else if (pic_order_cnt_type == 1) {
+        bit_reader_read1(&br); 
+        bit_reader_read_se(&br);  
+        bit_reader_read_se(&br);  
+        unsigned num = bit_reader_read_ue(&br);
+        for (unsigned i = 0; i < num; i++) bit_reader_read_se(&br);
+    }
+
+    bit_reader_read_ue(&br); // max_num_ref_frames
+    bit_reader_read1(&br); // gaps_in_frame_num_value_allowed_flag
+
+    pic_width_in_mbs_minus1 = bit_reader_read_ue(&br);
+    pic_height_in_map_units_minus1 = bit_reader_read_ue(&br);
+    frame_mbs_only_flag = bit_reader_read1(&br);
+
+    if (!frame_mbs_only_flag) bit_reader_read1(&br); // mb_adaptive_frame_field_flag
+    bit_reader_read1(&br); // direct_8x8_inference_flag
+
+    frame_cropping_flag = bit_reader_read1(&br);
+    if (frame_cropping_flag) {
+        crop_left = bit_reader_read_ue(&br);
+        crop_right = bit_reader_read_ue(&br);
+        crop_top = bit_reader_read_ue(&br);
+        crop_bottom = bit_reader_read_ue(&br);
+    }
+
+    width = (pic_width_in_mbs_minus1 + 1) * 16;
+    height = (pic_height_in_map_units_minus1 + 1) * 16 * (2 - frame_mbs_only_flag);
+
+    if (separate_colour_plane_flag) chroma_format_idc = 0;
+
+    if (chroma_format_idc == 1) { sub_width_c = 2; sub_height_c = 2; }
+    else if (chroma_format_idc == 2) { sub_width_c = 2; sub_height_c = 1; }
+
+    crop_unit_x = sub_width_c;
+    crop_unit_y = sub_height_c * (2 - frame_mbs_only_flag);
+
+    width -= (crop_left + crop_right) * crop_unit_x;
+    height -= (crop_top + crop_bottom) * crop_unit_y;
+
+    *w = width;
+    *h = height;
+    return 0;
+}
+
+// profile_tier_level(1, max_sub_layers_minus1)：general 部分原样保存，子层部分跳过
+static void HevcReadPtl(BitReader *br, int max_sub_layers_minus1, uint8_t ptl[12])
+{
+    int i, sub_profile[8] = {0}, sub_level[8] = {0};
+
+    for (i = 0; i < 12; i++) ptl[i] = (uint8_t)bit_reader_read(br, 8);
+
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+        sub_profile[i] = bit_reader_read1(br);
+        sub_level[i] = bit_reader_read1(br);
+    }
+    if (max_sub_layers_minus1 > 0) {
+        for (i = max_sub_layers_minus1; i < 8; i++) bit_reader_read(br, 2); // reserved_zero_2bits
+    }
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+        if (sub_profile[i]) bit_reader_skip(br, 88);
+        if (sub_level[i]) bit_reader_read(br, 8);
+    }
+}
+
+int packet_meta_hevc_sps_parse(const uint8_t *sps_payload, int sps_len, HevcSpsInfo *info)
+{
+    BitReader br;
+    unsigned max_sub_layers_minus1;
+    unsigned chroma_format_idc;
+    unsigned conf_left = 0, conf_right = 0, conf_top = 0, conf_bottom = 0;
+    int width, height;
+    int sub_width_c = 1, sub_height_c = 1;
+
+    if (!sps_payload || sps_len <= 0 || !info) return -1;
+    memset(info, 0, sizeof(HevcSpsInfo));
+    bit_reader_init(&br, sps_payload, sps_len);
+
+    bit_reader_read(&br, 4); // sps_video_parameter_set_id
+    max_sub_layers_minus1 = bit_reader_read(&br, 3);
+    info->temporal_id_nesting = (uint8_t)bit_reader_read1(&br);
+    if (max_sub_layers_minus1 > 6) return -1;
+    info->max_sub_layers = (uint8_t)(max_sub_layers_minus1 + 1);
+
+    HevcReadPtl(&br, (int)max_sub_layers_minus1, info->ptl);
+
+    bit_reader_read_ue(&br); // sps_seq_parameter_set_id
+    chroma_format_idc = bit_reader_read_ue(&br);
+    if (chroma_format_idc > 3) return -1;
+    if (chroma_format_idc == 3 && bit_reader_read1(&br)) { // separate_colour_plane_flag
+        sub_width_c = sub_height_c = 1;
+    } else if (chroma_format_idc == 1) {
+        sub_width_c = 2; sub_height_c = 2;
+    } else if (chroma_format_idc == 2) {
+        sub_width_c = 2; sub_height_c = 1;
+    }
+    info->chroma_format_idc = (uint8_t)chroma_format_idc;
+
+    width = (int)bit_reader_read_ue(&br);  // pic_width_in_luma_samples
+    height = (int)bit_reader_read_ue(&br); // pic_height_in_luma_samples
+
+    if (bit_reader_read1(&br)) { // conformance_window_flag
+        conf_left = bit_reader_read_ue(&br);
+        conf_right = bit_reader_read_ue(&br);
+        conf_top = bit_reader_read_ue(&br);
+        conf_bottom = bit_reader_read_ue(&br);
+    }
+    info->bit_depth_luma_minus8 = (uint8_t)(bit_reader_read_ue(&br) & 0x07);
+    info->bit_depth_chroma_minus8 = (uint8_t)(bit_reader_read_ue(&br) & 0x07);
+    if (br.overread) return -1;
+
+    width -= (int)(conf_left + conf_right) * sub_width_c;
+    height -= (int)(conf_top + conf_bottom) * sub_height_c;
+    if (width <= 0 || height <= 0) return -1;
+
+    info->width = width;
+    info->height = height;
+    return 0;
+}
+
+int packet_meta_extradata_wh(enum AVCodecID codec_id, const uint8_t *extra, int extra_size, int *w, int *h)
+{
+    PacketMeta m;
+    int pos, i, j, num_arrays;
+
+    if (!extra || extra_size < 7 || !w || !h) return -1;
+
+    // Annex-B (RTSP 由 sprop 参数集生成)：与视频包走同一个解析
+    if (extra[0] == 0 && extra[1] == 0 && (extra[2] == 1 || (extra[2] == 0 && extra[3] == 1))) {
+        if (packet_meta_parse(&m, codec_id, extra, extra_size) < 0 || m.width == 0) return -1;
+        *w = m.width;
+        *h = m.height;
+        return 0;
+    }
+    if (extra[0] != 1) return -1;
+
+    if (codec_id == AV_CODEC_ID_H264) {
+        // avcC：6 字节头之后是 SPS 数组
+        num_arrays = extra[5] & 0x1f;
+        pos = 6;
+        for (i = 0; i < num_arrays; i++) {
+            int len;
+            if (pos + 2 > extra_size) return -1;
+            len = (extra[pos] << 8) | extra[pos + 1];
+            pos += 2;
+            if (pos + len > extra_size) return -1;
+            if (len > 1 && (extra[pos] & 0x1f) == NAL_TYPE_SPS) {
+                if (packet_meta_h264_sps_wh(extra + pos + 1, len - 1, w, h) != 0) return -1;
+                return (*w > 0 && *h > 0 && *w <= META_MAX_WIDTH && *h <= META_MAX_HEIGHT) ? 0 : -1;
+            }
+            pos += len;
+        }
+    } else if (codec_id == AV_CODEC_ID_HEVC) {
+        // hvcC：23 字节头之后是按 NAL 类型分组的参数集数组
+        if (extra_size < 23) return -1;
+        num_arrays = extra[22];
+        pos = 23;
+        for (i = 0; i < num_arrays; i++) {
+            int type, num_nalus;
+            if (pos + 3 > extra_size) return -1;
+            type = extra[pos] & 0x3f;
+            num_nalus = (extra[pos + 1] << 8) | extra[pos + 2];
+            pos += 3;
+            for (j = 0; j < num_nalus; j++) {
+                int len;
+                if (pos + 2 > extra_size) return -1;
+                len = (extra[pos] << 8) | extra[pos + 1];
+                pos += 2;
+                if (pos + len > extra_size) return -1;
+                if (type == HEVC_NAL_SPS && len > 2) {
+                    HevcSpsInfo si;
+                    if (packet_meta_hevc_sps_parse(extra + pos + 2, len - 2, &si) != 0) return -1;
+                    if (si.width > META_MAX_WIDTH || si.height > META_MAX_HEIGHT) return -1;
+                    *w = si.width;
+                    *h = si.height;
+                    return 0;
+                }
+                pos += len;
+            }
+        }
+    }
+    return -1;
+}
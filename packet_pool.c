@@ -0,0 +1,119 @@
+#include "packet_pool.h"
+#include <string.h>
+#include <stdlib.h>
+
+#include "log.h"
+#ifndef TAG
+#define TAG "PKTPOOL"
+#endif
+
+// 尺寸级别：音频帧、P 帧、大 P 帧、I 帧、大 I 帧
+static const int g_class_size[PKT_POOL_CLASSES] = {
+    2 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024
+};
+
+// 池中无空闲块时的分配回调，用于统计真正的堆申请次数
+static AVBufferRef *pool_alloc(void *opaque, int size)
+{
+    PacketPoolClass *c = (PacketPoolClass *)opaque;
+    __atomic_add_fetch(&c->allocs, 1, __ATOMIC_RELAXED);
+    return av_buffer_alloc(size);
+}
+
+int packet_pool_init(PacketPool *pp)
+{
+    int i;
+
+    if (!pp) return -1;
+    memset(pp, 0, sizeof(PacketPool));
+
+    for (i = 0; i < PKT_POOL_CLASSES; i++) {
+        PacketPoolClass *c = &pp->cls[i];
+        c->owner = pp;
+        c->size = g_class_size[i];
+        c->pool = av_buffer_pool_init2(c->size + AV_INPUT_BUFFER_PADDING_SIZE, c, pool_alloc, NULL);
+        if (!c->pool) {
+            LOG_ERROR(TAG, "Failed to init buffer pool (%d)\n", c->size);
+            packet_pool_uninit(pp);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void packet_pool_uninit(PacketPool *pp)
+{
+    int i;
+
+    if (!pp) return;
+    for (i = 0; i < PKT_POOL_CLASSES; i++) {
+        if (pp->cls[i].pool) av_buffer_pool_uninit(&pp->cls[i].pool);
+    }
+}
+
+int packet_pool_rebuf(PacketPool *pp, AVPacket *pkt)
+{
+    PacketPoolClass *c = NULL;
+    AVBufferRef *buf;
+    int i;
+
+    if (!pp || !pkt || !pkt->data || pkt->size <= 0) return -1;
+
+    for (i = 0; i < PKT_POOL_CLASSES; i++) {
+        if (pkt->size <= pp->cls[i].size) {
+            c = &pp->cls[i];
+            break;
+        }
+    }
+    if (!c || !c->pool) {
+        __atomic_add_fetch(&pp->oversize, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    buf = av_buffer_pool_get(c->pool);
+    if (!buf) {
+        __atomic_add_fetch(&pp->failed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    __atomic_add_fetch(&c->gets, 1, __ATOMIC_RELAXED);
+
+    // 整包拷贝一次：目的是换掉解复用器/编码器按包长申请的变长块，不是省拷贝
+    memcpy(buf->data, pkt->data, pkt->size);
+    memset(buf->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    // buf->size 保持级别块大小 (含 padding)，负载长度只记在 pkt->size；
+    // 改小 buf->size 会让下游看不到 padding (按 buf->size 判断 data + size 之后是否可读)
+    av_buffer_unref(&pkt->buf);
+    pkt->buf  = buf;
+    pkt->data = buf->data;
+    return 0;
+}
+
+void packet_pool_get_stats(PacketPool *pp, PacketPoolStats *st)
+{
+    int i;
+
+    if (!pp || !st) return;
+    memset(st, 0, sizeof(PacketPoolStats));
+    for (i = 0; i < PKT_POOL_CLASSES; i++) {
+        st->gets   += __atomic_load_n(&pp->cls[i].gets, __ATOMIC_RELAXED);
+        st->allocs += __atomic_load_n(&pp->cls[i].allocs, __ATOMIC_RELAXED);
+    }
+    st->oversize = __atomic_load_n(&pp->oversize, __ATOMIC_RELAXED);
+    st->failed   = __atomic_load_n(&pp->failed, __ATOMIC_RELAXED);
+}
+
+void packet_pool_dump(PacketPool *pp, const char *name, FILE *fp)
+{
+    int i;
+
+    if (!pp || !fp) return;
+    fprintf(fp, "[%s] oversize %u failed %u\n", name ? name : "pool",
+            __atomic_load_n(&pp->oversize, __ATOMIC_RELAXED),
+            __atomic_load_n(&pp->failed, __ATOMIC_RELAXED));
+    for (i = 0; i < PKT_POOL_CLASSES; i++) {
+        fprintf(fp, "  class %7d get %u alloc %u\n", pp->cls[i].size,
+                __atomic_load_n(&pp->cls[i].gets, __ATOMIC_RELAXED),
+                __atomic_load_n(&pp->cls[i].allocs, __ATOMIC_RELAXED));
+    }
+}
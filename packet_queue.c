@@ -4,39 +4,924 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "log.h"
 #ifndef TAG
 #define TAG "QUEUE"
 #endif
 
+#ifndef FUTEX_WAIT_PRIVATE
+#define FUTEX_WAIT_PRIVATE FUTEX_WAIT
+#define FUTEX_WAKE_PRIVATE FUTEX_WAKE
+#endif
+
 /* ========================================================================== */
 /* 内部辅助函数 */
 /* ========================================================================== */
 
-// 在 active_list 中查找并移除指定类型的最旧节点 (无锁，需外部持有锁)
+// 由 type_node 反推所属的 PacketNode
+#define TYPE_NODE_TO_PACKET(n) ((PacketNode *)((char *)(n) - offsetof(PacketNode, type_node)))
+
+// 双向链表摘除节点，并重置指针指向自己，防止悬空
+static inline void list_unlink(ListNode *n) {
+    n->Prev->Next = n->Next;
+    n->Next->Prev = n->Prev;
+    n->Next = n->Prev = n;
+}
+
+static inline LinkList* active_list_of_type(PacketQueue *q, PacketType type) {
+    return (type == PKT_TYPE_VIDEO) ? &q->active_video : &q->active_audio;
+}
+
+// 移除指定类型的最旧节点 (无锁，需外部持有锁)
+// 同类型子链表的头部就是该类型最旧的包，O(1) 完成，不再遍历 active_list
 static PacketNode* remove_oldest_of_type(PacketQueue *q, PacketType type) {
-    LinkList *list = &q->active_list;
-    ListNode *head_sentinel = &list->Head;
-    ListNode *cur = head_sentinel->Next; // 第一个有效节点
+    LinkList *list = active_list_of_type(q, type);
+    ListNode *first = list->Head.Next;
+    PacketNode *pn;
 
-    // 遍历链表 (直到回到哨兵节点)
-    while (cur != head_sentinel) {
-        PacketNode *pn = (PacketNode *)cur;
-        
-        if (pn->type == type) {
-            // 找到同类型的最旧节点
-            // 双向链表摘除节点
-            cur->Prev->Next = cur->Next;
-            cur->Next->Prev = cur->Prev;
-            
-            // 重置指针指向自己，防止悬空
-            cur->Next = cur->Prev = cur;
-            return pn;
+    if (first == &list->Head) return NULL;
+
+    pn = TYPE_NODE_TO_PACKET(first);
+    list_unlink(&pn->type_node);
+    list_unlink(&pn->evict_node);
+    list_unlink(&pn->node);
+    return pn;
+}
+
+// 把活跃节点作为"丢弃"回收到对应的 FreeList (无锁，需外部持有锁)
+static void drop_node(PacketQueue *q, PacketNode *pn)
+{
+    list_unlink(&pn->node);
+    list_unlink(&pn->type_node);
+    list_unlink(&pn->evict_node);
+
+    q->size_bytes -= pn->pkt.size;
+    av_packet_unref(&pn->pkt);
+    av_init_packet(&pn->pkt);
+    pn->pkt.data = NULL;
+    pn->pkt.size = 0;
+
+    if (pn->type == PKT_TYPE_VIDEO) {
+        q->count_video--;
+        q->dropped_video++;
+        queue_stats_on_evict(&q->stats, PKT_TYPE_VIDEO, 1);
+        LinkList_PushToTail_NoLock(&q->free_list_video, &pn->node);
+    } else {
+        q->count_audio--;
+        q->dropped_audio++;
+        queue_stats_on_evict(&q->stats, PKT_TYPE_AUDIO, 1);
+        LinkList_PushToTail_NoLock(&q->free_list_audio, &pn->node);
+    }
+}
+
+// 丢弃最旧的一个 GOP (无锁，需外部持有锁)
+// 从第二个视频包开始找下一个关键帧，把它之前的所有音视频包一起丢掉:
+// 队头是关键帧时丢掉整个 GOP，队头是残缺 GOP 时只丢残缺部分。
+// 返回丢弃的包数，0 表示队列中没有下一个关键帧
+static int evict_oldest_gop(PacketQueue *q)
+{
+    ListNode *vhead = &q->active_video.Head;
+    ListNode *cur;
+    PacketNode *cut = NULL;
+    int n = 0;
+
+    if (vhead->Next == vhead) return 0;
+
+    for (cur = vhead->Next->Next; cur != vhead; cur = cur->Next) {
+        PacketNode *pn = TYPE_NODE_TO_PACKET(cur);
+        if (pn->pkt.flags & AV_PKT_FLAG_KEY) {
+            cut = pn;
+            break;
         }
-        cur = cur->Next;
     }
-    return NULL;
+    if (!cut) return 0;
+
+    while (q->active_list.Head.Next != &cut->node) {
+        drop_node(q, (PacketNode *)q->active_list.Head.Next);
+        n++;
+    }
+    return n;
+}
+
+// 视频池满时按策略腾出空间 (无锁，需外部持有锁)，返回丢弃的包数
+static int evict_video(PacketQueue *q)
+{
+    ListNode *first = q->disposable_list.Head.Next;
+
+    if (q->evict_policy == PKT_EVICT_NONREF_FIRST && first != &q->disposable_list.Head) {
+        // 非参考帧丢了不影响后续解码
+        drop_node(q, (PacketNode *)((char *)first - offsetof(PacketNode, evict_node)));
+        return 1;
+    }
+    return evict_oldest_gop(q);
+}
+
+// pts 差换算为毫秒，未设置时间基或 pts 无效时返回 0
+static int pts_span_ms(PacketQueue *q, int64_t oldest, int64_t newest)
+{
+    if (q->time_base.num <= 0 || q->time_base.den <= 0) return 0;
+    if (oldest == AV_NOPTS_VALUE || newest == AV_NOPTS_VALUE || newest <= oldest) return 0;
+    return (int)av_rescale_q(newest - oldest, q->time_base, (AVRational){1, 1000});
+}
+
+static inline int over_budget(PacketQueue *q, int bytes, int duration_ms)
+{
+    if (q->max_bytes > 0 && bytes > q->max_bytes) return 1;
+    if (q->max_duration_ms > 0 && duration_ms > q->max_duration_ms) return 1;
+    return 0;
+}
+
+// 队列中视频的时长 (无锁，需外部持有锁)
+// newest_pts 为即将入队的视频包 pts，AV_NOPTS_VALUE 时取队尾视频包
+static int locked_duration_ms(PacketQueue *q, int64_t newest_pts)
+{
+    ListNode *vhead = &q->active_video.Head;
+
+    if (vhead->Next == vhead) return 0;
+    if (newest_pts == AV_NOPTS_VALUE) {
+        newest_pts = TYPE_NODE_TO_PACKET(vhead->Prev)->pkt.pts;
+    }
+    return pts_span_ms(q, TYPE_NODE_TO_PACKET(vhead->Next)->pkt.pts, newest_pts);
+}
+
+// 计算 clk 时钟下 ms 毫秒后的绝对时间
+static void deadline_after_ms(struct timespec *ts, clockid_t clk, int ms)
+{
+    clock_gettime(clk, ts);
+    ts->tv_sec  += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+// 条件变量改用单调时钟，超时等待不受系统校时 (NTP/手动改时间) 影响
+static void cond_init_monotonic(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// 入队后检查水位 (只在生产者侧调用)，返回 1 表示需要触发回调
+static int watermark_hit(PacketQueue *q, int depth)
+{
+    if (q->wm_depth <= 0 || !q->wm_cb) return 0;
+    if (depth < q->wm_depth) {
+        q->wm_armed = 1;
+        return 0;
+    }
+    if (!q->wm_armed) return 0;
+    q->wm_armed = 0;
+    return 1;
+}
+
+// 从活跃链表头部取出一个包 (无锁，需外部持有锁)，队列为空返回 0
+static int compact_pop(PacketQueue *q, AVPacket *pkt);
+
+static int locked_pop(PacketQueue *q, AVPacket *pkt)
+{
+    ListNode *node = NULL;
+    PacketNode *pnode;
+
+    if (q->mode == PKT_QUEUE_MODE_COMPACT) return compact_pop(q, pkt);
+
+    // Pop from head (FIFO)
+    LinkList_PopFromHead_NoLock(&q->active_list, &node);
+    if (node == NULL) return 0;
+
+    pnode = (PacketNode *)node;
+    list_unlink(&pnode->type_node);
+    list_unlink(&pnode->evict_node);
+
+    queue_stats_on_get(&q->stats, pnode->type, pnode->enq_us,
+                       (pnode->type == PKT_TYPE_VIDEO) ? q->count_video : q->count_audio);
+    q->size_bytes -= pnode->pkt.size;
+    if (pnode->type == PKT_TYPE_VIDEO) q->count_video--;
+    else q->count_audio--;
+
+    *pkt = pnode->pkt; // Move data
+
+    // Reset node
+    av_init_packet(&pnode->pkt);
+    pnode->pkt.data = NULL;
+    pnode->pkt.size = 0;
+
+    // Return to Free List
+    if (pnode->type == PKT_TYPE_VIDEO) {
+        LinkList_PushToTail_NoLock(&q->free_list_video, node);
+    } else {
+        LinkList_PushToTail_NoLock(&q->free_list_audio, node);
+    }
+    return 1;
+}
+
+// 加入 pkt 后会超出字节/时长预算时，按丢弃策略淘汰旧包 (无锁，需外部持有锁)
+// 返回丢弃的包数
+static int evict_budget(PacketQueue *q, AVPacket *pkt, PacketType type)
+{
+    int64_t newest = (type == PKT_TYPE_VIDEO) ? pkt->pts : AV_NOPTS_VALUE;
+    int n = 0, k;
+
+    while (q->active_list.Head.Next != &q->active_list.Head &&
+           over_budget(q, q->size_bytes + pkt->size, locked_duration_ms(q, newest))) {
+        k = (q->evict_policy != PKT_EVICT_OLDEST) ? evict_video(q) : 0;
+        if (k == 0) {
+            drop_node(q, (PacketNode *)q->active_list.Head.Next);
+            k = 1;
+        }
+        n += k;
+    }
+    return n;
+}
+
+/* ========================================================================== */
+/* SPSC 无锁环形队列 */
+/* ========================================================================== */
+/*
+ * 视频、音频各一个有界环，每个槽位带序号 (seq):
+ *   seq == pos      槽位空闲，生产者可写
+ *   seq == pos + 1  槽位已发布，可被取走
+ * 取走的一方用 CAS 推进 tail 来"认领"槽位，因此消费者、生产者丢旧包以及
+ * 其他线程的 flush 之间不会重复释放同一个包。槽位里的 order 是全局入队序号，
+ * 消费者比较两个环头部的 order，保持与 LOCKED 模式一致的严格到达顺序。
+ */
+
+static uint32_t ring_round_pow2(uint32_t v)
+{
+    uint32_t n = 1;
+    while (n < v) n <<= 1;
+    return n;
+}
+
+static int ring_init(PacketRing *r, int cap)
+{
+    uint32_t i, n;
+
+    n = ring_round_pow2((uint32_t)cap);
+    r->slots = (PacketSlot *)calloc(n, sizeof(PacketSlot));
+    if (!r->slots) return -1;
+
+    for (i = 0; i < n; i++) {
+        r->slots[i].seq = i;
+        av_init_packet(&r->slots[i].pkt);
+        r->slots[i].pkt.data = NULL;
+        r->slots[i].pkt.size = 0;
+    }
+    r->mask = n - 1;
+    r->cap  = (uint32_t)cap;
+    r->head = 0;
+    r->tail = 0;
+    return 0;
+}
+
+static inline uint32_t ring_count(PacketRing *r)
+{
+    uint32_t t = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    uint32_t h = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    return h - t;
+}
+
+// 查看环头部: 返回 1 表示有已发布的包，输出其 tail 位置与入队序号
+static int ring_peek(PacketRing *r, uint32_t *pos, uint32_t *order)
+{
+    for (;;) {
+        uint32_t t = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        PacketSlot *slot = &r->slots[t & r->mask];
+        uint32_t s = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(s - (t + 1));
+
+        if (diff < 0) return 0;     // 空
+        if (diff > 0) continue;     // tail 已被别人推进，重读
+        *pos = t;
+        if (order) *order = __atomic_load_n(&slot->order, __ATOMIC_RELAXED);
+        return 1;
+    }
+}
+
+// 认领 pos 处的包并移出; CAS 失败 (被别人先取走) 返回 0
+// enq_us 非空时输出入队时间戳
+static int ring_take(PacketRing *r, uint32_t pos, AVPacket *out, int64_t *enq_us)
+{
+    PacketSlot *slot = &r->slots[pos & r->mask];
+
+    if (!__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    *out = slot->pkt; // Move data
+    if (enq_us) *enq_us = slot->enq_us;
+    av_init_packet(&slot->pkt);
+    slot->pkt.data = NULL;
+    slot->pkt.size = 0;
+
+    // 归还槽位给下一圈的生产者
+    __atomic_store_n(&slot->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int ring_pop(PacketRing *r, AVPacket *out)
+{
+    uint32_t pos;
+    while (ring_peek(r, &pos, NULL)) {
+        if (ring_take(r, pos, out, NULL)) return 1;
+    }
+    return 0;
+}
+
+// 生产者写入 (调用前已保证未超过 cap)
+static int ring_push(PacketRing *r, AVPacket *pkt, uint32_t order)
+{
+    uint32_t h = r->head;
+    PacketSlot *slot = &r->slots[h & r->mask];
+
+    // 消费者刚认领上一圈的同一槽位、还没搬完数据时需要让一下，窗口极短
+    while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != h) {
+        sched_yield();
+    }
+
+    if (av_packet_ref(&slot->pkt, pkt) < 0) {
+        return -1;
+    }
+    slot->flags = pkt->flags;
+    slot->pts = pkt->pts;
+    slot->enq_us = queue_stats_now_us();
+    __atomic_store_n(&slot->order, order, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, h + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// 生产者侧按 GOP 丢弃: 视频环中下一个关键帧之前的视频包，以及入队序号更早的音频包
+// 返回 0 表示环中找不到下一个关键帧
+static int spsc_evict_gop(PacketQueue *q)
+{
+    PacketRing *rv = &q->ring_video;
+    PacketRing *ra = &q->ring_audio;
+    uint32_t t = __atomic_load_n(&rv->tail, __ATOMIC_ACQUIRE);
+    uint32_t h = rv->head;
+    uint32_t p, pos, ord, cut_pos = 0, cut_order = 0;
+    int found = 0;
+    AVPacket old;
+
+    // [t, h) 之间槽位的 flags/order 只由生产者写入，此处读取是安全的
+    for (p = t + 1; p != h; p++) {
+        PacketSlot *slot = &rv->slots[p & rv->mask];
+        if (slot->flags & AV_PKT_FLAG_KEY) {
+            cut_pos = p;
+            cut_order = __atomic_load_n(&slot->order, __ATOMIC_RELAXED);
+            found = 1;
+            break;
+        }
+    }
+    if (!found) return 0;
+
+    while (ring_peek(rv, &pos, NULL) && (int32_t)(pos - cut_pos) < 0) {
+        if (ring_take(rv, pos, &old, NULL)) {
+            __atomic_sub_fetch(&q->size_bytes, old.size, __ATOMIC_RELAXED);
+            av_packet_unref(&old);
+            __atomic_add_fetch(&q->dropped_video, 1, __ATOMIC_RELAXED);
+            queue_stats_on_evict(&q->stats, PKT_TYPE_VIDEO, 1);
+        }
+    }
+    while (ring_peek(ra, &pos, &ord) && (int32_t)(ord - cut_order) < 0) {
+        if (ring_take(ra, pos, &old, NULL)) {
+            __atomic_sub_fetch(&q->size_bytes, old.size, __ATOMIC_RELAXED);
+            av_packet_unref(&old);
+            __atomic_add_fetch(&q->dropped_audio, 1, __ATOMIC_RELAXED);
+            queue_stats_on_evict(&q->stats, PKT_TYPE_AUDIO, 1);
+        }
+    }
+    return 1;
+}
+
+// 丢弃两个环中最早入队的一个包，返回 0 表示队列已空
+static int spsc_drop_oldest(PacketQueue *q)
+{
+    for (;;) {
+        uint32_t vpos = 0, apos = 0, vord = 0, aord = 0;
+        int has_v = ring_peek(&q->ring_video, &vpos, &vord);
+        int has_a = ring_peek(&q->ring_audio, &apos, &aord);
+        AVPacket old;
+
+        if (!has_v && !has_a) return 0;
+
+        if (has_v && (!has_a || (int32_t)(vord - aord) < 0)) {
+            if (!ring_take(&q->ring_video, vpos, &old, NULL)) continue;
+            __atomic_add_fetch(&q->dropped_video, 1, __ATOMIC_RELAXED);
+            queue_stats_on_evict(&q->stats, PKT_TYPE_VIDEO, 1);
+        } else {
+            if (!ring_take(&q->ring_audio, apos, &old, NULL)) continue;
+            __atomic_add_fetch(&q->dropped_audio, 1, __ATOMIC_RELAXED);
+            queue_stats_on_evict(&q->stats, PKT_TYPE_AUDIO, 1);
+        }
+        __atomic_sub_fetch(&q->size_bytes, old.size, __ATOMIC_RELAXED);
+        av_packet_unref(&old);
+        return 1;
+    }
+}
+
+// 视频环的时长，newest_pts 为 AV_NOPTS_VALUE 时取环尾视频包
+static int spsc_duration_ms(PacketQueue *q, int64_t newest_pts)
+{
+    PacketRing *rv = &q->ring_video;
+    uint32_t t = __atomic_load_n(&rv->tail, __ATOMIC_ACQUIRE);
+    uint32_t h = __atomic_load_n(&rv->head, __ATOMIC_ACQUIRE);
+
+    if (t == h) return 0;
+    if (newest_pts == AV_NOPTS_VALUE) {
+        newest_pts = rv->slots[(h - 1) & rv->mask].pts;
+    }
+    return pts_span_ms(q, rv->slots[t & rv->mask].pts, newest_pts);
+}
+
+// 生产者侧的字节/时长预算淘汰，返回丢弃的包数
+static int spsc_evict_budget(PacketQueue *q, AVPacket *pkt, PacketType type)
+{
+    int64_t newest = (type == PKT_TYPE_VIDEO) ? pkt->pts : AV_NOPTS_VALUE;
+    int n = 0;
+
+    while (over_budget(q, __atomic_load_n(&q->size_bytes, __ATOMIC_RELAXED) + pkt->size,
+                       spsc_duration_ms(q, newest))) {
+        if (q->evict_policy != PKT_EVICT_OLDEST && spsc_evict_gop(q)) {
+            n++;
+            continue;
+        }
+        if (!spsc_drop_oldest(q)) break;
+        n++;
+    }
+    return n;
+}
+
+static void ring_free(PacketRing *r)
+{
+    uint32_t i;
+    if (!r->slots) return;
+    for (i = 0; i <= r->mask; i++) {
+        av_packet_unref(&r->slots[i].pkt);
+    }
+    free(r->slots);
+    r->slots = NULL;
+}
+
+static void spsc_wake(PacketQueue *q, int all)
+{
+    __atomic_add_fetch(&q->wake_seq, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &q->wake_seq, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, NULL, NULL, 0);
+}
+
+// 按到达顺序从两个环中取出最早的包
+static int spsc_pop(PacketQueue *q, AVPacket *pkt)
+{
+    for (;;) {
+        uint32_t vpos = 0, apos = 0, vord = 0, aord = 0;
+        int has_v = ring_peek(&q->ring_video, &vpos, &vord);
+        int has_a = ring_peek(&q->ring_audio, &apos, &aord);
+        int64_t enq_us = 0;
+        PacketType type;
+        int ok;
+
+        if (!has_v && !has_a) return 0;
+
+        if (has_v && (!has_a || (int32_t)(vord - aord) < 0)) {
+            type = PKT_TYPE_VIDEO;
+            ok = ring_take(&q->ring_video, vpos, pkt, &enq_us);
+        } else {
+            type = PKT_TYPE_AUDIO;
+            ok = ring_take(&q->ring_audio, apos, pkt, &enq_us);
+        }
+        if (ok) {
+            __atomic_sub_fetch(&q->size_bytes, pkt->size, __ATOMIC_RELAXED);
+            queue_stats_on_get(&q->stats, type, enq_us,
+                               (int)ring_count((type == PKT_TYPE_VIDEO) ? &q->ring_video : &q->ring_audio) + 1);
+            return 1;
+        }
+        // 头部被生产者丢弃或被 flush 取走，重新比较
+    }
+}
+
+static int spsc_put(PacketQueue *q, AVPacket *pkt, PacketType type)
+{
+    PacketRing *r = (type == PKT_TYPE_VIDEO) ? &q->ring_video : &q->ring_audio;
+    int dropped = 0;
+
+    if (!r->slots) return -1;
+
+    // --- Over Budget ---
+    if (q->max_bytes > 0 || q->max_duration_ms > 0) {
+        dropped = spsc_evict_budget(q, pkt, type);
+    }
+
+    // --- Ring FULL ---
+    // 策略：视频按 GOP 整体丢弃
+    if (type == PKT_TYPE_VIDEO && q->evict_policy != PKT_EVICT_OLDEST && ring_count(r) >= r->cap) {
+        dropped += spsc_evict_gop(q);
+    }
+
+    // 策略：丢弃同类型最旧的包 (Smart Drop)
+    while (ring_count(r) >= r->cap) {
+        AVPacket old;
+        if (ring_pop(r, &old)) {
+            __atomic_sub_fetch(&q->size_bytes, old.size, __ATOMIC_RELAXED);
+            av_packet_unref(&old);
+            __atomic_add_fetch((type == PKT_TYPE_VIDEO) ? &q->dropped_video : &q->dropped_audio,
+                               1, __ATOMIC_RELAXED);
+            queue_stats_on_evict(&q->stats, type, 1);
+            dropped++;
+        }
+    }
+
+    if (ring_push(r, pkt, q->put_order++) < 0) {
+        return -1;
+    }
+    queue_stats_on_put(&q->stats, type, (int)ring_count(r),
+                       __atomic_add_fetch(&q->size_bytes, pkt->size, __ATOMIC_RELAXED));
+
+    // 只有消费者真正休眠时才进内核唤醒
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->consumer_parked, __ATOMIC_RELAXED)) {
+        spsc_wake(q, 0);
+    }
+
+    if (watermark_hit(q, (int)(ring_count(&q->ring_video) + ring_count(&q->ring_audio)))) {
+        q->wm_cb(q->wm_opaque, (int)(ring_count(&q->ring_video) + ring_count(&q->ring_audio)));
+    }
+
+    if (dropped) {
+        static int log_cnt = 0;
+        if (log_cnt++ % 100 == 0) {
+            LOG_WARN(TAG, "Queue Full (%s), dropped! V:%u/%u A:%u/%u Dropped V:%u A:%u\n",
+                     (type == PKT_TYPE_VIDEO) ? "Video" : "Audio",
+                     ring_count(&q->ring_video), q->ring_video.cap,
+                     ring_count(&q->ring_audio), q->ring_audio.cap,
+                     q->dropped_video, q->dropped_audio);
+        }
+    }
+
+    return 0;
+}
+
+static int spsc_get(PacketQueue *q, AVPacket *pkt, int block)
+{
+    for (;;) {
+        uint32_t seq;
+
+        if (__atomic_load_n(&q->abort_request, __ATOMIC_ACQUIRE)) return -1;
+        if (spsc_pop(q, pkt)) return 1;
+        if (!block) return 0;
+
+        // 先记录等待字再声明休眠，再复查一次，避免丢失唤醒
+        seq = __atomic_load_n(&q->wake_seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&q->consumer_parked, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&q->abort_request, __ATOMIC_SEQ_CST) &&
+            ring_count(&q->ring_video) == 0 && ring_count(&q->ring_audio) == 0) {
+            syscall(SYS_futex, &q->wake_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+        }
+        __atomic_store_n(&q->consumer_parked, 0, __ATOMIC_RELAXED);
+    }
+}
+
+// 截止时间出队: 休眠协议同 spsc_get，futex 超时取剩余时间
+static int spsc_get_until(PacketQueue *q, AVPacket *pkt, int64_t deadline_us)
+{
+    for (;;) {
+        struct timespec rel;
+        int64_t left;
+        uint32_t seq;
+
+        if (__atomic_load_n(&q->abort_request, __ATOMIC_ACQUIRE)) return -1;
+        if (spsc_pop(q, pkt)) return 1;
+
+        left = deadline_us - queue_stats_now_us();
+        if (left <= 0) return 0;
+        rel.tv_sec  = left / 1000000;
+        rel.tv_nsec = (long)(left % 1000000) * 1000L;
+
+        seq = __atomic_load_n(&q->wake_seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&q->consumer_parked, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&q->abort_request, __ATOMIC_SEQ_CST) &&
+            ring_count(&q->ring_video) == 0 && ring_count(&q->ring_audio) == 0) {
+            syscall(SYS_futex, &q->wake_seq, FUTEX_WAIT_PRIVATE, seq, &rel, NULL, 0);
+        }
+        __atomic_store_n(&q->consumer_parked, 0, __ATOMIC_RELAXED);
+    }
+}
+
+// 批量出队: 等待条件满足后一次取走最多 max 个包
+static int spsc_get_batch(PacketQueue *q, AVPacket *pkts, int max, int timeout_ms)
+{
+    struct timespec deadline, now, rel;
+    int n = 0;
+
+    if (timeout_ms > 0) deadline_after_ms(&deadline, CLOCK_MONOTONIC, timeout_ms);
+
+    for (;;) {
+        uint32_t seq, avail;
+        struct timespec *ptimeout = NULL;
+
+        if (__atomic_load_n(&q->abort_request, __ATOMIC_ACQUIRE)) return -1;
+
+        avail = ring_count(&q->ring_video) + ring_count(&q->ring_audio);
+        if (avail >= (uint32_t)max || timeout_ms == 0 || (avail > 0 && timeout_ms < 0)) break;
+
+        if (timeout_ms > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            rel.tv_sec  = deadline.tv_sec - now.tv_sec;
+            rel.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (rel.tv_nsec < 0) {
+                rel.tv_sec--;
+                rel.tv_nsec += 1000000000L;
+            }
+            if (rel.tv_sec < 0) break;
+            ptimeout = &rel;
+        }
+
+        // 与 spsc_get 相同的休眠协议，复查时只要有新包到达就重新判断
+        seq = __atomic_load_n(&q->wake_seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&q->consumer_parked, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&q->abort_request, __ATOMIC_SEQ_CST) &&
+            ring_count(&q->ring_video) + ring_count(&q->ring_audio) == avail) {
+            syscall(SYS_futex, &q->wake_seq, FUTEX_WAIT_PRIVATE, seq, ptimeout, NULL, 0);
+        }
+        __atomic_store_n(&q->consumer_parked, 0, __ATOMIC_RELAXED);
+    }
+
+    while (n < max && spsc_pop(q, &pkts[n])) n++;
+    return n;
+}
+
+static void spsc_flush(PacketQueue *q)
+{
+    AVPacket pkt;
+    while (ring_pop(&q->ring_video, &pkt) || ring_pop(&q->ring_audio, &pkt)) {
+        __atomic_sub_fetch(&q->size_bytes, pkt.size, __ATOMIC_RELAXED);
+        av_packet_unref(&pkt);
+    }
+}
+
+/* ========================================================================== */
+/* COMPACT 紧凑节点模式 (与 LOCKED 共用互斥锁/条件变量，以下函数均需外部持有锁) */
+/* ========================================================================== */
+/*
+ * 节点数组一次分配，视频在前、音频在后；链接全部用 32 位下标。
+ * 总链表双向 (丢旧时可能从中间摘除同类型头部)，同类型链表单向：
+ * 它与总链表同序，被摘除的永远是同类型的头部。
+ */
+
+static int compact_init(PacketQueue *q)
+{
+    uint32_t i, n = (uint32_t)(q->cap_video + q->cap_audio);
+
+    q->cnodes = (CompactNode *)calloc(n, sizeof(CompactNode));
+    if (!q->cnodes) return -1;
+
+    q->c_head = q->c_tail = PKT_NODE_NIL;
+    for (i = 0; i < 2; i++) {
+        q->c_type_head[i] = q->c_type_tail[i] = PKT_NODE_NIL;
+        q->c_free[i] = PKT_NODE_NIL;
+    }
+
+    // 倒序压入空闲链表，使低下标先被使用
+    for (i = n; i-- > 0;) {
+        int type = (i < (uint32_t)q->cap_video) ? PKT_TYPE_VIDEO : PKT_TYPE_AUDIO;
+        q->cnodes[i].type = (uint8_t)type;
+        q->cnodes[i].next = q->c_free[type];
+        q->c_free[type] = i;
+    }
+    return 0;
+}
+
+// 释放负载并归还到空闲链表 (节点已从活跃链表摘除)
+static void compact_release(PacketQueue *q, uint32_t idx)
+{
+    CompactNode *cn = &q->cnodes[idx];
+
+    av_buffer_unref(&cn->buf);
+    if (cn->side_data) {
+        AVPacket tmp;
+        av_init_packet(&tmp);
+        tmp.side_data = cn->side_data;
+        tmp.side_data_elems = cn->side_data_elems;
+        av_packet_free_side_data(&tmp);
+        cn->side_data = NULL;
+        cn->side_data_elems = 0;
+    }
+    q->size_bytes -= cn->size;
+    if (cn->type == PKT_TYPE_VIDEO) q->count_video--;
+    else q->count_audio--;
+
+    cn->next = q->c_free[cn->type];
+    q->c_free[cn->type] = idx;
+}
+
+// 从总链表摘除同类型链表的头节点
+static void compact_unlink_type_head(PacketQueue *q, int type)
+{
+    uint32_t idx = q->c_type_head[type];
+    CompactNode *cn = &q->cnodes[idx];
+
+    q->c_type_head[type] = cn->type_next;
+    if (q->c_type_head[type] == PKT_NODE_NIL) q->c_type_tail[type] = PKT_NODE_NIL;
+
+    if (cn->prev != PKT_NODE_NIL) q->cnodes[cn->prev].next = cn->next;
+    else q->c_head = cn->next;
+    if (cn->next != PKT_NODE_NIL) q->cnodes[cn->next].prev = cn->prev;
+    else q->c_tail = cn->prev;
+}
+
+// 丢弃同类型最旧的包
+static int compact_drop_oldest_of_type(PacketQueue *q, int type)
+{
+    uint32_t idx = q->c_type_head[type];
+
+    if (idx == PKT_NODE_NIL) return 0;
+    compact_unlink_type_head(q, type);
+    compact_release(q, idx);
+
+    if (type == PKT_TYPE_VIDEO) q->dropped_video++;
+    else q->dropped_audio++;
+    queue_stats_on_evict(&q->stats, type, 1);
+    return 1;
+}
+
+// 丢弃总链表最旧的包
+static int compact_drop_head(PacketQueue *q)
+{
+    if (q->c_head == PKT_NODE_NIL) return 0;
+    return compact_drop_oldest_of_type(q, q->cnodes[q->c_head].type);
+}
+
+// 丢弃最旧的 GOP：下一个关键帧之前的所有音视频包，返回丢弃数，0 表示没有下一个关键帧
+static int compact_evict_gop(PacketQueue *q)
+{
+    uint32_t first = q->c_type_head[PKT_TYPE_VIDEO];
+    uint32_t cut, idx;
+    int n = 0;
+
+    if (first == PKT_NODE_NIL) return 0;
+
+    for (cut = q->cnodes[first].type_next; cut != PKT_NODE_NIL; cut = q->cnodes[cut].type_next) {
+        if (q->cnodes[cut].flags & AV_PKT_FLAG_KEY) break;
+    }
+    if (cut == PKT_NODE_NIL) return 0;
+
+    while ((idx = q->c_head) != cut) {
+        n += compact_drop_oldest_of_type(q, q->cnodes[idx].type);
+    }
+    return n;
+}
+
+static int compact_duration_ms(PacketQueue *q, int64_t newest_pts)
+{
+    uint32_t first = q->c_type_head[PKT_TYPE_VIDEO];
+
+    if (first == PKT_NODE_NIL) return 0;
+    if (newest_pts == AV_NOPTS_VALUE) {
+        newest_pts = q->cnodes[q->c_type_tail[PKT_TYPE_VIDEO]].pts;
+    }
+    return pts_span_ms(q, q->cnodes[first].pts, newest_pts);
+}
+
+static int compact_put(PacketQueue *q, AVPacket *pkt, PacketType type)
+{
+    int64_t newest = (type == PKT_TYPE_VIDEO) ? pkt->pts : AV_NOPTS_VALUE;
+    AVBufferRef *buf;
+    CompactNode *cn;
+    uint32_t idx;
+    int dropped = 0;
+
+    // 1. 字节/时长预算
+    if (q->max_bytes > 0 || q->max_duration_ms > 0) {
+        while (q->c_head != PKT_NODE_NIL &&
+               over_budget(q, q->size_bytes + pkt->size, compact_duration_ms(q, newest))) {
+            int n = (q->evict_policy != PKT_EVICT_OLDEST) ? compact_evict_gop(q) : 0;
+            dropped += n ? n : compact_drop_head(q);
+        }
+    }
+
+    // 2. 节点池满
+    if (q->c_free[type] == PKT_NODE_NIL && type == PKT_TYPE_VIDEO && q->evict_policy != PKT_EVICT_OLDEST) {
+        dropped += compact_evict_gop(q);
+    }
+    if (q->c_free[type] == PKT_NODE_NIL) {
+        if (!compact_drop_oldest_of_type(q, type)) return -1;
+        dropped++;
+    }
+
+    // 3. 取得负载引用 (非引用计数的包需拷贝一份)
+    if (pkt->buf) {
+        buf = av_buffer_ref(pkt->buf);
+    } else {
+        buf = av_buffer_alloc(pkt->size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (buf) {
+            memcpy(buf->data, pkt->data, pkt->size);
+            memset(buf->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        }
+    }
+    if (!buf) return -1;
+
+    idx = q->c_free[type];
+    cn = &q->cnodes[idx];
+    q->c_free[type] = cn->next;
+
+    cn->buf = buf;
+    cn->data_off = pkt->buf ? (int32_t)(pkt->data - pkt->buf->data) : 0;
+    cn->size = pkt->size;
+    cn->pts = pkt->pts;
+    cn->dts = pkt->dts;
+    cn->flags = (uint16_t)pkt->flags;
+    cn->stream_index = (uint8_t)pkt->stream_index;
+    cn->enq_us = queue_stats_now_us();
+
+    // side data (如 ingest 附带的包元数据) 复制一份挂在节点上，复制失败时丢弃
+    cn->side_data = NULL;
+    cn->side_data_elems = 0;
+    if (pkt->side_data_elems > 0) {
+        AVPacket props;
+        av_init_packet(&props);
+        if (av_packet_copy_props(&props, pkt) == 0) {
+            cn->side_data = props.side_data;
+            cn->side_data_elems = (uint8_t)props.side_data_elems;
+        }
+    }
+
+    // 4. 挂到总链表和同类型链表尾部
+    cn->prev = q->c_tail;
+    cn->next = PKT_NODE_NIL;
+    cn->type_next = PKT_NODE_NIL;
+    if (q->c_tail != PKT_NODE_NIL) q->cnodes[q->c_tail].next = idx;
+    else q->c_head = idx;
+    q->c_tail = idx;
+    if (q->c_type_tail[type] != PKT_NODE_NIL) q->cnodes[q->c_type_tail[type]].type_next = idx;
+    else q->c_type_head[type] = idx;
+    q->c_type_tail[type] = idx;
+
+    q->size_bytes += cn->size;
+    if (type == PKT_TYPE_VIDEO) q->count_video++;
+    else q->count_audio++;
+    queue_stats_on_put(&q->stats, type, (type == PKT_TYPE_VIDEO) ? q->count_video : q->count_audio,
+                       q->size_bytes);
+    return dropped;
+}
+
+// 取出最旧的包并还原为 AVPacket
+static int compact_pop(PacketQueue *q, AVPacket *pkt)
+{
+    uint32_t idx = q->c_head;
+    CompactNode *cn;
+
+    if (idx == PKT_NODE_NIL) return 0;
+    cn = &q->cnodes[idx];
+
+    queue_stats_on_get(&q->stats, cn->type, cn->enq_us,
+                       (cn->type == PKT_TYPE_VIDEO) ? q->count_video : q->count_audio);
+    compact_unlink_type_head(q, cn->type);
+
+    av_init_packet(pkt);
+    pkt->buf = cn->buf; // Move ref
+    pkt->data = cn->buf->data + cn->data_off;
+    pkt->size = cn->size;
+    pkt->pts = cn->pts;
+    pkt->dts = cn->dts;
+    pkt->flags = cn->flags;
+    pkt->stream_index = cn->stream_index;
+    pkt->side_data = cn->side_data; // Move side data
+    pkt->side_data_elems = cn->side_data_elems;
+    cn->buf = NULL;
+    cn->side_data = NULL;
+    cn->side_data_elems = 0;
+
+    compact_release(q, idx);
+    return 1;
+}
+
+static void compact_flush(PacketQueue *q)
+{
+    while (q->c_head != PKT_NODE_NIL) {
+        uint32_t idx = q->c_head;
+        compact_unlink_type_head(q, q->cnodes[idx].type);
+        compact_release(q, idx);
+    }
+}
+
+static void compact_free(PacketQueue *q)
+{
+    if (!q->cnodes) return;
+    compact_flush(q);
+    free(q->cnodes);
+    q->cnodes = NULL;
 }
 
 /* ========================================================================== */
@@ -44,20 +929,54 @@ static PacketNode* remove_oldest_of_type(PacketQueue *q, PacketType type) {
 /* ========================================================================== */
 
 void packet_queue_init(PacketQueue *q, int max_video, int max_audio)
+{
+    packet_queue_init_ex(q, max_video, max_audio, PKT_QUEUE_MODE_LOCKED);
+}
+
+void packet_queue_init_ex(PacketQueue *q, int max_video, int max_audio, PacketQueueMode mode)
 {
     if (!q) return;
     if (max_video <= 0) max_video = QUEUE_CAPACITY_VIDEO_DEFAULT;
     if (max_audio <= 0) max_audio = QUEUE_CAPACITY_AUDIO_DEFAULT;
 
     memset(q, 0, sizeof(PacketQueue));
+    q->mode = mode;
+    queue_stats_reset(&q->stats);
     
     LinkList_Init(&q->active_list);
     LinkList_Init(&q->free_list_video);
     LinkList_Init(&q->free_list_audio);
+    LinkList_Init(&q->active_video);
+    LinkList_Init(&q->active_audio);
+    LinkList_Init(&q->disposable_list);
     
     pthread_mutex_init(&q->mutex, NULL);
-    pthread_cond_init(&q->cond, NULL);
+    cond_init_monotonic(&q->cond);
     q->abort_request = 0;
+
+    if (mode == PKT_QUEUE_MODE_SPSC) {
+        q->cap_video = max_video;
+        q->cap_audio = max_audio;
+        if (ring_init(&q->ring_video, max_video) < 0) {
+            LOG_ERROR(TAG, "Failed to alloc video ring (cnt=%d)\n", max_video);
+        }
+        if (ring_init(&q->ring_audio, max_audio) < 0) {
+            LOG_ERROR(TAG, "Failed to alloc audio ring (cnt=%d)\n", max_audio);
+        }
+        LOG_INFO(TAG, "Queue Inited (SPSC). VideoCap:%d, AudioCap:%d\n", max_video, max_audio);
+        return;
+    }
+
+    if (mode == PKT_QUEUE_MODE_COMPACT) {
+        q->cap_video = max_video;
+        q->cap_audio = max_audio;
+        if (compact_init(q) < 0) {
+            LOG_ERROR(TAG, "Failed to alloc compact nodes (cnt=%d)\n", max_video + max_audio);
+        }
+        LOG_INFO(TAG, "Queue Inited (COMPACT). VideoCap:%d, AudioCap:%d, %d bytes/node\n",
+                 max_video, max_audio, (int)sizeof(CompactNode));
+        return;
+    }
     
     // --- 1. Init Video Pool ---
     q->cap_video = max_video;
@@ -67,6 +986,8 @@ void packet_queue_init(PacketQueue *q, int max_video, int max_audio)
             av_init_packet(&q->pool_video[i].pkt);
             q->pool_video[i].type = PKT_TYPE_VIDEO;
             LinkList_NodeInit(&q->pool_video[i].node);
+            LinkList_NodeInit(&q->pool_video[i].type_node);
+            LinkList_NodeInit(&q->pool_video[i].evict_node);
             LinkList_PushToTail_NoLock(&q->free_list_video, &q->pool_video[i].node);
         }
     } else {
@@ -81,6 +1002,8 @@ void packet_queue_init(PacketQueue *q, int max_video, int max_audio)
             av_init_packet(&q->pool_audio[i].pkt);
             q->pool_audio[i].type = PKT_TYPE_AUDIO;
             LinkList_NodeInit(&q->pool_audio[i].node);
+            LinkList_NodeInit(&q->pool_audio[i].type_node);
+            LinkList_NodeInit(&q->pool_audio[i].evict_node);
             LinkList_PushToTail_NoLock(&q->free_list_audio, &q->pool_audio[i].node);
         }
     } else {
@@ -90,13 +1013,69 @@ void packet_queue_init(PacketQueue *q, int max_video, int max_audio)
     LOG_INFO(TAG, "Queue Inited. VideoCap:%d, AudioCap:%d\n", max_video, max_audio);
 }
 
+int packet_queue_set_evict_policy(PacketQueue *q, PacketEvictPolicy policy)
+{
+    if (!q) return -1;
+
+    if (q->mode != PKT_QUEUE_MODE_LOCKED && policy == PKT_EVICT_NONREF_FIRST) {
+        // 环形队列/紧凑节点无法从中间摘除节点
+        LOG_WARN(TAG, "NONREF_FIRST only supported in LOCKED mode, use GOP\n");
+        policy = PKT_EVICT_GOP;
+    }
+
+    pthread_mutex_lock(&q->mutex);
+    q->evict_policy = policy;
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+int packet_queue_set_budget(PacketQueue *q, int max_bytes, int max_duration_ms, AVRational time_base)
+{
+    if (!q) return -1;
+
+    pthread_mutex_lock(&q->mutex);
+    q->max_bytes = (max_bytes > 0) ? max_bytes : 0;
+    q->max_duration_ms = (max_duration_ms > 0) ? max_duration_ms : 0;
+    q->time_base = time_base;
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+int packet_queue_set_watermark(PacketQueue *q, int depth, PacketQueueWatermarkCb cb, void *opaque)
+{
+    if (!q) return -1;
+
+    pthread_mutex_lock(&q->mutex);
+    q->wm_depth  = (depth > 0 && cb) ? depth : 0;
+    q->wm_cb     = cb;
+    q->wm_opaque = opaque;
+    q->wm_armed  = 1;
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+int packet_queue_set_name(PacketQueue *q, const char *name)
+{
+    if (!q) return -1;
+    return queue_stats_register(&q->stats, name);
+}
+
 void packet_queue_destroy(PacketQueue *q)
 {
     if (!q) return;
     
+    queue_stats_unregister(&q->stats);
     packet_queue_abort(q);
+
+    if (q->mode == PKT_QUEUE_MODE_SPSC) {
+        ring_free(&q->ring_video);
+        ring_free(&q->ring_audio);
+    }
+
     pthread_mutex_lock(&q->mutex);
 
+    compact_free(q);
+
     // Free Video Pool Payloads
     if (q->pool_video) {
         for (int i = 0; i < q->cap_video; i++) {
@@ -123,23 +1102,48 @@ void packet_queue_destroy(PacketQueue *q)
     LinkList_DeInit(&q->active_list);
     LinkList_DeInit(&q->free_list_video);
     LinkList_DeInit(&q->free_list_audio);
+    LinkList_DeInit(&q->active_video);
+    LinkList_DeInit(&q->active_audio);
+    LinkList_DeInit(&q->disposable_list);
 }
 
 void packet_queue_abort(PacketQueue *q)
 {
     if (!q) return;
     pthread_mutex_lock(&q->mutex);
-    q->abort_request = 1;
+    __atomic_store_n(&q->abort_request, 1, __ATOMIC_SEQ_CST);
     pthread_cond_broadcast(&q->cond);
     pthread_mutex_unlock(&q->mutex);
+
+    if (q->mode == PKT_QUEUE_MODE_SPSC) {
+        spsc_wake(q, 1);
+    }
 }
 
-void packet_queue_get_stats(PacketQueue *q, int *size, int *nb_packets)
+void packet_queue_get_stats(PacketQueue *q, int *size, int *nb_packets, int *duration_ms)
 {
     if (!q) return;
+    if (q->mode == PKT_QUEUE_MODE_SPSC) {
+        if (size)        *size        = __atomic_load_n(&q->size_bytes, __ATOMIC_RELAXED);
+        if (nb_packets)  *nb_packets  = (int)(ring_count(&q->ring_video) + ring_count(&q->ring_audio));
+        if (duration_ms) *duration_ms = spsc_duration_ms(q, AV_NOPTS_VALUE);
+        return;
+    }
     pthread_mutex_lock(&q->mutex);
-    if (size)       *size       = q->size_bytes;
-    if (nb_packets) *nb_packets = q->count_video + q->count_audio;
+    if (size)        *size        = q->size_bytes;
+    if (nb_packets)  *nb_packets  = q->count_video + q->count_audio;
+    if (duration_ms) *duration_ms = (q->mode == PKT_QUEUE_MODE_COMPACT) ?
+                                    compact_duration_ms(q, AV_NOPTS_VALUE) :
+                                    locked_duration_ms(q, AV_NOPTS_VALUE);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+void packet_queue_get_drop_stats(PacketQueue *q, uint32_t *dropped_video, uint32_t *dropped_audio)
+{
+    if (!q) return;
+    pthread_mutex_lock(&q->mutex);
+    if (dropped_video) *dropped_video = __atomic_load_n(&q->dropped_video, __ATOMIC_RELAXED);
+    if (dropped_audio) *dropped_audio = __atomic_load_n(&q->dropped_audio, __ATOMIC_RELAXED);
     pthread_mutex_unlock(&q->mutex);
 }
 
@@ -151,7 +1155,18 @@ void packet_queue_flush(PacketQueue *q)
 
     if (!q) return;
 
+    if (q->mode == PKT_QUEUE_MODE_SPSC) {
+        spsc_flush(q);
+        return;
+    }
+
     pthread_mutex_lock(&q->mutex);
+
+    if (q->mode == PKT_QUEUE_MODE_COMPACT) {
+        compact_flush(q);
+        pthread_mutex_unlock(&q->mutex);
+        return;
+    }
     
     // 循环取出所有节点并归还到 FreeList
     while (1) {
@@ -161,6 +1176,8 @@ void packet_queue_flush(PacketQueue *q)
         }
 
         pnode = (PacketNode *)node;
+        list_unlink(&pnode->type_node);
+        list_unlink(&pnode->evict_node);
         q->size_bytes -= pnode->pkt.size;
         
         // 释放数据负载 (Data Payload)
@@ -189,12 +1206,18 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt, PacketType type)
     ListNode *node = NULL;
     LinkList *target_free_list = NULL;
     int dropped = 0;
+    int depth, fire;
 
     if (!q || !pkt) return -1;
     if (type != PKT_TYPE_VIDEO && type != PKT_TYPE_AUDIO) {
         type = PKT_TYPE_VIDEO; // Default
     }
 
+    if (q->mode == PKT_QUEUE_MODE_SPSC) {
+        if (__atomic_load_n(&q->abort_request, __ATOMIC_ACQUIRE)) return -1;
+        return spsc_put(q, pkt, type);
+    }
+
     pthread_mutex_lock(&q->mutex);
 
     if (q->abort_request) {
@@ -202,6 +1225,24 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt, PacketType type)
         return -1;
     }
 
+    if (q->mode == PKT_QUEUE_MODE_COMPACT) {
+        dropped = q->cnodes ? compact_put(q, pkt, type) : -1;
+        if (dropped >= 0) pthread_cond_signal(&q->cond);
+        depth = q->count_video + q->count_audio;
+        fire = (dropped >= 0) && watermark_hit(q, depth);
+        pthread_mutex_unlock(&q->mutex);
+        if (fire) q->wm_cb(q->wm_opaque, depth);
+        if (dropped > 0) {
+            static int compact_log_cnt = 0;
+            if (compact_log_cnt++ % 100 == 0) {
+                LOG_WARN(TAG, "Queue Full (%s), dropped %d! Dropped V:%u A:%u\n",
+                         (type == PKT_TYPE_VIDEO) ? "Video" : "Audio", dropped,
+                         q->dropped_video, q->dropped_audio);
+            }
+        }
+        return (dropped < 0) ? -1 : 0;
+    }
+
     // 1. Select Free List
     if (type == PKT_TYPE_VIDEO) {
         target_free_list = &q->free_list_video;
@@ -209,9 +1250,24 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt, PacketType type)
         target_free_list = &q->free_list_audio;
     }
 
-    // 2. Try to get free node
+    // 2. Enforce byte / duration budget
+    if (q->max_bytes > 0 || q->max_duration_ms > 0) {
+        dropped = evict_budget(q, pkt, type);
+    }
+
+    // 3. Try to get free node
     LinkList_PopFromHead_NoLock(target_free_list, &node);
 
+    if (node == NULL && type == PKT_TYPE_VIDEO && q->evict_policy != PKT_EVICT_OLDEST) {
+        // --- Pool FULL ---
+        // 策略：先丢非参考帧 / 整 GOP 丢弃，避免残缺 GOP 造成花屏
+        int n = evict_video(q);
+        if (n) {
+            dropped += n;
+            LinkList_PopFromHead_NoLock(target_free_list, &node);
+        }
+    }
+
     if (node == NULL) {
         // --- Pool FULL ---
         // 策略：丢弃同类型最旧的包 (Smart Drop)
@@ -222,10 +1278,17 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt, PacketType type)
             q->size_bytes -= pnode->pkt.size;
             av_packet_unref(&pnode->pkt);
             
-            if (type == PKT_TYPE_VIDEO) q->count_video--;
-            else q->count_audio--;
+            if (type == PKT_TYPE_VIDEO) {
+                q->count_video--;
+                q->dropped_video++;
+                queue_stats_on_evict(&q->stats, PKT_TYPE_VIDEO, 1);
+            } else {
+                q->count_audio--;
+                q->dropped_audio++;
+                queue_stats_on_evict(&q->stats, PKT_TYPE_AUDIO, 1);
+            }
             
-            dropped = 1;
+            dropped++;
             node = (ListNode*)pnode; // Reuse node
         } else {
             pthread_mutex_unlock(&q->mutex);
@@ -236,7 +1299,7 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt, PacketType type)
 
     pnode = (PacketNode *)node;
 
-    // 3. Move data
+    // 4. Move data
     if (av_packet_ref(&pnode->pkt, pkt) < 0) {
         LinkList_PushToTail_NoLock(target_free_list, node);
         pthread_mutex_unlock(&q->mutex);
@@ -245,22 +1308,37 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt, PacketType type)
     
     pnode->type = type;
 
-    // 4. Add to Active List
+    // 5. Add to Active List (总顺序 + 同类型子链表)
     LinkList_PushToTail_NoLock(&q->active_list, node);
+    LinkList_PushToTail_NoLock(active_list_of_type(q, type), &pnode->type_node);
+    if (type == PKT_TYPE_VIDEO && q->evict_policy == PKT_EVICT_NONREF_FIRST &&
+        (pnode->pkt.flags & AV_PKT_FLAG_DISPOSABLE)) {
+        LinkList_PushToTail_NoLock(&q->disposable_list, &pnode->evict_node);
+    }
     
+    pnode->enq_us = queue_stats_now_us();
     q->size_bytes += pnode->pkt.size;
     if (type == PKT_TYPE_VIDEO) q->count_video++;
     else q->count_audio++;
+    queue_stats_on_put(&q->stats, type, (type == PKT_TYPE_VIDEO) ? q->count_video : q->count_audio,
+                       q->size_bytes);
+
+    depth = q->count_video + q->count_audio;
+    fire = watermark_hit(q, depth);
 
     pthread_cond_signal(&q->cond);
     pthread_mutex_unlock(&q->mutex);
 
+    // 回调在锁外执行，可安全调用本队列的 get/get_stats
+    if (fire) q->wm_cb(q->wm_opaque, depth);
+
     if (dropped) {
         static int log_cnt = 0;
         if (log_cnt++ % 100 == 0) {
-            LOG_WARN(TAG, "Queue Full (%s), dropped oldest! V:%d/%d A:%d/%d\n", 
-                     (type == PKT_TYPE_VIDEO) ? "Video" : "Audio",
-                     q->count_video, q->cap_video, q->count_audio, q->cap_audio);
+            LOG_WARN(TAG, "Queue Full (%s), dropped %d! V:%d/%d A:%d/%d Dropped V:%u A:%u\n", 
+                     (type == PKT_TYPE_VIDEO) ? "Video" : "Audio", dropped,
+                     q->count_video, q->cap_video, q->count_audio, q->cap_audio,
+                     q->dropped_video, q->dropped_audio);
         }
     }
 
@@ -269,12 +1347,14 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt, PacketType type)
 
 int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block)
 {
-    ListNode *node = NULL;
-    PacketNode *pnode = NULL;
     int ret = -1;
 
     if (!q) return -1;
 
+    if (q->mode == PKT_QUEUE_MODE_SPSC) {
+        return spsc_get(q, pkt, block);
+    }
+
     pthread_mutex_lock(&q->mutex);
 
     for (;;) {
@@ -283,30 +1363,7 @@ int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block)
             break;
         }
 
-        // Pop from head (FIFO)
-        LinkList_PopFromHead_NoLock(&q->active_list, &node);
-
-        if (node != NULL) {
-            pnode = (PacketNode *)node;
-            
-            q->size_bytes -= pnode->pkt.size;
-            if (pnode->type == PKT_TYPE_VIDEO) q->count_video--;
-            else q->count_audio--;
-
-            *pkt = pnode->pkt; // Move data
-            
-            // Reset node
-            av_init_packet(&pnode->pkt); 
-            pnode->pkt.data = NULL;
-            pnode->pkt.size = 0;
-            
-            // Return to Free List
-            if (pnode->type == PKT_TYPE_VIDEO) {
-                LinkList_PushToTail_NoLock(&q->free_list_video, node);
-            } else {
-                LinkList_PushToTail_NoLock(&q->free_list_audio, node);
-            }
-            
+        if (locked_pop(q, pkt)) {
             ret = 1;
             break;
         } else if (!block) {
@@ -320,3 +1377,87 @@ int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block)
     pthread_mutex_unlock(&q->mutex);
     return ret;
 }
+
+int packet_queue_get_until(PacketQueue *q, AVPacket *pkt, int64_t deadline_us)
+{
+    struct timespec deadline;
+    int ret = -1;
+
+    if (!q || !pkt) return -1;
+
+    if (q->mode == PKT_QUEUE_MODE_SPSC) {
+        return spsc_get_until(q, pkt, deadline_us);
+    }
+
+    deadline.tv_sec  = deadline_us / 1000000;
+    deadline.tv_nsec = (long)(deadline_us % 1000000) * 1000L;
+
+    pthread_mutex_lock(&q->mutex);
+
+    for (;;) {
+        if (q->abort_request) {
+            ret = -1;
+            break;
+        }
+
+        if (locked_pop(q, pkt)) {
+            ret = 1;
+            break;
+        }
+
+        if (pthread_cond_timedwait(&q->cond, &q->mutex, &deadline) == ETIMEDOUT) {
+            // 超时与入队同时发生时仍取走该包
+            ret = q->abort_request ? -1 : locked_pop(q, pkt);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&q->mutex);
+    return ret;
+}
+
+int packet_queue_get_timeout(PacketQueue *q, AVPacket *pkt, int timeout_ms)
+{
+    if (timeout_ms <= 0) return packet_queue_get(q, pkt, timeout_ms < 0);
+    return packet_queue_get_until(q, pkt, queue_stats_now_us() + (int64_t)timeout_ms * 1000);
+}
+
+int packet_queue_get_batch(PacketQueue *q, AVPacket *pkts, int max, int timeout_ms)
+{
+    struct timespec deadline;
+    int n = 0;
+
+    if (!q || !pkts || max <= 0) return -1;
+
+    if (q->mode == PKT_QUEUE_MODE_SPSC) {
+        return spsc_get_batch(q, pkts, max, timeout_ms);
+    }
+
+    if (timeout_ms > 0) deadline_after_ms(&deadline, CLOCK_MONOTONIC, timeout_ms);
+
+    pthread_mutex_lock(&q->mutex);
+
+    for (;;) {
+        int avail;
+
+        if (q->abort_request) {
+            pthread_mutex_unlock(&q->mutex);
+            return -1;
+        }
+
+        avail = q->count_video + q->count_audio;
+        if (avail >= max || timeout_ms == 0 || (avail > 0 && timeout_ms < 0)) break;
+
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&q->cond, &q->mutex);
+        } else if (pthread_cond_timedwait(&q->cond, &q->mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    // 一次加锁取走全部可用的包
+    while (n < max && locked_pop(q, &pkts[n])) n++;
+
+    pthread_mutex_unlock(&q->mutex);
+    return n;
+}
@@ -0,0 +1,235 @@
+#include "queue_stats.h"
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+#ifndef TAG
+#define TAG "QSTATS"
+#endif
+
+static QueueStats *g_registry[QUEUE_STATS_MAX];
+static pthread_mutex_t g_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* ========================================================================== */
+/* 直方图 */
+/* ========================================================================== */
+
+static int hist_index(uint32_t v)
+{
+    int msb;
+
+    if (v < QS_HIST_LINEAR) return (int)v;
+    msb = 31 - __builtin_clz(v);
+    return QS_HIST_LINEAR + (msb - 4) * (1 << QS_HIST_SUB_BITS) +
+           (int)((v >> (msb - QS_HIST_SUB_BITS)) & ((1 << QS_HIST_SUB_BITS) - 1));
+}
+
+// 桶的上界 (输出分位数时取保守值)
+static uint32_t hist_upper(int idx)
+{
+    int msb, sub;
+    uint64_t lo;
+
+    if (idx < QS_HIST_LINEAR) return (uint32_t)idx;
+    msb = 4 + (idx - QS_HIST_LINEAR) / (1 << QS_HIST_SUB_BITS);
+    sub = (idx - QS_HIST_LINEAR) % (1 << QS_HIST_SUB_BITS);
+    lo  = (uint64_t)((1 << QS_HIST_SUB_BITS) + sub) << (msb - QS_HIST_SUB_BITS);
+    lo += ((uint64_t)1 << (msb - QS_HIST_SUB_BITS)) - 1;
+    return (lo > UINT32_MAX) ? UINT32_MAX : (uint32_t)lo;
+}
+
+static void hist_record(QsHistogram *h, uint32_t v)
+{
+    uint32_t old;
+
+    __atomic_add_fetch(&h->buckets[hist_index(v)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+
+    old = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (v > old && !__atomic_compare_exchange_n(&h->max, &old, v, 1,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static uint32_t hist_percentile(QsHistogram *h, double pct)
+{
+    uint32_t total = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    uint64_t want, acc = 0;
+    int i;
+
+    if (total == 0) return 0;
+    want = (uint64_t)(total * pct / 100.0);
+    if (want == 0) want = 1;
+
+    for (i = 0; i < QS_HIST_BUCKETS; i++) {
+        acc += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+        if (acc >= want) return hist_upper(i);
+    }
+    return __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+static void update_hw(int *hw, int v)
+{
+    int old = __atomic_load_n(hw, __ATOMIC_RELAXED);
+    while (v > old && !__atomic_compare_exchange_n(hw, &old, v, 1,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* ========================================================================== */
+/* API 实现 */
+/* ========================================================================== */
+
+int64_t queue_stats_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void queue_stats_reset(QueueStats *s)
+{
+    if (!s) return;
+    s->bytes_hw = 0;
+    memset(s->type, 0, sizeof(s->type));
+    memset(s->last_puts, 0, sizeof(s->last_puts));
+    memset(s->last_gets, 0, sizeof(s->last_gets));
+    s->last_dump_us = queue_stats_now_us();
+}
+
+void queue_stats_on_put(QueueStats *s, int type, int depth_pkts, int depth_bytes)
+{
+    QsTypeStats *t = &s->type[type ? 1 : 0];
+
+    __atomic_add_fetch(&t->puts, 1, __ATOMIC_RELAXED);
+    update_hw(&t->depth_hw, depth_pkts);
+    update_hw(&s->bytes_hw, depth_bytes);
+}
+
+void queue_stats_on_get(QueueStats *s, int type, int64_t enq_us, int depth_pkts)
+{
+    QsTypeStats *t = &s->type[type ? 1 : 0];
+    int64_t d = queue_stats_now_us() - enq_us;
+
+    if (d < 0) d = 0;
+    if (d > UINT32_MAX) d = UINT32_MAX;
+
+    __atomic_add_fetch(&t->gets, 1, __ATOMIC_RELAXED);
+    hist_record(&t->residence_us, (uint32_t)d);
+    update_hw(&t->depth_hw, depth_pkts);
+}
+
+void queue_stats_on_evict(QueueStats *s, int type, int n)
+{
+    __atomic_add_fetch(&s->type[type ? 1 : 0].evicts, (uint32_t)n, __ATOMIC_RELAXED);
+}
+
+int queue_stats_register(QueueStats *s, const char *name)
+{
+    int i, ret = -1;
+
+    if (!s) return -1;
+
+    pthread_mutex_lock(&g_registry_mutex);
+    if (s->registered) {
+        ret = 0;
+    } else {
+        for (i = 0; i < QUEUE_STATS_MAX; i++) {
+            if (g_registry[i] == NULL) {
+                g_registry[i] = s;
+                s->registered = 1;
+                ret = 0;
+                break;
+            }
+        }
+    }
+    if (ret == 0) {
+        snprintf(s->name, sizeof(s->name), "%s", name ? name : "queue");
+        if (s->last_dump_us == 0) s->last_dump_us = queue_stats_now_us();
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+
+    if (ret < 0) LOG_WARN(TAG, "Stats registry full, %s not registered\n", name ? name : "queue");
+    return ret;
+}
+
+void queue_stats_unregister(QueueStats *s)
+{
+    int i;
+
+    if (!s) return;
+
+    pthread_mutex_lock(&g_registry_mutex);
+    if (s->registered) {
+        for (i = 0; i < QUEUE_STATS_MAX; i++) {
+            if (g_registry[i] == s) {
+                g_registry[i] = NULL;
+                break;
+            }
+        }
+        s->registered = 0;
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+}
+
+void queue_stats_dump(QueueStats *s, FILE *fp)
+{
+    static const char *type_name[2] = { "video", "audio" };
+    int64_t now = queue_stats_now_us();
+    double dt = (now - s->last_dump_us) / 1000000.0;
+    int i;
+
+    fprintf(fp, "[%s] window %.1fs bytes_hw %d\n", s->name, dt,
+            __atomic_load_n(&s->bytes_hw, __ATOMIC_RELAXED));
+
+    for (i = 0; i < 2; i++) {
+        QsTypeStats *t = &s->type[i];
+        uint32_t puts = __atomic_load_n(&t->puts, __ATOMIC_RELAXED);
+        uint32_t gets = __atomic_load_n(&t->gets, __ATOMIC_RELAXED);
+
+        fprintf(fp, "  %s put %u (%.1f/s) get %u (%.1f/s) evict %u depth_hw %d\n",
+                type_name[i],
+                puts, dt > 0 ? (puts - s->last_puts[i]) / dt : 0.0,
+                gets, dt > 0 ? (gets - s->last_gets[i]) / dt : 0.0,
+                __atomic_load_n(&t->evicts, __ATOMIC_RELAXED),
+                __atomic_load_n(&t->depth_hw, __ATOMIC_RELAXED));
+        fprintf(fp, "        residence_us p50 %u p90 %u p99 %u p99.9 %u max %u\n",
+                hist_percentile(&t->residence_us, 50.0),
+                hist_percentile(&t->residence_us, 90.0),
+                hist_percentile(&t->residence_us, 99.0),
+                hist_percentile(&t->residence_us, 99.9),
+                __atomic_load_n(&t->residence_us.max, __ATOMIC_RELAXED));
+
+        s->last_puts[i] = puts;
+        s->last_gets[i] = gets;
+    }
+    s->last_dump_us = now;
+}
+
+int queue_stats_dump_all(const char *path)
+{
+    FILE *fp;
+    int i, n = 0;
+
+    if (!path) path = QUEUE_STATS_DUMP_FILE;
+    fp = fopen(path, "w");
+    if (!fp) {
+        LOG_ERROR(TAG, "Open %s failed\n", path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_registry_mutex);
+    for (i = 0; i < QUEUE_STATS_MAX; i++) {
+        if (g_registry[i]) {
+            queue_stats_dump(g_registry[i], fp);
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+
+    fclose(fp);
+    LOG_INFO(TAG, "Dumped %d queue stats to %s\n", n, path);
+    return n;
+}
@@ -18,6 +18,7 @@
 #include "storage.h"
 #include "record.h"
 #include "packet_queue.h"
+#include "packet_meta.h"
 
 #define TAG "RECORD"
 
@@ -33,14 +34,32 @@
 // 定义 I/O 错误后的冷却时间 (ms)
 #define IO_ERROR_COOLDOWN_MS 3000
 
+// 每次从广播队列批量取包的上限 (积压追赶时一次加锁取走一批)
+#define RECORD_BATCH_MAX 32
+
+// 1 = 分段经写后缓冲由 Record IO 线程落盘 (record_io.h)，SD 卡写停顿不阻塞录像线程
+// 0 = muxer 直接 avio_open 写文件
+#define ENABLE_RECORD_WRITE_BEHIND 1
+
+// 1 = 所有通道由一个共享录像线程轮流 mux (减少线程数，SD 卡写入不再多路交错)
+// 0 = 每路一个 Record_Thread
+#define ENABLE_SHARED_RECORDER 0
+// 共享录像线程所有通道都无数据时的等待时间
+#define RECORD_SHARED_IDLE_MS 20
+
+// 1 = 分段写入卡上预分配的定长槽位文件并环形覆盖 (record_store.h)，需要写后缓冲；
+//     槽位池未建好/卡未挂载时仍按 CAMn 目录逐个建文件
+#define ENABLE_RECORD_STORE 1
+
+// 1 = CAMn 下的分段按可用空间水位从最旧的开始删除 (record_retention.h)
+#define ENABLE_RECORD_RETENTION 1
+
+// 1 = 分段关闭时登记到卡上的录像目录 (record_catalog.h)，回放按时间查找不再扫描目录
+#define ENABLE_RECORD_CATALOG 1
+
 // AAC 标准帧大小
 #define AAC_FRAME_SIZE_DEFAULT 1024
 
-// H.264 NAL Unit Types
-#define NAL_TYPE_SLICE_IDR 5
-#define NAL_TYPE_SPS       7
-#define NAL_TYPE_PPS       8
-
 /* ========================================================================== */
 /* 调试辅助函数                                                               */
 /* ========================================================================== */
@@ -65,13 +84,6 @@ static void LogHex(const char *func, const char *desc, const uint8_t *data, int
 /* 结构体定义                                                                 */
 /* ========================================================================== */
 
-// 简单的位读取辅助结构
-typedef struct {
-    const uint8_t *p;
-    int size;   // bytes
-    int bit;    // bit position
-} BitReader;
-
 static int64_t NowMsMonotonic(void)
 {
     struct timespec ts;
@@ -79,72 +91,6 @@ static int64_t NowMsMonotonic(void)
     return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-static inline unsigned BrReadBit(BitReader *b)
-{
-    unsigned v;
-    if (!b || b->bit >= (b->size * 8)) {
-        return 0;
-    }
-    v = (b->p[b->bit >> 3] >> (7 - (b->bit & 7))) & 1;
-    b->bit++;
-    return v;
-}
-
-static inline unsigned BrReadBits(BitReader *b, int n)
-{
-    unsigned v = 0;
-    int i;
-    for (i = 0; i < n; i++) {
-        v = (v << 1) | BrReadBit(b);
-    }
-    return v;
-}
-
-static unsigned BrReadUe(BitReader *b)
-{
-    unsigned zeros = 0;
-    unsigned info = 0;
-    unsigned i;
-
-    while (BrReadBit(b) == 0 && zeros < 32) {
-        zeros++;
-    }
-
-    for (i = 0; i < zeros; i++) {
-        info = (info << 1) | BrReadBit(b);
-    }
-
-    return ((1U << zeros) - 1U) + info;
-}
-
-static inline int BrReadSe(BitReader *b)
-{
-    unsigned ue = BrReadUe(b);
-    return (ue & 1) ? (int)((ue + 1) / 2) : -(int)(ue / 2);
-}
-
-static int EbspToRbsp(uint8_t *dst, const uint8_t *src, int n)
-{
-    int di = 0;
-    int zeros = 0;
-    int i;
-
-    for (i = 0; i < n; i++) {
-        uint8_t v = src[i];
-        if (zeros >= 2 && v == 0x03) {
-            zeros = 0;
-            continue; // Skip Emulation Prevention Byte
-        }
-        dst[di++] = v;
-        if (v == 0x00) {
-            zeros++;
-        } else {
-            zeros = 0;
-        }
-    }
-    return di;
-}
-
 /* ========================================================================== */
 /* 时间戳处理逻辑                                                             */
 /* ========================================================================== */
@@ -264,221 +210,146 @@ static void ResetTsState(RecordCtx *ctx)
 }
 
 /* ========================================================================== */
-/* H.264 / AAC 解析逻辑                                                       */
+/* H.264 / H.265 / AAC 解析逻辑                                              */
 /* ========================================================================== */
 
-static int FindStartCode(const uint8_t *p, int from, int size, int *sc_size)
+// 从包元数据中取一个参数集 NAL (含起始码)，元数据由 Stream_RtspThread 解析并随包附带
+static void CopyParamSet(const PacketMeta *m, int index, const AVPacket *pkt, uint8_t *dst, int *dst_sz, int cap)
 {
-    int i;
-    for (i = from; i + 3 < size; i++) {
-        if (p[i] == 0x00 && p[i+1] == 0x00) {
-            if (p[i+2] == 0x01) {
-                *sc_size = 3;
-                return i;
-            }
-            if (i + 4 < size && p[i+2] == 0x00 && p[i+3] == 0x01) {
-                *sc_size = 4;
-                return i;
-            }
-        }
-    }
-    return -1;
+    const NalUnitInfo *u;
+    int nal_size, copy_len;
+
+    if (index < 0) return;
+    u = &m->nal.nal[index];
+    nal_size = (int)(u->size + u->sc_size);
+    copy_len = (nal_size > cap) ? cap : nal_size;
+    memcpy(dst, pkt->data + u->offset - u->sc_size, copy_len);
+    *dst_sz = copy_len;
 }
 
-static int H264IsIframeNal(const uint8_t *nal, int nal_len)
+// VPS 仅 H.265 有
+static void CollectParamSets(const PacketMeta *m, const AVPacket *pkt, uint8_t *vps, int *vps_sz, int vps_cap,
+                             uint8_t *sps, int *sps_sz, int sps_cap, uint8_t *pps, int *pps_sz, int pps_cap)
 {
-    int nal_type;
-    uint8_t rbsp[128];
-    int pay;
-    int rbsp_len;
-    BitReader br;
-    unsigned slice_type;
-
-    if (!nal || nal_len < 2) return 0;
-    nal_type = nal[0] & 0x1F;
-    if (nal_type == NAL_TYPE_SLICE_IDR) return 1;
-    if (nal_type != 1) return 0;
+    CopyParamSet(m, m->vps, pkt, vps, vps_sz, vps_cap);
+    CopyParamSet(m, m->sps, pkt, sps, sps_sz, sps_cap);
+    CopyParamSet(m, m->pps, pkt, pps, pps_sz, pps_cap);
+}
 
-    pay = nal_len - 1;
-    if (pay > sizeof(rbsp)) pay = sizeof(rbsp);
+static int VideoIsIframePkt(const AVPacket *pkt, enum AVCodecID codec_id)
+{
+    PacketMeta tmp;
 
-    rbsp_len = EbspToRbsp(rbsp, nal + 1, pay);
-    br.p = rbsp; br.size = rbsp_len; br.bit = 0;
-    
-    BrReadUe(&br); 
-    slice_type = BrReadUe(&br);
-    slice_type %= 5;
-    return (slice_type == 2 || slice_type == 4);
+    if (!pkt || !pkt->data || pkt->size < 5) return 0;
+    return PKT_META_IS_INTRA(packet_meta_get(pkt, codec_id, &tmp));
 }
 
-static int H264IsIframeAnnexb(const uint8_t *p, int n)
+// 由 Annex-B 的 VPS/SPS/PPS 生成 hvcC (ISO/IEC 14496-15)，NAL 长度字段固定 4 字节
+static int HevcBuildHvcc(const uint8_t *annexb, int size, uint8_t **out, int *out_size)
 {
-    int scsz = 0, pos = 0;
-    if (!p || n < 5) return 0;
-    
-    while (1) {
-        int sc = FindStartCode(p, pos, n, &scsz);
-        int nal_start;
-        int scsz2 = 0;
-        int sc2;
-        int nal_end;
-        
-        if (sc < 0) break;
-        nal_start = sc + scsz;
-        if (nal_start >= n) break;
-        
-        sc2 = FindStartCode(p, nal_start, n, &scsz2);
-        nal_end = (sc2 >= 0) ? sc2 : n;
-        
-        if (H264IsIframeNal(&p[nal_start], nal_end - nal_start)) return 1;
-        pos = nal_end;
-        if (pos >= n) break;
-    }
-    return 0;
+    PacketMeta m;
+    HevcSpsInfo si;
+    const NalUnitInfo *sps;
+    int8_t order[3];
+    uint8_t *ex, *p;
+    int i, total;
+
+    if (packet_meta_parse_hevc(&m, annexb, size) <= 0 || m.vps < 0 || m.sps < 0 || m.pps < 0) return -1;
+    sps = &m.nal.nal[m.sps];
+    if (sps->size <= 2 || packet_meta_hevc_sps_parse(annexb + sps->offset + 2, (int)sps->size - 2, &si) != 0) return -1;
+    order[0] = m.vps;
+    order[1] = m.sps;
+    order[2] = m.pps;
+
+    total = 23;
+    for (i = 0; i < 3; i++) total += 5 + (int)m.nal.nal[(int)order[i]].size;
+
+    ex = av_mallocz(total + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!ex) return -1;
+
+    p = ex;
+    *p++ = 1;                                   // configurationVersion
+    memcpy(p, si.ptl, 12);                      // profile / 兼容标志 / 约束标志 / level
+    p += 12;
+    *p++ = 0xF0; *p++ = 0x00;                   // min_spatial_segmentation_idc = 0
+    *p++ = 0xFC;                                // parallelismType = 0
+    *p++ = 0xFC | si.chroma_format_idc;
+    *p++ = 0xF8 | si.bit_depth_luma_minus8;
+    *p++ = 0xF8 | si.bit_depth_chroma_minus8;
+    *p++ = 0x00; *p++ = 0x00;                   // avgFrameRate
+    *p++ = (uint8_t)(((si.max_sub_layers & 0x07) << 3) | ((si.temporal_id_nesting & 0x01) << 2) | 0x03);
+    *p++ = 3;                                   // numOfArrays: VPS / SPS / PPS
+    for (i = 0; i < 3; i++) {
+        const NalUnitInfo *u = &m.nal.nal[(int)order[i]];
+        *p++ = 0x80 | NAL_HEVC_TYPE(u);         // array_completeness = 1
+        *p++ = 0x00; *p++ = 0x01;               // numNalus
+        *p++ = (uint8_t)(u->size >> 8);
+        *p++ = (uint8_t)u->size;
+        memcpy(p, annexb + u->offset, u->size);
+        p += u->size;
+    }
+
+    *out = ex;
+    *out_size = total;
+    return 0;
 }
 
-static void H264CollectSpsPps(const uint8_t *p, int n, uint8_t *sps, int *sps_sz, int sps_cap, uint8_t *pps, int *pps_sz, int pps_cap)
-{
-    int scsz = 0, pos = 0;
-    while (1) {
-        int sc = FindStartCode(p, pos, n, &scsz);
-        int nal_start;
-        int scsz2 = 0;
-        int sc2;
-        int nal_end;
-        int nal_size;
-
-        if (sc < 0) break;
-        nal_start = sc + scsz;
-        sc2 = FindStartCode(p, nal_start, n, &scsz2);
-        nal_end = (sc2 >= 0) ? sc2 : n;
-        nal_size = nal_end - sc;
-
-        if (nal_start < n && nal_size > 0) {
-            int nal_type = p[nal_start] & 0x1F;
-            if (nal_type == NAL_TYPE_SPS) {
-                int copy_len = (nal_size > sps_cap) ? sps_cap : nal_size;
-                memcpy(sps, &p[sc], copy_len);
-                *sps_sz = copy_len;
-            } else if (nal_type == NAL_TYPE_PPS) {
-                int copy_len = (nal_size > pps_cap) ? pps_cap : nal_size;
-                memcpy(pps, &p[sc], copy_len);
-                *pps_sz = copy_len;
-            }
-        }
-        pos = nal_end;
-        if (pos >= n) break;
-    }
+static uint8_t *PutLengthPrefixedNal(uint8_t *dst, const uint8_t *nal, uint32_t size)
+{
+    dst[0] = (uint8_t)(size >> 24);
+    dst[1] = (uint8_t)(size >> 16);
+    dst[2] = (uint8_t)(size >> 8);
+    dst[3] = (uint8_t)size;
+    memcpy(dst + 4, nal, size);
+    return dst + 4 + size;
 }
 
-static int H264ParseSpsWh(const uint8_t *sps_payload, int sps_len, int *w, int *h)
-{
-    uint8_t rbsp[512];
-    int rbsp_len;
-    BitReader br;
-    unsigned profile_idc;
-    unsigned chroma_format_idc = 1;
-    unsigned separate_colour_plane_flag = 0;
-    unsigned pic_width_in_mbs_minus1;
-    unsigned pic_height_in_map_units_minus1;
-    unsigned frame_mbs_only_flag;
-    unsigned frame_cropping_flag;
-    unsigned crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
-    int width, height;
-    int sub_width_c = 1, sub_height_c = 1;
-    int crop_unit_x, crop_unit_y;
-    int i;
-
-    if (!sps_payload || sps_len <= 0) return -1;
-    if (sps_len > sizeof(rbsp)) sps_len = sizeof(rbsp);
-
-    rbsp_len = EbspToRbsp(rbsp, sps_payload, sps_len);
-    br.p = rbsp; br.size = rbsp_len; br.bit = 0;
-
-    profile_idc = BrReadBits(&br, 8);
-    BrReadBits(&br, 8); // constraint_set_flags
-    BrReadBits(&br, 8); // level_idc
-    BrReadUe(&br);      // seq_parameter_set_id
-
-    if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 ||
-        profile_idc == 244 || profile_idc == 44 || profile_idc == 83 ||
-        profile_idc == 86 || profile_idc == 118 || profile_idc == 128 ||
-        profile_idc == 138 || profile_idc == 139 || profile_idc == 134) {
-
-        chroma_format_idc = BrReadUe(&br);
-        if (chroma_format_idc == 3) {
-            separate_colour_plane_flag = BrReadBit(&br);
-        }
-        BrReadUe(&br); // bit_depth_luma_minus8
-        BrReadUe(&br); // bit_depth_chroma_minus8
-        BrReadBit(&br); // qpprime_y_zero_transform_bypass_flag
-
-        if (BrReadBit(&br)) { // seq_scaling_matrix_present_flag
-            int scaling_list_count = (chroma_format_idc != 3) ? 8 : 12;
-            for (i = 0; i < scaling_list_count; i++) {
-                if (BrReadBit(&br)) {
-                    int size = (i < 6) ? 16 : 64;
-                    int last = 8, next = 8, j;
-                    for (j = 0; j < size; j++) {
-                        if (next != 0) {
-                            int delta = BrReadSe(&br);
-                            next = (last + delta + 256) % 256;
-                        }
-                        last = (next == 0) ? last : next;
-                    }
-                }
-            }
-        }
-    }
-
-    BrReadUe(&br); // log2_max_frame_num_minus4
-    unsigned pic_order_cnt_type = BrReadUe(&br);
-
-    if (pic_order_cnt_type == 0) {
-        BrReadUe(&br); // log2_max_pic_order_cnt_lsb_minus4
-    } else if (pic_order_cnt_type == 1) {
-        BrReadBit(&br); 
-        BrReadSe(&br);  
-        BrReadSe(&br);  
-        unsigned num = BrReadUe(&br);
-        for (unsigned i = 0; i < num; i++) BrReadSe(&br);
-    }
-
-    BrReadUe(&br); // max_num_ref_frames
-    BrReadBit(&br); // gaps_in_frame_num_value_allowed_flag
-
-    pic_width_in_mbs_minus1 = BrReadUe(&br);
-    pic_height_in_map_units_minus1 = BrReadUe(&br);
-    frame_mbs_only_flag = BrReadBit(&br);
-
-    if (!frame_mbs_only_flag) BrReadBit(&br); // mb_adaptive_frame_field_flag
-    BrReadBit(&br); // direct_8x8_inference_flag
-
-    frame_cropping_flag = BrReadBit(&br);
-    if (frame_cropping_flag) {
-        crop_left = BrReadUe(&br);
-        crop_right = BrReadUe(&br);
-        crop_top = BrReadUe(&br);
-        crop_bottom = BrReadUe(&br);
-    }
-
-    width = (pic_width_in_mbs_minus1 + 1) * 16;
-    height = (pic_height_in_map_units_minus1 + 1) * 16 * (2 - frame_mbs_only_flag);
-
-    if (separate_colour_plane_flag) chroma_format_idc = 0;
-
-    if (chroma_format_idc == 1) { sub_width_c = 2; sub_height_c = 2; }
-    else if (chroma_format_idc == 2) { sub_width_c = 2; sub_height_c = 1; }
-
-    crop_unit_x = sub_width_c;
-    crop_unit_y = sub_height_c * (2 - frame_mbs_only_flag);
-
-    width -= (crop_left + crop_right) * crop_unit_x;
-    height -= (crop_top + crop_bottom) * crop_unit_y;
-
-    *w = width;
-    *h = height;
-    return 0;
+// 把 Annex-B 视频包改写为 4 字节长度前缀 (与 hvcC 一致)，直接使用包元数据中的 NAL 索引，不再扫描起始码；
+// muxer 只在 extradata 为 Annex-B 时才自己转换，这里提供了 hvcC 就必须由我们转换
+static int HevcPacketToLengthPrefixed(AVPacket *pkt)
+{
+    PacketMeta tmp;
+    const PacketMeta *m;
+    const uint8_t *end, *sc = NULL;
+    AVBufferRef *buf;
+    uint8_t *dst;
+    int i, max_size;
+
+    m = packet_meta_get(pkt, AV_CODEC_ID_HEVC, &tmp);
+    if (m->nal.count == 0) return -1;
+
+    // 每个起始码至少 3 字节，换成 4 字节长度后最多增长 1/3
+    max_size = pkt->size + pkt->size / 3 + 4;
+    buf = av_buffer_alloc(max_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!buf) return -1;
+
+    dst = buf->data;
+    end = pkt->data + pkt->size;
+    for (i = 0; i < m->nal.count; i++) {
+        const NalUnitInfo *u = &m->nal.nal[i];
+        dst = PutLengthPrefixedNal(dst, pkt->data + u->offset, u->size);
+        sc = pkt->data + u->offset + u->size;
+    }
+
+    // NAL 数超出索引上限 (多 slice 大帧)：从最后一个已索引的 NAL 之后继续扫描
+    if (m->nal.flags & NAL_INDEX_TRUNCATED) {
+        sc = nal_find_start_code(sc, end);
+        while (sc < end) {
+            const uint8_t *nal = sc + 3;
+            const uint8_t *next = nal_find_start_code(nal, end);
+            const uint8_t *nal_end = (next < end && next > nal && next[-1] == 0) ? next - 1 : next;
+            if (nal < nal_end) dst = PutLengthPrefixedNal(dst, nal, (uint32_t)(nal_end - nal));
+            sc = next;
+        }
+    }
+
+    av_buffer_unref(&pkt->buf);
+    buf->size = (int)(dst - buf->data);
+    memset(dst, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    pkt->buf = buf;
+    pkt->data = buf->data;
+    pkt->size = buf->size;
+    return 0;
 }
 
 // AAC 辅助函数
@@ -548,7 +419,7 @@ static void PrebufClear(PreBuf *b)
     while (b->count > 0) PrebufDropOldest(b);
 }
 
-static int PrebufFindFirstIframe(const PreBuf *b, int video_index)
+static int PrebufFindFirstIframe(const PreBuf *b, int video_index, enum AVCodecID codec_id)
 {
     int k;
     if (!b) return -1;
@@ -556,7 +427,7 @@ static int PrebufFindFirstIframe(const PreBuf *b, int video_index)
         int idx = (b->head + k) % PREBUF_MAX_PKTS;
         const AVPacket *p = &b->pkts[idx];
         if (p->stream_index == video_index) {
-            if ((p->flags & AV_PKT_FLAG_KEY) || H264IsIframeAnnexb(p->data, p->size)) {
+            if ((p->flags & AV_PKT_FLAG_KEY) || VideoIsIframePkt(p, codec_id)) {
                 return k;
             }
         }
@@ -588,8 +459,156 @@ static void MakeSegmentFilename(RecordCtx *ctx, int cam_index, int seg_no)
     snprintf(ctx->FileName, sizeof(ctx->FileName), "%s/%s_seg%04d.MP4", dir, dt, seg_no);
 }
 
+static int64_t NowMsRealtime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static RecordSegInfo *NewSegInfo(RecordCtx *ctx, int ticket, const char *path)
+{
+    RecordSegInfo *info = calloc(1, sizeof(RecordSegInfo));
+
+    if (!info) return NULL;
+    info->Record = ctx->Record;
+    info->Ticket = ticket;
+    info->Entry.Cam = (int16_t)ctx->Session.cam_index;
+    info->Entry.Slot = (ticket >= 0) ? RECORD_STORE_TICKET_SLOT(ticket) : -1;
+    info->Entry.StartMs = NowMsRealtime();
+    snprintf(info->Path, sizeof(info->Path), "%s", path);
+    return info;
+}
+
+// 分段文件已关闭：登记到录像目录后释放
+static void FinishSegInfo(RecordSegInfo *info, int64_t length, int error)
+{
+    #if ENABLE_RECORD_CATALOG
+    info->Entry.Bytes = (uint32_t)(length > 0xffffffffLL ? 0xffffffffLL : length);
+    if (error) info->Entry.Flags |= RECORD_SEG_PARTIAL;
+    if (length > 0) record_catalog_add(&info->Record->Catalog, &info->Entry, info->Path);
+    #else
+    (void)length;
+    (void)error;
+    #endif
+    free(info);
+}
+
+#if ENABLE_RECORD_WRITE_BEHIND
+// 写后缓冲的文件事件 (I/O 线程)
+static void SegmentIoEvent(void *opaque, int tag, int event, int64_t length, int error)
+{
+    RecordSegInfo *info = (RecordSegInfo *)opaque;
+
+    (void)tag;
+    if (event == RECORD_IO_EV_OPENED) {
+        #if ENABLE_RECORD_STORE
+        if (info->Ticket >= 0) {
+            record_store_opened(&info->Record->Store, info->Ticket, error);
+            #if ENABLE_RECORD_CATALOG
+            // 槽位里原来的分段从此被覆盖 (作废记录在写入数据之前落盘)
+            if (!error) record_catalog_drop_slot(&info->Record->Catalog, info->Entry.Slot);
+            #endif
+        }
+        #endif
+        return;
+    }
+    #if ENABLE_RECORD_STORE
+    if (info->Ticket >= 0) record_store_closed(&info->Record->Store, info->Ticket, length, error);
+    #endif
+    FinishSegInfo(info, length, error);
+}
+
+// 分段经写后缓冲写入：优先写一个预分配槽位，取不到时写 ctx->FileName，失败返回 NULL
+static AVIOContext *OpenSegmentIo(RecordCtx *ctx)
+{
+    RecordIoTarget target;
+    RecordSegInfo *info;
+    AVIOContext *pb;
+    char path[sizeof(ctx->FileName)];
+    int ticket = -1;
+
+    #if ENABLE_RECORD_STORE
+    ticket = record_store_acquire(&ctx->Record->Store, ctx->Session.cam_index, path, sizeof(path));
+    #endif
+    if (ticket < 0) snprintf(path, sizeof(path), "%s", ctx->FileName);
+
+    info = NewSegInfo(ctx, ticket, path);
+    memset(&target, 0, sizeof(target));
+    target.prealloc = (ticket >= 0) ? RECORD_STORE_SLOT_BYTES : 0;
+    target.cb = SegmentIoEvent;
+    target.opaque = info;
+    target.tag = ticket;
+    pb = info ? record_io_open(&ctx->Io, path, &target) : NULL;
+    if (!pb) {
+        #if ENABLE_RECORD_STORE
+        // 按打开失败处理：槽位条目回滚到 acquire 之前，索引和录像目录里的旧分段不受影响
+        if (ticket >= 0) {
+            record_store_opened(&ctx->Record->Store, ticket, 1);
+            record_store_closed(&ctx->Record->Store, ticket, 0, 1);
+        }
+        #endif
+        free(info);
+        return NULL;
+    }
+    // info 由 I/O 线程在 CLOSED 事件中释放
+    snprintf(ctx->FileName, sizeof(ctx->FileName), "%s", path);
+    ctx->StoreTicket = ticket;
+    ctx->SegInfo = info;
+    return pb;
+}
+#endif
+
+static void CloseSegmentIo(RecordCtx *ctx, AVFormatContext *oc)
+{
+    RecordSegInfo *info = ctx->SegInfo;
+    int64_t now = NowMsRealtime();
+    int64_t bytes;
+    int in_store = (ctx->StoreTicket >= 0);
+
+    ctx->SegInfo = NULL;
+    if (info) {
+        info->Entry.EndMs = now;
+        info->Entry.Flags |= (uint16_t)__atomic_exchange_n(&ctx->EventFlags, 0, __ATOMIC_RELAXED);
+    }
+    #if ENABLE_RECORD_WRITE_BEHIND && ENABLE_RECORD_STORE
+    // 结束时间在这里记下，条目在 I/O 线程关闭文件后写入索引
+    if (ctx->StoreTicket >= 0) {
+        record_store_finish(&ctx->Record->Store, ctx->StoreTicket, now);
+        ctx->StoreTicket = -1;
+    }
+    #endif
+    if (!oc->pb) {
+        if (info) FinishSegInfo(info, 0, 1);
+        return;
+    }
+    if (oc->flags & AVFMT_FLAG_CUSTOM_IO) {
+        record_io_close(&ctx->Io, &oc->pb);
+    } else {
+        bytes = avio_tell(oc->pb);
+        avio_closep(&oc->pb);
+        if (info) FinishSegInfo(info, bytes, 0);
+    }
+
+    #if ENABLE_RECORD_RETENTION
+    // 槽位之外新建的分段文件登记给保留管理，卡满时从最旧的删起
+    if (!in_store) record_retention_add(&ctx->Record->Retention, ctx->Session.cam_index, ctx->FileName);
+    #else
+    (void)in_store;
+    #endif
+}
+
+// 打开/写入分段失败：进入冷却，卡满时让保留管理立即腾空间
+static void SegmentIoError(RecordCtx *ctx)
+{
+    ctx->last_io_error_ms = NowMsMonotonic();
+    #if ENABLE_RECORD_RETENTION
+    record_retention_kick(&ctx->Record->Retention);
+    #endif
+}
+
 static int OpenMp4Segment(RecordCtx *ctx, AVFormatContext **poc, AVStream *stream_in_audio,
-                          const uint8_t *sps, int sps_sz, const uint8_t *pps, int pps_sz,
+                          const uint8_t *vps, int vps_sz, const uint8_t *sps, int sps_sz, const uint8_t *pps, int pps_sz,
                           const uint8_t *asc, int asc_sz)
 {
     int ret;
@@ -617,8 +636,35 @@ static int OpenMp4Segment(RecordCtx *ctx, AVFormatContext **poc, AVStream *strea
     }
     avcodec_parameters_copy(vst->codecpar, ctx->v_codecpar_cache);
 
-    // 填充 Video Extradata
-    if ((vst->codecpar->extradata_size <= 0) && sps_sz > 0 && pps_sz > 0) {
+    // 填充 Video Extradata
+    if (vst->codecpar->codec_id == AV_CODEC_ID_HEVC) {
+        // H.265：生成 hvcC，优先用包中采集到的参数集，否则用 RTSP 给出的 Annex-B extradata；
+        // 已经是 hvcC 的 extradata 直接沿用。视频包由 HevcPacketToLengthPrefixed 转成同样的长度前缀格式
+        uint8_t annexb[1024];
+        int annexb_sz = 0;
+
+        if (vps_sz > 0 && sps_sz > 0 && pps_sz > 0 && vps_sz + sps_sz + pps_sz <= (int)sizeof(annexb)) {
+            memcpy(annexb, vps, vps_sz);
+            memcpy(annexb + vps_sz, sps, sps_sz);
+            memcpy(annexb + vps_sz + sps_sz, pps, pps_sz);
+            annexb_sz = vps_sz + sps_sz + pps_sz;
+        } else if (vst->codecpar->extradata_size > 0 && vst->codecpar->extradata[0] != 1 &&
+                   vst->codecpar->extradata_size <= (int)sizeof(annexb)) {
+            memcpy(annexb, vst->codecpar->extradata, vst->codecpar->extradata_size);
+            annexb_sz = vst->codecpar->extradata_size;
+        }
+        if (annexb_sz > 0 && HevcBuildHvcc(annexb, annexb_sz, &ex, &exsz) == 0) {
+            if (vst->codecpar->extradata) av_free(vst->codecpar->extradata);
+            vst->codecpar->extradata = ex;
+            vst->codecpar->extradata_size = exsz;
+            LOG_INFO(TAG, "Filled Video Extradata (hvcC): %d bytes\n", exsz);
+        }
+        if (vst->codecpar->extradata_size < 23 || vst->codecpar->extradata[0] != 1) {
+            LOG_ERROR(TAG, "No usable HEVC parameter sets for hvcC\n");
+            avformat_free_context(oc);
+            return -1;
+        }
+    } else if ((vst->codecpar->extradata_size <= 0) && sps_sz > 0 && pps_sz > 0) {
         exsz = sps_sz + pps_sz;
         ex = av_malloc(exsz + AV_INPUT_BUFFER_PADDING_SIZE);
         if (ex) {
@@ -673,10 +719,18 @@ static int OpenMp4Segment(RecordCtx *ctx, AVFormatContext **poc, AVStream *strea
     }
 
     if (!(oc->oformat->flags & AVFMT_NOFILE)) {
-        if (avio_open(&oc->pb, ctx->FileName, AVIO_FLAG_WRITE) < 0) {
-            avformat_free_context(oc);
-            return -1;
-        }
+        #if ENABLE_RECORD_WRITE_BEHIND
+        // Record IO 线程不可用时退回直接写文件
+        oc->pb = OpenSegmentIo(ctx);
+        if (oc->pb) oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+        #endif
+        if (!oc->pb) {
+            if (avio_open(&oc->pb, ctx->FileName, AVIO_FLAG_WRITE) < 0) {
+                avformat_free_context(oc);
+                return -1;
+            }
+            ctx->SegInfo = NewSegInfo(ctx, -1, ctx->FileName);
+        }
     }
 
     av_dict_set(&wopt, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
@@ -691,7 +745,7 @@ static int OpenMp4Segment(RecordCtx *ctx, AVFormatContext **poc, AVStream *strea
     av_dict_free(&wopt);
 
     if (ret < 0) {
-        if (oc->pb) avio_closep(&oc->pb);
+        CloseSegmentIo(ctx, oc);
         avformat_free_context(oc);
         return -1;
     }
@@ -700,7 +754,7 @@ static int OpenMp4Segment(RecordCtx *ctx, AVFormatContext **poc, AVStream *strea
     return 0;
 }
 
-static void CloseMp4Segment(AVFormatContext **poc, int file_opened)
+static void CloseMp4Segment(RecordCtx *ctx, AVFormatContext **poc, int file_opened)
 {
     AVFormatContext *oc;
     if (!poc || !*poc) return;
@@ -708,271 +762,554 @@ static void CloseMp4Segment(AVFormatContext **poc, int file_opened)
     if (file_opened) {
         av_write_trailer(oc);
         LOG_INFO(TAG, "Closed segment\n");
-    }
-    if (oc->pb) avio_closep(&oc->pb);
+    }
+    CloseSegmentIo(ctx, oc);
     avformat_free_context(oc);
     *poc = NULL;
 }
 
-static void* Record_Thread(void *Arg)
+/* ========================================================================== */
+/* 录像会话：线程模式与共享录像线程共用                                       */
+/* ========================================================================== */
+
+static void RecordSessionInit(RecordCtx *ctx)
 {
-    int32_t ret;
-    RecordCtx *ctx = (RecordCtx *)Arg;
-    AVFormatContext *oc = NULL;
-    AVStream *stream_in_audio = NULL;
-    AVPacket pkt;
-    int32_t video_idx, audio_idx;
-    int file_opened = 0;
-    int wait_audio_cnt = 0; 
-    uint8_t sps_cache[512]; int sps_sz = 0;
-    uint8_t pps_cache[256]; int pps_sz = 0;
-    uint8_t asc_cache[2];   int asc_sz = 0;
-    PreBuf pb;
-    int64_t seg_start_ms = 0;
-    int seg_no = 1;
-    int cam_index;
-    int k;
+    RecordSession *s = &ctx->Session;
 
-    prctl(PR_SET_NAME, (unsigned long)__FUNCTION__);
-    PrebufInit(&pb);
+    memset(s, 0, sizeof(RecordSession));
+    PrebufInit(&s->pb);
+    s->seg_no = 1;
+    s->audio_idx = -1;
+    s->cam_index = (int)(ctx - ctx->Record->Ctx);
 
     ctx->v_codecpar_cache = avcodec_parameters_alloc();
     ctx->v_extradata_cached = 0;
     ctx->last_io_error_ms = 0;
+}
 
-    cam_index = (int)(ctx - ctx->Record->Ctx);
-    
-    // 等待 RTSP 准备就绪
-    while (1) {
-        if (ctx->Rtsp->running == 0) goto Record_Thread_Exit;
-        if (ctx->Rtsp->running == 2 && Storage_IsReady(ctx->Record->Station)) break;
-        usleep(20 * 1000);
-    }
+// 等待 RTSP 与存储就绪后缓存流参数，返回 1 就绪，0 尚未就绪，-1 该路已停止
+static int RecordSessionBegin(RecordCtx *ctx)
+{
+    RecordSession *s = &ctx->Session;
+
+    if (s->began) return 1;
+    // Record_Stop 先中止读者再 join，这时 RTSP 可能仍在运行 (或一直连不上)，不能只看 running
+    if (ctx->Rtsp->running == 0 || packet_broadcast_reader_aborted(&ctx->Rtsp->RecordReader)) return -1;
+    if (ctx->Rtsp->running != 2 || !Storage_IsReady(ctx->Record->Station)) return 0;
 
-    video_idx = ctx->Rtsp->VdIndex;
-    audio_idx = ctx->Rtsp->AdIndex;
+    s->video_idx = ctx->Rtsp->VdIndex;
+    s->audio_idx = ctx->Rtsp->AdIndex;
 
     // 复制参数
     {
-        AVStream *src_v = ctx->Rtsp->AvFmtCtx->streams[video_idx];
+        AVStream *src_v = ctx->Rtsp->AvFmtCtx->streams[s->video_idx];
         avcodec_parameters_copy(ctx->v_codecpar_cache, src_v->codecpar);
-        ctx->v_src_tb = src_v->time_base;
+        ctx->v_src_tb = src_v->time_base;
+        s->v_codec = src_v->codecpar->codec_id;
         ctx->v_width_cache = src_v->codecpar->width;
         ctx->v_height_cache = src_v->codecpar->height;
         LOG_INFO(TAG, "Cached Video: %dx%d TB=%d/%d\n", ctx->v_width_cache, ctx->v_height_cache, ctx->v_src_tb.num, ctx->v_src_tb.den);
-    }
-    if (audio_idx >= 0) {
-        stream_in_audio = ctx->Rtsp->AvFmtCtx->streams[audio_idx];
-        if (stream_in_audio->codecpar->extradata_size > 0) {
-            if (stream_in_audio->codecpar->extradata_size <= 2) {
-                memcpy(asc_cache, stream_in_audio->codecpar->extradata, stream_in_audio->codecpar->extradata_size);
-                asc_sz = stream_in_audio->codecpar->extradata_size;
+    }
+    if (s->audio_idx >= 0) {
+        s->stream_in_audio = ctx->Rtsp->AvFmtCtx->streams[s->audio_idx];
+        if (s->stream_in_audio->codecpar->extradata_size > 0) {
+            if (s->stream_in_audio->codecpar->extradata_size <= 2) {
+                memcpy(s->asc_cache, s->stream_in_audio->codecpar->extradata, s->stream_in_audio->codecpar->extradata_size);
+                s->asc_sz = s->stream_in_audio->codecpar->extradata_size;
                 LOG_INFO(TAG, "Audio config loaded from AVStream.\n");
-            }
-        }
-        
+            }
+        }
+
         // 【关键修复】如果流中没有 Extradata (Raw AAC)，强制注入配置
         // 0x14 0x08 对应 AAC LC, 16000Hz, Mono
-        if (asc_sz == 0) {
-            asc_cache[0] = 0x14; 
-            asc_cache[1] = 0x08;
-            asc_sz = 2;
+        if (s->asc_sz == 0) {
+            s->asc_cache[0] = 0x14;
+            s->asc_cache[1] = 0x08;
+            s->asc_sz = 2;
             LOG_INFO(TAG, "FIX: Hardcoded AAC ASC to 16k Mono (14 08) for Raw AAC Stream\n");
-        }
-    }
+        }
+    }
 
     ResetTsState(ctx);
-    av_init_packet(&pkt);
-
-    while (1) {
-        if (ctx->Rtsp->running == 0) {
-            if (packet_queue_get(&ctx->Rtsp->RecordQueue, &pkt, 1) <= 0) break;
-        } else {
-            ret = packet_queue_get(&ctx->Rtsp->RecordQueue, &pkt, 1);
-            if (ret < 0) break;
-            if (ret == 0) continue;
-        }
-
-        int is_video = (pkt.stream_index == video_idx);
-        int is_audio = (audio_idx >= 0 && pkt.stream_index == audio_idx);
+    s->began = 1;
+    return 1;
+}
 
-        if (!is_video && !is_audio) {
-            av_packet_unref(&pkt);
-            continue;
-        }
+// 处理一个包 (取得 pkt 的所有权)
+static void RecordSessionPacket(RecordCtx *ctx, AVPacket *pkt)
+{
+    RecordSession *s = &ctx->Session;
+    PacketMeta meta_tmp;
+    int res_changed = 0;
+    int k;
 
-        // --- 关键信息采集 ---
-        // (虽然我们已经硬编码了 ASC，但保留此逻辑以兼容其他标准流，只要不覆盖非零值即可)
-        if (is_audio && pkt.data && pkt.size > 7 && asc_sz == 0) {
-            if (AacCollectAsc(pkt.data, pkt.size, asc_cache, &asc_sz) == 0) {
-                LOG_INFO(TAG, "Captured AAC ASC: %02X %02X\n", asc_cache[0], asc_cache[1]);
-            }
-        }
-        if (is_video && pkt.data && pkt.size > 0) {
-            H264CollectSpsPps(pkt.data, pkt.size, sps_cache, &sps_sz, 512, pps_cache, &pps_sz, 256);
-            if (H264IsIframeAnnexb(pkt.data, pkt.size)) pkt.flags |= AV_PKT_FLAG_KEY;
-        }
+    int is_video = (pkt->stream_index == s->video_idx);
+    int is_audio = (s->audio_idx >= 0 && pkt->stream_index == s->audio_idx);
 
-        // --- 切片逻辑 ---
-        if (file_opened && is_video) {
-            int64_t now = NowMsMonotonic();
-            int slice_due = (seg_start_ms != 0 && (now - seg_start_ms) >= SLICE_MS);
-            int is_i = ((pkt.flags & AV_PKT_FLAG_KEY) != 0);
-
-            if (slice_due && is_i) {
-                CloseMp4Segment(&oc, 1);
-                oc = NULL;
-                file_opened = 0;
-                ResetTsState(ctx);
-                PrebufClear(&pb);
-                PrebufPush(&pb, &pkt);
-                av_packet_unref(&pkt);
-                wait_audio_cnt = 0;
-                continue;
-            }
-        }
+    if (!is_video && !is_audio) {
+        av_packet_unref(pkt);
+        return;
+    }
+
+    // --- 关键信息采集 ---
+    // (虽然我们已经硬编码了 ASC，但保留此逻辑以兼容其他标准流，只要不覆盖非零值即可)
+    if (is_audio && pkt->data && pkt->size > 7 && s->asc_sz == 0) {
+        if (AacCollectAsc(pkt->data, pkt->size, s->asc_cache, &s->asc_sz) == 0) {
+            LOG_INFO(TAG, "Captured AAC ASC: %02X %02X\n", s->asc_cache[0], s->asc_cache[1]);
+        }
+    }
+    if (is_video && pkt->data && pkt->size > 0) {
+        const PacketMeta *meta = packet_meta_get(pkt, s->v_codec, &meta_tmp);
+        CollectParamSets(meta, pkt, s->vps_cache, &s->vps_sz, 256, s->sps_cache, &s->sps_sz, 512, s->pps_cache, &s->pps_sz, 256);
+        if (PKT_META_IS_INTRA(meta)) pkt->flags |= AV_PKT_FLAG_KEY;
+        if (meta->width > 0) {
+            s->sps_w = meta->width;
+            s->sps_h = meta->height;
+        }
+        if (meta->flags & PKT_META_RES_CHANGED) {
+            // 分辨率变化：旧的 extradata/宽高作废，下一个分段用新的 SPS/PPS
+            res_changed = 1;
+            ctx->v_width_cache = s->sps_w;
+            ctx->v_height_cache = s->sps_h;
+            ctx->v_codecpar_cache->width = s->sps_w;
+            ctx->v_codecpar_cache->height = s->sps_h;
+            av_freep(&ctx->v_codecpar_cache->extradata);
+            ctx->v_codecpar_cache->extradata_size = 0;
+            LOG_INFO(TAG, "Video resolution changed to %dx%d\n", s->sps_w, s->sps_h);
+        }
+    }
+
+    // --- 切片逻辑 ---
+    if (s->file_opened && is_video) {
+        int64_t now = NowMsMonotonic();
+        int slice_due = (s->seg_start_ms != 0 && (now - s->seg_start_ms) >= SLICE_MS);
+        int is_i = ((pkt->flags & AV_PKT_FLAG_KEY) != 0);
+        int slice_now = 0;
+
+        #if ENABLE_RECORD_WRITE_BEHIND && ENABLE_RECORD_STORE
+        if (ctx->StoreTicket >= 0) {
+            // 已写出的加上 muxer 里还没成片的当前 GOP
+            int64_t used = record_io_file_bytes(&ctx->Io) + s->gop_bytes + pkt->size;
+
+            // 码率过高时在槽位写满之前提前切段
+            if (used >= RECORD_STORE_SLOT_BYTES - RECORD_STORE_SLOT_MARGIN) slice_due = 1;
+            // GOP 太长等不到 I 帧：不能写出槽位 (超出部分下次覆盖时会残留旧数据)，
+            // 立即切段，新分段从下一个 I 帧开始，顺便请求摄像头尽快出 I 帧
+            if (!is_i && used >= RECORD_STORE_SLOT_BYTES - RECORD_STORE_SLOT_GUARD) {
+                LOG_WARN(TAG, "CAM%d GOP overruns slot, cut without I-frame\n", s->cam_index);
+                slice_now = 1;
+                Stream_RequestIFrame(ctx->Record->Station, s->cam_index);
+            }
+        }
+        #endif
+
+        if (((slice_due || res_changed) && is_i) || slice_now) {
+            CloseMp4Segment(ctx, &s->oc, 1);
+            s->file_opened = 0;
+            ResetTsState(ctx);
+            PrebufClear(&s->pb);
+            PrebufPush(&s->pb, pkt);
+            av_packet_unref(pkt);
+            s->wait_audio_cnt = 0;
+            return;
+        }
+    }
+
+    // --- 打开文件逻辑 ---
+    if (!s->file_opened) {
+        PrebufPush(&s->pb, pkt);
+        av_packet_unref(pkt);
+
+        // I/O 错误冷却期间只缓存 (不在此休眠，共享录像线程中会拖慢其它通道)
+        if (NowMsMonotonic() - ctx->last_io_error_ms < IO_ERROR_COOLDOWN_MS) {
+            return;
+        }
+
+        int w = ctx->v_width_cache;
+        int h = ctx->v_height_cache;
+
+        // [FIX] 如果缓存的宽高是 0 (因为RTSP握手时没拿到)，尝试从捕获到的 SPS 中解析
+        if (w <= 0 || h <= 0) {
+            if (s->sps_w > 0 && s->sps_h > 0) {
+                 w = s->sps_w; h = s->sps_h;
+                 ctx->v_width_cache = w;
+                 ctx->v_height_cache = h;
+                 ctx->v_codecpar_cache->width = w;
+                 ctx->v_codecpar_cache->height = h;
+                 LOG_INFO(TAG, "Updated Video Params from collected SPS: %dx%d\n", w, h);
+            }
+        }
+
+        int have_spspps = (s->sps_sz > 0 && s->pps_sz > 0 && (s->v_codec != AV_CODEC_ID_HEVC || s->vps_sz > 0)) ||
+                          (ctx->v_codecpar_cache->extradata_size > 0);
+        int iframe_off = PrebufFindFirstIframe(&s->pb, s->video_idx, s->v_codec);
+
+        // [修复] 增加对音频配置的等待
+        int audio_ready = (s->audio_idx < 0) || (s->asc_sz > 0);
+
+        if (!audio_ready && s->wait_audio_cnt < 100) {
+            s->wait_audio_cnt++;
+            if (s->pb.count < PREBUF_MAX_PKTS - 20) {
+                return;
+            }
+        }
+
+        if (w > 0 && h > 0 && have_spspps && iframe_off >= 0) {
+            MakeSegmentFilename(ctx, s->cam_index, s->seg_no);
+            if (OpenMp4Segment(ctx, &s->oc, s->stream_in_audio, s->vps_cache, s->vps_sz, s->sps_cache, s->sps_sz,
+                               s->pps_cache, s->pps_sz, s->asc_cache, s->asc_sz) == 0) {
+                s->file_opened = 1;
+                s->seg_start_ms = NowMsMonotonic();
+                s->gop_bytes = 0;
+                s->seg_no++;
+
+                // 写入 Prebuf
+                for (k = iframe_off; k < s->pb.count; k++) {
+                    int idx = (s->pb.head + k) % PREBUF_MAX_PKTS;
+                    AVPacket *bp = &s->pb.pkts[idx];
+                    int bv = (bp->stream_index == s->video_idx);
+                    int ba = (s->audio_idx >= 0 && bp->stream_index == s->audio_idx);
+
+                    if (bv) {
+                        if (VideoIsIframePkt(bp, s->v_codec)) bp->flags |= AV_PKT_FLAG_KEY;
+                        if (s->v_codec == AV_CODEC_ID_HEVC && HevcPacketToLengthPrefixed(bp) < 0) continue;
+                        if ((bp->flags & AV_PKT_FLAG_KEY) && ctx->SegInfo) ctx->SegInfo->Entry.KeyFrames++;
+                        NormalizeAndRescaleTs(ctx, bp, 1);
+                        bp->stream_index = ctx->v_st->index;
+                    } else if (ba && ctx->a_st) {
+                        if (ctx->a_st->codecpar->codec_id == AV_CODEC_ID_AAC) {
+                            if (bp->size > 7 && bp->data[0] == 0xFF && (bp->data[1] & 0xF0) == 0xF0) {
+                                int hlen = (bp->data[1] & 0x01) ? 7 : 9;
+                                bp->data += hlen;
+                                bp->size -= hlen;
+                            }
+                        }
+                        NormalizeAndRescaleTs(ctx, bp, 0);
+                        bp->stream_index = ctx->a_st->index;
+                    } else {
+                        continue;
+                    }
+                    bp->pos = -1;
+                    if (bv && (bp->flags & AV_PKT_FLAG_KEY)) s->gop_bytes = 0;
+                    s->gop_bytes += bp->size;
+                    av_interleaved_write_frame(s->oc, bp);
+                }
+                PrebufClear(&s->pb);
+            } else {
+                SegmentIoError(ctx);
+            }
+        }
+        return;
+    }
 
-        // --- 打开文件逻辑 ---
-        if (!file_opened) {
-            PrebufPush(&pb, &pkt);
+    // --- 正常写入逻辑 ---
+    if (is_video) {
+        if (VideoIsIframePkt(pkt, s->v_codec)) pkt->flags |= AV_PKT_FLAG_KEY;
+        if (s->v_codec == AV_CODEC_ID_HEVC && HevcPacketToLengthPrefixed(pkt) < 0) {
+            av_packet_unref(pkt);
+            return;
+        }
+        if ((pkt->flags & AV_PKT_FLAG_KEY) && ctx->SegInfo) ctx->SegInfo->Entry.KeyFrames++;
+        NormalizeAndRescaleTs(ctx, pkt, 1);
+        pkt->stream_index = ctx->v_st->index;
+    } else {
+        if (!ctx->a_st) {
+            av_packet_unref(pkt);
+            return;
+        }
+        if (ctx->a_st->codecpar->codec_id == AV_CODEC_ID_AAC) {
+            if (pkt->size > 7 && pkt->data[0] == 0xFF && (pkt->data[1] & 0xF0) == 0xF0) {
+                int header_len = (pkt->data[1] & 0x01) ? 7 : 9;
+                pkt->data += header_len;
+                pkt->size -= header_len;
+            }
+        }
+        NormalizeAndRescaleTs(ctx, pkt, 0);
+        pkt->stream_index = ctx->a_st->index;
+    }
+    pkt->pos = -1;
+    // I 帧到来时 muxer 把上一个 GOP 作为一个分片写出
+    if (is_video && (pkt->flags & AV_PKT_FLAG_KEY)) s->gop_bytes = 0;
+    s->gop_bytes += pkt->size;
+    av_interleaved_write_frame(s->oc, pkt);
+    av_packet_unref(pkt);
+
+    #if ENABLE_RECORD_WRITE_BEHIND
+    // 文件创建/写入失败，或卡停顿过久写后缓冲用完：放弃该分段，冷却后从下一个 I 帧重开
+    if (record_io_failed(&ctx->Io)) {
+        LOG_WARN(TAG, "CAM%d segment aborted on I/O error: %s\n", s->cam_index, ctx->FileName);
+        CloseMp4Segment(ctx, &s->oc, 0);
+        s->file_opened = 0;
+        ResetTsState(ctx);
+        s->wait_audio_cnt = 0;
+        SegmentIoError(ctx);
+    }
+    #endif
+}
 
-            if (NowMsMonotonic() - ctx->last_io_error_ms < IO_ERROR_COOLDOWN_MS) {
-                usleep(20 * 1000);
-                av_packet_unref(&pkt);
-                continue;
-            }
+static void RecordSessionEnd(RecordCtx *ctx)
+{
+    RecordSession *s = &ctx->Session;
 
-            int w = ctx->v_width_cache;
-            int h = ctx->v_height_cache;
-
-            // [FIX] 如果缓存的宽高是 0 (因为RTSP握手时没拿到)，尝试从捕获到的 SPS 中解析
-            if (w <= 0 || h <= 0) {
-                if (sps_sz > 0) {
-                     int tw=0, th=0;
-                     if (H264ParseSpsWh(sps_cache, sps_sz, &tw, &th) == 0) {
-                         w = tw; h = th;
-                         ctx->v_width_cache = w;
-                         ctx->v_height_cache = h;
-                         ctx->v_codecpar_cache->width = w;
-                         ctx->v_codecpar_cache->height = h;
-                         LOG_INFO(TAG, "Updated Video Params from collected SPS: %dx%d\n", w, h);
-                     }
-                }
-            }
+    PrebufClear(&s->pb);
+    if (s->oc) CloseMp4Segment(ctx, &s->oc, s->file_opened);
+    s->file_opened = 0;
+    s->began = 0;
+    if (ctx->v_codecpar_cache) avcodec_parameters_free(&ctx->v_codecpar_cache);
+}
 
-            int have_spspps = (sps_sz > 0 && pps_sz > 0) || (ctx->v_codecpar_cache->extradata_size > 0);
-            int iframe_off = PrebufFindFirstIframe(&pb, video_idx);
+static void* Record_Thread(void *Arg)
+{
+    RecordCtx *ctx = (RecordCtx *)Arg;
+    AVPacket batch[RECORD_BATCH_MAX];
+    int batch_n, i, ret;
 
-            // [修复] 增加对音频配置的等待 (定义已移至顶部)
-            int audio_ready = (audio_idx < 0) || (asc_sz > 0);
-            
-            if (!audio_ready && wait_audio_cnt < 100) { 
-                wait_audio_cnt++;
-                if (pb.count < PREBUF_MAX_PKTS - 20) {
-                    av_packet_unref(&pkt);
-                    continue; 
-                }
-            }
+    prctl(PR_SET_NAME, (unsigned long)__FUNCTION__);
+    RecordSessionInit(ctx);
 
-            if (w > 0 && h > 0 && have_spspps && iframe_off >= 0) {
-                MakeSegmentFilename(ctx, cam_index, seg_no);
-                if (OpenMp4Segment(ctx, &oc, stream_in_audio, sps_cache, sps_sz, pps_cache, pps_sz, asc_cache, asc_sz) == 0) {
-                    file_opened = 1;
-                    seg_start_ms = NowMsMonotonic();
-                    seg_no++;
-
-                    // 写入 Prebuf
-                    for (k = iframe_off; k < pb.count; k++) {
-                        int idx = (pb.head + k) % PREBUF_MAX_PKTS;
-                        AVPacket *bp = &pb.pkts[idx];
-                        int bv = (bp->stream_index == video_idx);
-                        int ba = (audio_idx >= 0 && bp->stream_index == audio_idx);
-
-                        if (bv) {
-                            if (H264IsIframeAnnexb(bp->data, bp->size)) bp->flags |= AV_PKT_FLAG_KEY;
-                            NormalizeAndRescaleTs(ctx, bp, 1);
-                            bp->stream_index = ctx->v_st->index;
-                        } else if (ba && ctx->a_st) {
-                            if (ctx->a_st->codecpar->codec_id == AV_CODEC_ID_AAC) {
-                                if (bp->size > 7 && bp->data[0] == 0xFF && (bp->data[1] & 0xF0) == 0xF0) {
-                                    int hlen = (bp->data[1] & 0x01) ? 7 : 9;
-                                    bp->data += hlen;
-                                    bp->size -= hlen;
-                                }
-                            }
-                            NormalizeAndRescaleTs(ctx, bp, 0);
-                            bp->stream_index = ctx->a_st->index;
-                        } else {
-                            continue;
-                        }
-                        bp->pos = -1;
-                        av_interleaved_write_frame(oc, bp);
-                    }
-                    PrebufClear(&pb);
-                } else {
-                    ctx->last_io_error_ms = NowMsMonotonic();
-                }
-            }
-            av_packet_unref(&pkt);
-            continue;
-        }
+    // 等待 RTSP 准备就绪
+    while ((ret = RecordSessionBegin(ctx)) == 0) {
+        usleep(20 * 1000);
+    }
 
-        // --- 正常写入逻辑 ---
-        if (is_video) {
-            if (H264IsIframeAnnexb(pkt.data, pkt.size)) pkt.flags |= AV_PKT_FLAG_KEY;
-            NormalizeAndRescaleTs(ctx, &pkt, 1);
-            pkt.stream_index = ctx->v_st->index;
-        } else {
-            if (!ctx->a_st) {
-                av_packet_unref(&pkt);
-                continue;
-            }
-            if (ctx->a_st->codecpar->codec_id == AV_CODEC_ID_AAC) {
-                if (pkt.size > 7 && pkt.data[0] == 0xFF && (pkt.data[1] & 0xF0) == 0xF0) {
-                    int header_len = (pkt.data[1] & 0x01) ? 7 : 9;
-                    pkt.data += header_len;
-                    pkt.size -= header_len;
-                }
-            }
-            NormalizeAndRescaleTs(ctx, &pkt, 0);
-            pkt.stream_index = ctx->a_st->index;
-        }
-        pkt.pos = -1;
-        av_interleaved_write_frame(oc, &pkt);
-        av_packet_unref(&pkt);
-    }
+    while (ret > 0) {
+        batch_n = packet_broadcast_get_batch(&ctx->Rtsp->RecordReader, batch, RECORD_BATCH_MAX,
+                                             (ctx->Rtsp->running == 0) ? 0 : -1);
+        if (batch_n <= 0) break;
+        for (i = 0; i < batch_n; i++) RecordSessionPacket(ctx, &batch[i]);
+    }
 
-Record_Thread_Exit:
-    PrebufClear(&pb);
-    if (oc) CloseMp4Segment(&oc, file_opened);
-    if (ctx->v_codecpar_cache) avcodec_parameters_free(&ctx->v_codecpar_cache);
+    RecordSessionEnd(ctx);
     LOG_DEBUG(TAG, "Thread exit\n");
     pthread_exit(NULL);
 }
 
+#if ENABLE_SHARED_RECORDER
+/* ========================================================================== */
+/* 共享录像线程：一个线程轮流处理所有通道                                     */
+/* ========================================================================== */
+
+// 各路按轮询顺序每次最多处理一批，所有通道都没有数据时等待 RECORD_SHARED_IDLE_MS
+// 同一时刻只有一路在 mux，写后缓冲里各路数据都是整块连续写出，SD 卡上不再交错小块写入
+static void *Record_SharedThread(void *Arg)
+{
+    RecordHandle *Record = (RecordHandle *)Arg;
+    AVPacket batch[RECORD_BATCH_MAX];
+    struct timespec ts;
+    int i, j, n, work;
+
+    prctl(PR_SET_NAME, "Record_Shared");
+
+    pthread_mutex_lock(&Record->Mutex);
+    while (!Record->SharedAbort) {
+        work = 0;
+        for (i = 0; i < Record->ChannelCnt; i++) {
+            RecordCtx *ctx = &Record->Ctx[i];
+
+            if (!ctx->shared_attached) continue;
+            if (ctx->shared_stop) {
+                // Record_Stop 在等待：结束会话 (排队关闭当前分段) 后交还该通道
+                pthread_mutex_unlock(&Record->Mutex);
+                RecordSessionEnd(ctx);
+                pthread_mutex_lock(&Record->Mutex);
+                ctx->shared_attached = 0;
+                pthread_cond_broadcast(&Record->SharedCond);
+                continue;
+            }
+            // shared_attached 期间 Record_Stop 不会改动 ctx，处理时可以解锁
+            pthread_mutex_unlock(&Record->Mutex);
+            if (RecordSessionBegin(ctx) > 0) {
+                n = packet_broadcast_get_batch(&ctx->Rtsp->RecordReader, batch, RECORD_BATCH_MAX, 0);
+                for (j = 0; j < n; j++) RecordSessionPacket(ctx, &batch[j]);
+                if (n > 0) work = 1;
+            }
+            pthread_mutex_lock(&Record->Mutex);
+        }
+        if (!work && !Record->SharedAbort) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_nsec += RECORD_SHARED_IDLE_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&Record->SharedCond, &Record->Mutex, &ts);
+        }
+    }
+    pthread_mutex_unlock(&Record->Mutex);
+    return NULL;
+}
+
+static int SharedRecorderInit(RecordHandle *Record)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&Record->SharedCond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&Record->SharedThread, NULL, Record_SharedThread, Record) != 0) {
+        LOG_ERROR(TAG, "Shared recorder thread create failed, use per-camera threads\n");
+        return -1;
+    }
+    Record->SharedStarted = 1;
+    return 0;
+}
+
+static void SharedRecorderUninit(RecordHandle *Record)
+{
+    pthread_mutex_lock(&Record->Mutex);
+    Record->SharedAbort = 1;
+    pthread_cond_broadcast(&Record->SharedCond);
+    pthread_mutex_unlock(&Record->Mutex);
+    if (Record->SharedStarted) pthread_join(Record->SharedThread, NULL);
+    Record->SharedStarted = 0;
+    pthread_cond_destroy(&Record->SharedCond);
+}
+
+static int SharedRecorderAdd(RecordHandle *Record, RecordCtx *ctx)
+{
+    if (!Record->SharedStarted) return -1;
+    RecordSessionInit(ctx);
+    pthread_mutex_lock(&Record->Mutex);
+    ctx->shared_stop = 0;
+    ctx->shared_attached = 1;
+    pthread_cond_broadcast(&Record->SharedCond);
+    pthread_mutex_unlock(&Record->Mutex);
+    return 0;
+}
+
+// 阻塞到共享线程结束该路会话、不再访问 ctx 为止
+static void SharedRecorderRemove(RecordHandle *Record, RecordCtx *ctx)
+{
+    pthread_mutex_lock(&Record->Mutex);
+    ctx->shared_stop = 1;
+    pthread_cond_broadcast(&Record->SharedCond);
+    while (ctx->shared_attached && !Record->SharedAbort) {
+        pthread_cond_wait(&Record->SharedCond, &Record->Mutex);
+    }
+    pthread_mutex_unlock(&Record->Mutex);
+    // 共享线程已退出时由这里结束会话
+    if (ctx->shared_attached) {
+        RecordSessionEnd(ctx);
+        ctx->shared_attached = 0;
+    }
+}
+#endif
+
+#if ENABLE_RECORD_RETENTION
+// 保留管理删掉分段文件后同步录像目录
+static void RetentionOnDelete(void *Opaque, int Cam, const char *Path)
+{
+    #if ENABLE_RECORD_CATALOG
+    RecordHandle *Record = (RecordHandle *)Opaque;
+    record_catalog_remove(&Record->Catalog, Cam, Path);
+    #else
+    (void)Opaque;
+    (void)Cam;
+    (void)Path;
+    #endif
+}
+
+// 槽位池还能扩大时要求保留的可用空间
+static int64_t RetentionFreeGoal(void *Opaque)
+{
+    #if ENABLE_RECORD_WRITE_BEHIND && ENABLE_RECORD_STORE
+    RecordHandle *Record = (RecordHandle *)Opaque;
+    return record_store_free_goal(&Record->Store);
+    #else
+    (void)Opaque;
+    return 0;
+    #endif
+}
+#endif
+
 int32_t Record_Init(StationHandle *Station) {
     RecordHandle *Record = calloc(1, sizeof(RecordHandle));
     if (!Record) return -1;
+    Record->ChannelCnt = Station->Stream ? Station->Stream->ChannelCnt : CamManage_GetChannelCnt(Station);
+    Record->Ctx = calloc(Record->ChannelCnt > 0 ? Record->ChannelCnt : 1, sizeof(RecordCtx));
+    if (!Record->Ctx) {
+        free(Record);
+        return -1;
+    }
     Station->Record = Record;
     Record->Station = Station;
     pthread_mutex_init(&Record->Mutex, NULL);
-    return 0;
+    // 失败时各路退回直接写文件
+    if (record_io_init(&Record->Io) != 0) {
+        LOG_ERROR(TAG, "Record I/O thread init failed, write segments directly\n");
+    }
+    #if ENABLE_RECORD_WRITE_BEHIND && ENABLE_RECORD_STORE
+    // 失败时按 CAMn 目录逐个建文件
+    if (record_store_init(&Record->Store, Station, RECORD_BASE_DIR) != 0) {
+        LOG_ERROR(TAG, "Record store init failed, write per-segment files\n");
+    }
+    #endif
+    #if ENABLE_RECORD_CATALOG
+    if (record_catalog_init(&Record->Catalog, Station, RECORD_BASE_DIR) != 0) {
+        LOG_ERROR(TAG, "Record catalog init failed\n");
+    }
+    #endif
+    #if ENABLE_RECORD_RETENTION
+    if (record_retention_init(&Record->Retention, Station, RECORD_BASE_DIR) != 0) {
+        LOG_ERROR(TAG, "Record retention init failed, old segments will not be deleted\n");
+    }
+    record_retention_set_hooks(&Record->Retention, RetentionOnDelete, RetentionFreeGoal, Record);
+    #endif
+    #if ENABLE_SHARED_RECORDER
+    // 失败时 Record_Start 退回到每路一个线程
+    SharedRecorderInit(Record);
+    #endif
+    return 0;
 }
 void Record_Deinit(StationHandle *Station) {
     if (Station->Record) {
+        // 先停各路录像线程 (排队的数据落盘)，再停 I/O 线程
+        for (int i = 0; i < Station->Record->ChannelCnt; i++) {
+            Record_Stop(Station, i);
+        }
+        #if ENABLE_SHARED_RECORDER
+        SharedRecorderUninit(Station->Record);
+        #endif
+        record_io_uninit(&Station->Record->Io);
+        #if ENABLE_RECORD_WRITE_BEHIND && ENABLE_RECORD_STORE
+        // I/O 线程的回调会更新槽位索引，需在其后停止
+        record_store_uninit(&Station->Record->Store);
+        #endif
+        #if ENABLE_RECORD_RETENTION
+        record_retention_uninit(&Station->Record->Retention);
+        #endif
+        #if ENABLE_RECORD_CATALOG
+        record_catalog_uninit(&Station->Record->Catalog);
+        #endif
         pthread_mutex_destroy(&Station->Record->Mutex);
+        free(Station->Record->Ctx);
         free(Station->Record);
         Station->Record = NULL;
     }
 }
 int32_t Record_Start(StationHandle *Station, int32_t Index) {
     RecordHandle *Record = Station->Record;
-    if (!Record) return -1;
+    char name[16];
+    if (!Record || Index < 0 || Index >= Record->ChannelCnt) return -1;
     Record_Stop(Station, Index);
     memset(&Record->Ctx[Index], 0, sizeof(RecordCtx));
     Record->Ctx[Index].Record = Record;
     Record->Ctx[Index].Rtsp   = &Station->Stream->Rtsp[Index];
-    if (pthread_create(&Record->Ctx[Index].Thread, NULL, Record_Thread, &Record->Ctx[Index]) != 0) return -1;
+    Record->Ctx[Index].StoreTicket = -1;
+    snprintf(name, sizeof(name), "ch%d.record", Index);
+    record_io_writer_init(&Record->Ctx[Index].Io, &Record->Io, name);
+    #if ENABLE_SHARED_RECORDER
+    if (SharedRecorderAdd(Record, &Record->Ctx[Index]) == 0) {
+        Record->Ctx[Index].thread_created = 1;
+        return 0;
+    }
+    #endif
+    if (pthread_create(&Record->Ctx[Index].Thread, NULL, Record_Thread, &Record->Ctx[Index]) != 0) {
+        record_io_writer_destroy(&Record->Ctx[Index].Io);
+        return -1;
+    }
     Record->Ctx[Index].thread_created = 1;
     return 0;
 }
@@ -980,11 +1317,79 @@ int32_t Record_Stop(StationHandle *Station, int32_t Index) {
     RecordCtx *rc;
     RtspCtx *rt;
     if (!Station || !Station->Record || !Station->Stream) return 0;
+    if (Index < 0 || Index >= Station->Record->ChannelCnt) return 0;
     rc = &Station->Record->Ctx[Index];
     rt = &Station->Stream->Rtsp[Index];
     if (!rc->thread_created) return 0;
-    packet_queue_abort(&rt->RecordQueue);
-    pthread_join(rc->Thread, NULL);
+    packet_broadcast_reader_abort(&rt->RecordReader);
+    #if ENABLE_SHARED_RECORDER
+    if (rc->shared_attached) SharedRecorderRemove(Station->Record, rc);
+    else pthread_join(rc->Thread, NULL);
+    #else
+    pthread_join(rc->Thread, NULL);
+    #endif
     rc->thread_created = 0;
-    return 0;
+    record_io_writer_destroy(&rc->Io);
+    return 0;
+}
+
+void Record_DumpIoStats(StationHandle *Station, FILE *fp) {
+    RecordHandle *Record = Station ? Station->Record : NULL;
+    int i;
+
+    if (!Record || !fp) return;
+    for (i = 0; i < Record->ChannelCnt; i++) {
+        if (!Record->Ctx[i].thread_created) continue;
+        record_io_dump(&Record->Ctx[i].Io, fp);
+    }
+    #if ENABLE_RECORD_RETENTION
+    record_retention_dump(&Record->Retention, fp);
+    #endif
+    #if ENABLE_RECORD_CATALOG
+    record_catalog_dump(&Record->Catalog, fp);
+    #endif
+}
+
+void Record_MarkEvent(StationHandle *Station, int32_t Index, uint16_t Flags) {
+    RecordHandle *Record = Station ? Station->Record : NULL;
+
+    if (!Record || Index < 0 || Index >= Record->ChannelCnt) return;
+    __atomic_fetch_or(&Record->Ctx[Index].EventFlags, Flags, __ATOMIC_RELAXED);
+}
+
+int32_t Record_FindSegment(StationHandle *Station, int32_t Index, int64_t TimeMs, RecordCatalogEntry *Out) {
+    #if ENABLE_RECORD_CATALOG
+    if (!Station || !Station->Record) return -1;
+    return record_catalog_find(&Station->Record->Catalog, Index, TimeMs, Out);
+    #else
+    return -1;
+    #endif
+}
+
+int32_t Record_ListSegments(StationHandle *Station, int32_t Index, int64_t FromMs, int64_t ToMs,
+                            RecordCatalogEntry *Out, int32_t Max) {
+    #if ENABLE_RECORD_CATALOG
+    if (!Station || !Station->Record) return 0;
+    return record_catalog_list(&Station->Record->Catalog, Index, FromMs, ToMs, Out, Max);
+    #else
+    return 0;
+    #endif
+}
+
+int32_t Record_ListSegmentsOfDay(StationHandle *Station, int32_t Index, int32_t Year, int32_t Month, int32_t Day,
+                                 RecordCatalogEntry *Out, int32_t Max) {
+    struct tm t;
+    time_t from, to;
+
+    memset(&t, 0, sizeof(t));
+    t.tm_year = Year - 1900;
+    t.tm_mon = Month - 1;
+    t.tm_mday = Day;
+    t.tm_isdst = -1;
+    from = mktime(&t);
+    t.tm_mday++;
+    t.tm_isdst = -1;
+    to = mktime(&t);
+    if (from == (time_t)-1 || to == (time_t)-1) return 0;
+    return Record_ListSegments(Station, Index, (int64_t)from * 1000, (int64_t)to * 1000, Out, Max);
 }
@@ -0,0 +1,665 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+
+#include "storage.h"
+#include "record_catalog.h"
+#include "log.h"
+
+#define TAG "RECORD_CATALOG"
+
+// 回放时每次读入的记录数
+#define CATALOG_READ_BATCH  64
+// 插拔检测与压缩的轮询间隔
+#define CATALOG_POLL_MS     1000
+
+static uint32_t RecordCheck(const RecordCatalogRecord *r)
+{
+    const uint8_t *p = (const uint8_t *)r;
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < offsetof(RecordCatalogRecord, Check); i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 完整路径转成相对卡根目录的路径 ("/tmp/mnt/sdcard//CAM0/x.MP4" -> "CAM0/x.MP4")
+static void RelativeName(RecordCatalog *cat, const char *path, char *name, int size)
+{
+    size_t n = strlen(cat->CardDir);
+
+    if (strncmp(path, cat->CardDir, n) == 0) path += n;
+    while (*path == '/') path++;
+    snprintf(name, size, "%s", path);
+}
+
+static void CatalogPath(RecordCatalog *cat, char *path, int size, const char *suffix)
+{
+    snprintf(path, size, "%s/%s%s", cat->CardDir, RECORD_CATALOG_FILE, suffix);
+}
+
+/* ========================================================================== */
+/* 单路区间索引 (调用者持有 Mutex)                                            */
+/* ========================================================================== */
+
+// 从 pos 开始重算前缀最大结束时间
+static void CamFixMaxEnd(RecordCatalogCam *c, int pos)
+{
+    int64_t m = (pos > c->Begin) ? c->MaxEnd[pos - 1] : INT64_MIN;
+    int i;
+
+    for (i = pos; i < c->Count; i++) {
+        if (c->Items[i].EndMs > m) m = c->Items[i].EndMs;
+        c->MaxEnd[i] = m;
+    }
+}
+
+// 把 [Begin, Count) 挪到数组开头
+static void CamShift(RecordCatalogCam *c)
+{
+    int n = c->Count - c->Begin;
+
+    if (c->Begin == 0) return;
+    memmove(c->Items, c->Items + c->Begin, n * sizeof(RecordCatalogEntry));
+    c->Begin = 0;
+    c->Count = n;
+    CamFixMaxEnd(c, 0);
+}
+
+static int CamInsert(RecordCatalogCam *c, const RecordCatalogEntry *e)
+{
+    RecordCatalogEntry *items;
+    int64_t *maxend;
+    int cap, lo, hi, mid;
+
+    if (c->Count == c->Cap) {
+        if (c->Begin > 0) {
+            CamShift(c);
+        } else {
+            cap = c->Cap ? c->Cap * 2 : 256;
+            items = realloc(c->Items, cap * sizeof(RecordCatalogEntry));
+            if (!items) return -1;
+            c->Items = items;
+            maxend = realloc(c->MaxEnd, cap * sizeof(int64_t));
+            if (!maxend) return -1;
+            c->MaxEnd = maxend;
+            c->Cap = cap;
+        }
+    }
+
+    // 通常按时间顺序到达，直接追加；时钟回拨时插入到有序位置
+    lo = c->Begin;
+    hi = c->Count;
+    if (hi > lo && c->Items[hi - 1].StartMs > e->StartMs) {
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (c->Items[mid].StartMs <= e->StartMs) lo = mid + 1;
+            else hi = mid;
+        }
+        memmove(c->Items + lo + 1, c->Items + lo, (c->Count - lo) * sizeof(RecordCatalogEntry));
+    } else {
+        lo = c->Count;
+    }
+    c->Items[lo] = *e;
+    c->Count++;
+    CamFixMaxEnd(c, lo);
+    return 0;
+}
+
+static void CamRemoveAt(RecordCatalogCam *c, int i)
+{
+    if (i == c->Begin) {
+        // 最常见：删除最旧的
+        c->Begin++;
+    } else {
+        memmove(c->Items + i, c->Items + i + 1, (c->Count - i - 1) * sizeof(RecordCatalogEntry));
+        c->Count--;
+        CamFixMaxEnd(c, i);
+        return;
+    }
+    if (c->Begin == c->Count) c->Begin = c->Count = 0;
+    else if (c->Begin >= 1024 && c->Begin > (c->Count - c->Begin)) CamShift(c);
+}
+
+// 按起始时间精确查找，找不到返回 -1
+static int CamFindStart(RecordCatalogCam *c, int64_t start_ms, int slot)
+{
+    int lo = c->Begin, hi = c->Count, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (c->Items[mid].StartMs < start_ms) lo = mid + 1;
+        else hi = mid;
+    }
+    for (; lo < c->Count && c->Items[lo].StartMs == start_ms; lo++) {
+        if (c->Items[lo].Slot == slot) return lo;
+    }
+    return -1;
+}
+
+/* ========================================================================== */
+/* 条目增删 (调用者持有 Mutex，或独占还没交换进来的回放副本)                  */
+/* ========================================================================== */
+
+static void RemoveEntryLocked(RecordCatalog *cat, int cam, int i)
+{
+    RecordCatalogCam *c = &cat->Cam[cam];
+    int slot = c->Items[i].Slot;
+
+    if (slot >= 0 && slot < RECORD_STORE_MAX_SLOTS && cat->SlotRef[slot].Cam == cam &&
+        cat->SlotRef[slot].StartMs == c->Items[i].StartMs) {
+        cat->SlotRef[slot].Cam = -1;
+    }
+    CamRemoveAt(c, i);
+    cat->Live--;
+}
+
+static void DropSlotLocked(RecordCatalog *cat, int slot)
+{
+    RecordCatalogSlotRef *ref;
+    int i;
+
+    if (slot < 0 || slot >= RECORD_STORE_MAX_SLOTS) return;
+    ref = &cat->SlotRef[slot];
+    if (ref->Cam < 0 || ref->Cam >= CAM_CHANNEL_LIMIT) return;
+    i = CamFindStart(&cat->Cam[ref->Cam], ref->StartMs, slot);
+    if (i >= 0) RemoveEntryLocked(cat, ref->Cam, i);
+    ref->Cam = -1;
+}
+
+static void AddEntryLocked(RecordCatalog *cat, const RecordCatalogEntry *e)
+{
+    if (e->Cam < 0 || e->Cam >= CAM_CHANNEL_LIMIT) return;
+    // 同一个槽位只保留最新的内容
+    if (e->Slot >= 0) DropSlotLocked(cat, e->Slot);
+    if (CamInsert(&cat->Cam[e->Cam], e) != 0) {
+        LOG_ERROR(TAG, "CAM%d: catalog index grow failed\n", e->Cam);
+        return;
+    }
+    cat->Live++;
+    if (e->Slot >= 0 && e->Slot < RECORD_STORE_MAX_SLOTS) {
+        cat->SlotRef[e->Slot].Cam = e->Cam;
+        cat->SlotRef[e->Slot].StartMs = e->StartMs;
+    }
+}
+
+// 按文件名删除：保留管理总是删最旧的，从 Begin 往后找通常第一个就是
+static void RemoveNameLocked(RecordCatalog *cat, int cam, const char *name)
+{
+    RecordCatalogCam *c;
+    int i;
+
+    if (cam < 0 || cam >= CAM_CHANNEL_LIMIT) return;
+    c = &cat->Cam[cam];
+    for (i = c->Begin; i < c->Count; i++) {
+        if (c->Items[i].Slot < 0 && strcmp(c->Items[i].Name, name) == 0) {
+            RemoveEntryLocked(cat, cam, i);
+            return;
+        }
+    }
+}
+
+static void ApplyRecordLocked(RecordCatalog *cat, const RecordCatalogRecord *r)
+{
+    RecordCatalogEntry e;
+
+    if (r->Op == RECORD_CATALOG_OP_DEL) {
+        RemoveNameLocked(cat, r->Cam, r->Name);
+        return;
+    }
+    if (r->Op == RECORD_CATALOG_OP_DROP) {
+        DropSlotLocked(cat, r->Slot);
+        return;
+    }
+    memset(&e, 0, sizeof(e));
+    e.Cam = r->Cam;
+    e.Flags = r->Flags;
+    e.KeyFrames = r->KeyFrames;
+    e.StartMs = r->StartMs;
+    e.EndMs = r->EndMs;
+    e.Bytes = r->Bytes;
+    e.Slot = r->Slot;
+    memcpy(e.Name, r->Name, sizeof(e.Name));
+    e.Name[sizeof(e.Name) - 1] = '\0';
+    AddEntryLocked(cat, &e);
+}
+
+static void FillRecord(RecordCatalogRecord *r, int op, const RecordCatalogEntry *e)
+{
+    memset(r, 0, sizeof(*r));
+    r->Magic = RECORD_CATALOG_MAGIC;
+    r->Op = (uint8_t)op;
+    r->Cam = e->Cam;
+    r->StartMs = e->StartMs;
+    r->EndMs = e->EndMs;
+    r->Bytes = e->Bytes;
+    r->KeyFrames = e->KeyFrames;
+    r->Flags = e->Flags;
+    r->Slot = e->Slot;
+    memcpy(r->Name, e->Name, sizeof(r->Name));
+    r->Check = RecordCheck(r);
+}
+
+/* ========================================================================== */
+/* 卡上文件                                                                   */
+/* ========================================================================== */
+
+static void UnloadLocked(RecordCatalog *cat)
+{
+    int i;
+
+    if (cat->Fd >= 0) close(cat->Fd);
+    cat->Fd = -1;
+    for (i = 0; i < CAM_CHANNEL_LIMIT; i++) cat->Cam[i].Begin = cat->Cam[i].Count = 0;
+    for (i = 0; i < RECORD_STORE_MAX_SLOTS; i++) cat->SlotRef[i].Cam = -1;
+    cat->Live = 0;
+    cat->FileRecords = 0;
+    cat->Loaded = 0;
+    cat->CompactRequest = 0;
+    // 暂存的是拔出的那张卡上的增删，不能补写到下一张卡
+    cat->NbPending = 0;
+}
+
+static void FreeCams(RecordCatalog *cat)
+{
+    int i;
+
+    for (i = 0; i < CAM_CHANNEL_LIMIT; i++) {
+        free(cat->Cam[i].Items);
+        free(cat->Cam[i].MaxEnd);
+        memset(&cat->Cam[i], 0, sizeof(RecordCatalogCam));
+    }
+}
+
+static void AppendLocked(RecordCatalog *cat, const RecordCatalogRecord *r)
+{
+    if (cat->Fd < 0) return;
+    if (write(cat->Fd, r, sizeof(*r)) != (ssize_t)sizeof(*r)) {
+        // 卡被拔出或格式化：目录线程下次轮询时重新加载
+        LOG_WARN(TAG, "append failed: %d\n", errno);
+        UnloadLocked(cat);
+        return;
+    }
+    cat->FileRecords++;
+    // 压缩要重写整个文件，交给目录线程
+    if (cat->FileRecords >= RECORD_CATALOG_COMPACT_MIN * 2 && cat->FileRecords > cat->Live * 4) cat->CompactRequest = 1;
+}
+
+// 应用并追加一条增删记录，返回是否写了记录 (槽位没有条目时 DROP 不用记)
+static int CommitLocked(RecordCatalog *cat, RecordCatalogRecord *r)
+{
+    RecordCatalogSlotRef *ref;
+
+    if (r->Op == RECORD_CATALOG_OP_DROP) {
+        ref = &cat->SlotRef[r->Slot];
+        if (ref->Cam < 0) return 0;
+        r->Cam = ref->Cam;
+        r->StartMs = ref->StartMs;
+        r->Check = RecordCheck(r);
+    }
+    ApplyRecordLocked(cat, r);
+    AppendLocked(cat, r);
+    return 1;
+}
+
+// 写入路径只做这一步：已加载时直接提交；卡已就绪但目录线程还在回放时先暂存，交换进来后补写
+static int SubmitLocked(RecordCatalog *cat, RecordCatalogRecord *r)
+{
+    if (cat->Loaded) return CommitLocked(cat, r);
+    if (!Storage_IsReady(cat->Station)) return 0;
+    if (cat->NbPending >= RECORD_CATALOG_PENDING_MAX) {
+        LOG_WARN(TAG, "pending full, drop op %d cam %d\n", r->Op, r->Cam);
+        return 0;
+    }
+    cat->Pending[cat->NbPending++] = *r;
+    return 0;
+}
+
+/* ========================================================================== */
+/* 目录线程 (回放与压缩都不持有 Mutex 做整文件读写)                           */
+/* ========================================================================== */
+
+// 把 catalog.bin 回放到 tmp (目录线程独占，不用加锁)，返回截掉残缺尾部后用于追加的 fd
+static int CatalogReplay(RecordCatalog *cat, RecordCatalog *tmp)
+{
+    char path[128];
+    RecordCatalogRecord buf[CATALOG_READ_BATCH];
+    ssize_t got;
+    off_t valid = 0;
+    int fd, i, n, torn = 0;
+
+    CatalogPath(cat, path, sizeof(path), "");
+    fd = open(path, O_RDONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        LOG_ERROR(TAG, "open %s failed: %d\n", path, errno);
+        return -1;
+    }
+    while (!torn && (got = read(fd, buf, sizeof(buf))) > 0) {
+        n = (int)(got / sizeof(RecordCatalogRecord));
+        for (i = 0; i < n; i++) {
+            if (buf[i].Magic != RECORD_CATALOG_MAGIC || buf[i].Check != RecordCheck(&buf[i])) {
+                torn = 1;
+                break;
+            }
+            ApplyRecordLocked(tmp, &buf[i]);
+            valid += sizeof(RecordCatalogRecord);
+            tmp->FileRecords++;
+        }
+        if (got % sizeof(RecordCatalogRecord)) torn = 1;
+    }
+    close(fd);
+
+    fd = open(path, O_WRONLY | O_APPEND, 0644);
+    if (fd < 0) {
+        LOG_ERROR(TAG, "open %s for append failed: %d\n", path, errno);
+        return -1;
+    }
+    // 掉电时写了一半的尾部记录截掉，后续追加从整条记录边界开始 (未加载时写入路径不会追加)
+    if (torn) {
+        LOG_WARN(TAG, "Discard torn tail after %u records\n", tmp->FileRecords);
+        if (ftruncate(fd, valid) != 0) LOG_WARN(TAG, "truncate failed: %d\n", errno);
+    }
+    return fd;
+}
+
+static void CatalogLoad(RecordCatalog *cat)
+{
+    RecordCatalog *tmp;
+    RecordCatalogCam c;
+    RecordCatalogSlotRef *ref;
+    int fd, i, drop = 0;
+
+    tmp = calloc(1, sizeof(RecordCatalog));
+    if (!tmp || !(tmp->SlotRef = calloc(RECORD_STORE_MAX_SLOTS, sizeof(RecordCatalogSlotRef)))) {
+        LOG_ERROR(TAG, "alloc load table failed\n");
+        free(tmp);
+        return;
+    }
+    for (i = 0; i < RECORD_STORE_MAX_SLOTS; i++) tmp->SlotRef[i].Cam = -1;
+    fd = CatalogReplay(cat, tmp);
+
+    // 建好的索引换进来，旧的 (空的) 数组随 tmp 释放
+    pthread_mutex_lock(&cat->Mutex);
+    if (fd >= 0) {
+        for (i = 0; i < CAM_CHANNEL_LIMIT; i++) {
+            c = cat->Cam[i];
+            cat->Cam[i] = tmp->Cam[i];
+            tmp->Cam[i] = c;
+        }
+        ref = cat->SlotRef;
+        cat->SlotRef = tmp->SlotRef;
+        tmp->SlotRef = ref;
+        cat->Live = tmp->Live;
+        cat->FileRecords = tmp->FileRecords;
+        cat->Fd = fd;
+        cat->Loaded = 1;
+        LOG_INFO(TAG, "Loaded catalog: %u records, %u live, %d pending\n", cat->FileRecords, cat->Live, cat->NbPending);
+        for (i = 0; i < cat->NbPending && cat->Loaded; i++) {
+            if (CommitLocked(cat, &cat->Pending[i]) && cat->Pending[i].Op == RECORD_CATALOG_OP_DROP) drop = 1;
+        }
+        cat->NbPending = 0;
+        if (drop && cat->Fd >= 0) fdatasync(cat->Fd);
+        if (cat->FileRecords >= RECORD_CATALOG_COMPACT_MIN && cat->FileRecords > cat->Live * 2) cat->CompactRequest = 1;
+    }
+    pthread_mutex_unlock(&cat->Mutex);
+
+    FreeCams(tmp);
+    free(tmp->SlotRef);
+    free(tmp);
+}
+
+// 只写活跃条目到临时文件，再原子替换。条目在锁内拷出，写文件和 fsync 在锁外；
+// 这期间追加的记录最后在锁内从旧文件尾部补到临时文件 (通常只有几条)
+static void CatalogCompact(RecordCatalog *cat)
+{
+    char path[128], tmp[128];
+    RecordCatalogRecord *recs, r;
+    RecordCatalogCam *c;
+    uint32_t n = 0, base, total, k;
+    int fd, rfd, i, j, ok = 1;
+
+    pthread_mutex_lock(&cat->Mutex);
+    cat->CompactRequest = 0;
+    recs = cat->Loaded ? malloc((cat->Live + 1) * sizeof(RecordCatalogRecord)) : NULL;
+    if (!recs) {
+        pthread_mutex_unlock(&cat->Mutex);
+        return;
+    }
+    for (i = 0; i < CAM_CHANNEL_LIMIT; i++) {
+        c = &cat->Cam[i];
+        for (j = c->Begin; j < c->Count; j++) FillRecord(&recs[n++], RECORD_CATALOG_OP_ADD, &c->Items[j]);
+    }
+    base = cat->FileRecords;
+    pthread_mutex_unlock(&cat->Mutex);
+
+    CatalogPath(cat, path, sizeof(path), "");
+    CatalogPath(cat, tmp, sizeof(tmp), ".tmp");
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(recs);
+        return;
+    }
+    if (write(fd, recs, n * sizeof(RecordCatalogRecord)) != (ssize_t)(n * sizeof(RecordCatalogRecord))) ok = 0;
+    if (ok && fsync(fd) != 0) ok = 0;
+    free(recs);
+
+    pthread_mutex_lock(&cat->Mutex);
+    // 期间卡被拔出或追加失败：文件已不是拷出条目时的那个
+    if (!cat->Loaded) ok = 0;
+    if (ok && cat->FileRecords > base) {
+        rfd = open(path, O_RDONLY);
+        if (rfd < 0) ok = 0;
+        for (k = base; ok && k < cat->FileRecords; k++) {
+            if (pread(rfd, &r, sizeof(r), (off_t)k * sizeof(r)) != (ssize_t)sizeof(r) ||
+                write(fd, &r, sizeof(r)) != (ssize_t)sizeof(r)) ok = 0;
+        }
+        if (rfd >= 0) close(rfd);
+        if (ok && fdatasync(fd) != 0) ok = 0;
+    }
+    close(fd);
+    if (!ok || rename(tmp, path) != 0) {
+        LOG_WARN(TAG, "compact failed: %d\n", errno);
+        unlink(tmp);
+        pthread_mutex_unlock(&cat->Mutex);
+        return;
+    }
+
+    total = n + (cat->FileRecords - base);
+    if (cat->Fd >= 0) close(cat->Fd);
+    cat->Fd = open(path, O_WRONLY | O_APPEND, 0644);
+    LOG_INFO(TAG, "Compacted %u -> %u records\n", cat->FileRecords, total);
+    cat->FileRecords = total;
+    if (cat->Fd < 0) UnloadLocked(cat);
+    pthread_mutex_unlock(&cat->Mutex);
+}
+
+// 卡就绪时加载，卡拔出后丢弃内存中的索引，按需压缩
+static void *RecordCatalog_Thread(void *Arg)
+{
+    RecordCatalog *cat = (RecordCatalog *)Arg;
+    int ready, loaded, compact, i;
+
+    prctl(PR_SET_NAME, "Record_Catalog");
+    while (!cat->AbortRequest) {
+        ready = Storage_IsReady(cat->Station);
+        pthread_mutex_lock(&cat->Mutex);
+        if (!ready && (cat->Loaded || cat->NbPending)) UnloadLocked(cat);
+        loaded = cat->Loaded;
+        compact = cat->CompactRequest;
+        pthread_mutex_unlock(&cat->Mutex);
+
+        if (!loaded && ready) CatalogLoad(cat);
+        else if (loaded && compact) CatalogCompact(cat);
+        for (i = 0; i < CATALOG_POLL_MS / 100 && !cat->AbortRequest; i++) usleep(100 * 1000);
+    }
+    return NULL;
+}
+
+/* ========================================================================== */
+/* 对外接口                                                                   */
+/* ========================================================================== */
+
+int record_catalog_init(RecordCatalog *cat, StationHandle *Station, const char *card_dir)
+{
+    int i;
+
+    if (!cat) return -1;
+    memset(cat, 0, sizeof(RecordCatalog));
+    cat->Station = Station;
+    cat->Fd = -1;
+    snprintf(cat->CardDir, sizeof(cat->CardDir), "%s", card_dir ? card_dir : STORAGE_CARD);
+    pthread_mutex_init(&cat->Mutex, NULL);
+    cat->SlotRef = calloc(RECORD_STORE_MAX_SLOTS, sizeof(RecordCatalogSlotRef));
+    if (!cat->SlotRef) {
+        LOG_ERROR(TAG, "alloc slot table failed\n");
+        return -1;
+    }
+    for (i = 0; i < RECORD_STORE_MAX_SLOTS; i++) cat->SlotRef[i].Cam = -1;
+    if (pthread_create(&cat->Thread, NULL, RecordCatalog_Thread, cat) != 0) {
+        LOG_ERROR(TAG, "Failed to create record catalog thread\n");
+        free(cat->SlotRef);
+        cat->SlotRef = NULL;
+        return -1;
+    }
+    cat->ThreadStarted = 1;
+    cat->Inited = 1;
+    return 0;
+}
+
+void record_catalog_uninit(RecordCatalog *cat)
+{
+    if (!cat || !cat->Inited) return;
+    cat->AbortRequest = 1;
+    if (cat->ThreadStarted) pthread_join(cat->Thread, NULL);
+    cat->ThreadStarted = 0;
+    pthread_mutex_lock(&cat->Mutex);
+    UnloadLocked(cat);
+    FreeCams(cat);
+    free(cat->SlotRef);
+    cat->SlotRef = NULL;
+    cat->Inited = 0;
+    pthread_mutex_unlock(&cat->Mutex);
+    pthread_mutex_destroy(&cat->Mutex);
+}
+
+void record_catalog_add(RecordCatalog *cat, const RecordCatalogEntry *e, const char *path)
+{
+    RecordCatalogEntry ent;
+    RecordCatalogRecord r;
+
+    if (!cat || !cat->Inited || !e || !path) return;
+    ent = *e;
+    RelativeName(cat, path, ent.Name, sizeof(ent.Name));
+    FillRecord(&r, RECORD_CATALOG_OP_ADD, &ent);
+
+    pthread_mutex_lock(&cat->Mutex);
+    SubmitLocked(cat, &r);
+    pthread_mutex_unlock(&cat->Mutex);
+}
+
+void record_catalog_remove(RecordCatalog *cat, int cam, const char *path)
+{
+    RecordCatalogEntry ent;
+    RecordCatalogRecord r;
+
+    if (!cat || !cat->Inited || !path || cam < 0 || cam >= CAM_CHANNEL_LIMIT) return;
+    memset(&ent, 0, sizeof(ent));
+    ent.Cam = (int16_t)cam;
+    ent.Slot = -1;
+    RelativeName(cat, path, ent.Name, sizeof(ent.Name));
+    FillRecord(&r, RECORD_CATALOG_OP_DEL, &ent);
+
+    pthread_mutex_lock(&cat->Mutex);
+    SubmitLocked(cat, &r);
+    pthread_mutex_unlock(&cat->Mutex);
+}
+
+void record_catalog_drop_slot(RecordCatalog *cat, int slot)
+{
+    RecordCatalogEntry ent;
+    RecordCatalogRecord r;
+
+    if (!cat || !cat->Inited || slot < 0 || slot >= RECORD_STORE_MAX_SLOTS) return;
+    memset(&ent, 0, sizeof(ent));
+    ent.Cam = -1;
+    ent.Slot = slot;
+    FillRecord(&r, RECORD_CATALOG_OP_DROP, &ent);
+
+    pthread_mutex_lock(&cat->Mutex);
+    // 之后就要覆盖槽位数据，作废记录必须先落盘
+    if (SubmitLocked(cat, &r) && cat->Fd >= 0) fdatasync(cat->Fd);
+    pthread_mutex_unlock(&cat->Mutex);
+}
+
+int record_catalog_find(RecordCatalog *cat, int cam, int64_t t_ms, RecordCatalogEntry *out)
+{
+    RecordCatalogCam *c;
+    int lo, hi, mid, j, ret = -1;
+
+    if (!cat || !cat->Inited || cam < 0 || cam >= CAM_CHANNEL_LIMIT) return -1;
+    pthread_mutex_lock(&cat->Mutex);
+    if (cat->Loaded) {
+        c = &cat->Cam[cam];
+        // 最后一个 StartMs <= t 的分段，再往前找仍可能覆盖 t 的 (前缀最大结束时间 >= t)
+        lo = c->Begin;
+        hi = c->Count;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (c->Items[mid].StartMs <= t_ms) lo = mid + 1;
+            else hi = mid;
+        }
+        for (j = lo - 1; j >= c->Begin && c->MaxEnd[j] >= t_ms; j--) {
+            if (c->Items[j].EndMs >= t_ms) {
+                if (out) *out = c->Items[j];
+                ret = 0;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cat->Mutex);
+    return ret;
+}
+
+int record_catalog_list(RecordCatalog *cat, int cam, int64_t from_ms, int64_t to_ms, RecordCatalogEntry *out, int max)
+{
+    RecordCatalogCam *c;
+    int lo, hi, mid, i, total = 0;
+
+    if (!cat || !cat->Inited || cam < 0 || cam >= CAM_CHANNEL_LIMIT) return 0;
+    pthread_mutex_lock(&cat->Mutex);
+    if (cat->Loaded) {
+        c = &cat->Cam[cam];
+        // 第一个前缀最大结束时间 > from 的位置之前的分段都在时间段之前结束
+        lo = c->Begin;
+        hi = c->Count;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (c->MaxEnd[mid] > from_ms) hi = mid;
+            else lo = mid + 1;
+        }
+        for (i = lo; i < c->Count && c->Items[i].StartMs < to_ms; i++) {
+            if (c->Items[i].EndMs <= from_ms) continue;
+            if (out && total < max) out[total] = c->Items[i];
+            total++;
+        }
+    }
+    pthread_mutex_unlock(&cat->Mutex);
+    return total;
+}
+
+void record_catalog_dump(RecordCatalog *cat, FILE *fp)
+{
+    if (!cat || !cat->Inited || !fp) return;
+    pthread_mutex_lock(&cat->Mutex);
+    fprintf(fp, "record.catalog loaded=%d live=%u file_records=%u\n", cat->Loaded, cat->Live, cat->FileRecords);
+    pthread_mutex_unlock(&cat->Mutex);
+}
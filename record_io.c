@@ -0,0 +1,528 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE             // O_DIRECT
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+
+#include "record_io.h"
+#include "log.h"
+
+#define TAG "RECORD_IO"
+
+// 1 = 整块写入时使用 O_DIRECT (绕过页缓存，避免脏页堆积后集中回写造成更长的停顿)
+// 文件系统不支持时自动退回普通写入
+#define RECORD_IO_USE_DIRECT 1
+
+static int64_t NowMsMonotonic(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* ========================================================================== */
+/* 块管理 (调用者持有 io->mutex)                                              */
+/* ========================================================================== */
+
+// 取一个数据块：先用空闲链表，不够时在上限内分配
+static RecordIoBlock *GetDataBlockLocked(RecordIoWriter *w)
+{
+    RecordIoBlock *b = w->free_list;
+
+    if (b) {
+        w->free_list = b->next;
+    } else {
+        if (w->nb_blocks >= RECORD_IO_MAX_BLOCKS) return NULL;
+        b = calloc(1, sizeof(RecordIoBlock));
+        if (!b) return NULL;
+        if (posix_memalign((void **)&b->data, RECORD_IO_ALIGN, RECORD_IO_BLOCK_SIZE) != 0) {
+            free(b);
+            return NULL;
+        }
+        w->nb_blocks++;
+    }
+    b->op = RECORD_IO_OP_DATA;
+    b->len = 0;
+    b->next = NULL;
+    return b;
+}
+
+static void PutBlockLocked(RecordIoWriter *w, RecordIoBlock *b)
+{
+    if (!b->data) {
+        free(b);
+        return;
+    }
+    b->next = w->free_list;
+    w->free_list = b;
+}
+
+static void QueueBlockLocked(RecordIoWriter *w, RecordIoBlock *b)
+{
+    RecordIo *io = w->io;
+
+    b->next = NULL;
+    if (w->tail) w->tail->next = b;
+    else w->head = b;
+    w->tail = b;
+    w->queued++;
+    if (w->queued > w->stats.peak_blocks) w->stats.peak_blocks = w->queued;
+
+    if (!w->scheduled) {
+        w->scheduled = 1;
+        w->next = NULL;
+        if (io->ready_tail) io->ready_tail->next = w;
+        else io->ready_head = w;
+        io->ready_tail = w;
+        pthread_cond_broadcast(&io->cond);
+    }
+}
+
+/* ========================================================================== */
+/* I/O 线程                                                                   */
+/* ========================================================================== */
+
+static int OpenFile(RecordIoWriter *w, const char *path)
+{
+    // 预分配文件必须已存在，原地覆盖不截断，保留已分配的簇
+    int flags = w->target.prealloc > 0 ? O_WRONLY : (O_WRONLY | O_CREAT | O_TRUNC);
+
+    w->file_off = 0;
+    w->io_error = 0;
+    w->direct = 0;
+#if RECORD_IO_USE_DIRECT
+    w->fd = open(path, flags | O_DIRECT, 0644);
+    if (w->fd >= 0) {
+        w->direct = 1;
+        return 0;
+    }
+#endif
+    w->fd = open(path, flags, 0644);
+    return w->fd >= 0 ? 0 : -1;
+}
+
+// O_DIRECT 要求长度和偏移对齐，文件最后不足一块的数据改用普通写入
+static void DropDirect(RecordIoWriter *w)
+{
+    int flags;
+
+    if (!w->direct) return;
+    flags = fcntl(w->fd, F_GETFL);
+    if (flags >= 0) fcntl(w->fd, F_SETFL, flags & ~O_DIRECT);
+    w->direct = 0;
+}
+
+// 预分配文件中有效数据之后的旧内容用一个 'free' box 盖住，解析器会直接跳到文件末尾
+static void WriteFreeBox(RecordIoWriter *w)
+{
+    int64_t left = w->target.prealloc - w->file_off;
+    uint8_t hdr[8];
+
+    if (left < 8 || left > 0xffffffffLL) return;
+    DropDirect(w);
+    hdr[0] = (uint8_t)(left >> 24);
+    hdr[1] = (uint8_t)(left >> 16);
+    hdr[2] = (uint8_t)(left >> 8);
+    hdr[3] = (uint8_t)left;
+    memcpy(hdr + 4, "free", 4);
+    if (pwrite(w->fd, hdr, sizeof(hdr), w->file_off) != (ssize_t)sizeof(hdr)) {
+        LOG_WARN(TAG, "[%s] write free box failed: %d\n", w->name, errno);
+    }
+}
+
+// 关闭当前文件并回调 CLOSED (OPEN 失败的文件也要回调，让上层释放槽位)
+static void FinishFile(RecordIoWriter *w)
+{
+    struct stat sb;
+
+    if (w->fd >= 0) {
+        if (w->target.prealloc > 0) {
+            WriteFreeBox(w);
+            // 之前写超过预分配大小的文件截回去，free box 之后不能再有旧分片
+            if (fstat(w->fd, &sb) == 0 && sb.st_size > w->target.prealloc &&
+                ftruncate(w->fd, w->target.prealloc) != 0) {
+                LOG_WARN(TAG, "[%s] truncate to %lld failed: %d\n", w->name, (long long)w->target.prealloc, errno);
+            }
+        }
+        close(w->fd);
+        w->fd = -1;
+    }
+    if (w->target_pending) {
+        w->target_pending = 0;
+        if (w->target.cb) w->target.cb(w->target.opaque, w->target.tag, RECORD_IO_EV_CLOSED, w->file_off, w->io_error);
+    }
+    memset(&w->target, 0, sizeof(w->target));
+}
+
+static int WriteFull(RecordIoWriter *w, const uint8_t *data, int len)
+{
+    int off = 0;
+    ssize_t n;
+
+    if (w->direct && ((len % RECORD_IO_ALIGN) != 0 || (w->file_off % RECORD_IO_ALIGN) != 0)) DropDirect(w);
+    while (off < len) {
+        n = write(w->fd, data + off, len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL && w->direct) {
+                DropDirect(w);
+                continue;
+            }
+            return -1;
+        }
+        off += (int)n;
+        w->file_off += n;
+    }
+    return 0;
+}
+
+// 处理一个块，统计记入 st，写失败返回 -1
+static int ProcessBlock(RecordIoWriter *w, RecordIoBlock *b, RecordIoStats *st)
+{
+    int64_t t0, cost;
+
+    switch (b->op) {
+    case RECORD_IO_OP_OPEN:
+        FinishFile(w);
+        w->target = b->target;
+        w->target_pending = 1;
+        if (OpenFile(w, b->path) < 0) {
+            LOG_ERROR(TAG, "[%s] open %s failed: %d\n", w->name, b->path, errno);
+            w->io_error = 1;
+            if (w->target.cb) w->target.cb(w->target.opaque, w->target.tag, RECORD_IO_EV_OPENED, 0, 1);
+            return -1;
+        }
+        if (w->target.cb) w->target.cb(w->target.opaque, w->target.tag, RECORD_IO_EV_OPENED, 0, 0);
+        st->files++;
+        st->direct = w->direct;
+        return 0;
+
+    case RECORD_IO_OP_DATA:
+        if (w->fd < 0 || w->io_error || b->len <= 0) return 0;
+        // 预分配文件不能写出边界 (至少留出 free box 头)，超出时放弃该分段
+        if (w->target.prealloc > 0 && w->file_off + b->len > w->target.prealloc - 8) {
+            LOG_ERROR(TAG, "[%s] segment exceeds preallocated %lld bytes\n", w->name, (long long)w->target.prealloc);
+            w->io_error = 1;
+            return -1;
+        }
+        t0 = NowMsMonotonic();
+        if (WriteFull(w, b->data, b->len) < 0) {
+            LOG_ERROR(TAG, "[%s] write failed: %d\n", w->name, errno);
+            w->io_error = 1;
+            return -1;
+        }
+        cost = NowMsMonotonic() - t0;
+        st->bytes += b->len;
+        st->writes++;
+        if (cost > st->write_max_ms) st->write_max_ms = cost;
+        if (cost >= RECORD_IO_STALL_MS) {
+            st->stalls++;
+            st->stall_total_ms += cost;
+            LOG_WARN(TAG, "[%s] SD write stalled %lldms (%d bytes)\n", w->name, (long long)cost, b->len);
+        }
+        return 0;
+
+    case RECORD_IO_OP_CLOSE:
+        FinishFile(w);
+        return 0;
+    }
+    return 0;
+}
+
+static void *RecordIoThread(void *Arg)
+{
+    RecordIo *io = (RecordIo *)Arg;
+    RecordIoWriter *w;
+    RecordIoBlock *batch, *b, *next;
+    RecordIoStats st;
+    uint32_t failed_gen;
+
+    prctl(PR_SET_NAME, "Record_IO");
+
+    pthread_mutex_lock(&io->mutex);
+    while (!io->abort_request) {
+        w = io->ready_head;
+        if (!w) {
+            pthread_cond_wait(&io->cond, &io->mutex);
+            continue;
+        }
+        io->ready_head = w->next;
+        if (!io->ready_head) io->ready_tail = NULL;
+        w->next = NULL;
+
+        // 整条队列取走后解锁写入，录像线程只在取块/入队时短暂持锁
+        batch = w->head;
+        w->head = w->tail = NULL;
+        w->queued = 0;
+        pthread_mutex_unlock(&io->mutex);
+
+        memset(&st, 0, sizeof(st));
+        st.direct = -1;
+        failed_gen = 0;
+        for (b = batch; b; b = b->next) {
+            if (ProcessBlock(w, b, &st) < 0) failed_gen = b->gen;
+        }
+
+        pthread_mutex_lock(&io->mutex);
+        for (b = batch; b; b = next) {
+            next = b->next;
+            PutBlockLocked(w, b);
+        }
+        w->stats.bytes += st.bytes;
+        w->stats.files += st.files;
+        w->stats.writes += st.writes;
+        w->stats.stalls += st.stalls;
+        w->stats.stall_total_ms += st.stall_total_ms;
+        if (st.write_max_ms > w->stats.write_max_ms) w->stats.write_max_ms = st.write_max_ms;
+        if (st.direct >= 0) w->stats.direct = st.direct;
+        if (failed_gen) {
+            w->failed_gen = failed_gen;
+            w->stats.errors++;
+        }
+
+        // 写入期间又有新块入队则排回就绪链表尾部，各路轮流写
+        if (w->head) {
+            if (io->ready_tail) io->ready_tail->next = w;
+            else io->ready_head = w;
+            io->ready_tail = w;
+        } else {
+            w->scheduled = 0;
+            pthread_cond_broadcast(&io->cond); // 唤醒等待该路写完的 writer_destroy
+        }
+    }
+    pthread_mutex_unlock(&io->mutex);
+    return NULL;
+}
+
+int record_io_init(RecordIo *io)
+{
+    if (!io) return -1;
+    memset(io, 0, sizeof(RecordIo));
+    pthread_mutex_init(&io->mutex, NULL);
+    pthread_cond_init(&io->cond, NULL);
+    if (pthread_create(&io->thread, NULL, RecordIoThread, io) != 0) {
+        LOG_ERROR(TAG, "Failed to create record I/O thread\n");
+        return -1;
+    }
+    io->started = 1;
+    return 0;
+}
+
+void record_io_uninit(RecordIo *io)
+{
+    if (!io) return;
+    pthread_mutex_lock(&io->mutex);
+    io->abort_request = 1;
+    pthread_cond_broadcast(&io->cond);
+    pthread_mutex_unlock(&io->mutex);
+
+    if (io->started) pthread_join(io->thread, NULL);
+    io->started = 0;
+    pthread_cond_destroy(&io->cond);
+    pthread_mutex_destroy(&io->mutex);
+}
+
+/* ========================================================================== */
+/* 录像线程侧                                                                 */
+/* ========================================================================== */
+
+void record_io_writer_init(RecordIoWriter *w, RecordIo *io, const char *name)
+{
+    memset(w, 0, sizeof(RecordIoWriter));
+    w->io = io;
+    w->fd = -1;
+    snprintf(w->name, sizeof(w->name), "%s", name ? name : "rec");
+}
+
+void record_io_writer_destroy(RecordIoWriter *w)
+{
+    RecordIo *io = w->io;
+    RecordIoBlock *b, *next;
+
+    if (!io) return;
+    pthread_mutex_lock(&io->mutex);
+    if (w->cur) {
+        PutBlockLocked(w, w->cur);
+        w->cur = NULL;
+    }
+    while (w->scheduled && io->started && !io->abort_request) {
+        pthread_cond_wait(&io->cond, &io->mutex);
+    }
+    // I/O 线程未运行时队列中可能还有块，直接丢弃
+    for (b = w->head; b; b = next) {
+        next = b->next;
+        PutBlockLocked(w, b);
+    }
+    w->head = w->tail = NULL;
+    w->queued = 0;
+    for (b = w->free_list; b; b = next) {
+        next = b->next;
+        free(b->data);
+        free(b);
+    }
+    w->free_list = NULL;
+    w->nb_blocks = 0;
+    pthread_mutex_unlock(&io->mutex);
+
+    FinishFile(w);
+    w->io = NULL;
+}
+
+// AVIOContext 写回调：只拷贝到块缓冲，满一块交给 I/O 线程
+static int WritePacket(void *opaque, uint8_t *buf, int buf_size)
+{
+    RecordIoWriter *w = (RecordIoWriter *)opaque;
+    RecordIo *io = w->io;
+    int n, done = 0;
+
+    if (record_io_failed(w)) return AVERROR(EIO);
+
+    while (done < buf_size) {
+        if (!w->cur) {
+            pthread_mutex_lock(&io->mutex);
+            w->cur = GetDataBlockLocked(w);
+            if (!w->cur) {
+                // 缓冲用完：该文件后续数据全部丢弃，已排队的部分照常落盘
+                w->failed_gen = w->gen;
+                w->stats.overflows++;
+                pthread_mutex_unlock(&io->mutex);
+                LOG_WARN(TAG, "[%s] write-behind buffer full (%d blocks), drop rest of segment\n",
+                         w->name, RECORD_IO_MAX_BLOCKS);
+                return AVERROR(ENOSPC);
+            }
+            w->cur->gen = w->gen;
+            pthread_mutex_unlock(&io->mutex);
+        }
+
+        n = RECORD_IO_BLOCK_SIZE - w->cur->len;
+        if (n > buf_size - done) n = buf_size - done;
+        memcpy(w->cur->data + w->cur->len, buf + done, n);
+        w->cur->len += n;
+        w->file_bytes += n;
+        done += n;
+
+        if (w->cur->len == RECORD_IO_BLOCK_SIZE) {
+            pthread_mutex_lock(&io->mutex);
+            QueueBlockLocked(w, w->cur);
+            pthread_mutex_unlock(&io->mutex);
+            w->cur = NULL;
+        }
+    }
+    return buf_size;
+}
+
+AVIOContext *record_io_open(RecordIoWriter *w, const char *path, const RecordIoTarget *target)
+{
+    RecordIo *io = w->io;
+    RecordIoBlock *op;
+    AVIOContext *pb;
+    uint8_t *buf;
+
+    if (!io || !io->started || !path) return NULL;
+
+    op = calloc(1, sizeof(RecordIoBlock));
+    buf = av_malloc(RECORD_IO_AVIO_BUF_SIZE);
+    pb = buf ? avio_alloc_context(buf, RECORD_IO_AVIO_BUF_SIZE, 1, w, NULL, WritePacket, NULL) : NULL;
+    if (!op || !pb) {
+        free(op);
+        if (pb) av_freep(&pb->buffer);
+        else av_free(buf);
+        av_freep(&pb);
+        return NULL;
+    }
+    // fMP4 只顺序追加，不需要回写
+    pb->seekable = 0;
+
+    w->gen++;
+    if (w->gen == 0) w->gen = 1;
+    op->op = RECORD_IO_OP_OPEN;
+    op->gen = w->gen;
+    snprintf(op->path, sizeof(op->path), "%s", path);
+    if (target) op->target = *target;
+    w->file_bytes = 0;
+
+    pthread_mutex_lock(&io->mutex);
+    QueueBlockLocked(w, op);
+    pthread_mutex_unlock(&io->mutex);
+    return pb;
+}
+
+void record_io_close(RecordIoWriter *w, AVIOContext **pb)
+{
+    RecordIo *io = w->io;
+    RecordIoBlock *op;
+
+    if (!pb || !*pb) return;
+    avio_flush(*pb);
+    av_freep(&(*pb)->buffer);
+    av_freep(pb);
+
+    // CLOSE 分配失败时文件在下一次 OPEN 或 writer_destroy 时关闭
+    op = calloc(1, sizeof(RecordIoBlock));
+    pthread_mutex_lock(&io->mutex);
+    if (w->cur) {
+        if (w->cur->len > 0 && w->failed_gen != w->gen) QueueBlockLocked(w, w->cur);
+        else PutBlockLocked(w, w->cur);
+        w->cur = NULL;
+    }
+    if (op) {
+        op->op = RECORD_IO_OP_CLOSE;
+        op->gen = w->gen;
+        QueueBlockLocked(w, op);
+    }
+    pthread_mutex_unlock(&io->mutex);
+}
+
+int record_io_failed(RecordIoWriter *w)
+{
+    int failed;
+
+    if (!w->io) return 0;
+    pthread_mutex_lock(&w->io->mutex);
+    failed = (w->gen != 0 && w->failed_gen == w->gen);
+    pthread_mutex_unlock(&w->io->mutex);
+    return failed;
+}
+
+int64_t record_io_file_bytes(RecordIoWriter *w)
+{
+    return w->file_bytes;
+}
+
+void record_io_get_stats(RecordIoWriter *w, RecordIoStats *st)
+{
+    memset(st, 0, sizeof(*st));
+    if (!w->io) return;
+    pthread_mutex_lock(&w->io->mutex);
+    *st = w->stats;
+    pthread_mutex_unlock(&w->io->mutex);
+}
+
+void record_io_dump(RecordIoWriter *w, FILE *fp)
+{
+    RecordIoStats st;
+    int blocks = 0, queued = 0;
+
+    if (!w->io || !fp) return;
+    pthread_mutex_lock(&w->io->mutex);
+    st = w->stats;
+    blocks = w->nb_blocks;
+    queued = w->queued;
+    pthread_mutex_unlock(&w->io->mutex);
+
+    fprintf(fp, "%s.io bytes=%llu files=%u writes=%u direct=%d stalls=%u stall_total=%lldms write_max=%lldms "
+            "overflows=%u errors=%u blocks=%d/%d queued=%d peak=%d\n",
+            w->name, (unsigned long long)st.bytes, st.files, st.writes, st.direct, st.stalls,
+            (long long)st.stall_total_ms, (long long)st.write_max_ms, st.overflows, st.errors,
+            blocks, RECORD_IO_MAX_BLOCKS, queued, st.peak_blocks);
+}
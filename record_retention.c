@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include "storage.h"
+#include "record_retention.h"
+#include "log.h"
+
+#define TAG "RECORD_RETENTION"
+
+static int64_t FreeBytes(RecordRetention *rt)
+{
+    struct statvfs vfs;
+
+    if (statvfs(rt->BaseDir, &vfs) != 0) return -1;
+    return (int64_t)vfs.f_bavail * (int64_t)vfs.f_frsize;
+}
+
+static void CamDir(RecordRetention *rt, int cam, char *dir, int size)
+{
+    snprintf(dir, size, "%s/CAM%d", rt->BaseDir, cam);
+}
+
+static int IsSegmentName(const char *name)
+{
+    int len = (int)strlen(name);
+
+    return len > 4 && len < RECORD_RETENTION_NAME_MAX && strcasecmp(name + len - 4, ".MP4") == 0;
+}
+
+// 清空所有链表 (调用者持有 Mutex)
+static void ClearLocked(RecordRetention *rt)
+{
+    ListNode *node;
+    int i;
+
+    for (i = 0; i < CAM_CHANNEL_LIMIT; i++) {
+        for (;;) {
+            LinkList_PopFromHead_NoLock(&rt->Cam[i].List, &node);
+            if (!node) break;
+            free(container_of(node, RecordSegNode, Node));
+        }
+        rt->Cam[i].Count = 0;
+    }
+}
+
+static int CompareSeg(const void *a, const void *b)
+{
+    const RecordSegNode *x = *(RecordSegNode * const *)a;
+    const RecordSegNode *y = *(RecordSegNode * const *)b;
+
+    if (x->Mtime != y->Mtime) return x->Mtime < y->Mtime ? -1 : 1;
+    return strcmp(x->Name, y->Name);
+}
+
+// 插卡后扫描一次 CAMn 目录，按修改时间排好序放到链表头部 (比扫描期间新关闭的分段都旧)
+static void ScanCam(RecordRetention *rt, int cam)
+{
+    char dir[96], path[192];
+    DIR *dp;
+    struct dirent *de;
+    struct stat sb;
+    RecordSegNode **arr = NULL, **tmp, *n;
+    int cnt = 0, cap = 0, i;
+
+    CamDir(rt, cam, dir, sizeof(dir));
+    dp = opendir(dir);
+    if (!dp) return;
+    while ((de = readdir(dp)) != NULL) {
+        if (!IsSegmentName(de->d_name)) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode)) continue;
+        if (cnt == cap) {
+            cap = cap ? cap * 2 : 256;
+            tmp = realloc(arr, cap * sizeof(*arr));
+            if (!tmp) break;
+            arr = tmp;
+        }
+        n = calloc(1, sizeof(RecordSegNode));
+        if (!n) break;
+        n->Mtime = sb.st_mtime;
+        snprintf(n->Name, sizeof(n->Name), "%s", de->d_name);
+        arr[cnt++] = n;
+    }
+    closedir(dp);
+    if (cnt == 0) {
+        free(arr);
+        return;
+    }
+
+    qsort(arr, cnt, sizeof(*arr), CompareSeg);
+    pthread_mutex_lock(&rt->Mutex);
+    for (i = cnt - 1; i >= 0; i--) {
+        LinkList_NodeInit(&arr[i]->Node);
+        LinkList_PushToHead_NoLock(&rt->Cam[cam].List, &arr[i]->Node);
+    }
+    rt->Cam[cam].Count += cnt;
+    pthread_mutex_unlock(&rt->Mutex);
+    free(arr);
+    LOG_INFO(TAG, "CAM%d: %d segments on card\n", cam, cnt);
+}
+
+// 取出所有通道中最旧的一个分段 (调用者持有 Mutex)，没有返回 NULL
+static RecordSegNode *PopOldestLocked(RecordRetention *rt, int *cam)
+{
+    RecordSegNode *best = NULL, *n;
+    ListNode *node;
+    int i, best_cam = -1;
+
+    for (i = 0; i < CAM_CHANNEL_LIMIT; i++) {
+        if (LinkList_IsEmpty_NoLock(&rt->Cam[i].List)) continue;
+        n = container_of(rt->Cam[i].List.Head.Next, RecordSegNode, Node);
+        if (!best || n->Mtime < best->Mtime) {
+            best = n;
+            best_cam = i;
+        }
+    }
+    if (!best) return NULL;
+    LinkList_PopFromHead_NoLock(&rt->Cam[best_cam].List, &node);
+    rt->Cam[best_cam].Count--;
+    *cam = best_cam;
+    return best;
+}
+
+// 从最旧的分段删起，直到可用空间回到 high 以上
+static void Purge(RecordRetention *rt, int64_t free_bytes, int64_t high,
+                  void (*on_delete)(void *, int, const char *), void *opaque)
+{
+    char path[192];
+    struct stat sb;
+    RecordSegNode *n;
+    int cam, deleted = 0;
+    int64_t bytes = 0, start = free_bytes;
+
+    while (!rt->AbortRequest && free_bytes >= 0 && free_bytes < high) {
+        pthread_mutex_lock(&rt->Mutex);
+        n = PopOldestLocked(rt, &cam);
+        pthread_mutex_unlock(&rt->Mutex);
+        if (!n) {
+            // 只在第一次提示，卡满但链表已空时每轮都会走到这里 (只是槽位池想扩大时不提示)
+            if (!rt->WarnedEmpty && free_bytes < RECORD_RETENTION_FREE_LOW) {
+                LOG_WARN(TAG, "Card low (%lldMB free) but no recordings left to delete\n", (long long)(free_bytes >> 20));
+            }
+            rt->WarnedEmpty = 1;
+            break;
+        }
+        rt->WarnedEmpty = 0;
+
+        snprintf(path, sizeof(path), "%s/CAM%d/%s", rt->BaseDir, cam, n->Name);
+        if (stat(path, &sb) != 0) sb.st_size = 0;
+        if (unlink(path) == 0) {
+            deleted++;
+            bytes += sb.st_size;
+            if (on_delete) on_delete(opaque, cam, path);
+        } else if (errno != ENOENT) {
+            LOG_WARN(TAG, "unlink %s failed: %d\n", path, errno);
+        } else if (on_delete) {
+            on_delete(opaque, cam, path);
+        }
+        free(n);
+        free_bytes = FreeBytes(rt);
+    }
+
+    if (deleted > 0) {
+        pthread_mutex_lock(&rt->Mutex);
+        rt->Deleted += deleted;
+        rt->DeletedBytes += bytes;
+        rt->Passes++;
+        pthread_mutex_unlock(&rt->Mutex);
+        LOG_INFO(TAG, "Deleted %d oldest segments (%lldMB), free %lldMB -> %lldMB\n", deleted,
+                 (long long)(bytes >> 20), (long long)(start >> 20), (long long)(free_bytes >> 20));
+    }
+}
+
+static void *RecordRetention_Thread(void *Arg)
+{
+    RecordRetention *rt = (RecordRetention *)Arg;
+    struct timespec ts;
+    int64_t free_bytes, goal, low, high;
+    void (*on_delete)(void *, int, const char *);
+    int64_t (*free_goal)(void *);
+    void *opaque;
+    int i;
+
+    prctl(PR_SET_NAME, "Record_Retention");
+
+    pthread_mutex_lock(&rt->Mutex);
+    while (!rt->AbortRequest) {
+        if (!rt->Kick) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += RECORD_RETENTION_POLL_MS / 1000;
+            ts.tv_nsec += (RECORD_RETENTION_POLL_MS % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&rt->Cond, &rt->Mutex, &ts);
+            if (rt->AbortRequest) break;
+        }
+        rt->Kick = 0;
+
+        // 卡拔出：链表作废，下次插卡重新扫描
+        if (!Storage_IsReady(rt->Station)) {
+            if (rt->Scanned) ClearLocked(rt);
+            rt->Scanned = 0;
+            continue;
+        }
+        on_delete = rt->OnDelete;
+        free_goal = rt->FreeGoal;
+        opaque = rt->Opaque;
+        pthread_mutex_unlock(&rt->Mutex);
+
+        // Scanned 只由本线程修改
+        if (!rt->Scanned) {
+            for (i = 0; i < CAM_CHANNEL_LIMIT && !rt->AbortRequest; i++) ScanCam(rt, i);
+        }
+        // 槽位池还能扩大：把水位提到它需要的空间，CAMn 下的旧分段逐步腾给槽位池
+        goal = free_goal ? free_goal(opaque) : 0;
+        low = goal > RECORD_RETENTION_FREE_LOW ? goal : RECORD_RETENTION_FREE_LOW;
+        high = goal > RECORD_RETENTION_FREE_HIGH ? goal : RECORD_RETENTION_FREE_HIGH;
+        free_bytes = FreeBytes(rt);
+        if (free_bytes >= 0 && free_bytes < low) Purge(rt, free_bytes, high, on_delete, opaque);
+
+        pthread_mutex_lock(&rt->Mutex);
+        rt->Scanned = 1;
+    }
+    pthread_mutex_unlock(&rt->Mutex);
+    return NULL;
+}
+
+int record_retention_init(RecordRetention *rt, StationHandle *Station, const char *base_dir)
+{
+    pthread_condattr_t attr;
+    int i;
+
+    if (!rt) return -1;
+    memset(rt, 0, sizeof(RecordRetention));
+    rt->Station = Station;
+    snprintf(rt->BaseDir, sizeof(rt->BaseDir), "%s", base_dir ? base_dir : STORAGE_CARD);
+    for (i = 0; i < CAM_CHANNEL_LIMIT; i++) LinkList_Init(&rt->Cam[i].List);
+    pthread_mutex_init(&rt->Mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&rt->Cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&rt->Thread, NULL, RecordRetention_Thread, rt) != 0) {
+        LOG_ERROR(TAG, "Failed to create retention thread\n");
+        return -1;
+    }
+    rt->ThreadStarted = 1;
+    return 0;
+}
+
+void record_retention_uninit(RecordRetention *rt)
+{
+    int i;
+
+    if (!rt) return;
+    pthread_mutex_lock(&rt->Mutex);
+    rt->AbortRequest = 1;
+    pthread_cond_broadcast(&rt->Cond);
+    pthread_mutex_unlock(&rt->Mutex);
+    if (rt->ThreadStarted) pthread_join(rt->Thread, NULL);
+    rt->ThreadStarted = 0;
+
+    pthread_mutex_lock(&rt->Mutex);
+    ClearLocked(rt);
+    pthread_mutex_unlock(&rt->Mutex);
+    for (i = 0; i < CAM_CHANNEL_LIMIT; i++) LinkList_DeInit(&rt->Cam[i].List);
+    pthread_cond_destroy(&rt->Cond);
+    pthread_mutex_destroy(&rt->Mutex);
+}
+
+void record_retention_add(RecordRetention *rt, int cam, const char *path)
+{
+    const char *name;
+    RecordSegNode *n;
+
+    if (!rt || !rt->ThreadStarted || !path || cam < 0 || cam >= CAM_CHANNEL_LIMIT) return;
+    name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    if (!IsSegmentName(name)) return;
+
+    n = calloc(1, sizeof(RecordSegNode));
+    if (!n) return;
+    LinkList_NodeInit(&n->Node);
+    n->Mtime = time(NULL);
+    snprintf(n->Name, sizeof(n->Name), "%s", name);
+
+    pthread_mutex_lock(&rt->Mutex);
+    LinkList_PushToTail_NoLock(&rt->Cam[cam].List, &n->Node);
+    rt->Cam[cam].Count++;
+    pthread_mutex_unlock(&rt->Mutex);
+}
+
+void record_retention_kick(RecordRetention *rt)
+{
+    if (!rt || !rt->ThreadStarted) return;
+    pthread_mutex_lock(&rt->Mutex);
+    rt->Kick = 1;
+    pthread_cond_broadcast(&rt->Cond);
+    pthread_mutex_unlock(&rt->Mutex);
+}
+
+void record_retention_set_hooks(RecordRetention *rt, void (*on_delete)(void *, int, const char *),
+                                int64_t (*free_goal)(void *), void *opaque)
+{
+    if (!rt || !rt->ThreadStarted) return;
+    pthread_mutex_lock(&rt->Mutex);
+    rt->OnDelete = on_delete;
+    rt->FreeGoal = free_goal;
+    rt->Opaque = opaque;
+    pthread_mutex_unlock(&rt->Mutex);
+}
+
+void record_retention_dump(RecordRetention *rt, FILE *fp)
+{
+    int i, total = 0;
+
+    if (!rt || !rt->ThreadStarted || !fp) return;
+    pthread_mutex_lock(&rt->Mutex);
+    for (i = 0; i < CAM_CHANNEL_LIMIT; i++) total += rt->Cam[i].Count;
+    fprintf(fp, "record.retention scanned=%d segments=%d deleted=%u deleted_mb=%llu passes=%u free_mb=%lld\n",
+            rt->Scanned, total, rt->Deleted, (unsigned long long)(rt->DeletedBytes >> 20), rt->Passes,
+            (long long)(rt->Scanned ? FreeBytes(rt) >> 20 : -1));
+    pthread_mutex_unlock(&rt->Mutex);
+}
@@ -0,0 +1,519 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include "storage.h"
+#include "record_store.h"
+#include "log.h"
+
+#define TAG "RECORD_STORE"
+
+// 两个槽位之间的间隔：建池时不要长时间独占 SD 卡，录像的写后缓冲仍能及时落盘
+#define RECORD_STORE_BUILD_PAUSE_MS 200
+// 卡状态轮询间隔
+#define RECORD_STORE_POLL_MS        1000
+// 池建满后按可用空间重新计算目标的间隔 (循环删除腾出空间后继续扩建)
+#define RECORD_STORE_RETARGET_MS    5000
+
+static int64_t NowMsRealtime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void SlotPath(RecordStore *st, int slot, char *path, int size)
+{
+    snprintf(path, size, "%s/S%05d.MP4", st->Dir, slot);
+}
+
+static void IndexPath(RecordStore *st, char *path, int size)
+{
+    snprintf(path, size, "%s/%s", st->Dir, RECORD_STORE_INDEX);
+}
+
+// 由句柄取条目，句柄过期 (已换卡) 或越界返回 -1 (调用者持有 Mutex)
+static int TicketSlotLocked(RecordStore *st, int ticket)
+{
+    int slot;
+
+    if (!st->Mounted || ticket < 0) return -1;
+    if (RECORD_STORE_TICKET_GEN(ticket) != (st->MountGen & 0x7fff)) return -1;
+    slot = RECORD_STORE_TICKET_SLOT(ticket);
+    if (slot >= (int)st->Hdr.NbSlots) return -1;
+    return slot;
+}
+
+/* ========================================================================== */
+/* 索引文件                                                                   */
+/* ========================================================================== */
+
+// 把文件头和一个条目 (slot < 0 时只写头) 写入索引，sync 时等待落盘
+// 先在 Mutex 下取快照再写，SD 卡停顿不会阻塞 record_store_acquire
+static void StorePersist(RecordStore *st, int slot, int sync)
+{
+    RecordStoreHeader hdr;
+    RecordSlotEntry e;
+    int fd;
+
+    pthread_mutex_lock(&st->IoMutex);
+    pthread_mutex_lock(&st->Mutex);
+    hdr = st->Hdr;
+    fd = st->IndexFd;
+    if (slot >= 0) e = st->Slots[slot];
+    pthread_mutex_unlock(&st->Mutex);
+
+    if (fd >= 0) {
+        if (slot >= 0 &&
+            pwrite(fd, &e, sizeof(e), (off_t)sizeof(hdr) + (off_t)slot * sizeof(e)) != (ssize_t)sizeof(e)) {
+            LOG_WARN(TAG, "write index entry %d failed: %d\n", slot, errno);
+        }
+        if (pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+            LOG_WARN(TAG, "write index header failed: %d\n", errno);
+        }
+        if (sync) fdatasync(fd);
+    }
+    pthread_mutex_unlock(&st->IoMutex);
+}
+
+// 按卡的可用空间计算槽位池大小 (只增不减)
+static int StoreTargetSlots(RecordStore *st)
+{
+    struct statvfs vfs;
+    int64_t avail, target;
+
+    if (statvfs(st->Dir, &vfs) != 0) return (int)st->Hdr.NbSlots;
+    avail = (int64_t)vfs.f_bavail * (int64_t)vfs.f_frsize - RECORD_STORE_RESERVE_BYTES;
+    target = st->Hdr.NbSlots + (avail > 0 ? avail / RECORD_STORE_SLOT_BYTES : 0);
+    if (target > RECORD_STORE_MAX_SLOTS) target = RECORD_STORE_MAX_SLOTS;
+    return (int)target;
+}
+
+static int StoreMount(RecordStore *st)
+{
+    char path[128];
+    RecordStoreHeader hdr;
+    ssize_t want;
+    int fd, valid, i, target, recovered = 0;
+
+    if (mkdir(st->Dir, 0755) != 0 && errno != EEXIST) {
+        LOG_ERROR(TAG, "mkdir %s failed: %d\n", st->Dir, errno);
+        return -1;
+    }
+    IndexPath(st, path, sizeof(path));
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LOG_ERROR(TAG, "open %s failed: %d\n", path, errno);
+        return -1;
+    }
+
+    valid = (pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+             hdr.Magic == RECORD_STORE_MAGIC && hdr.Version == RECORD_STORE_VERSION &&
+             hdr.EntrySize == sizeof(RecordSlotEntry) && hdr.SlotBytes == RECORD_STORE_SLOT_BYTES &&
+             hdr.NbSlots <= RECORD_STORE_MAX_SLOTS);
+
+    pthread_mutex_lock(&st->Mutex);
+    memset(st->Slots, 0, sizeof(RecordSlotEntry) * RECORD_STORE_MAX_SLOTS);
+    memset(st->Busy, 0, RECORD_STORE_MAX_SLOTS);
+    if (valid) {
+        want = (ssize_t)hdr.NbSlots * sizeof(RecordSlotEntry);
+        if (want > 0 && pread(fd, st->Slots, want, sizeof(hdr)) != want) valid = 0;
+    }
+    if (valid) {
+        st->Hdr = hdr;
+        if (st->Hdr.Head > st->Hdr.NbSlots) st->Hdr.Head = 0;
+        // 掉电时正在写的槽位：内容已被部分覆盖，标记为不完整
+        for (i = 0; i < (int)st->Hdr.NbSlots; i++) {
+            if (st->Slots[i].State == RECORD_SLOT_WRITING) {
+                st->Slots[i].State = RECORD_SLOT_PARTIAL;
+                recovered++;
+            }
+        }
+    } else {
+        // 新卡或槽位参数变了：重建索引，已有的槽位文件在建池时按新大小重新分配
+        memset(&st->Hdr, 0, sizeof(st->Hdr));
+        st->Hdr.Magic = RECORD_STORE_MAGIC;
+        st->Hdr.Version = RECORD_STORE_VERSION;
+        st->Hdr.EntrySize = sizeof(RecordSlotEntry);
+        st->Hdr.SlotBytes = RECORD_STORE_SLOT_BYTES;
+        memset(st->Slots, 0, sizeof(RecordSlotEntry) * RECORD_STORE_MAX_SLOTS);
+    }
+    st->IndexFd = fd;
+    st->MountGen++;
+    st->Mounted = 1;
+    pthread_mutex_unlock(&st->Mutex);
+
+    if (!valid) {
+        // 条目区一次性占位，之后每次更新都是原地 pwrite
+        if (ftruncate(fd, (off_t)sizeof(RecordStoreHeader) + (off_t)RECORD_STORE_MAX_SLOTS * sizeof(RecordSlotEntry)) != 0) {
+            LOG_WARN(TAG, "size index failed: %d\n", errno);
+        }
+        StorePersist(st, -1, 1);
+    }
+    for (i = 0; recovered > 0 && i < (int)st->Hdr.NbSlots; i++) {
+        if (st->Slots[i].State == RECORD_SLOT_PARTIAL) StorePersist(st, i, 0);
+    }
+
+    target = StoreTargetSlots(st);
+    pthread_mutex_lock(&st->Mutex);
+    st->TargetSlots = target;
+    pthread_mutex_unlock(&st->Mutex);
+    LOG_INFO(TAG, "Mounted %s: %u slots (target %d, %s index), head=%u, recovered=%d\n", st->Dir,
+             st->Hdr.NbSlots, st->TargetSlots, valid ? "existing" : "new", st->Hdr.Head, recovered);
+    return 0;
+}
+
+static void StoreUnmount(RecordStore *st)
+{
+    int fd;
+
+    pthread_mutex_lock(&st->IoMutex);
+    pthread_mutex_lock(&st->Mutex);
+    fd = st->IndexFd;
+    st->IndexFd = -1;
+    st->Mounted = 0;
+    pthread_mutex_unlock(&st->Mutex);
+    if (fd >= 0) {
+        close(fd);
+        LOG_INFO(TAG, "Unmounted %s\n", st->Dir);
+    }
+    pthread_mutex_unlock(&st->IoMutex);
+}
+
+// 创建并预分配一个槽位文件，失败返回 -1
+static int StoreAllocSlotFile(RecordStore *st, int slot)
+{
+    char path[128];
+    int fd, err;
+
+    SlotPath(st, slot, path, sizeof(path));
+    fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        LOG_ERROR(TAG, "create %s failed: %d\n", path, errno);
+        return -1;
+    }
+    // 文件系统不支持 fallocate 时 posix_fallocate 会逐块写零，同样一次性把簇分配好
+    err = posix_fallocate(fd, 0, RECORD_STORE_SLOT_BYTES);
+    if (err == 0 && ftruncate(fd, RECORD_STORE_SLOT_BYTES) != 0) err = errno;
+    close(fd);
+    if (err != 0) {
+        LOG_WARN(TAG, "preallocate %s failed: %d\n", path, err);
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+// 预分配下一个槽位文件，卡满或失败返回 -1
+static int StoreBuildSlot(RecordStore *st)
+{
+    int slot = (int)st->Hdr.NbSlots;
+
+    if (StoreAllocSlotFile(st, slot) < 0) {
+        LOG_WARN(TAG, "pool stops at %d slots\n", slot);
+        return -1;
+    }
+
+    pthread_mutex_lock(&st->Mutex);
+    memset(&st->Slots[slot], 0, sizeof(RecordSlotEntry));
+    st->Hdr.NbSlots++;
+    pthread_mutex_unlock(&st->Mutex);
+    StorePersist(st, slot, 0);
+    return 0;
+}
+
+// 重建一个文件丢失的槽位，没有待重建的返回 0
+static int StoreRebuildSlot(RecordStore *st)
+{
+    int i, slot = -1;
+
+    pthread_mutex_lock(&st->Mutex);
+    for (i = 0; i < (int)st->Hdr.NbSlots; i++) {
+        if (st->Busy[i] == RECORD_BUSY_REBUILD) {
+            slot = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&st->Mutex);
+    if (slot < 0) return 0;
+
+    if (StoreAllocSlotFile(st, slot) == 0) {
+        LOG_INFO(TAG, "slot %d file recreated\n", slot);
+        pthread_mutex_lock(&st->Mutex);
+        st->Busy[slot] = RECORD_BUSY_NONE;
+        pthread_mutex_unlock(&st->Mutex);
+    } else {
+        LOG_WARN(TAG, "slot %d retired\n", slot);
+        pthread_mutex_lock(&st->Mutex);
+        st->Busy[slot] = RECORD_BUSY_RETIRED;
+        pthread_mutex_unlock(&st->Mutex);
+    }
+    return 1;
+}
+
+// 卡插拔/格式化检测与后台建池
+static void *RecordStore_Thread(void *Arg)
+{
+    RecordStore *st = (RecordStore *)Arg;
+    char path[128];
+    int ready, i, target, idle_ms = 0;
+
+    prctl(PR_SET_NAME, "Record_Store");
+    IndexPath(st, path, sizeof(path));
+
+    while (!st->AbortRequest) {
+        ready = Storage_IsReady(st->Station);
+        // 卡拔出或被格式化 (索引文件没了) 后重新挂载
+        if (st->Mounted && (!ready || access(path, F_OK) != 0)) StoreUnmount(st);
+        if (!st->Mounted && ready) StoreMount(st);
+
+        if (st->Mounted && StoreRebuildSlot(st) > 0) {
+            usleep(RECORD_STORE_BUILD_PAUSE_MS * 1000);
+            continue;
+        }
+
+        if (st->Mounted && (int)st->Hdr.NbSlots < st->TargetSlots) {
+            if (StoreBuildSlot(st) < 0) {
+                pthread_mutex_lock(&st->Mutex);
+                st->TargetSlots = (int)st->Hdr.NbSlots;
+                pthread_mutex_unlock(&st->Mutex);
+            } else if ((int)st->Hdr.NbSlots == st->TargetSlots) {
+                LOG_INFO(TAG, "Slot pool complete: %d x %dMB\n", st->TargetSlots, RECORD_STORE_SLOT_BYTES >> 20);
+            }
+            usleep(RECORD_STORE_BUILD_PAUSE_MS * 1000);
+            idle_ms = 0;
+            continue;
+        }
+        // 挂载时算出的目标只反映当时的空间；旧固件录满的卡要等 CAMn 下的分段被删掉才有空间
+        if (st->Mounted && st->Hdr.NbSlots < RECORD_STORE_MAX_SLOTS && idle_ms >= RECORD_STORE_RETARGET_MS) {
+            idle_ms = 0;
+            target = StoreTargetSlots(st);
+            if (target > st->TargetSlots) {
+                LOG_INFO(TAG, "Slot pool target %d -> %d\n", st->TargetSlots, target);
+                pthread_mutex_lock(&st->Mutex);
+                st->TargetSlots = target;
+                pthread_mutex_unlock(&st->Mutex);
+                continue;
+            }
+        }
+        for (i = 0; i < RECORD_STORE_POLL_MS / 100 && !st->AbortRequest; i++) usleep(100 * 1000);
+        idle_ms += RECORD_STORE_POLL_MS;
+    }
+    StoreUnmount(st);
+    return NULL;
+}
+
+/* ========================================================================== */
+/* 对外接口                                                                   */
+/* ========================================================================== */
+
+int record_store_init(RecordStore *st, StationHandle *Station, const char *card_dir)
+{
+    if (!st) return -1;
+    memset(st, 0, sizeof(RecordStore));
+    st->Station = Station;
+    st->IndexFd = -1;
+    snprintf(st->Dir, sizeof(st->Dir), "%s/%s", card_dir ? card_dir : STORAGE_CARD, RECORD_STORE_DIR);
+    pthread_mutex_init(&st->Mutex, NULL);
+    pthread_mutex_init(&st->IoMutex, NULL);
+
+    st->Slots = calloc(RECORD_STORE_MAX_SLOTS, sizeof(RecordSlotEntry));
+    st->Busy = calloc(RECORD_STORE_MAX_SLOTS, 1);
+    if (!st->Slots || !st->Busy) {
+        LOG_ERROR(TAG, "alloc slot table failed\n");
+        return -1;
+    }
+    if (pthread_create(&st->Thread, NULL, RecordStore_Thread, st) != 0) {
+        LOG_ERROR(TAG, "Failed to create record store thread\n");
+        return -1;
+    }
+    st->ThreadStarted = 1;
+    return 0;
+}
+
+// 需在 Record IO 线程停止之后调用 (其回调会访问这里的状态)
+void record_store_uninit(RecordStore *st)
+{
+    if (!st) return;
+    st->AbortRequest = 1;
+    if (st->ThreadStarted) pthread_join(st->Thread, NULL);
+    st->ThreadStarted = 0;
+    StoreUnmount(st);
+    free(st->Slots);
+    free(st->Busy);
+    st->Slots = NULL;
+    st->Busy = NULL;
+    pthread_mutex_destroy(&st->IoMutex);
+    pthread_mutex_destroy(&st->Mutex);
+}
+
+int record_store_acquire(RecordStore *st, int cam, char *path, int path_size)
+{
+    RecordSlotEntry *e;
+    int n, i, slot = -1, ticket = -1;
+
+    if (!st || !st->ThreadStarted) return -1;
+    pthread_mutex_lock(&st->Mutex);
+    n = (int)st->Hdr.NbSlots;
+    if (st->Mounted && n >= RECORD_STORE_MIN_SLOTS) {
+        // 先用建好后还没写过的槽位 (池扩大时新建的在 Head 之后)
+        for (i = 0; i < n; i++) {
+            int s = (int)((st->Hdr.Head + i) % n);
+            if (!st->Busy[s] && st->Slots[s].Seq == 0) {
+                slot = s;
+                break;
+            }
+        }
+        // 池还在扩大时不回绕：不覆盖最旧的录像，这一段改写 CAMn 下的普通文件，等后台建好下一个槽位
+        for (i = 0; slot < 0 && n >= st->TargetSlots && i < n; i++) {
+            int s = (int)((st->Hdr.Head + i) % n);
+            if (!st->Busy[s]) slot = s;
+        }
+    }
+    if (slot >= 0) {
+        st->Hdr.Head = slot + 1;
+        st->Busy[slot] = RECORD_BUSY_WRITING;
+        e = &st->Slots[slot];
+        memset(e, 0, sizeof(RecordSlotEntry));
+        if (++st->Hdr.Seq == 0) st->Hdr.Seq = 1;
+        e->Seq = st->Hdr.Seq;
+        e->Cam = (int16_t)cam;
+        e->State = RECORD_SLOT_WRITING;
+        e->StartMs = NowMsRealtime();
+        ticket = RECORD_STORE_TICKET(st->MountGen, slot);
+        SlotPath(st, slot, path, path_size);
+    }
+    pthread_mutex_unlock(&st->Mutex);
+    return ticket;
+}
+
+void record_store_finish(RecordStore *st, int ticket, int64_t end_ms)
+{
+    int slot;
+
+    pthread_mutex_lock(&st->Mutex);
+    slot = TicketSlotLocked(st, ticket);
+    if (slot >= 0 && st->Busy[slot] == RECORD_BUSY_WRITING) st->Slots[slot].EndMs = end_ms;
+    pthread_mutex_unlock(&st->Mutex);
+}
+
+// 覆盖数据之前先让 "正在写" 状态落盘，掉电后不会把新数据当成旧的时间段
+// 打开失败时索引里仍是旧条目，只记下失败原因，等关闭时回滚内存中的条目
+void record_store_opened(RecordStore *st, int ticket, int error)
+{
+    char path[128];
+    int slot, missing = 0;
+
+    pthread_mutex_lock(&st->Mutex);
+    slot = TicketSlotLocked(st, ticket);
+    pthread_mutex_unlock(&st->Mutex);
+    if (slot < 0) return;
+    if (!error) {
+        StorePersist(st, slot, 1);
+        return;
+    }
+
+    SlotPath(st, slot, path, sizeof(path));
+    missing = (access(path, F_OK) != 0 && errno == ENOENT);
+    if (missing) LOG_WARN(TAG, "slot file %s missing, rebuild after close\n", path);
+    pthread_mutex_lock(&st->Mutex);
+    if (TicketSlotLocked(st, ticket) == slot && st->Busy[slot] == RECORD_BUSY_WRITING) {
+        st->Busy[slot] = missing ? RECORD_BUSY_MISSING : RECORD_BUSY_OPEN_FAILED;
+    }
+    pthread_mutex_unlock(&st->Mutex);
+}
+
+// 打开失败的槽位：条目恢复为索引里 acquire 之前的内容 (旧分段仍完好，目录里的记录继续有效)；
+// 文件已丢失的清空条目并落盘，交给后台线程重建
+static void StoreRollback(RecordStore *st, int ticket, int slot, int missing)
+{
+    RecordSlotEntry e;
+    int fd, restored = 0;
+
+    if (!missing) {
+        pthread_mutex_lock(&st->IoMutex);
+        fd = st->IndexFd;
+        restored = (fd >= 0 &&
+                    pread(fd, &e, sizeof(e), (off_t)sizeof(RecordStoreHeader) + (off_t)slot * sizeof(e)) ==
+                    (ssize_t)sizeof(e));
+        pthread_mutex_unlock(&st->IoMutex);
+    }
+
+    pthread_mutex_lock(&st->Mutex);
+    if (TicketSlotLocked(st, ticket) == slot) {
+        if (restored) st->Slots[slot] = e;
+        else memset(&st->Slots[slot], 0, sizeof(RecordSlotEntry));
+        st->Busy[slot] = missing ? RECORD_BUSY_REBUILD : RECORD_BUSY_NONE;
+    } else {
+        slot = -1;
+    }
+    pthread_mutex_unlock(&st->Mutex);
+    if (slot >= 0 && !restored) StorePersist(st, slot, 0);
+}
+
+void record_store_closed(RecordStore *st, int ticket, int64_t length, int error)
+{
+    RecordSlotEntry *e;
+    int slot, busy;
+
+    pthread_mutex_lock(&st->Mutex);
+    slot = TicketSlotLocked(st, ticket);
+    busy = (slot >= 0) ? st->Busy[slot] : RECORD_BUSY_NONE;
+    if (busy == RECORD_BUSY_WRITING) {
+        e = &st->Slots[slot];
+        e->Length = (uint32_t)(length > 0xffffffffLL ? 0xffffffffLL : length);
+        e->State = error ? RECORD_SLOT_PARTIAL : RECORD_SLOT_DONE;
+        if (e->EndMs == 0) e->EndMs = NowMsRealtime();
+        st->Busy[slot] = RECORD_BUSY_NONE;
+    }
+    pthread_mutex_unlock(&st->Mutex);
+    if (busy == RECORD_BUSY_WRITING) {
+        StorePersist(st, slot, 0);
+    } else if (busy == RECORD_BUSY_OPEN_FAILED || busy == RECORD_BUSY_MISSING) {
+        StoreRollback(st, ticket, slot, busy == RECORD_BUSY_MISSING);
+    }
+}
+
+int record_store_get_entry(RecordStore *st, int slot, RecordSlotEntry *e)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&st->Mutex);
+    if (st->Mounted && slot >= 0 && slot < (int)st->Hdr.NbSlots) {
+        *e = st->Slots[slot];
+        ret = 0;
+    }
+    pthread_mutex_unlock(&st->Mutex);
+    return ret;
+}
+
+int64_t record_store_free_goal(RecordStore *st)
+{
+    int64_t goal = 0;
+
+    if (!st || !st->ThreadStarted) return 0;
+    pthread_mutex_lock(&st->Mutex);
+    if (st->Mounted && st->Hdr.NbSlots < RECORD_STORE_MAX_SLOTS) {
+        goal = RECORD_STORE_RESERVE_BYTES + RECORD_STORE_SLOT_BYTES;
+    }
+    pthread_mutex_unlock(&st->Mutex);
+    return goal;
+}
+
+int record_store_slot_count(RecordStore *st)
+{
+    int n;
+
+    pthread_mutex_lock(&st->Mutex);
+    n = st->Mounted ? (int)st->Hdr.NbSlots : 0;
+    pthread_mutex_unlock(&st->Mutex);
+    return n;
+}
@@ -0,0 +1,912 @@
+#include "rtsp_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <libavutil/md5.h>
+#include <libavutil/base64.h>
+
+#include "log.h"
+#ifndef TAG
+#define TAG "RTSPCLI"
+#endif
+
+#define RTSP_DEFAULT_PORT       554
+#define RTSP_FRAME_MAX          (4 * 1024 * 1024)   // 单帧组装上限，超过视为码流异常
+#define RTSP_KEEPALIVE_DEFAULT  60                  // 服务端未给出 timeout 时按 60 秒计
+#define AAC_SAMPLES_PER_AU      1024
+
+static const uint8_t g_start_code[4] = { 0, 0, 0, 1 };
+
+static int64_t NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
+}
+
+static void SetState(RtspClient *c, RtspClientState state, int64_t now_ms)
+{
+    c->state = state;
+    c->state_ms = now_ms;
+}
+
+// ==========================================
+// 请求发送
+// ==========================================
+
+static int FlushWrite(RtspClient *c)
+{
+    while (c->woff < c->wlen) {
+        ssize_t n = send(c->fd, c->wbuf + c->woff, c->wlen - c->woff, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        c->woff += (int)n;
+    }
+    c->woff = c->wlen = 0;
+    return 0;
+}
+
+static void Md5Hex(const char *in, char out[33])
+{
+    static const char hex[] = "0123456789abcdef";
+    uint8_t d[16];
+    int i;
+
+    av_md5_sum(d, (const uint8_t *)in, (int)strlen(in));
+    for (i = 0; i < 16; i++) {
+        out[i * 2] = hex[d[i] >> 4];
+        out[i * 2 + 1] = hex[d[i] & 0x0F];
+    }
+    out[32] = 0;
+}
+
+static void BuildAuth(RtspClient *c, const char *method, const char *uri, char *out, int len)
+{
+    char tmp[256], ha1[33], ha2[33], resp[33];
+
+    out[0] = 0;
+    if (c->auth == 1) {
+        char b64[AV_BASE64_SIZE(sizeof(c->user) + sizeof(c->pass))];
+        int n = snprintf(tmp, sizeof(tmp), "%s:%s", c->user, c->pass);
+        av_base64_encode(b64, sizeof(b64), (const uint8_t *)tmp, n);
+        snprintf(out, len, "Authorization: Basic %s\r\n", b64);
+    } else if (c->auth == 2) {
+        snprintf(tmp, sizeof(tmp), "%s:%s:%s", c->user, c->realm, c->pass);
+        Md5Hex(tmp, ha1);
+        snprintf(tmp, sizeof(tmp), "%s:%s", method, uri);
+        Md5Hex(tmp, ha2);
+        snprintf(tmp, sizeof(tmp), "%s:%s:%s", ha1, c->nonce, ha2);
+        Md5Hex(tmp, resp);
+        snprintf(out, len, "Authorization: Digest username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"%s\", response=\"%s\"\r\n",
+                 c->user, c->realm, c->nonce, uri, resp);
+    }
+}
+
+static int SendRequest(RtspClient *c, const char *method, const char *uri, const char *extra)
+{
+    char auth[512], session[96];
+    int avail, n;
+
+    // 前一个请求还没发完时把剩余数据挪到开头再追加
+    if (c->woff > 0) {
+        memmove(c->wbuf, c->wbuf + c->woff, c->wlen - c->woff);
+        c->wlen -= c->woff;
+        c->woff = 0;
+    }
+
+    BuildAuth(c, method, uri, auth, sizeof(auth));
+    session[0] = 0;
+    if (c->session[0]) snprintf(session, sizeof(session), "Session: %s\r\n", c->session);
+
+    avail = RTSP_CLIENT_WBUF_SIZE - c->wlen;
+    n = snprintf((char *)c->wbuf + c->wlen, avail, "%s %s RTSP/1.0\r\nCSeq: %d\r\nUser-Agent: HaLowStation\r\n%s%s%s\r\n",
+                 method, uri, ++c->cseq, session, auth, extra ? extra : "");
+    if (n <= 0 || n >= avail) return -1;
+    c->wlen += n;
+    return FlushWrite(c);
+}
+
+static const char *BaseUrl(RtspClient *c)
+{
+    return c->content_base[0] ? c->content_base : c->uri;
+}
+
+static void TrackUrl(RtspClient *c, RtspTrack *t, char *out, int len)
+{
+    const char *base = BaseUrl(c);
+    int blen = (int)strlen(base);
+
+    if (!strncasecmp(t->control, "rtsp://", 7)) {
+        snprintf(out, len, "%s", t->control);
+    } else if (t->control[0] == 0 || !strcmp(t->control, "*")) {
+        snprintf(out, len, "%s", base);
+    } else {
+        if (blen > 0 && base[blen - 1] == '/') blen--;
+        snprintf(out, len, "%.*s/%s", blen, base, t->control);
+    }
+}
+
+static int SendDescribe(RtspClient *c)
+{
+    return SendRequest(c, "DESCRIBE", c->uri, "Accept: application/sdp\r\n");
+}
+
+static int SendSetup(RtspClient *c)
+{
+    RtspTrack *t = &c->tracks[c->setup_idx];
+    char url[256], transport[96];
+
+    TrackUrl(c, t, url, sizeof(url));
+    t->interleaved = c->setup_idx * 2;
+    snprintf(transport, sizeof(transport), "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\n",
+             t->interleaved, t->interleaved + 1);
+    return SendRequest(c, "SETUP", url, transport);
+}
+
+static int SendPlay(RtspClient *c)
+{
+    return SendRequest(c, "PLAY", BaseUrl(c), "Range: npt=0.000-\r\n");
+}
+
+// 认证失败后按当前阶段重发
+static int SendCurrent(RtspClient *c)
+{
+    switch (c->state) {
+    case RTSP_CLIENT_DESCRIBE: return SendDescribe(c);
+    case RTSP_CLIENT_SETUP:    return SendSetup(c);
+    case RTSP_CLIENT_PLAY:     return SendPlay(c);
+    default:                   return 0;
+    }
+}
+
+// ==========================================
+// SDP
+// ==========================================
+
+// 把 base64 编码的参数集以 Annex-B 形式追加到 extradata
+static void AppendParamSet(RtspTrack *t, const char *b64, int len)
+{
+    char tmp[512];
+    uint8_t nal[384];
+    uint8_t *p;
+    int n;
+
+    if (len <= 0 || len >= (int)sizeof(tmp)) return;
+    memcpy(tmp, b64, len);
+    tmp[len] = 0;
+    n = av_base64_decode(nal, tmp, sizeof(nal));
+    if (n <= 0) return;
+
+    p = av_realloc(t->extradata, t->extradata_size + 4 + n + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!p) return;
+    memcpy(p + t->extradata_size, g_start_code, 4);
+    memcpy(p + t->extradata_size + 4, nal, n);
+    t->extradata = p;
+    t->extradata_size += 4 + n;
+    memset(p + t->extradata_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+}
+
+static void ParseFmtp(RtspTrack *t, const char *params)
+{
+    const char *p = params;
+
+    while (*p) {
+        const char *end = strchr(p, ';');
+        const char *eq;
+        int klen, vlen;
+
+        if (!end) end = p + strlen(p);
+        while (p < end && isspace((unsigned char)*p)) p++;
+        eq = memchr(p, '=', end - p);
+        if (eq) {
+            const char *v = eq + 1;
+            klen = (int)(eq - p);
+            vlen = (int)(end - v);
+            while (vlen > 0 && isspace((unsigned char)v[vlen - 1])) vlen--;
+
+            if (klen == 20 && !strncasecmp(p, "sprop-parameter-sets", 20)) {
+                while (vlen > 0) {
+                    const char *comma = memchr(v, ',', vlen);
+                    int n = comma ? (int)(comma - v) : vlen;
+                    AppendParamSet(t, v, n);
+                    v += n;
+                    vlen -= n;
+                    if (comma) { v++; vlen--; }
+                }
+            } else if (klen == 9 && (!strncasecmp(p, "sprop-vps", 9) || !strncasecmp(p, "sprop-sps", 9) ||
+                                     !strncasecmp(p, "sprop-pps", 9))) {
+                AppendParamSet(t, v, vlen);
+            } else if (klen == 6 && !strncasecmp(p, "config", 6) && t->codec_id == AV_CODEC_ID_AAC) {
+                int i, n = vlen / 2;
+                uint8_t *cfg = av_mallocz(n + AV_INPUT_BUFFER_PADDING_SIZE);
+                if (cfg) {
+                    for (i = 0; i < n; i++) {
+                        char hx[3] = { v[i * 2], v[i * 2 + 1], 0 };
+                        cfg[i] = (uint8_t)strtol(hx, NULL, 16);
+                    }
+                    av_freep(&t->extradata);
+                    t->extradata = cfg;
+                    t->extradata_size = n;
+                }
+            } else if (klen == 10 && !strncasecmp(p, "sizelength", 10)) {
+                t->size_length = atoi(v);
+            } else if (klen == 11 && !strncasecmp(p, "indexlength", 11)) {
+                t->index_length = atoi(v);
+            } else if (klen == 16 && !strncasecmp(p, "indexdeltalength", 16)) {
+                t->index_delta_length = atoi(v);
+            }
+        }
+        p = (*end == ';') ? end + 1 : end;
+    }
+}
+
+static void SetCodecByName(RtspTrack *t, const char *name)
+{
+    if (!strcasecmp(name, "H264")) {
+        t->codec_id = AV_CODEC_ID_H264;
+    } else if (!strcasecmp(name, "H265")) {
+        t->codec_id = AV_CODEC_ID_HEVC;
+    } else if (!strcasecmp(name, "MPEG4-GENERIC")) {
+        t->codec_id = AV_CODEC_ID_AAC;
+        t->size_length = 13;
+        t->index_length = 3;
+        t->index_delta_length = 3;
+    } else if (!strcasecmp(name, "PCMA")) {
+        t->codec_id = AV_CODEC_ID_PCM_ALAW;
+    } else if (!strcasecmp(name, "PCMU")) {
+        t->codec_id = AV_CODEC_ID_PCM_MULAW;
+    } else if (!strcasecmp(name, "L16")) {
+        t->codec_id = AV_CODEC_ID_PCM_S16BE;
+    } else {
+        t->codec_id = AV_CODEC_ID_NONE;
+    }
+}
+
+static void FreeTrack(RtspTrack *t)
+{
+    av_freep(&t->extradata);
+    av_freep(&t->frame);
+    memset(t, 0, sizeof(RtspTrack));
+}
+
+// 只保留第一路支持的视频和第一路支持的音频
+static int ParseSdp(RtspClient *c, char *sdp)
+{
+    RtspTrack *t = NULL;
+    char *save = NULL, *line;
+    int i, n, has_video = 0, has_audio = 0;
+
+    for (line = strtok_r(sdp, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char *cr = strchr(line, '\r');
+        if (cr) *cr = 0;
+
+        if (!strncmp(line, "m=", 2)) {
+            char media[16];
+            int port, pt;
+            t = NULL;
+            if (c->nb_tracks >= RTSP_CLIENT_MAX_TRACKS) continue;
+            if (sscanf(line + 2, "%15s %d %*s %d", media, &port, &pt) != 3) continue;
+            t = &c->tracks[c->nb_tracks++];
+            memset(t, 0, sizeof(RtspTrack));
+            t->payload_type = pt;
+            t->channels = 1;
+            if (!strcmp(media, "video")) {
+                t->type = AVMEDIA_TYPE_VIDEO;
+                t->clock_rate = 90000;
+            } else if (!strcmp(media, "audio")) {
+                t->type = AVMEDIA_TYPE_AUDIO;
+                t->clock_rate = 8000;
+                // 静态负载类型可以没有 rtpmap
+                if (pt == 0) t->codec_id = AV_CODEC_ID_PCM_MULAW;
+                else if (pt == 8) t->codec_id = AV_CODEC_ID_PCM_ALAW;
+            } else {
+                t->type = AVMEDIA_TYPE_UNKNOWN;
+            }
+        } else if (!strncmp(line, "a=control:", 10)) {
+            if (t) {
+                snprintf(t->control, sizeof(t->control), "%s", line + 10);
+            } else if (!strncasecmp(line + 10, "rtsp://", 7) && !c->content_base[0]) {
+                snprintf(c->content_base, sizeof(c->content_base), "%s", line + 10);
+            }
+        } else if (t && !strncmp(line, "a=rtpmap:", 9)) {
+            char name[32];
+            int pt, rate = 0, ch = 0;
+            n = sscanf(line + 9, "%d %31[^/]/%d/%d", &pt, name, &rate, &ch);
+            if (n >= 2 && pt == t->payload_type) {
+                SetCodecByName(t, name);
+                if (n >= 3 && rate > 0) t->clock_rate = rate;
+                if (n >= 4 && ch > 0) t->channels = ch;
+            }
+        } else if (t && !strncmp(line, "a=fmtp:", 7)) {
+            char *sp = strchr(line + 7, ' ');
+            if (sp && atoi(line + 7) == t->payload_type) ParseFmtp(t, sp + 1);
+        }
+    }
+
+    // 去掉不支持的轨道，压紧数组
+    for (i = 0, n = 0; i < c->nb_tracks; i++) {
+        RtspTrack *src = &c->tracks[i];
+        int keep = 0;
+        if (src->codec_id != AV_CODEC_ID_NONE) {
+            if (src->type == AVMEDIA_TYPE_VIDEO && !has_video) keep = has_video = 1;
+            else if (src->type == AVMEDIA_TYPE_AUDIO && !has_audio) keep = has_audio = 1;
+        }
+        if (!keep) {
+            FreeTrack(src);
+            continue;
+        }
+        if (n != i) {
+            c->tracks[n] = *src;
+            memset(src, 0, sizeof(RtspTrack));
+        }
+        n++;
+    }
+    c->nb_tracks = n;
+    return has_video ? 0 : -1;
+}
+
+// ==========================================
+// 响应解析
+// ==========================================
+
+// 在报文头中查找 name 字段，值复制到 val
+static int GetHeader(const char *hdr, const char *name, char *val, int len)
+{
+    int nlen = (int)strlen(name);
+    const char *p = hdr;
+
+    while ((p = strchr(p, '\n')) != NULL) {
+        p++;
+        if (!strncasecmp(p, name, nlen) && p[nlen] == ':') {
+            const char *v = p + nlen + 1;
+            const char *e = strpbrk(v, "\r\n");
+            int vlen;
+            while (*v == ' ' || *v == '\t') v++;
+            vlen = e ? (int)(e - v) : (int)strlen(v);
+            if (vlen >= len) vlen = len - 1;
+            memcpy(val, v, vlen);
+            val[vlen] = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// 从 WWW-Authenticate 中取 key="value"
+static void GetAuthParam(const char *auth, const char *key, char *val, int len)
+{
+    const char *p = strstr(auth, key);
+    const char *e;
+
+    val[0] = 0;
+    if (!p) return;
+    p += strlen(key);
+    if (*p++ != '=') return;
+    if (*p == '"') {
+        p++;
+        e = strchr(p, '"');
+    } else {
+        e = strpbrk(p, ", ");
+    }
+    if (!e) e = p + strlen(p);
+    snprintf(val, len, "%.*s", (int)(e - p), p);
+}
+
+static int HandleAuth(RtspClient *c, const char *hdr)
+{
+    char www[384];
+
+    if (c->auth_tries++ >= 2 || !c->user[0]) return -1;
+    if (GetHeader(hdr, "WWW-Authenticate", www, sizeof(www)) < 0) return -1;
+    if (!strncasecmp(www, "Digest", 6)) {
+        c->auth = 2;
+        GetAuthParam(www, "realm", c->realm, sizeof(c->realm));
+        GetAuthParam(www, "nonce", c->nonce, sizeof(c->nonce));
+    } else {
+        c->auth = 1;
+    }
+    return SendCurrent(c);
+}
+
+static int HandleResponse(RtspClient *c, const char *hdr, char *body, int64_t now_ms)
+{
+    char val[192];
+    int status = atoi(hdr + 9);
+
+    if (status == 401) {
+        if (c->state == RTSP_CLIENT_PLAYING) return 0;
+        if (HandleAuth(c, hdr) < 0) {
+            LOG_WARN(TAG, "%s: authorization failed\n", c->host);
+            return -1;
+        }
+        return 0;
+    }
+    if (status != 200) {
+        // keepalive 不被支持时不影响收流
+        if (c->state == RTSP_CLIENT_PLAYING) return 0;
+        LOG_WARN(TAG, "%s: RTSP status %d in state %d\n", c->host, status, c->state);
+        return -1;
+    }
+
+    switch (c->state) {
+    case RTSP_CLIENT_DESCRIBE:
+        if (GetHeader(hdr, "Content-Base", val, sizeof(val)) == 0)
+            snprintf(c->content_base, sizeof(c->content_base), "%.*s", (int)sizeof(c->content_base) - 1, val);
+        if (!body || ParseSdp(c, body) < 0) {
+            LOG_WARN(TAG, "%s: no supported video track in SDP\n", c->host);
+            return -1;
+        }
+        c->setup_idx = 0;
+        SetState(c, RTSP_CLIENT_SETUP, now_ms);
+        return SendSetup(c);
+
+    case RTSP_CLIENT_SETUP:
+        if (GetHeader(hdr, "Session", val, sizeof(val)) == 0) {
+            char *semi = strchr(val, ';');
+            if (semi) {
+                char *to = strstr(semi, "timeout=");
+                if (to) c->session_timeout = atoi(to + 8);
+                *semi = 0;
+            }
+            snprintf(c->session, sizeof(c->session), "%.*s", (int)sizeof(c->session) - 1, val);
+        }
+        if (GetHeader(hdr, "Transport", val, sizeof(val)) == 0) {
+            char *il = strstr(val, "interleaved=");
+            if (il) c->tracks[c->setup_idx].interleaved = atoi(il + 12);
+        }
+        if (++c->setup_idx < c->nb_tracks) return SendSetup(c);
+        SetState(c, RTSP_CLIENT_PLAY, now_ms);
+        return SendPlay(c);
+
+    case RTSP_CLIENT_PLAY:
+        SetState(c, RTSP_CLIENT_PLAYING, now_ms);
+        c->play_ms = now_ms;
+        c->last_recv_ms = now_ms;
+        c->last_keepalive_ms = now_ms;
+        if (c->on_ready && c->on_ready(c->opaque) < 0) return -1;
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+// ==========================================
+// RTP 组帧
+// ==========================================
+
+static int FrameAppend(RtspTrack *t, const uint8_t *sc, int sc_len, const uint8_t *data, int len)
+{
+    int need = t->frame_len + sc_len + len;
+
+    if (need > t->frame_cap) {
+        int cap = t->frame_cap ? t->frame_cap : 64 * 1024;
+        uint8_t *p;
+        while (cap < need) cap *= 2;
+        if (cap > RTSP_FRAME_MAX) return -1;
+        p = av_realloc(t->frame, cap);
+        if (!p) return -1;
+        t->frame = p;
+        t->frame_cap = cap;
+    }
+    if (sc_len) memcpy(t->frame + t->frame_len, sc, sc_len);
+    memcpy(t->frame + t->frame_len + sc_len, data, len);
+    t->frame_len = need;
+    return 0;
+}
+
+static void FrameEmit(RtspClient *c, int idx)
+{
+    RtspTrack *t = &c->tracks[idx];
+
+    if (t->frame_len > 0 && !t->frame_broken && c->on_frame)
+        c->on_frame(c->opaque, idx, t->frame, t->frame_len, t->frame_pts);
+    t->frame_len = 0;
+    t->frame_broken = 0;
+    t->fu_active = 0;
+}
+
+// 聚合包：[16 位长度][NAL] 重复
+static int DepackAggregate(RtspTrack *t, const uint8_t *p, int len)
+{
+    while (len >= 2) {
+        int n = (p[0] << 8) | p[1];
+        if (n == 0 || n > len - 2) return -1;
+        if (FrameAppend(t, g_start_code, 4, p + 2, n) < 0) return -1;
+        p += 2 + n;
+        len -= 2 + n;
+    }
+    return 0;
+}
+
+// RFC 6184
+static int DepackH264(RtspTrack *t, const uint8_t *p, int len)
+{
+    int type = p[0] & 0x1F;
+
+    if (type >= 1 && type <= 23) return FrameAppend(t, g_start_code, 4, p, len);
+    if (type == 24) return DepackAggregate(t, p + 1, len - 1);
+    if (type == 28 && len > 2) {
+        if (p[1] & 0x80) {
+            uint8_t hdr = (p[0] & 0xE0) | (p[1] & 0x1F);
+            if (FrameAppend(t, g_start_code, 4, &hdr, 1) < 0) return -1;
+            t->fu_active = 1;
+        }
+        if (!t->fu_active) return -1;
+        if (FrameAppend(t, NULL, 0, p + 2, len - 2) < 0) return -1;
+        if (p[1] & 0x40) t->fu_active = 0;
+        return 0;
+    }
+    return 0;
+}
+
+// RFC 7798 (不含 DONL)
+static int DepackHevc(RtspTrack *t, const uint8_t *p, int len)
+{
+    int type;
+
+    if (len < 3) return -1;
+    type = (p[0] >> 1) & 0x3F;
+    if (type < 48) return FrameAppend(t, g_start_code, 4, p, len);
+    if (type == 48) return DepackAggregate(t, p + 2, len - 2);
+    if (type == 49 && len > 3) {
+        if (p[2] & 0x80) {
+            uint8_t hdr[2];
+            hdr[0] = (p[0] & 0x81) | ((p[2] & 0x3F) << 1);
+            hdr[1] = p[1];
+            if (FrameAppend(t, g_start_code, 4, hdr, 2) < 0) return -1;
+            t->fu_active = 1;
+        }
+        if (!t->fu_active) return -1;
+        if (FrameAppend(t, NULL, 0, p + 3, len - 3) < 0) return -1;
+        if (p[2] & 0x40) t->fu_active = 0;
+        return 0;
+    }
+    return 0;
+}
+
+static unsigned ReadBits(const uint8_t *p, int *pos, int n)
+{
+    unsigned v = 0;
+
+    while (n-- > 0) {
+        v = (v << 1) | ((p[*pos >> 3] >> (7 - (*pos & 7))) & 1);
+        (*pos)++;
+    }
+    return v;
+}
+
+// RFC 3640 AAC-hbr：AU 头长度 + AU 头 + 各 AU 数据
+static void DepackAac(RtspClient *c, int idx, const uint8_t *p, int len, int64_t pts)
+{
+    RtspTrack *t = &c->tracks[idx];
+    const uint8_t *data;
+    int hdr_bits, hdr_bytes, left, pos = 0, n = 0;
+
+    if (t->size_length <= 0) {
+        c->on_frame(c->opaque, idx, p, len, pts);
+        return;
+    }
+    if (len < 2) return;
+    hdr_bits = (p[0] << 8) | p[1];
+    hdr_bytes = (hdr_bits + 7) / 8;
+    if (2 + hdr_bytes > len) return;
+    data = p + 2 + hdr_bytes;
+    left = len - 2 - hdr_bytes;
+
+    while (pos + t->size_length <= hdr_bits) {
+        int size = (int)ReadBits(p + 2, &pos, t->size_length);
+        pos += n ? t->index_delta_length : t->index_length;
+        if (size <= 0 || size > left) break;
+        c->on_frame(c->opaque, idx, data, size, pts + (int64_t)n * AAC_SAMPLES_PER_AU);
+        data += size;
+        left -= size;
+        n++;
+    }
+}
+
+// 本轨 pts：首包时间戳对齐到到达时刻 (相对 PLAY)，之后按 RTP 时间戳差值累加
+static int64_t TrackPts(RtspClient *c, RtspTrack *t, uint32_t ts, int64_t now_ms)
+{
+    if (!t->ts_valid) {
+        t->ts_valid = 1;
+        t->ts_ext = 0;
+        t->ts_origin = (now_ms - c->play_ms) * t->clock_rate / 1000;
+    } else {
+        t->ts_ext += (int32_t)(ts - t->last_ts);
+    }
+    t->last_ts = ts;
+    return t->ts_ext + t->ts_origin;
+}
+
+static void HandleRtp(RtspClient *c, int idx, const uint8_t *p, int len, int64_t now_ms)
+{
+    RtspTrack *t = &c->tracks[idx];
+    int hdr, marker, ret = 0;
+    uint16_t seq;
+    uint32_t ts;
+    int64_t pts;
+
+    if (len < 12 || (p[0] >> 6) != 2) return;
+    hdr = 12 + (p[0] & 0x0F) * 4;
+    if (p[0] & 0x10) {
+        if (len < hdr + 4) return;
+        hdr += 4 + ((p[hdr + 2] << 8) | p[hdr + 3]) * 4;
+    }
+    if (p[0] & 0x20) len -= p[len - 1];
+    if (hdr >= len) return;
+
+    marker = p[1] >> 7;
+    seq = (uint16_t)((p[2] << 8) | p[3]);
+    ts = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+    if (t->seq_valid && seq != (uint16_t)(t->last_seq + 1)) {
+        c->lost++;
+        t->frame_broken = 1;
+        t->fu_active = 0;
+    }
+    t->seq_valid = 1;
+    t->last_seq = seq;
+    pts = TrackPts(c, t, ts, now_ms);
+    p += hdr;
+    len -= hdr;
+
+    if (t->type == AVMEDIA_TYPE_VIDEO) {
+        // 没收到上一帧的 marker 位：时间戳变化即视为新帧开始
+        if (t->frame_len > 0 && ts != t->frame_ts) FrameEmit(c, idx);
+        if (t->frame_len == 0) {
+            t->frame_ts = ts;
+            t->frame_pts = pts;
+        }
+        ret = (t->codec_id == AV_CODEC_ID_HEVC) ? DepackHevc(t, p, len) : DepackH264(t, p, len);
+        if (ret < 0) t->frame_broken = 1;
+        if (marker) FrameEmit(c, idx);
+    } else if (t->codec_id == AV_CODEC_ID_AAC) {
+        DepackAac(c, idx, p, len, pts);
+    } else if (c->on_frame) {
+        c->on_frame(c->opaque, idx, p, len, pts);
+    }
+}
+
+static void HandleInterleaved(RtspClient *c, int channel, const uint8_t *p, int len, int64_t now_ms)
+{
+    int i;
+
+    if (c->state != RTSP_CLIENT_PLAYING) return;
+    for (i = 0; i < c->nb_tracks; i++) {
+        // RTCP (奇数通道) 不处理：pts 已按到达时刻对齐
+        if (c->tracks[i].interleaved == channel) {
+            HandleRtp(c, i, p, len, now_ms);
+            return;
+        }
+    }
+}
+
+// 报文头结束位置 (\r\n\r\n 之后)，不完整返回 0
+static int HeaderLength(const uint8_t *p, int len)
+{
+    int i;
+
+    for (i = 3; i < len; i++) {
+        if (p[i] == '\n' && p[i - 1] == '\r' && p[i - 2] == '\n' && p[i - 3] == '\r') return i + 1;
+    }
+    return 0;
+}
+
+// 解析接收缓冲中的完整报文，返回消费的字节数，出错返回 -1
+static int ParseBuffer(RtspClient *c, int64_t now_ms)
+{
+    int pos = 0;
+
+    while (pos < c->rlen) {
+        uint8_t *p = c->rbuf + pos;
+        int avail = c->rlen - pos;
+
+        if (p[0] == '$') {
+            int len;
+            if (avail < 4) break;
+            len = (p[2] << 8) | p[3];
+            if (avail < 4 + len) break;
+            HandleInterleaved(c, p[1], p + 4, len, now_ms);
+            pos += 4 + len;
+        } else if (isupper(p[0])) {
+            char hdr[2048], body[4096], val[16];
+            int hlen = HeaderLength(p, avail < (int)sizeof(hdr) ? avail : (int)sizeof(hdr) - 1);
+            int clen = 0;
+
+            if (hlen == 0) {
+                if (avail >= (int)sizeof(hdr) - 1) return -1;
+                break;
+            }
+            memcpy(hdr, p, hlen);
+            hdr[hlen] = 0;
+            if (GetHeader(hdr, "Content-Length", val, sizeof(val)) == 0) clen = atoi(val);
+            if (clen < 0 || clen >= RTSP_CLIENT_RBUF_SIZE / 2) return -1;
+            if (avail < hlen + clen) break;
+
+            // 服务端发来的请求 (如 ANNOUNCE) 直接跳过
+            if (!strncmp(hdr, "RTSP/1.0 ", 9)) {
+                int blen = (clen < (int)sizeof(body)) ? clen : (int)sizeof(body) - 1;
+                memcpy(body, p + hlen, blen);
+                body[blen] = 0;
+                if (HandleResponse(c, hdr, clen ? body : NULL, now_ms) < 0) return -1;
+            }
+            pos += hlen + clen;
+        } else {
+            // 不认识的字节 (interleaved 流中偶见的填充)，跳过
+            pos++;
+        }
+    }
+    return pos;
+}
+
+// ==========================================
+// 对外接口
+// ==========================================
+
+static int ParseUrl(RtspClient *c, const char *url)
+{
+    const char *p, *at, *slash, *colon;
+    char hostport[96];
+
+    if (strncasecmp(url, "rtsp://", 7)) return -1;
+    p = url + 7;
+    slash = strchr(p, '/');
+    at = strchr(p, '@');
+    if (at && (!slash || at < slash)) {
+        colon = memchr(p, ':', at - p);
+        if (colon) {
+            snprintf(c->user, sizeof(c->user), "%.*s", (int)(colon - p), p);
+            snprintf(c->pass, sizeof(c->pass), "%.*s", (int)(at - colon - 1), colon + 1);
+        } else {
+            snprintf(c->user, sizeof(c->user), "%.*s", (int)(at - p), p);
+        }
+        p = at + 1;
+    }
+    snprintf(hostport, sizeof(hostport), "%.*s", slash ? (int)(slash - p) : (int)strlen(p), p);
+    colon = strchr(hostport, ':');
+    c->port = colon ? atoi(colon + 1) : RTSP_DEFAULT_PORT;
+    snprintf(c->host, sizeof(c->host), "%.*s", colon ? (int)(colon - hostport) : (int)strlen(hostport), hostport);
+    snprintf(c->uri, sizeof(c->uri), "rtsp://%s%s", hostport, slash ? slash : "/");
+    return c->host[0] ? 0 : -1;
+}
+
+int rtsp_client_open(RtspClient *c, const char *url, RtspFrameCb on_frame, RtspReadyCb on_ready, void *opaque)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    memset(c, 0, sizeof(RtspClient));
+    c->fd = -1;
+    c->on_frame = on_frame;
+    c->on_ready = on_ready;
+    c->opaque = opaque;
+    if (ParseUrl(c, url) < 0) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(c->port);
+    if (inet_pton(AF_INET, c->host, &addr.sin_addr) != 1) {
+        LOG_WARN(TAG, "Unsupported host %s\n", c->host);
+        return -1;
+    }
+
+    c->rbuf = av_malloc(RTSP_CLIENT_RBUF_SIZE);
+    if (!c->rbuf) return -1;
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) {
+        rtsp_client_close(c);
+        return -1;
+    }
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        SetState(c, RTSP_CLIENT_DESCRIBE, NowMs());
+        if (SendDescribe(c) < 0) {
+            rtsp_client_close(c);
+            return -1;
+        }
+    } else if (errno == EINPROGRESS) {
+        SetState(c, RTSP_CLIENT_CONNECTING, NowMs());
+    } else {
+        rtsp_client_close(c);
+        return -1;
+    }
+    return c->fd;
+}
+
+int rtsp_client_process(RtspClient *c, int readable, int writable, int64_t now_ms)
+{
+    if (c->fd < 0) return -1;
+
+    if (writable) {
+        if (c->state == RTSP_CLIENT_CONNECTING) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) return -1;
+            SetState(c, RTSP_CLIENT_DESCRIBE, now_ms);
+            if (SendDescribe(c) < 0) return -1;
+        } else if (FlushWrite(c) < 0) {
+            return -1;
+        }
+    }
+
+    while (readable) {
+        ssize_t n = recv(c->fd, c->rbuf + c->rlen, RTSP_CLIENT_RBUF_SIZE - c->rlen, 0);
+        int used;
+
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        c->rlen += (int)n;
+        c->last_recv_ms = now_ms;
+
+        used = ParseBuffer(c, now_ms);
+        if (used < 0) return -1;
+        if (used > 0) {
+            memmove(c->rbuf, c->rbuf + used, c->rlen - used);
+            c->rlen -= used;
+        }
+        // 缓冲已满却解析不出完整报文
+        if (c->rlen >= RTSP_CLIENT_RBUF_SIZE) return -1;
+    }
+    return 0;
+}
+
+int rtsp_client_tick(RtspClient *c, int64_t now_ms, int timeout_ms)
+{
+    int interval;
+
+    if (c->fd < 0) return -1;
+    if (c->state != RTSP_CLIENT_PLAYING) {
+        return (now_ms - c->state_ms > timeout_ms) ? -1 : 0;
+    }
+    if (now_ms - c->last_recv_ms > timeout_ms) return -1;
+
+    interval = (c->session_timeout > 0 ? c->session_timeout : RTSP_KEEPALIVE_DEFAULT) * 1000 / 2;
+    if (now_ms - c->last_keepalive_ms >= interval) {
+        c->last_keepalive_ms = now_ms;
+        if (SendRequest(c, "OPTIONS", BaseUrl(c), NULL) < 0) return -1;
+    }
+    return 0;
+}
+
+int rtsp_client_want_write(const RtspClient *c)
+{
+    return c->state == RTSP_CLIENT_CONNECTING || c->woff < c->wlen;
+}
+
+void rtsp_client_close(RtspClient *c)
+{
+    int i;
+
+    if (c->fd >= 0) {
+        if (c->state >= RTSP_CLIENT_PLAY && c->session[0]) {
+            SendRequest(c, "TEARDOWN", BaseUrl(c), NULL);
+        }
+        close(c->fd);
+        c->fd = -1;
+    }
+    for (i = 0; i < RTSP_CLIENT_MAX_TRACKS; i++) FreeTrack(&c->tracks[i]);
+    c->nb_tracks = 0;
+    av_freep(&c->rbuf);
+    c->rlen = 0;
+    c->wlen = c->woff = 0;
+    c->state = RTSP_CLIENT_IDLE;
+}
@@ -11,12 +11,13 @@
 #include <libavutil/log.h>
 #include <libavutil/avutil.h>
 #include <libavutil/opt.h>
-#include <libswresample/swresample.h>
-#include <libavutil/audio_fifo.h>
 
 #include "system.h"
 #include "stream.h"
 #include "packet_queue.h"
+#include "packet_meta.h"
+#include "audio_transcode.h"
+#include "ingest_reactor.h"
 #include "camera_manage.h"
 #include "record.h"
 #include "p2p.h"
@@ -25,315 +26,266 @@
 
 #define TAG "STREAM"
 #define ENABLE_MP4_RECORD 1
+// 1: 所有摄像头由一个 epoll 线程接收 (ingest_reactor.c)，0: 每路一个阻塞的 RTSP 线程
+#define ENABLE_INGEST_REACTOR 0
 #define RTSP_PORT 1234
-#define SAMPLING_RATE 16000
-#define H264_RBSP_BUF_SIZE 4096
-#define NAL_TYPE_SLICE      1
-#define NAL_TYPE_SLICE_IDR  5
+// 广播环的内存上限：I 帧可能是 P 帧的几十倍，按字节和时长限制而不是只按包数
+#define INGEST_BUDGET_BYTES (3 * 1024 * 1024)
+#define INGEST_BUDGET_MS    8000
+// 转码后的音频在等待视频时间戳追上时最多积压的包数 (16kHz AAC 约 0.5 秒)，超过后不再等视频
+#define AUDIO_MERGE_MAX_PENDING 8
+#define AUDIO_CAMS_PER_WORKER   2       // 每个音频转码线程负责的摄像头路数
+
+// 断线重连退避：200ms 起按次数翻倍，上限随 HaLow 链路质量放宽，另加 ±20% 抖动避免多路摄像头同时重连
+#define RECONNECT_BASE_MS       200
+#define RECONNECT_CAP_GOOD_MS   2000
+#define RECONNECT_CAP_WEAK_MS   5000
+#define RECONNECT_CAP_DOWN_MS   8000
+#define RECONNECT_JITTER_PCT    20
+#define RECONNECT_SLICE_MS      50      // 退避期间按此间隔检查停止请求和链路恢复
+#define HALOW_RSSI_DOWN         (-127)  // network.c 在链路断开时写入的 RSSI
+#define HALOW_RSSI_WEAK         (-85)
+#define HALOW_EVM_WEAK          (-15)   // EVM (dB) 高于此值视为链路差
+// 必须探测时 (没有缓存也没有摄像头通告的参数) 只读很少的数据，SDP 已给出编码类型
+#define PROBE_SIZE_BYTES        "32768"
+#define PROBE_DURATION_US       "500000"
 
 // ==========================================
 // Helper Structures
 // ==========================================
-typedef struct {
-    const uint8_t *data;
-    int size;
-    int index; 
-} GetBitContext;
-
-typedef struct {
-    int initialized;
-    AVCodecContext *dec_ctx;
-    AVCodecContext *enc_ctx;
-    SwrContext *swr_ctx;
-    AVAudioFifo *fifo;
-    AVFrame *dec_frame;
-    AVFrame *enc_frame;
-    int64_t pts_counter;
-} AudioTranscoder;
+
+// 音频入队路径：每次连接成功后按音频 codecpar 决定
+typedef enum {
+    AUDIO_PATH_DROP = 0,      // 无音频，或转码器初始化失败 (不把无法录制的原始包送给下游)
+    AUDIO_PATH_PASSTHROUGH,   // 摄像头已是 AAC：不解码，直接入队
+    AUDIO_PATH_TRANSCODE,     // G.711 / PCM 等：交给共享转码线程池，编码结果按时间戳合并回广播环
+} AudioPath;
+
+// 把转码线程池输出的 AAC 包合并进广播环 (广播环只由 RTSP 线程发布)。
+// 只发布 pts 不晚于 limit (最近视频包的时间，已换算到音频时间基) 的包，保证环中音视频按时间戳有序；
+// 视频迟迟不来导致积压超过 AUDIO_MERGE_MAX_PENDING 时不再等待。hold 为预读出来、尚未到时间的一个包
+static void MergeTranscodedAudio(RtspCtx *ctx, AVPacket *hold, int *held, int64_t limit) {
+    while (1) {
+        if (!*held) {
+            if (!audio_transcode_job_receive(&ctx->Audio, hold)) break;
+            *held = 1;
+        }
+        if (hold->pts != AV_NOPTS_VALUE && hold->pts > limit &&
+            audio_transcode_job_pending(&ctx->Audio) < AUDIO_MERGE_MAX_PENDING) {
+            break;
+        }
+        packet_broadcast_put(&ctx->Ingest, hold, PKT_TYPE_AUDIO);
+        av_packet_unref(hold);
+        *held = 0;
+    }
+}
 
 /* ========================================================================== */
-/* H.264 Parsing Helpers (SPS/PPS/Keyframe)                                   */
+/* Main Stream Logic                                                          */
 /* ========================================================================== */
 
-static void init_get_bits(GetBitContext *s, const uint8_t *buffer, int bit_len) {
-    s->data = buffer;
-    s->size = bit_len / 8;
-    s->index = 0;
-}
-
-static int get_bits(GetBitContext *s, int n) {
-    int val = 0;
-    for (int i = 0; i < n; i++) {
-        int byte_idx = s->index >> 3;
-        int bit_idx  = 7 - (s->index & 7);
-        if (byte_idx >= s->size) return 0;
-        int bit = (s->data[byte_idx] >> bit_idx) & 1;
-        val = (val << 1) | bit;
-        s->index++;
-    }
-    return val;
+static inline int64_t NowMsMonotonic(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000LL + (int64_t)ts.tv_nsec / 1000000LL;
 }
 
-static int get_1bit(GetBitContext *s) { return get_bits(s, 1); }
+// 链路状态：0 正常 (或尚未收到信号事件)，1 信号弱，2 断开
+static int HalowLinkLevel(RtspCtx *ctx, int *rssi, int *evm) {
+    int r = 0, e = 0;
 
-static unsigned int get_ue_golomb(GetBitContext *s) {
-    int zeros = 0;
-    while (get_1bit(s) == 0 && zeros < 32 && (s->index >> 3) < s->size) {
-        zeros++;
-    }
-    if (zeros == 0) return 0;
-    unsigned int val = get_bits(s, zeros);
-    return (1U << zeros) - 1 + val;
+    Network_GetHalowState(((StreamHandle*)ctx->Stream)->Station, &r, &e, NULL);
+    if (rssi) *rssi = r;
+    if (evm) *evm = e;
+    if (r <= HALOW_RSSI_DOWN) return 2;
+    if ((r != 0 && r < HALOW_RSSI_WEAK) || (e != 0 && e > HALOW_EVM_WEAK)) return 1;
+    return 0;
 }
 
-static int get_se_golomb(GetBitContext *s) {
-    unsigned int ue = get_ue_golomb(s);
-    int val = (ue + 1) >> 1;
-    return (ue & 1) ? val : -val;
+// 计算下一次重连前的等待时间：抖动指数退避，上限随链路质量放宽。
+// link_down 返回链路是否断开 (断开时调用者应在链路恢复后提前重连)
+int Stream_BackoffDelay(RtspCtx *ctx, const char *reason, int *link_down) {
+    static const int caps[3] = { RECONNECT_CAP_GOOD_MS, RECONNECT_CAP_WEAK_MS, RECONNECT_CAP_DOWN_MS };
+    RtspReconnect *rc = &ctx->Reconnect;
+    int rssi, evm, level, shift, delay, jitter;
+
+    level = HalowLinkLevel(ctx, &rssi, &evm);
+    shift = (rc->attempts < 10) ? rc->attempts : 10;
+    delay = RECONNECT_BASE_MS << shift;
+    if (delay > caps[level]) delay = caps[level];
+    jitter = delay * RECONNECT_JITTER_PCT / 100;
+    if (jitter > 0) delay += (int)(rand_r(&rc->seed) % (2 * jitter + 1)) - jitter;
+
+    rc->attempts++;
+    rc->last_backoff_ms = delay;
+    rc->state = RTSP_STATE_BACKOFF;
+    LOG_WARN(TAG, "[Ch%d] %s. RSSI:%d EVM:%d, retry #%d in %dms\n",
+             ctx->CamIndex, reason, rssi, evm, rc->attempts, delay);
+    if (link_down) *link_down = (level == 2);
+    return delay;
 }
 
-static int EbspToRbsp(const uint8_t *src, int src_len, uint8_t *dst) {
-    int i, j = 0;
-    for (i = 0; i < src_len; i++) {
-        if (i >= 2 && src[i] == 0x03 && src[i-1] == 0x00 && src[i-2] == 0x00) {
-            continue; 
-        }
-        dst[j++] = src[i];
-    }
-    return j;
+int Stream_LinkDown(RtspCtx *ctx) {
+    return HalowLinkLevel(ctx, NULL, NULL) == 2;
 }
 
-static int H264SpsGetWh(const uint8_t *sps, int sps_len, int *out_w, int *out_h)
-{
-    if (!sps || sps_len < 4) return -1;
-    if (sps_len > H264_RBSP_BUF_SIZE) sps_len = H264_RBSP_BUF_SIZE;
-
-    const uint8_t *nal_start = sps;
-    int nal_len = sps_len;
-
-    if (sps[0] == 0 && sps[1] == 0) {
-        if (sps[2] == 1) { nal_start += 3; nal_len -= 3; }
-        else if (sps[2] == 0 && sps[3] == 1) { nal_start += 4; nal_len -= 4; }
-    }
-    
-    if (nal_len > 0) { nal_start++; nal_len--; }
-    if (nal_len <= 0) return -1;
-
-    uint8_t rbsp[H264_RBSP_BUF_SIZE];
-    int rbsp_len = EbspToRbsp(nal_start, nal_len, rbsp); 
-
-    GetBitContext gb;
-    init_get_bits(&gb, rbsp, rbsp_len * 8);
-
-    int profile_idc = get_bits(&gb, 8);
-    get_bits(&gb, 8); 
-    get_bits(&gb, 8); 
-    get_ue_golomb(&gb); 
-
-    if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 ||
-        profile_idc == 244 || profile_idc == 44  || profile_idc == 83  ||
-        profile_idc == 86  || profile_idc == 118 || profile_idc == 128 ||
-        profile_idc == 138 || profile_idc == 139 || profile_idc == 134) 
-    {
-        int chroma_format_idc = get_ue_golomb(&gb);
-        if (chroma_format_idc == 3) get_1bit(&gb);
-        get_ue_golomb(&gb); 
-        get_ue_golomb(&gb); 
-        get_1bit(&gb);      
-        
-        int seq_scaling_matrix_present_flag = get_1bit(&gb);
-        if (seq_scaling_matrix_present_flag) {
-            int limit = (chroma_format_idc != 3) ? 8 : 12;
-            for (int i = 0; i < limit; i++) {
-                if (get_1bit(&gb)) { 
-                    int last_scale = 8;
-                    int next_scale = 8;
-                    int count = (i < 6) ? 16 : 64;
-                    for (int j = 0; j < count; j++) {
-                        if (next_scale != 0) {
-                            int delta_scale = get_se_golomb(&gb);
-                            next_scale = (last_scale + delta_scale + 256) % 256;
-                        }
-                        last_scale = (next_scale == 0) ? last_scale : next_scale;
-                    }
-                }
-            }
-        }
-    }
+// 线程模式下的等待：按 RECONNECT_SLICE_MS 分段睡眠，
+// 停止请求立即返回；链路从断开恢复时提前结束等待，马上重连
+static void RtspBackoffWait(RtspCtx *ctx, const char *reason) {
+    int link_down;
+    int64_t deadline = NowMsMonotonic() + Stream_BackoffDelay(ctx, reason, &link_down);
+
+    while (ctx->running) {
+        int64_t left = deadline - NowMsMonotonic();
+        if (left <= 0) break;
+        if (left > RECONNECT_SLICE_MS) left = RECONNECT_SLICE_MS;
+        usleep((useconds_t)left * 1000);
+        if (link_down && !Stream_LinkDown(ctx)) {
+            LOG_INFO(TAG, "[Ch%d] HaLow link back, reconnect now\n", ctx->CamIndex);
+            break;
+        }
+    }
+}
 
-    get_ue_golomb(&gb); 
-    int pic_order_cnt_type = get_ue_golomb(&gb);
-    if (pic_order_cnt_type == 0) {
-        get_ue_golomb(&gb); 
-    } else if (pic_order_cnt_type == 1) {
-        get_1bit(&gb); 
-        get_se_golomb(&gb); 
-        get_se_golomb(&gb); 
-        int num = get_ue_golomb(&gb);
-        for (int i = 0; i < num; i++) get_se_golomb(&gb); 
-    }
+// 断线开始 (重复调用只记第一次)
+void Stream_MarkDown(RtspCtx *ctx) {
+    if (ctx->Reconnect.down_since_ms == 0) ctx->Reconnect.down_since_ms = NowMsMonotonic();
+}
 
-    get_ue_golomb(&gb); 
-    get_1bit(&gb);      
-    
-    int pic_width_in_mbs_minus1 = get_ue_golomb(&gb);
-    int pic_height_in_map_units_minus1 = get_ue_golomb(&gb);
-    int frame_mbs_only_flag = get_1bit(&gb);
-    
-    if (!frame_mbs_only_flag) get_1bit(&gb); 
-    get_1bit(&gb); 
-    
-    int frame_cropping_flag = get_1bit(&gb);
-    int crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
-    if (frame_cropping_flag) {
-        crop_left   = get_ue_golomb(&gb);
-        crop_right  = get_ue_golomb(&gb);
-        crop_top    = get_ue_golomb(&gb);
-        crop_bottom = get_ue_golomb(&gb);
-    }
+// 断线后收到第一个包：记录中断时长，退避次数清零
+static void RtspMarkUp(RtspCtx *ctx, int fast) {
+    RtspReconnect *rc = &ctx->Reconnect;
+
+    rc->attempts = 0;
+    rc->state = RTSP_STATE_STREAMING;
+    if (rc->down_since_ms == 0) return;
+
+    rc->last_gap_ms = NowMsMonotonic() - rc->down_since_ms;
+    if (rc->last_gap_ms > rc->max_gap_ms) rc->max_gap_ms = rc->last_gap_ms;
+    rc->total_gap_ms += rc->last_gap_ms;
+    rc->reconnects++;
+    if (fast) rc->fast_reconnects++;
+    rc->down_since_ms = 0;
+    LOG_INFO(TAG, "[Ch%d] Stream restored after %lldms gap%s\n", ctx->CamIndex,
+             (long long)rc->last_gap_ms, fast ? " (cached params)" : "");
+}
 
-    int width  = (pic_width_in_mbs_minus1 + 1) * 16;
-    int height = (pic_height_in_map_units_minus1 + 1) * 16 * (2 - frame_mbs_only_flag);
-    int crop_unit_x = 2; 
-    int crop_unit_y = 2 * (2 - frame_mbs_only_flag);
-    width  -= (crop_left + crop_right) * crop_unit_x;
-    height -= (crop_top + crop_bottom) * crop_unit_y;
+// SDP 给出的流参数签名 (FNV-1a)，在 avformat_open_input 之后、探测之前计算
+static uint32_t StreamParamSig(const AVCodecParameters *par) {
+    int32_t fields[6];
+    const uint8_t *p;
+    uint32_t h = 2166136261u;
+    int i;
+
+    fields[0] = par->codec_type;
+    fields[1] = par->codec_id;
+    fields[2] = par->sample_rate;
+    fields[3] = par->channels;
+    fields[4] = par->width;
+    fields[5] = par->height;
+    p = (const uint8_t *)fields;
+    for (i = 0; i < (int)sizeof(fields); i++) h = (h ^ p[i]) * 16777619u;
+    for (i = 0; i < par->extradata_size; i++) h = (h ^ par->extradata[i]) * 16777619u;
+    return h;
+}
 
-    if (width <= 0 || height <= 0 || width > 4096 || height > 2160) return -1;
+static void ParamCacheClear(RtspParamCache *cache) {
+    int i;
 
-    *out_w = width;
-    *out_h = height;
-    return 0;
+    for (i = 0; i < RTSP_CACHE_STREAMS; i++) avcodec_parameters_free(&cache->par[i]);
+    cache->valid = 0;
+    cache->nb_streams = 0;
 }
 
-static int H264CheckSliceIsI(const uint8_t *nal_payload, int len)
-{
-    if (len < 2) return 0;
-    const uint8_t *ptr = nal_payload + 1;
-    int size = len - 1;
-    GetBitContext gb;
-    uint8_t rbsp_head[32]; 
-    int rbsp_len = EbspToRbsp(ptr, (size > 32 ? 32 : size), rbsp_head);
-    init_get_bits(&gb, rbsp_head, rbsp_len * 8);
-    get_ue_golomb(&gb); 
-    unsigned int slice_type = get_ue_golomb(&gb);
-    slice_type %= 5; 
-    return (slice_type == 2); 
-}
-
-static int H264_Scan_KeyFrame(const uint8_t *p, int size)
-{
-    if (!p || size < 5) return 0;
-    int i;
-    for (i = 0; i < size - 5; i++) {
-        if (p[i] == 0 && p[i+1] == 0) {
-            if (p[i+2] == 1) { 
-                int type = p[i+3] & 0x1F;
-                if (type == NAL_TYPE_SLICE_IDR) return 1;
-                if (type == NAL_TYPE_SLICE && H264CheckSliceIsI(&p[i+3], size - (i+3))) return 1;
-            } else if (p[i+2] == 0 && p[i+3] == 1) { 
-                int type = p[i+4] & 0x1F;
-                if (type == NAL_TYPE_SLICE_IDR) return 1;
-                if (type == NAL_TYPE_SLICE && H264CheckSliceIsI(&p[i+4], size - (i+4))) return 1;
-            }
-        }
-    }
-    return 0;
+// 本次连接的 SDP 与缓存一致时，把上次探测得到的参数套用到各流上，返回 1
+static int ParamCacheApply(RtspParamCache *cache, AVFormatContext *fmt, const uint32_t *sig) {
+    int i;
+
+    if (!cache->valid || (int)fmt->nb_streams != cache->nb_streams) return 0;
+    for (i = 0; i < cache->nb_streams; i++) {
+        if (sig[i] != cache->sdp_sig[i]) return 0;
+    }
+    for (i = 0; i < cache->nb_streams; i++) {
+        AVStream *st = fmt->streams[i];
+        if (avcodec_parameters_copy(st->codecpar, cache->par[i]) < 0) return 0;
+        st->avg_frame_rate = cache->frame_rate[i];
+        st->r_frame_rate = cache->frame_rate[i];
+    }
+    return 1;
 }
 
-static int AvccGetFirstSps(const uint8_t *extra, int extra_size, const uint8_t **sps, int *sps_len)
-{
-    int num_sps, pos, i;
-    if (!extra || extra_size < 7) return -1;
-    if (extra[0] != 1) return -1;
-    num_sps = extra[5] & 0x1f;
-    pos = 6;
-    for (i = 0; i < num_sps; i++) {
-        int len; if (pos + 2 > extra_size) return -1;
-        len = (extra[pos] << 8) | extra[pos + 1]; pos += 2;
-        if (pos + len > extra_size) return -1;
-        if (len > 0 && ((extra[pos] & 0x1f) == 7)) { 
-            *sps = &extra[pos];
-            *sps_len = len;
-            return 0;
-        }
-        pos += len;
-    }
-    return -1;
+// 探测成功后保存参数 (须在音频转码改写 codecpar 之前)，流数超过缓存容量时不缓存
+static void ParamCacheStore(RtspParamCache *cache, AVFormatContext *fmt, const uint32_t *sig) {
+    int i;
+
+    ParamCacheClear(cache);
+    if (fmt->nb_streams == 0 || fmt->nb_streams > RTSP_CACHE_STREAMS) return;
+    for (i = 0; i < (int)fmt->nb_streams; i++) {
+        cache->par[i] = avcodec_parameters_alloc();
+        if (!cache->par[i] || avcodec_parameters_copy(cache->par[i], fmt->streams[i]->codecpar) < 0) {
+            ParamCacheClear(cache);
+            return;
+        }
+        cache->sdp_sig[i] = sig[i];
+        cache->frame_rate[i] = fmt->streams[i]->avg_frame_rate;
+    }
+    cache->nb_streams = fmt->nb_streams;
+    cache->valid = 1;
 }
 
-/* ========================================================================== */
-/* Audio Transcoder                                                           */
-/* ========================================================================== */
+// 取摄像头经控制通道通告的流参数，没有时返回 0
+static int GetAnnouncedInfo(RtspCtx *ctx, StreamInfo *info) {
+    StreamHandle *Stream = (StreamHandle *)ctx->Stream;
+    int valid;
 
-static void FreeTranscoder(AudioTranscoder *tc) {
-    if (!tc) return;
-    if (tc->dec_ctx) avcodec_free_context(&tc->dec_ctx);
-    if (tc->enc_ctx) avcodec_free_context(&tc->enc_ctx);
-    if (tc->swr_ctx) swr_free(&tc->swr_ctx);
-    if (tc->fifo)    av_audio_fifo_free(tc->fifo);
-    if (tc->dec_frame) av_frame_free(&tc->dec_frame);
-    if (tc->enc_frame) av_frame_free(&tc->enc_frame);
-    memset(tc, 0, sizeof(AudioTranscoder));
-}
-
-static int InitTranscoder(AudioTranscoder *tc, AVCodecParameters *in_par) {
-    int ret;
-    AVCodec *dec = avcodec_find_decoder(in_par->codec_id);
-    AVCodec *enc = avcodec_find_encoder(AV_CODEC_ID_AAC); 
-    if (!enc) enc = avcodec_find_encoder_by_name("aac");
-
-    if (!enc || !dec) return -1;
-
-    tc->dec_ctx = avcodec_alloc_context3(dec);
-    avcodec_parameters_to_context(tc->dec_ctx, in_par);
-    if ((ret = avcodec_open2(tc->dec_ctx, dec, NULL)) < 0) return ret;
-
-    tc->enc_ctx = avcodec_alloc_context3(enc);
-    tc->enc_ctx->sample_rate = in_par->sample_rate > 0 ? in_par->sample_rate : SAMPLING_RATE;
-    tc->enc_ctx->channel_layout = AV_CH_LAYOUT_MONO;
-    tc->enc_ctx->channels = 1;
-    tc->enc_ctx->sample_fmt = enc->sample_fmts ? enc->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
-    tc->enc_ctx->bit_rate = 32000; 
-    tc->enc_ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL; 
-    tc->enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-
-    if ((ret = avcodec_open2(tc->enc_ctx, enc, NULL)) < 0) return ret;
-
-    tc->swr_ctx = swr_alloc();
-    av_opt_set_int(tc->swr_ctx, "in_channel_layout",  tc->dec_ctx->channel_layout ? tc->dec_ctx->channel_layout : av_get_default_channel_layout(tc->dec_ctx->channels), 0);
-    av_opt_set_int(tc->swr_ctx, "in_sample_rate",     tc->dec_ctx->sample_rate, 0);
-    av_opt_set_sample_fmt(tc->swr_ctx, "in_sample_fmt", tc->dec_ctx->sample_fmt, 0);
-
-    av_opt_set_int(tc->swr_ctx, "out_channel_layout", tc->enc_ctx->channel_layout, 0);
-    av_opt_set_int(tc->swr_ctx, "out_sample_rate",    tc->enc_ctx->sample_rate, 0);
-    av_opt_set_sample_fmt(tc->swr_ctx, "out_sample_fmt", tc->enc_ctx->sample_fmt, 0);
-
-    if ((ret = swr_init(tc->swr_ctx)) < 0) return ret;
-
-    tc->fifo = av_audio_fifo_alloc(tc->enc_ctx->sample_fmt, tc->enc_ctx->channels, 1024 * 50);
-    tc->dec_frame = av_frame_alloc();
-    tc->enc_frame = av_frame_alloc();
-    tc->enc_frame->nb_samples = tc->enc_ctx->frame_size;
-    tc->enc_frame->format = tc->enc_ctx->sample_fmt;
-    tc->enc_frame->channel_layout = tc->enc_ctx->channel_layout;
-    tc->enc_frame->sample_rate = tc->enc_ctx->sample_rate;
-    
-    if ((ret = av_frame_get_buffer(tc->enc_frame, 0)) < 0) return ret;
+    pthread_mutex_lock(&Stream->Mutex);
+    valid = Stream->AnnouncedValid[ctx->CamIndex];
+    if (valid) *info = Stream->Announced[ctx->CamIndex];
+    pthread_mutex_unlock(&Stream->Mutex);
+    return valid;
+}
 
-    tc->initialized = 1;
-    tc->pts_counter = 0;
-    return 0;
+// 用 SDP + 摄像头通告的参数补全 codecpar，代替 find_stream_info (它要读入并缓存若干帧才返回)。
+// 编码类型必须由 SDP 给出；音频采样率 SDP 和通告都没有时返回 0，交给探测
+static int SeedStreamParams(AVFormatContext *fmt, const StreamInfo *info) {
+    int i, has_video = 0;
+
+    for (i = 0; i < (int)fmt->nb_streams; i++) {
+        AVStream *st = fmt->streams[i];
+        AVCodecParameters *par = st->codecpar;
+
+        if (par->codec_type == AVMEDIA_TYPE_VIDEO) {
+            if (par->codec_id == AV_CODEC_ID_NONE) return 0;
+            // SDP 中的 SPS 优先，通告的分辨率只用来补缺
+            if (par->width == 0 && par->extradata_size > 0)
+                packet_meta_extradata_wh(par->codec_id, par->extradata, par->extradata_size, &par->width, &par->height);
+            if (par->width == 0 && info->VideoWidth > 0 && info->VideoHeight > 0) {
+                par->width = info->VideoWidth;
+                par->height = info->VideoHeight;
+            }
+            if (st->avg_frame_rate.num == 0 && info->VideoFrameRate > 0) {
+                st->avg_frame_rate = (AVRational){ info->VideoFrameRate, 1 };
+                st->r_frame_rate = st->avg_frame_rate;
+            }
+            has_video = 1;
+        } else if (par->codec_type == AVMEDIA_TYPE_AUDIO) {
+            if (par->codec_id == AV_CODEC_ID_NONE) return 0;
+            if (par->sample_rate == 0) par->sample_rate = info->AudioSampleRate;
+            if (par->sample_rate <= 0) return 0;
+            if (par->channels == 0) par->channels = 1;
+            if (par->channel_layout == 0) par->channel_layout = av_get_default_channel_layout(par->channels);
+        }
+    }
+    return has_video;
 }
 
-/* ========================================================================== */
-/* Main Stream Logic                                                          */
-/* ========================================================================== */
+int Stream_SeedParams(RtspCtx *ctx, AVFormatContext *fmt) {
+    StreamInfo info;
 
-static inline int64_t NowMsMonotonic(void) {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (int64_t)ts.tv_sec * 1000LL + (int64_t)ts.tv_nsec / 1000000LL;
+    if (!GetAnnouncedInfo(ctx, &info) || !SeedStreamParams(fmt, &info)) return 0;
+    LOG_INFO(TAG, "[Ch%d] Params seeded from camera: %dx%d@%d audio %dHz\n", ctx->CamIndex,
+             info.VideoWidth, info.VideoHeight, info.VideoFrameRate, info.AudioSampleRate);
+    return 1;
 }
 
 static int32_t FfmpegInterruptCb(void *opaque) {
@@ -341,207 +293,335 @@ static int32_t FfmpegInterruptCb(void *opaque) {
     return ctx ? (ctx->running == 0) : 1;
 }
 
-static void* Stream_RtspThread(void *Arg) {
-    RtspCtx *ctx = (RtspCtx *)Arg;
-    AVDictionary *opts = NULL;
-    AVPacket pkt;
-    int ret;
-    AudioTranscoder tc = {0};
-    
-    // [FIX] Monotonic Timestamp Variables (Preserved)
-    int64_t last_valid_pts = 0;
-    int64_t pts_offset = 0;
-    int is_first_connection = 1;
-    
-    prctl(PR_SET_NAME, "RTSP_Worker");
-    av_init_packet(&pkt);
-
-    while (ctx->running) {
-        // [REMOVED] Low Power / Weak Signal Detection Logic
-
-        ctx->running = 1; 
-        ctx->VdIndex = -1;
-        ctx->AdIndex = -1;
-        
-        FreeTranscoder(&tc); 
-
-        ctx->AvFmtCtx = avformat_alloc_context();
-        ctx->AvFmtCtx->interrupt_callback.callback = FfmpegInterruptCb;
-        ctx->AvFmtCtx->interrupt_callback.opaque = ctx;
-        ctx->AvFmtCtx->flags |= AVFMT_FLAG_NOBUFFER;
-        
-        if (ctx->TransProto) av_dict_set(&opts, "rtsp_transport", "tcp", 0);
-        av_dict_set(&opts, "stimeout", "5000000", 0); 
-        av_dict_set(&opts, "max_delay", "500000", 0);
-        av_dict_set(&opts, "buffer_size", "1024000", 0);
-
-        LOG_INFO(TAG, "[Ch%d] Connecting to %s...\n", ctx->CamIndex, ctx->url);
-        
-        ret = avformat_open_input(&ctx->AvFmtCtx, ctx->url, NULL, &opts);
-        av_dict_free(&opts);
-
-        if (ret < 0) {
-            // [LOGGING] Keep useful signal logging
-            int rssi=0, evm=0, rate=0;
-            Network_GetHalowState(((StreamHandle*)ctx->Stream)->Station, &rssi, &evm, &rate);
-            LOG_WARN(TAG, "[Ch%d] Open failed: %d. RSSI:%d EVM:%d Rate:%dKbps. Retry in 2s...\n", 
-                     ctx->CamIndex, ret, rssi, evm, rate);
-                     
-            if (ctx->AvFmtCtx) avformat_close_input(&ctx->AvFmtCtx);
-            ctx->AvFmtCtx = NULL;
-            sleep(2); // [REVERT] Fixed 2s sleep
-            continue;
-        }
-
-        if (avformat_find_stream_info(ctx->AvFmtCtx, NULL) < 0) {
-            LOG_WARN(TAG, "[Ch%d] Find stream info failed\n", ctx->CamIndex);
-            avformat_close_input(&ctx->AvFmtCtx);
-            continue;
-        }
+void Stream_IngestReset(RtspCtx *ctx) {
+    IngestSession *s = &ctx->Session;
 
-        for (int i = 0; i < ctx->AvFmtCtx->nb_streams; i++) {
-            if (ctx->AvFmtCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && ctx->VdIndex < 0)
-                ctx->VdIndex = i;
-            else if (ctx->AvFmtCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && ctx->AdIndex < 0)
-                ctx->AdIndex = i;
-        }
-
-        if (ctx->VdIndex < 0) {
-            LOG_ERROR(TAG, "[Ch%d] No Video Stream! Retry...\n", ctx->CamIndex);
-            avformat_close_input(&ctx->AvFmtCtx);
-            sleep(1);
-            continue;
-        }
-
-        if (ctx->AdIndex >= 0) {
-            AVStream *ast = ctx->AvFmtCtx->streams[ctx->AdIndex];
-            if (ast->codecpar->codec_id != AV_CODEC_ID_AAC) {
-                if (InitTranscoder(&tc, ast->codecpar) == 0) {
-                    avcodec_parameters_from_context(ast->codecpar, tc.enc_ctx);
-                    ast->time_base = (AVRational){1, tc.enc_ctx->sample_rate};
-                }
-            }
-        }
-
-        AVStream *vst = ctx->AvFmtCtx->streams[ctx->VdIndex];
-        if (vst->codecpar->width == 0 && vst->codecpar->extradata_size > 0) {
-            const uint8_t *sps = NULL; int sps_len = 0;
-            if (AvccGetFirstSps(vst->codecpar->extradata, vst->codecpar->extradata_size, &sps, &sps_len) == 0) {
-                int w=0, h=0;
-                if (H264SpsGetWh(sps, sps_len, &w, &h) == 0) {
-                    vst->codecpar->width = w; vst->codecpar->height = h;
-                    LOG_INFO(TAG, "[Ch%d] SPS Parsed: %dx%d\n", ctx->CamIndex, w, h);
-                }
-            }
-        }
-
-        LOG_INFO(TAG, "[Ch%d] Running. V:%d A:%d\n", ctx->CamIndex, ctx->VdIndex, ctx->AdIndex);
-        ctx->running = 2; 
-        
-        Stream_RequestIFrame(((StreamHandle*)ctx->Stream)->Station, ctx->CamIndex);
+    memset(s, 0, sizeof(IngestSession));
+    av_init_packet(&s->audio_hold);
+    s->audio_path = AUDIO_PATH_DROP;
+    s->audio_tb = (AVRational){1, 1};
+    s->audio_limit = INT64_MIN;
+    s->is_first_connection = 1;
+    ctx->Reconnect.seed = (unsigned int)NowMsMonotonic() ^ ((unsigned int)ctx->CamIndex << 16);
+}
 
-        // [FIX] Calculate timestamp offset on reconnection
-        if (!is_first_connection) {
-            pts_offset = last_valid_pts + 3000; 
-            LOG_INFO(TAG, "[Ch%d] Reconnection detected. Preparing PTS offset base: %lld\n", ctx->CamIndex, last_valid_pts);
-        }
-        int calc_offset_flag = 1;
+int Stream_IngestBegin(RtspCtx *ctx, int fast_path) {
+    IngestSession *s = &ctx->Session;
+    AVFormatContext *fmt = ctx->AvFmtCtx;
+
+    for (int i = 0; i < fmt->nb_streams; i++) {
+        if (fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && ctx->VdIndex < 0)
+            ctx->VdIndex = i;
+        else if (fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && ctx->AdIndex < 0)
+            ctx->AdIndex = i;
+    }
+
+    if (ctx->VdIndex < 0) {
+        LOG_ERROR(TAG, "[Ch%d] No Video Stream!\n", ctx->CamIndex);
+        return -1;
+    }
+
+    s->audio_path = AUDIO_PATH_DROP;
+    if (ctx->AdIndex >= 0) {
+        AVStream *ast = fmt->streams[ctx->AdIndex];
+        if (ast->codecpar->codec_id == AV_CODEC_ID_AAC) {
+            s->audio_path = AUDIO_PATH_PASSTHROUGH;
+        } else if (audio_transcode_job_open(&ctx->Audio, ast, ctx->AdIndex) == 0) {
+            // codecpar / time_base 已改为转码后的 AAC，下游 (录像/P2P) 按 AAC 处理
+            s->audio_path = AUDIO_PATH_TRANSCODE;
+            s->audio_tb = ast->time_base;
+            s->audio_limit = INT64_MIN;
+        } else {
+            LOG_WARN(TAG, "[Ch%d] Audio codec %d transcoder init failed, audio disabled\n",
+                     ctx->CamIndex, ast->codecpar->codec_id);
+            ctx->AdIndex = -1;
+        }
+    }
+
+    AVStream *vst = fmt->streams[ctx->VdIndex];
+    s->video_tb = vst->time_base;
+    packet_broadcast_set_budget(&ctx->Ingest, INGEST_BUDGET_BYTES, INGEST_BUDGET_MS, vst->time_base);
+    // H.264 / H.265 由 codecpar 决定，录像和 P2P 按 VdCodecId 选择参数集和编码标识
+    ctx->VdCodecId = vst->codecpar->codec_id;
+    if (!packet_meta_codec_supported(ctx->VdCodecId)) {
+        LOG_WARN(TAG, "[Ch%d] Unsupported video codec %d, packets forwarded without metadata\n",
+                 ctx->CamIndex, ctx->VdCodecId);
+    }
+    if (vst->codecpar->width == 0 && vst->codecpar->extradata_size > 0) {
+        int w = 0, h = 0;
+        if (packet_meta_extradata_wh(ctx->VdCodecId, vst->codecpar->extradata, vst->codecpar->extradata_size, &w, &h) == 0) {
+            vst->codecpar->width = w; vst->codecpar->height = h;
+            LOG_INFO(TAG, "[Ch%d] SPS Parsed: %dx%d\n", ctx->CamIndex, w, h);
+        }
+    }
+
+    LOG_INFO(TAG, "[Ch%d] Running. V:%d A:%d%s\n", ctx->CamIndex, ctx->VdIndex, ctx->AdIndex,
+             fast_path ? " (cached params)" : "");
+    s->fast_path = fast_path;
+    s->pkts = 0;
+    // 先于本次连接的第一个包发布，读者取到新连接的包之前一定能看到新的 SessionGen
+    __atomic_add_fetch(&ctx->SessionGen, 1, __ATOMIC_RELEASE);
+    ctx->running = 2; 
+    
+    Stream_RequestIFrame(((StreamHandle*)ctx->Stream)->Station, ctx->CamIndex);
+
+    // [FIX] Calculate timestamp offset on reconnection
+    if (!s->is_first_connection) {
+        s->pts_offset = s->last_valid_pts + 3000; 
+        LOG_INFO(TAG, "[Ch%d] Reconnection detected. Preparing PTS offset base: %lld\n", ctx->CamIndex, s->last_valid_pts);
+    }
+    s->calc_offset_flag = 1;
+    return 0;
+}
 
-        while (ctx->running == 2) {
-            ret = av_read_frame(ctx->AvFmtCtx, &pkt);
-            if (ret < 0) {
-                LOG_WARN(TAG, "[Ch%d] EOF/Error: %d\n", ctx->CamIndex, ret);
-                break; 
-            }
+void Stream_IngestPacket(RtspCtx *ctx, AVPacket *pkt) {
+    IngestSession *s = &ctx->Session;
+    PacketMeta meta;
+
+    if (s->pkts++ == 0) RtspMarkUp(ctx, s->fast_path);
+
+    // [FIX] Monotonic Timestamp Correction
+    if (pkt->pts != AV_NOPTS_VALUE) {
+        if (!s->is_first_connection && s->calc_offset_flag) {
+            s->pts_offset = (s->last_valid_pts + 3000) - pkt->pts;
+            s->calc_offset_flag = 0;
+            LOG_INFO(TAG, "[Ch%d] Calculated PTS Offset: %lld\n", ctx->CamIndex, s->pts_offset);
+        }
+        
+        pkt->pts += s->pts_offset;
+        pkt->dts += s->pts_offset;
+        
+        if (pkt->pts > s->last_valid_pts) {
+            s->last_valid_pts = pkt->pts;
+        }
+    }
+
+    // 每包只解析一次 (起始码、关键帧类型、参数集)，元数据随包下发给录像等下游复用；
+    // 不支持的编码不附加元数据，只按 demuxer 给的关键帧标志转发
+    if (pkt->stream_index == ctx->VdIndex &&
+        packet_meta_parse(&meta, ctx->VdCodecId, pkt->data, pkt->size) >= 0) {
+        if (meta.width > 0) {
+            if (s->last_w > 0 && (meta.width != s->last_w || meta.height != s->last_h)) {
+                meta.flags |= PKT_META_RES_CHANGED;
+                LOG_INFO(TAG, "[Ch%d] Resolution changed: %dx%d -> %dx%d\n", ctx->CamIndex,
+                         s->last_w, s->last_h, meta.width, meta.height);
+            }
+            s->last_w = meta.width;
+            s->last_h = meta.height;
+        }
+        if (!(pkt->flags & AV_PKT_FLAG_KEY)) {
+            if (PKT_META_IS_KEY(&meta)) {
+                pkt->flags |= AV_PKT_FLAG_KEY;
+            } else if (meta.flags & PKT_META_DISPOSABLE) {
+                pkt->flags |= AV_PKT_FLAG_DISPOSABLE;
+            }
+        }
+        packet_meta_attach(pkt, &meta);
+    }
+
+    if (pkt->stream_index == ctx->VdIndex) {
+        if (s->audio_path == AUDIO_PATH_TRANSCODE) {
+            // 先发布时间戳不晚于本帧的音频
+            int64_t ts = (pkt->dts != AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
+            s->audio_limit = (ts != AV_NOPTS_VALUE) ? av_rescale_q(ts, s->video_tb, s->audio_tb) : INT64_MAX;
+            MergeTranscodedAudio(ctx, &s->audio_hold, &s->audio_held, s->audio_limit);
+        }
+        packet_pool_rebuf(&ctx->Pool, pkt);
+        packet_broadcast_put(&ctx->Ingest, pkt, PKT_TYPE_VIDEO);
+    } 
+    else if (pkt->stream_index == ctx->AdIndex) {
+        if (s->audio_path == AUDIO_PATH_TRANSCODE) {
+            // RTSP 线程只入队，不做解码/编码
+            audio_transcode_job_submit(&ctx->Audio, pkt);
+            MergeTranscodedAudio(ctx, &s->audio_hold, &s->audio_held, s->audio_limit);
+        } else if (s->audio_path == AUDIO_PATH_PASSTHROUGH) {
+            packet_pool_rebuf(&ctx->Pool, pkt);
+            packet_broadcast_put(&ctx->Ingest, pkt, PKT_TYPE_AUDIO);
+        }
+    }
+    av_packet_unref(pkt);
+}
 
-            // [FIX] Monotonic Timestamp Correction
-            if (pkt.pts != AV_NOPTS_VALUE) {
-                if (!is_first_connection && calc_offset_flag) {
-                    pts_offset = (last_valid_pts + 3000) - pkt.pts;
-                    calc_offset_flag = 0;
-                    LOG_INFO(TAG, "[Ch%d] Calculated PTS Offset: %lld\n", ctx->CamIndex, pts_offset);
-                }
-                
-                pkt.pts += pts_offset;
-                pkt.dts += pts_offset;
-                
-                if (pkt.pts > last_valid_pts) {
-                    last_valid_pts = pkt.pts;
-                }
-            }
+const char *Stream_IngestEnd(RtspCtx *ctx) {
+    IngestSession *s = &ctx->Session;
+
+    audio_transcode_job_close(&ctx->Audio);
+    if (s->audio_held) {
+        av_packet_unref(&s->audio_hold);
+        s->audio_held = 0;
+    }
+    s->is_first_connection = 0; 
+    // 套用缓存参数后一个包都没收到，可能参数已变：下次重新探测
+    if (s->fast_path && s->pkts == 0) ParamCacheClear(&ctx->ParamCache);
+    Stream_MarkDown(ctx);
+    return s->pkts ? "Stream interrupted" : "No packets received";
+}
 
-            if (pkt.stream_index == ctx->VdIndex) {
-                if (!(pkt.flags & AV_PKT_FLAG_KEY)) {
-                    if (H264_Scan_KeyFrame(pkt.data, pkt.size)) {
-                        pkt.flags |= AV_PKT_FLAG_KEY;
-                    }
-                }
-            }
+void Stream_IngestFinish(RtspCtx *ctx) {
+    IngestSession *s = &ctx->Session;
 
-            if (pkt.stream_index == ctx->VdIndex) {
-                #ifdef ENABLE_MP4_RECORD
-                packet_queue_put(&ctx->RecordQueue, &pkt, PKT_TYPE_VIDEO);
-                #endif
-                if (!ctx->paused) {
-                    packet_queue_put(&ctx->P2pQueue, &pkt, PKT_TYPE_VIDEO);
-                }
-                av_packet_unref(&pkt);
-            } 
-            else if (pkt.stream_index == ctx->AdIndex) {
-                if (tc.initialized) {
-                    int send_ret = avcodec_send_packet(tc.dec_ctx, &pkt);
-                    if (send_ret >= 0) {
-                        while (avcodec_receive_frame(tc.dec_ctx, tc.dec_frame) >= 0) {
-                            // Transcoding logic placeholder
-                        }
-                    }
-                    av_packet_unref(&pkt);
-                } else {
-                    #ifdef ENABLE_MP4_RECORD
-                    packet_queue_put(&ctx->RecordQueue, &pkt, PKT_TYPE_AUDIO);
-                    #endif
-                    if (!ctx->paused) {
-                        packet_queue_put(&ctx->P2pQueue, &pkt, PKT_TYPE_AUDIO);
-                    }
-                    av_packet_unref(&pkt);
-                }
-            } else {
-                av_packet_unref(&pkt);
-            }
-        }
+    packet_broadcast_abort(&ctx->Ingest);
+    audio_transcode_job_close(&ctx->Audio);
+    if (s->audio_held) {
+        av_packet_unref(&s->audio_hold);
+        s->audio_held = 0;
+    }
+}
 
-        if (ctx->AvFmtCtx) {
-            avformat_close_input(&ctx->AvFmtCtx);
-            ctx->AvFmtCtx = NULL;
-        }
-        
-        FreeTranscoder(&tc); 
-        is_first_connection = 0; 
+static void* Stream_RtspThread(void *Arg) {
+    RtspCtx *ctx = (RtspCtx *)Arg;
+    AVDictionary *opts = NULL;
+    AVPacket pkt;
+    int ret;
+    uint32_t sdp_sig[RTSP_CACHE_STREAMS];
+    int fast_path;                      // 本次连接套用了缓存参数，未做 find_stream_info
+    const char *reason;
+    
+    prctl(PR_SET_NAME, "RTSP_Worker");
+    av_init_packet(&pkt);
+    Stream_IngestReset(ctx);
+
+    while (ctx->running) {
+        // [REMOVED] Low Power / Weak Signal Detection Logic
+
+        ctx->running = 1; 
+        ctx->VdIndex = -1;
+        ctx->AdIndex = -1;
+        
+        audio_transcode_job_close(&ctx->Audio);
+        ctx->Reconnect.state = RTSP_STATE_CONNECTING;
+
+        ctx->AvFmtCtx = avformat_alloc_context();
+        ctx->AvFmtCtx->interrupt_callback.callback = FfmpegInterruptCb;
+        ctx->AvFmtCtx->interrupt_callback.opaque = ctx;
+        ctx->AvFmtCtx->flags |= AVFMT_FLAG_NOBUFFER;
+        
+        if (ctx->TransProto) av_dict_set(&opts, "rtsp_transport", "tcp", 0);
+        av_dict_set(&opts, "stimeout", "5000000", 0); 
+        av_dict_set(&opts, "max_delay", "500000", 0);
+        av_dict_set(&opts, "buffer_size", "1024000", 0);
+        av_dict_set(&opts, "probesize", PROBE_SIZE_BYTES, 0);
+        av_dict_set(&opts, "analyzeduration", PROBE_DURATION_US, 0);
+
+        LOG_INFO(TAG, "[Ch%d] Connecting to %s...\n", ctx->CamIndex, ctx->url);
+        
+        ret = avformat_open_input(&ctx->AvFmtCtx, ctx->url, NULL, &opts);
+        av_dict_free(&opts);
+
+        if (ret < 0) {
+            char msg[48];
+            if (ctx->AvFmtCtx) avformat_close_input(&ctx->AvFmtCtx);
+            ctx->AvFmtCtx = NULL;
+            ctx->Reconnect.failures++;
+            if (!ctx->Session.is_first_connection) Stream_MarkDown(ctx);
+            snprintf(msg, sizeof(msg), "Open failed: %d", ret);
+            RtspBackoffWait(ctx, msg);
+            continue;
+        }
+
+        // 摄像头重启后 SDP 与上次相同时直接用缓存的参数，省去 find_stream_info 的探测 (弱信号下可达数秒)
+        for (int i = 0; i < (int)ctx->AvFmtCtx->nb_streams && i < RTSP_CACHE_STREAMS; i++)
+            sdp_sig[i] = StreamParamSig(ctx->AvFmtCtx->streams[i]->codecpar);
+        fast_path = ParamCacheApply(&ctx->ParamCache, ctx->AvFmtCtx, sdp_sig);
+        if (!fast_path && Stream_SeedParams(ctx, ctx->AvFmtCtx)) {
+            // 摄像头已通告分辨率/帧率/采样率：不探测，第一个 GOP 到达即可出流
+            ParamCacheStore(&ctx->ParamCache, ctx->AvFmtCtx, sdp_sig);
+        } else if (!fast_path) {
+            ctx->Reconnect.state = RTSP_STATE_PROBING;
+            ctx->Reconnect.probes++;
+            if (avformat_find_stream_info(ctx->AvFmtCtx, NULL) < 0) {
+                avformat_close_input(&ctx->AvFmtCtx);
+                ctx->Reconnect.failures++;
+                if (!ctx->Session.is_first_connection) Stream_MarkDown(ctx);
+                RtspBackoffWait(ctx, "Find stream info failed");
+                continue;
+            }
+            ParamCacheStore(&ctx->ParamCache, ctx->AvFmtCtx, sdp_sig);
+        }
+
+        if (Stream_IngestBegin(ctx, fast_path) < 0) {
+            avformat_close_input(&ctx->AvFmtCtx);
+            ParamCacheClear(&ctx->ParamCache);
+            ctx->Reconnect.failures++;
+            RtspBackoffWait(ctx, "No video stream");
+            continue;
+        }
+
+        while (ctx->running == 2) {
+            ret = av_read_frame(ctx->AvFmtCtx, &pkt);
+            if (ret < 0) {
+                LOG_WARN(TAG, "[Ch%d] EOF/Error: %d\n", ctx->CamIndex, ret);
+                break; 
+            }
+            Stream_IngestPacket(ctx, &pkt);
+        }
+
+        if (ctx->AvFmtCtx) {
+            avformat_close_input(&ctx->AvFmtCtx);
+            ctx->AvFmtCtx = NULL;
+        }
+        reason = Stream_IngestEnd(ctx);
+
+        if (ctx->running == 0) break;
+        ctx->running = 1; 
+        RtspBackoffWait(ctx, reason);
+    }
+
+    Stream_IngestFinish(ctx);
+    
+    LOG_INFO(TAG, "[Ch%d] Thread Exit\n", ctx->CamIndex);
+    pthread_exit(NULL);
+}
 
-        if (ctx->running == 0) break;
-        ctx->running = 1; 
-        sleep(1);
-    }
+// 音频转码线程数：每 AUDIO_CAMS_PER_WORKER 路已绑定的摄像头一个线程
+static int AudioWorkerCount(StationHandle *Station) {
+    CamManageHandle *CamManage = Station->CameraMag;
+    int cams = CamManage ? CamManage->CameraBindCnt : 0;
+    int n = (cams + AUDIO_CAMS_PER_WORKER - 1) / AUDIO_CAMS_PER_WORKER;
 
-    packet_queue_abort(&ctx->RecordQueue);
-    packet_queue_abort(&ctx->P2pQueue);
-    FreeTranscoder(&tc);
-    
-    LOG_INFO(TAG, "[Ch%d] Thread Exit\n", ctx->CamIndex);
-    pthread_exit(NULL);
+    if (n < 1) n = 1;
+    if (n > AUDIO_WORKER_MAX) n = AUDIO_WORKER_MAX;
+    return n;
 }
 
 int32_t Stream_Init(StationHandle *Station) {
     StreamHandle *Stream = calloc(1, sizeof(StreamHandle));
     if (!Stream) return -1;
     
+    // 每路上下文按实际通道数分配 (RtspCtx 含大块缓冲，不再固定按最大路数占用内存)
+    Stream->ChannelCnt = CamManage_GetChannelCnt(Station);
+    if (Stream->ChannelCnt <= 0) Stream->ChannelCnt = CAM_MAX_CNT;
+    Stream->Rtsp = calloc(Stream->ChannelCnt, sizeof(RtspCtx));
+    Stream->Announced = calloc(Stream->ChannelCnt, sizeof(StreamInfo));
+    Stream->AnnouncedValid = calloc(Stream->ChannelCnt, sizeof(int32_t));
+    if (!Stream->Rtsp || !Stream->Announced || !Stream->AnnouncedValid) {
+        free(Stream->Rtsp);
+        free(Stream->Announced);
+        free(Stream->AnnouncedValid);
+        free(Stream);
+        return -1;
+    }
+
     Stream->Station = Station;
     ((StationHandle*)Station)->Stream = Stream;
     pthread_mutex_init(&Stream->Mutex, NULL);
     
-    av_register_all();
-    avformat_network_init();
-    av_log_set_level(AV_LOG_ERROR);
+    av_register_all();
+    avformat_network_init();
+    av_log_set_level(AV_LOG_ERROR);
+
+    #if ENABLE_INGEST_REACTOR
+    // 失败时 Stream_Start 退回到每路一个线程
+    if (ingest_reactor_init(&Stream->Reactor) != 0) {
+        LOG_ERROR(TAG, "Ingest reactor init failed, use per-camera threads\n");
+    }
+    #endif
+
+    // 所有摄像头共用的音频转码线程，按已绑定的摄像头数启动，之后有新摄像头绑定时在 Stream_Start 中补充
+    // 失败时非 AAC 摄像头没有音频，但视频照常
+    if (audio_transcode_pool_init(&Stream->AudioPool, AudioWorkerCount(Station)) != 0) {
+        LOG_ERROR(TAG, "Audio transcode pool init failed\n");
+    }
 
     return 0;
 }
@@ -549,10 +629,17 @@ int32_t Stream_Init(StationHandle *Station) {
 void Stream_Deinit(StationHandle *Station) {
     if (Station->Stream) {
         StreamHandle *Stream = Station->Stream;
-        for (int i = 0; i < CAM_MAX_CNT; i++) {
-            Stream_Stop(Station, i);
-        }
-        pthread_mutex_destroy(&Stream->Mutex);
+        for (int i = 0; i < Stream->ChannelCnt; i++) {
+            Stream_Stop(Station, i);
+        }
+        #if ENABLE_INGEST_REACTOR
+        ingest_reactor_uninit(&Stream->Reactor);
+        #endif
+        audio_transcode_pool_uninit(&Stream->AudioPool);
+        pthread_mutex_destroy(&Stream->Mutex);
+        free(Stream->Rtsp);
+        free(Stream->Announced);
+        free(Stream->AnnouncedValid);
         free(Stream);
         Station->Stream = NULL;
     }
@@ -562,9 +649,10 @@ void Stream_Deinit(StationHandle *Station) {
 int32_t Stream_Start(StationHandle *Station, int32_t Index) {
     StreamHandle *Stream = Station->Stream;
     CamManageHandle *CamManage = Station->CameraMag;
+    char name[QUEUE_STATS_NAME_LEN];
     
-    if (Index < 0 || Index >= CAM_MAX_CNT) return -1;
-    
+    if (!Stream || Index < 0 || Index >= Stream->ChannelCnt) return -1;
+    
     Stream_Stop(Station, Index);
     
     RtspCtx *ctx = &Stream->Rtsp[Index];
@@ -583,13 +671,42 @@ int32_t Stream_Start(StationHandle *Station, int32_t Index) {
     snprintf(ctx->url, sizeof(ctx->url), "rtsp://%s:%s@%s:%d/live/ch0", 
              user, pwd, CamManage->Camera[Index].Addr, RTSP_PORT);
 
-    packet_queue_init(&ctx->RecordQueue, 200, 250); 
-    packet_queue_init(&ctx->P2pQueue, 60, 80);
-
-    if (pthread_create(&ctx->Thread, NULL, Stream_RtspThread, ctx) != 0) {
-        return -1;
-    }
-    ctx->thread_created = 1;
+    // RTSP 线程每包只发布一次，录像/P2P 作为读者挂在同一个环上
+    // 读者落后超过 max_lag 时整 GOP 跳过，避免残缺 GOP 导致录像/预览花屏
+    if (packet_broadcast_init(&ctx->Ingest, 512) != 0) return -1;
+    // 队列里驻留的负载都放到池里，稳定后不再向堆申请
+    packet_pool_init(&ctx->Pool);
+    snprintf(name, sizeof(name), "ch%d.audio", Index);
+    audio_transcode_pool_grow(&Stream->AudioPool, AudioWorkerCount(Station));
+    audio_transcode_job_init(&ctx->Audio, &Stream->AudioPool, &ctx->Pool, name);
+    #ifdef ENABLE_MP4_RECORD
+    packet_broadcast_attach(&ctx->Ingest, &ctx->RecordReader, 450, PKT_EVICT_GOP);
+    #endif
+    packet_broadcast_attach(&ctx->Ingest, &ctx->P2pReader, 140, PKT_EVICT_GOP);
+
+    // 注册统计，kill -USR1 后输出到 /tmp/queue_stats.txt
+    snprintf(name, sizeof(name), "ch%d.ingest", Index);
+    packet_broadcast_set_name(&ctx->Ingest, name);
+    snprintf(name, sizeof(name), "ch%d.record", Index);
+    packet_broadcast_reader_set_name(&ctx->RecordReader, name);
+    snprintf(name, sizeof(name), "ch%d.p2p", Index);
+    packet_broadcast_reader_set_name(&ctx->P2pReader, name);
+
+    #if ENABLE_INGEST_REACTOR
+    if (ingest_reactor_add(&Stream->Reactor, ctx) == 0) ctx->InReactor = 1;
+    #endif
+    if (!ctx->InReactor && pthread_create(&ctx->Thread, NULL, Stream_RtspThread, ctx) != 0) {
+        LOG_ERROR(TAG, "[Ch%d] Failed to create RTSP thread\n", Index);
+        // 没有线程发布，读者还没人在等，按 Stream_Stop 的顺序释放，下次 Start 的 memset 才不会泄漏
+        ctx->running = 0;
+        packet_broadcast_detach(&ctx->RecordReader);
+        packet_broadcast_detach(&ctx->P2pReader);
+        packet_broadcast_destroy(&ctx->Ingest);
+        audio_transcode_job_destroy(&ctx->Audio);
+        packet_pool_uninit(&ctx->Pool);
+        return -1;
+    }
+    ctx->thread_created = 1;
 
     #ifdef ENABLE_MP4_RECORD
     Record_Start(Station, Index);
@@ -601,32 +718,40 @@ int32_t Stream_Start(StationHandle *Station, int32_t Index) {
 
 int32_t Stream_Stop(StationHandle *Station, int32_t Index) {
     StreamHandle *Stream = Station->Stream;
-    if (Index < 0 || Index >= CAM_MAX_CNT) return -1;
+    if (!Stream || Index < 0 || Index >= Stream->ChannelCnt) return -1;
 
     RtspCtx *ctx = &Stream->Rtsp[Index];
     if (!ctx->thread_created) return 0;
 
     ctx->running = 0; 
-    packet_queue_abort(&ctx->RecordQueue);
-    packet_queue_abort(&ctx->P2pQueue);
+    packet_broadcast_abort(&ctx->Ingest);
 
     #ifdef ENABLE_MP4_RECORD
     Record_Stop(Station, Index);
     #endif
     P2P_Stop(Station, Index);
 
-    pthread_join(ctx->Thread, NULL);
-    ctx->thread_created = 0;
-
-    packet_queue_destroy(&ctx->RecordQueue);
-    packet_queue_destroy(&ctx->P2pQueue);
+    if (ctx->InReactor) {
+        ingest_reactor_remove(&Stream->Reactor, ctx);
+        ctx->InReactor = 0;
+    } else {
+        pthread_join(ctx->Thread, NULL);
+    }
+    ctx->thread_created = 0;
+    ParamCacheClear(&ctx->ParamCache);
+
+    packet_broadcast_detach(&ctx->RecordReader);
+    packet_broadcast_detach(&ctx->P2pReader);
+    packet_broadcast_destroy(&ctx->Ingest);
+    audio_transcode_job_destroy(&ctx->Audio);
+    packet_pool_uninit(&ctx->Pool);
 
     return 0;
 }
 
 int32_t Stream_SetPause(StationHandle *Station, int32_t Index, int32_t Pause) {
     StreamHandle *Stream = Station->Stream;
-    if (!Stream || Index < 0 || Index >= CAM_MAX_CNT) return -1;
+    if (!Stream || Index < 0 || Index >= Stream->ChannelCnt) return -1;
 
     RtspCtx *ctx = &Stream->Rtsp[Index];
     
@@ -634,13 +759,14 @@ int32_t Stream_SetPause(StationHandle *Station, int32_t Index, int32_t Pause) {
         if (Pause) {
             if (!ctx->paused) {
                 ctx->paused = 1;
-                packet_queue_flush(&ctx->P2pQueue);
+                packet_broadcast_pause(&ctx->P2pReader, 1);
                 LOG_INFO(TAG, "[Ch%d] Paused & Flushed\n", Index);
             }
         } else {
-            packet_queue_flush(&ctx->P2pQueue);
+            packet_broadcast_flush(&ctx->P2pReader);
             if (ctx->paused) {
                 ctx->paused = 0;
+                packet_broadcast_pause(&ctx->P2pReader, 0);
                 LOG_INFO(TAG, "[Ch%d] Resumed\n", Index);
             }
             Stream_RequestIFrame(Station, Index);
@@ -650,6 +776,56 @@ int32_t Stream_SetPause(StationHandle *Station, int32_t Index, int32_t Pause) {
     return -1;
 }
 
+void Stream_SetStreamInfo(StationHandle *Station, int32_t Index, const StreamInfo *Info) {
+    StreamHandle *Stream = Station ? Station->Stream : NULL;
+
+    if (!Stream || !Info || Index < 0 || Index >= Stream->ChannelCnt) return;
+    // 明显不合理的值按未通告处理
+    if (Info->VideoWidth <= 0 || Info->VideoWidth > 8192 || Info->VideoHeight <= 0 || Info->VideoHeight > 8192 ||
+        Info->VideoFrameRate < 0 || Info->VideoFrameRate > 240 ||
+        Info->AudioSampleRate < 0 || Info->AudioSampleRate > 192000) {
+        LOG_WARN(TAG, "[Ch%d] Ignore invalid stream info %dx%d@%d audio %dHz\n", Index,
+                 Info->VideoWidth, Info->VideoHeight, Info->VideoFrameRate, Info->AudioSampleRate);
+        return;
+    }
+    pthread_mutex_lock(&Stream->Mutex);
+    Stream->Announced[Index] = *Info;
+    Stream->AnnouncedValid[Index] = 1;
+    pthread_mutex_unlock(&Stream->Mutex);
+}
+
 int32_t Stream_RequestIFrame(StationHandle *Station, int32_t Index) {
     return CamManage_Send(Station, Index, MSG_REQ_IFRAME, NULL, 0);
 }
+
+void Stream_DumpPoolStats(StationHandle *Station, FILE *fp) {
+    StreamHandle *Stream = Station ? Station->Stream : NULL;
+    char name[16];
+    int i;
+
+    if (!Stream || !fp) return;
+    for (i = 0; i < Stream->ChannelCnt; i++) {
+        if (!Stream->Rtsp[i].thread_created) continue;
+        snprintf(name, sizeof(name), "ch%d.pool", i);
+        packet_pool_dump(&Stream->Rtsp[i].Pool, name, fp);
+    }
+}
+
+void Stream_DumpReconnectStats(StationHandle *Station, FILE *fp) {
+    static const char *states[] = { "connecting", "probing", "streaming", "backoff" };
+    StreamHandle *Stream = Station ? Station->Stream : NULL;
+    int64_t now = NowMsMonotonic();
+    int i;
+
+    if (!Stream || !fp) return;
+    for (i = 0; i < Stream->ChannelCnt; i++) {
+        RtspCtx *ctx = &Stream->Rtsp[i];
+        RtspReconnect *rc = &ctx->Reconnect;
+        if (!ctx->thread_created) continue;
+        fprintf(fp, "ch%d.rtsp state=%s attempts=%d backoff=%dms reconnects=%u fast=%u failures=%u probes=%u "
+                "gap_last=%lldms gap_max=%lldms gap_total=%lldms down_for=%lldms\n",
+                i, states[rc->state], rc->attempts, rc->last_backoff_ms, rc->reconnects, rc->fast_reconnects,
+                rc->failures, rc->probes, (long long)rc->last_gap_ms, (long long)rc->max_gap_ms, (long long)rc->total_gap_ms,
+                (long long)(rc->down_since_ms ? now - rc->down_since_ms : 0));
+    }
+}